@@ -1,6 +1,15 @@
 #pragma once
 
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <array>
+#include <atomic>
+#include <thread>
+
 #include "../include/btree_node.hpp"
+#include "../include/btree_node_cache.hpp"
 #include "../include/far_offset_ptr.hpp"
 #include "../include/file_cache.hpp"
 #include "../include/file_allocator.hpp"
@@ -35,24 +44,48 @@ struct btree_iterator
 
     inline bool is_end() const
     {
-        for(const auto& p : path)
+        if (path.empty())
         {
-            if (p.btree_position < p.btree_size)
-            {
-                return false; // If any node in the path is not at the end, this iterator is not at the end
-            }
-            if (p.is_found)
+            return true;
+        }
+
+        for (size_t n = 0; (n + 1) < path.size(); n++)
+        {
+            if ((path[n].btree_position + 1) < path[n].btree_size)
             {
-                return false; // If the last node is found, this iterator is not at the end
+                return false; // a branch node has a later child, so there are entries after this position
             }
         }
+
+        const auto& leaf = path.back();
+        if (leaf.btree_position < leaf.btree_size || leaf.is_found)
+        {
+            return false; // the leaf still has an entry at or after this position
+        }
         return true;
     }
 };
 
+class btree_entry_source
+{
+public:
+    virtual ~btree_entry_source() = default;
+    virtual bool next(std::vector<uint8_t>& entry) = 0; // read the next entry in key order, returns false once the source is exhausted
+};
+
+class btree_vector_entry_source : public btree_entry_source
+{
+    const std::vector<std::vector<uint8_t>>& entries_;
+    size_t position_ = 0;
+public:
+    explicit btree_vector_entry_source(const std::vector<std::vector<uint8_t>>& entries);
+    bool next(std::vector<uint8_t>& entry) override;
+};
 
 class btree
 {
+    friend class btree_cursor;
+
     btree() = delete;
     btree(const btree& b) = delete;
     void operator=(const btree& b) = delete;
@@ -60,14 +93,138 @@ class btree
     file_allocator& allocator_;
     far_offset_ptr offset_;
 
+    // writes that change the shape of the tree hold the latch alone. A write that only changes one leaf of the open
+    // transaction in place shares the latch with the others like it and latches that leaf, so writers to different
+    // leaves go on side by side. Reads do not take the latch but use optimistic lock coupling: each node has a version,
+    // kept in a slot its offset hashes to, and a write marks every node it writes before changing it. A read notes the
+    // version of each node before reading it and checks once done that none has changed and none is marked. Marks are
+    // kept by node and taken off, moving the version of their slot on, once the write is done and its root published,
+    // so a long write only holds up the reads that meet the nodes it writes. The nodes of the open transaction are
+    // modified in place, so a write mostly changes a leaf alone and only reads through that leaf go again. Committed
+    // nodes are copied rather than changed, so reads from the published root go on beside the write. A read that keeps
+    // meeting writes ends up sharing the latch instead
+    mutable std::shared_mutex latch_;
+    static constexpr size_t node_version_count = 1024;
+    static constexpr size_t leaf_latch_count = 64;
+    static constexpr int optimistic_read_attempts = 4;
+    std::array<std::atomic<uint64_t>, node_version_count> node_versions_{};
+    std::array<std::atomic<uint32_t>, node_version_count> marked_counts_{}; // the marked nodes in each slot
+    std::set<std::tuple<filesize_t, filesize_t>> marked_nodes_;
+    mutable std::mutex marked_mutex_;
+    std::array<std::mutex, leaf_latch_count> leaf_latches_; // shared by the leaves whose offsets hash alike
+
+    std::mutex published_mutex_;
+    far_offset_ptr published_offset_; // the root as of the last write that finished, where optimistic reads start
+
+    class node_changed {}; // thrown when an optimistic read meets a node being written
+
+    class node_read_set
+    {
+    public:
+        struct noted_version
+        {
+            far_offset_ptr offset;
+            size_t slot;
+            uint64_t version;
+        };
+
+        far_offset_ptr root;
+        bool latched = false; // read under the latch, so the branches do not change and nothing is noted
+        std::vector<noted_version> versions;
+    };
+
+    // the guard of every write, it publishes the root and takes off the marks of the nodes the write wrote. Writes
+    // on a thread nest, a write to one tree can run inside a write to another
+    class write_latch
+    {
+        btree& tree_;
+        std::unique_lock<std::shared_mutex> lock_;
+        std::shared_lock<std::shared_mutex> shared_lock_;
+        write_latch* enclosing_;
+        std::vector<far_offset_ptr> marked_;
+    public:
+        explicit write_latch(btree& tree, bool shared = false);
+        ~write_latch();
+        void mark(far_offset_ptr offset);
+        static write_latch* find(btree& tree); // the write on this thread that holds the tree's latch
+    };
+    static thread_local write_latch* current_write_;
+
+    static size_t get_version_slot(far_offset_ptr offset);
+    uint64_t note_read(node_read_set& reads, far_offset_ptr offset); // the version the node is read at
+    bool is_marked(size_t slot, far_offset_ptr offset) const;
+    void mark_written(far_offset_ptr offset);
+    bool validate(const node_read_set& reads) const;
+
+    template<typename Read>
+    auto read_optimistically(Read read)
+    {
+        for (int attempt = 0; attempt < optimistic_read_attempts; attempt++)
+        {
+            node_read_set reads;
+            {
+                std::lock_guard lock(published_mutex_);
+                reads.root = published_offset_;
+            }
+            try
+            {
+                auto result = read(reads);
+                if (validate(reads))
+                {
+                    return result;
+                }
+            }
+            catch (const node_changed&)
+            {
+            }
+            catch (const object_db_exception&)
+            {
+                if (validate(reads))
+                {
+                    throw; // not caused by a write
+                }
+            }
+            std::this_thread::yield();
+        }
+
+        std::shared_lock lock(latch_);
+        node_read_set reads;
+        reads.root = offset_;
+        reads.latched = true;
+        return read(reads);
+    }
+
+    // the roots of committed transactions, kept so that readers can open the tree as it was at any of them
+    std::map<filesize_t, far_offset_ptr> snapshots_;
+    filesize_t committed_transaction_id_ = 0;
+    far_offset_ptr committed_offset_; // the root a rollback returns to
+
+    // with buffered writes the nodes of the open transaction are kept here, encoded, and only written on commit.
+    // a node rewritten many times by one transaction is then written once, and a rollback writes nothing
+    bool buffer_writes_ = false;
+    std::map<std::tuple<filesize_t, filesize_t>, std::vector<uint8_t>> dirty_nodes_;
+    std::mutex dirty_nodes_mutex_; // optimistic reads look nodes up while the write adds them
+    void flush_dirty_nodes();
+    bool read_only_ = false; // set on the trees opened at a snapshot
+
     bool check_offset();
+    void check_writable(filesize_t transaction_id);
 
     std::shared_ptr<btree_row_traits> row_traits_;
 
-    btree_iterator internal_next(btree_iterator it);
-    btree_iterator internal_prev(btree_iterator it);
+    btree_iterator internal_begin(node_read_set& reads);
+    btree_iterator internal_end(node_read_set& reads);
+    btree_iterator internal_seek_begin(node_read_set& reads, std::span<uint8_t> key);
+    btree_iterator internal_seek_end(node_read_set& reads, std::span<uint8_t> key);
+    btree_iterator internal_next(node_read_set& reads, btree_iterator it);
+    btree_iterator internal_prev(node_read_set& reads, btree_iterator it);
 
-    std::vector<uint8_t> internal_get_entry(btree_iterator it);
+    std::shared_ptr<btree_node> move_to_next_leaf(node_read_set& reads, std::vector<btree_node_info>& path);
+    std::shared_ptr<btree_node> move_to_prev_leaf(node_read_set& reads, std::vector<btree_node_info>& path);
+    std::shared_ptr<btree_node> load_leaf_path(node_read_set& reads, std::span<uint8_t> key, std::vector<btree_node_info>& path);
+    std::shared_ptr<btree_node> load_edge_path(node_read_set& reads, bool last, std::vector<btree_node_info>& path);
+
+    std::vector<uint8_t> internal_get_entry(node_read_set& reads, btree_iterator it);
 
     std::vector<uint8_t> derive_key_from_entry(std::span<uint8_t> entry);
 
@@ -79,13 +236,159 @@ class btree
     uint32_t get_value_size();
     uint32_t get_entry_size();
 
+    struct child_reference
+    {
+        std::vector<uint8_t> key;
+        far_offset_ptr offset;
+        uint32_t entry_count = 0;
+    };
+
+    struct batch_entry
+    {
+        std::vector<uint8_t> key;
+        std::vector<uint8_t> entry;
+    };
+
+    struct decoded_path_node
+    {
+        far_offset_ptr offset;
+        std::shared_ptr<btree_node> node;
+        uint32_t position;
+    };
+
+    enum class write_mode
+    {
+        upsert,
+        insert_if_absent,
+        update_if_present
+    };
+
+    btree_iterator internal_upsert(filesize_t transaction_id, std::span<uint8_t> entry, write_mode mode, bool& applied);
+    bool upsert_in_leaf(filesize_t transaction_id, std::span<uint8_t> entry, write_mode mode, bool& applied, btree_iterator& result);
+    btree_iterator write_entry(filesize_t transaction_id, std::span<uint8_t> entry, write_mode mode, bool& applied);
+
+    // in append mode the decoded rightmost path is kept between writes so that increasing keys skip the descent
+    static constexpr double append_split_fraction = 0.9;
+    bool append_mode_ = false;
+    std::vector<decoded_path_node> rightmost_path_;
+
+    void load_rightmost_path();
+    void invalidate_rightmost_path();
+    btree_iterator get_rightmost_iterator(bool is_found);
+    std::vector<child_reference> write_append_node(filesize_t transaction_id, decoded_path_node& path_node);
+    bool internal_append(filesize_t transaction_id, std::span<uint8_t> entry, std::span<uint8_t> key, write_mode mode, bool& applied, btree_iterator& result);
+
+    // decoded branch nodes, so that next and prev only read the leaf they move into
+    btree_node_cache branch_cache_ = btree_node_cache{ 1024 };
+    std::shared_ptr<btree_node> read_cached_node(node_read_set& reads, far_offset_ptr offset);
+
+    // point lookups decode their leaf into a node from this pool, so they keep no path and reuse its buffer.
+    // concurrent lookups each take a node of their own
+    std::mutex lookup_nodes_mutex_;
+    std::vector<std::unique_ptr<btree_node>> lookup_nodes_;
+
+    class lookup_node_lease
+    {
+        btree& tree_;
+        std::unique_ptr<btree_node> node_;
+    public:
+        explicit lookup_node_lease(btree& tree);
+        ~lookup_node_lease();
+        btree_node& get() { return *node_; }
+    };
+
+    std::shared_ptr<btree_node> read_lookup_branch(node_read_set& reads, far_offset_ptr offset, btree_node& lookup_node);
+    btree_node& read_lookup_leaf(node_read_set& reads, std::span<uint8_t> key, btree_node& lookup_node);
+    void internal_multi_get(node_read_set& reads, far_offset_ptr offset, std::span<std::vector<uint8_t>> keys, size_t first_index, std::span<uint8_t> values, std::vector<bool>& found, size_t& found_count, btree_node& lookup_node);
+
+    void read_node(far_offset_ptr offset, btree_node& node);
+    void write_node(far_offset_ptr offset, btree_node& node);
+    far_offset_ptr write_modified_node(filesize_t transaction_id, far_offset_ptr offset, btree_node& node);
+
+    double low_water_fraction_ = 0.25;
+    bool leaf_key_array_ = false;
+    bool leaf_compression_ = true;
+    uint32_t get_low_water_count(btree_node& node);
+    bool rebalance_after_remove(filesize_t transaction_id, decoded_path_node& path_node, decoded_path_node& parent_path_node, btree_node_info& info);
+
+    bool byte_comparable_keys_ = false;
+    std::vector<uint8_t> get_separator(std::span<uint8_t> left_key, std::span<uint8_t> right_key);
+    std::vector<uint8_t> get_child_key(btree_node& left_node, btree_node& node);
+    void lower_first_key(btree_node& node);
+    void keep_separator(std::span<uint8_t> separator, child_reference& first_child);
+
+    std::vector<child_reference> write_split_node(filesize_t transaction_id, far_offset_ptr offset, btree_node& node);
+    static void locate_split_position(const std::vector<child_reference>& children, uint32_t position, size_t& node_index, uint32_t& node_position, uint32_t& node_size);
+    // a leaf takes every batch entry that lands in it before it splits, and node entry counts are 16 bits, so a batch
+    // goes down the tree in chunks that a leaf can take on top of a full block
+    static constexpr size_t max_batch_chunk = 32768;
+    void upsert_leaf_entries(btree_node& leaf, std::span<batch_entry> entries);
+    void upsert_batch_chunk(filesize_t transaction_id, std::span<batch_entry> entries);
+    std::vector<child_reference> internal_upsert_batch(filesize_t transaction_id, far_offset_ptr offset, std::span<batch_entry> entries);
+
+    struct bulk_load_level
+    {
+        std::shared_ptr<btree_node> pending; // a full node held back so the last node of the level can borrow from it
+        std::shared_ptr<btree_node> current;
+        bool has_written = false;
+        std::vector<uint8_t> last_key; // the last key of the last leaf written
+    };
+
+    std::shared_ptr<btree_node> create_bulk_load_node(filesize_t transaction_id, size_t level);
+    uint16_t get_bulk_load_count(btree_node& node, double fill_factor);
+    void bulk_load_write(filesize_t transaction_id, std::vector<bulk_load_level>& levels, size_t level, btree_node& node, double fill_factor);
+    void bulk_load_add(filesize_t transaction_id, std::vector<bulk_load_level>& levels, size_t level, std::span<uint8_t> key, far_offset_ptr offset, double fill_factor);
+
 public:
 
     std::shared_ptr<btree_row_traits> get_row_traits();
 
     int compare_keys(std::span<uint8_t> a, std::span<uint8_t> b);
 
-    far_offset_ptr get_offset() const { return offset_; }
+    far_offset_ptr get_offset() const
+    {
+        std::shared_lock lock(latch_);
+        return offset_;
+    }
+
+    // retain the root as the snapshot of the transaction. Later writes must use a newer transaction, so that they copy
+    // the committed nodes rather than modify them and the snapshot stays as it is
+    void commit(filesize_t transaction_id);
+    far_offset_ptr get_snapshot_root(filesize_t transaction_id) const; // the root of the newest commit at or before the transaction
+    void release_snapshots(filesize_t transaction_id); // forget the snapshots that reads as of the transaction or later do not need
+
+    // drop the changes made since the last commit, or since the tree was opened if it has not been committed
+    void rollback(filesize_t transaction_id);
+
+    // a read only tree at the root of a snapshot. Writers never latch it, so scans of a snapshot do not hold them up
+    std::unique_ptr<btree> open_snapshot(filesize_t transaction_id);
+    std::unique_ptr<btree> open_committed(); // the same at the last commit, or at the root the tree was opened with
+    bool is_read_only() const { return read_only_; }
+
+    // the settings below are not latched, so choose them before the tree is shared between threads
+
+    // optimise for keys that arrive in increasing order: appends skip the descent and rightmost nodes split nearly full
+    void set_append_mode(bool append_mode);
+    bool get_append_mode() const { return append_mode_; }
+
+    // removes leave a node alone until it holds fewer than this fraction of its capacity
+    void set_low_water_fraction(double low_water_fraction);
+    double get_low_water_fraction() const { return low_water_fraction_; }
+
+    // new leaves keep a contiguous copy of their keys ahead of the entries, so searches skip over the values.
+    // worth it when values are large compared to keys. Existing leaves keep the layout they were written with
+    void set_leaf_key_array(bool leaf_key_array) { leaf_key_array_ = leaf_key_array; }
+    bool get_leaf_key_array() const { return leaf_key_array_; }
+
+    // new leaves are written as slotted pages: the prefix their entries share stored once, then a variable length cell
+    // per entry with its zero padding left out. On by default. Branches are always compressed
+    void set_leaf_compression(bool leaf_compression) { leaf_compression_ = leaf_compression; }
+    bool get_leaf_compression() const { return leaf_compression_; }
+
+    // keep the nodes a transaction modifies in memory until it commits. Other trees and caches see none of the
+    // transaction's nodes before then, so only the tree itself reads them. Turning it off writes what is buffered
+    void set_buffer_writes(bool buffer_writes);
+    bool get_buffer_writes() const { return buffer_writes_; }
     btree(std::shared_ptr<btree_row_traits> row_traits, file_cache& cache, far_offset_ptr offset, file_allocator& allocator);
 
     btree_iterator begin(); // Seek to the first entry in the B-tree (this could be end if the B-tree is empty)
@@ -99,6 +402,19 @@ public:
     btree_iterator prev(btree_iterator it); // move to the previous entry in the B-tree
 
     btree_iterator upsert(filesize_t transaction_id, std::span<uint8_t> entry);
+    bool insert_if_absent(filesize_t transaction_id, std::span<uint8_t> entry); // returns false if the key already exists
+    bool update_if_present(filesize_t transaction_id, std::span<uint8_t> entry); // returns false if the key does not exist
+    void upsert_batch(filesize_t transaction_id, const std::vector<std::vector<uint8_t>>& entries); // insert or update many entries, visiting each affected node once
+
+    // build an empty B-tree from entries sorted by key, packing each node to fill_factor of its capacity
+    void bulk_load(filesize_t transaction_id, btree_entry_source& source, double fill_factor = 1.0);
+
+    bool get(std::span<uint8_t> key, std::span<uint8_t> value); // copy the value stored for key into value, returns false if the key does not exist
+    bool contains(std::span<uint8_t> key);
+
+    // look up many keys in one descent. The value for sorted_keys[n] is copied to values at n times the value size
+    // and found[n] records whether it exists. Returns the number of keys found
+    size_t multi_get(std::span<std::vector<uint8_t>> sorted_keys, std::span<uint8_t> values, std::vector<bool>& found);
 
     std::vector<uint8_t> get_entry(btree_iterator it); // get the entry at the current iterator position
     btree_iterator insert(filesize_t transaction_id, btree_iterator it, std::span<uint8_t> entry); // insert an entry at the current iterator position
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <functional>
+
+#include "../include/btree.hpp"
+
+// a cursor keeps its current leaf decoded and moves through it in place, only reading when it crosses into another leaf.
+// it is invalidated by any modification of the tree, after which it must be positioned again with one of the seeks
+class btree_cursor
+{
+    btree& tree_;
+    std::vector<btree_node_info> path_;
+    std::shared_ptr<btree_node> leaf_; // the leaf at the end of path_, or nullptr once the cursor has moved off the tree
+
+    std::shared_ptr<btree_node> settle(btree::node_read_set& reads, std::shared_ptr<btree_node> leaf, std::vector<btree_node_info>& path);
+    bool position(const std::function<std::shared_ptr<btree_node>(btree::node_read_set& reads, std::vector<btree_node_info>& path)>& read);
+
+    btree_cursor() = delete;
+    btree_cursor(const btree_cursor&) = delete;
+    void operator=(const btree_cursor&) = delete;
+public:
+    explicit btree_cursor(btree& tree);
+
+    bool seek_first(); // position on the first entry, returns false if the tree is empty
+    bool seek_last(); // position on the last entry, returns false if the tree is empty
+    bool seek(std::span<uint8_t> key); // position on the first entry greater than or equal to the key
+
+    bool next(); // returns false when moving past the last entry
+    bool prev(); // returns false when moving before the first entry
+
+    bool is_end() const { return !leaf_; }
+
+    std::span<uint8_t> get_entry(); // the entry inside the pinned leaf, valid until the cursor moves
+    btree_iterator get_iterator() const; // an iterator at the same position, for use with the btree methods
+};
@@ -24,6 +24,25 @@ class btree_node
     * 
     * array of data
     * each is a key-value pair
+    *
+    * leaves with the key array flag set store a copy of every key first, followed by the entries:
+    * key_0 .. key_n-1, entry_0 .. entry_n-1
+    * so searching only touches the keys. It costs a second copy of each key
+    *
+    * branches may be written compressed, and so may leaves with the leaf compression flag that were written before
+    * leaves were slotted. The compressed flag is then set in the block and the header is followed by:
+    * uint16_t: prefix size (2 bytes)
+    * uint16_t: stored size (2 bytes)
+    * the prefix shared by every entry, then each entry with the prefix removed from its key (the whole entry in a
+    * leaf) and trailing zero bytes trimmed to the stored size. Nodes are always uncompressed in memory
+    *
+    * when entries differ in how much of them is zero padding, e.g. short text in wide span fields, and for any leaf
+    * with the leaf compression flag that it makes smaller, the slotted flag is set as well and each entry gets a
+    * variable length cell instead:
+    * uint16_t: prefix size (2 bytes)
+    * uint16_t: cells size (2 bytes)
+    * the shared prefix, a uint16_t per entry giving the end of its cell, then the cells. A cell holds the rest of
+    * its entry as runs of a uint16_t literal length, the literal bytes and a uint16_t count of zeros that follow
     */
 
     // note the keys and values are not large enough to hold sizes of large data, but in any realistic large data case
@@ -31,10 +50,21 @@ class btree_node
 
     // in the case of non leaf nodes, the values will reliably be far pointers so will be 128 bit values i.e a file id and offset
     // that's hopefully plenty of space to hold realistic data sets for the near future
+    // new branches store them compactly in 64 bits instead (see far_offset_ptr::write_compact), which the value size
+    // records. A branch is widened to full pointers if it is ever given one that does not fit
 
     std::vector<uint8_t> data;
 
     static const uint8_t is_leaf_bit_mask = 0x1;
+    static const uint8_t key_array_bit_mask = 0x2;
+    static const uint8_t compressed_bit_mask = 0x4;
+    static const uint8_t leaf_compression_bit_mask = 0x8;
+    static const uint8_t slotted_bit_mask = 0x10;
+
+    static const size_t slot_size = 2;
+    static const size_t min_zero_run = 5; // shorter runs of zeros stay in the literal, as a new run costs four bytes
+
+    static const size_t compression_header_size = 4;
 
     static const size_t transaction_id_offset = 0;
     static const size_t transaction_id_size = 8; // big enough?
@@ -60,11 +90,43 @@ class btree_node
         size_t key_size;
         size_t value_size;
         size_t entry_count;
+        size_t key_array_size; // bytes per entry in the key array, zero without one
     };
 
     metadata get_metadata();
     uint16_t get_capacity(const metadata& md);
 
+    struct compression
+    {
+        size_t prefix_size;
+        size_t stored_size; // bytes kept of each entry's compressible part
+        size_t part_size; // the compressible part: the key of a branch entry, the whole entry in a leaf
+        size_t tail_size; // the rest of the entry, stored unchanged
+    };
+
+    bool is_compressible() const;
+    compression get_compression(const metadata& md);
+    static size_t get_compressed_size(const metadata& md, const compression& c);
+    size_t get_slotted_size(const metadata& md, const compression& c);
+    static size_t get_cell_size(std::span<uint8_t> part);
+    static size_t next_cell_run(std::span<uint8_t> part, size_t position, size_t& zero_count);
+    static void write_cell(std::span<uint8_t> part, span_iterator& it);
+    static void read_cell(std::span<uint8_t> cell, std::span<uint8_t> part);
+    void encode_slotted(const metadata& md, const compression& c, std::vector<uint8_t>& block);
+    void decode_slotted(const metadata& md, size_t prefix_size, std::span<uint8_t> stored);
+    void encode(std::vector<uint8_t>& block);
+    size_t get_compressed_length(std::span<uint8_t> compression_header);
+    void decode(std::span<uint8_t> compression_header, std::span<uint8_t> stored);
+
+    static size_t get_entry_stride(const metadata& md);
+    static size_t get_entries_offset(const metadata& md);
+    std::span<uint8_t> get_array_key(const metadata& md, size_t n);
+    void set_array_key(const metadata& md, size_t n, std::span<uint8_t> entry);
+
+    std::vector<uint8_t> make_branch_entry(std::span<uint8_t> key, far_offset_ptr offset);
+    void widen_branch_values();
+    void match_branch_values(btree_node& other_node);
+
     btree& btree_;
 
     void internal_insert_entry(int position, std::span<uint8_t> entry);
@@ -87,6 +149,7 @@ public:
     virtual ~btree_node() = default;
 
     bool is_leaf() const;
+    bool has_key_array() const;
     uint64_t get_transaction_id();
     void set_transaction_id(uint64_t transaction_id);
     uint16_t get_key_size();
@@ -106,9 +169,14 @@ public:
     uint16_t get_capacity();
 
     bool should_split();
+    size_t get_stored_size(); // the bytes the node takes in its block, after any compression
     bool should_merge();
 
+    void borrow_from_left(btree_node& left_node, uint32_t count); // move the last count entries of left_node to the front of this node
+    void borrow_from_right(btree_node& right_node, uint32_t count); // move the first count entries of right_node to the end of this node
+
     void split(btree_node& other);
+    void split(btree_node& other, uint32_t position); // move the entries from position onwards into other
     void merge(btree_node& other_node);
     bool is_full();
 
@@ -124,13 +192,17 @@ public:
     void update_leaf_entry(int position, std::span<uint8_t> entry);
 
     void remove_key(int position);
+    void remove_keys(int position, int count);
 
     bool remove_key(std::span<uint8_t> key);
 
     template<Binary_iterator It>
     void write(It& it)
     {
-        write_span(it, data);
+        // nodes are written as whole blocks so the file cache can write them in a single operation
+        std::vector<uint8_t> block(block_size, 0);
+        encode(block);
+        write_span(it, block);
     }
 
     template<Binary_iterator It>
@@ -141,6 +213,17 @@ public:
         data.resize(header_size);
         read_span(it, data);
 
+        if ((data[flags_offset] & compressed_bit_mask) != 0)
+        {
+            std::vector<uint8_t> compression_header(compression_header_size);
+            read_span(it, compression_header);
+
+            std::vector<uint8_t> stored(get_compressed_length(compression_header));
+            read_span(it, stored);
+            decode(compression_header, stored);
+            return;
+        }
+
         auto size = calculate_buffer_size();
         data.resize(size);
 
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <map>
+#include <list>
+#include <memory>
+#include <tuple>
+#include <mutex>
+
+#include "../include/core.hpp"
+#include "../include/far_offset_ptr.hpp"
+
+class btree_node;
+
+// keeps recently used branch nodes decoded so that walking between leaves does not re-read the levels above them.
+// nodes are shared with the callers and must not be modified once they are in the cache. Each is kept with the
+// version it was read at and only found at that version, so a node cached by a read that raced a write is not used
+class btree_node_cache
+{
+    class btree_node_cache_entry
+    {
+    public:
+        std::shared_ptr<btree_node> node;
+        uint64_t version = 0;
+        std::list<std::tuple<filesize_t, filesize_t>>::iterator lru_iterator;
+    };
+
+    size_t lru_max_;
+    std::map<std::tuple<filesize_t, filesize_t>, btree_node_cache_entry> nodes_;
+    std::list<std::tuple<filesize_t, filesize_t>> lru_node_list_;
+    std::mutex mutex_;
+
+    void erase_entry(far_offset_ptr offset); // erase_node without taking the mutex
+
+    btree_node_cache() = delete;
+public:
+    btree_node_cache(size_t lru_size);
+
+    std::shared_ptr<btree_node> get_node(far_offset_ptr offset, uint64_t version); // returns nullptr if the node is not cached at the version
+    void put_node(far_offset_ptr offset, std::shared_ptr<btree_node> node, uint64_t version);
+    void erase_node(far_offset_ptr offset);
+    void clear();
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <algorithm>
 
 #include "../include/core.hpp"
 
@@ -11,6 +12,17 @@ public:
     virtual int compare(const std::span<uint8_t>& p1, const std::span<uint8_t>& p2) = 0;
     virtual std::vector<uint8_t> get_data(const std::span<uint8_t>& entry_span) = 0;
     virtual uint32_t get_size() = 0;
+
+    // true if comparing the data gives the same order as comparing its bytes, so that a prefix of a key padded
+    // with zeros never sorts after the key. B-trees rely on this to shorten the keys that separate their nodes
+    virtual bool is_byte_comparable() { return false; }
+
+    // copy the data into a buffer of at least get_size() bytes. Override to avoid the intermediate vector
+    virtual void copy_data(const std::span<uint8_t>& entry_span, std::span<uint8_t> data)
+    {
+        auto result = get_data(entry_span);
+        std::copy(result.begin(), result.end(), data.begin());
+    }
 };
 
 class btree_row_traits
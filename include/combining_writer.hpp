@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+#include "../include/btree.hpp"
+
+// a write front end for a btree shared by many writing threads. Rather than each thread taking the tree latch for
+// its own write, a thread publishes the write and waits. The first waiting thread to find no combiner at work
+// becomes the combiner: it takes everything published so far, sorts it by key and applies it as one batch, then
+// applies one more batch if more arrived and hands the role on, so its own call returns under steady load. The
+// descents of a batch share the root and branches in one core's cache, and threads that would have queued on the
+// latch add to the batch instead
+class combining_writer
+{
+    struct pending_write
+    {
+        std::vector<uint8_t> key;
+        std::vector<uint8_t> entry; // empty for a remove
+        bool done = false;
+        std::exception_ptr error;
+    };
+
+    btree& tree_;
+    filesize_t transaction_id_;
+
+    std::mutex mutex_;
+    std::condition_variable applied_;
+    std::vector<pending_write*> queue_; // the writes live on the stacks of the threads waiting for them
+    bool combining_ = false;
+    static const size_t max_combine_rounds = 2;
+    size_t batch_count_ = 0;
+
+    void write(pending_write& write);
+    void combine(std::unique_lock<std::mutex>& lock);
+    void apply(std::vector<pending_write*>& batch);
+
+    combining_writer() = delete;
+    combining_writer(const combining_writer&) = delete;
+    void operator=(const combining_writer&) = delete;
+public:
+    combining_writer(btree& tree, filesize_t transaction_id);
+
+    // both return once the write is in the tree, and throw what applying that write threw. A wrong sized entry or
+    // key throws before it is queued
+    void upsert(std::span<uint8_t> entry);
+    void remove(std::span<uint8_t> key);
+
+    // commit the tree once the writes in progress are applied, and apply later writes in the next transaction
+    void commit(filesize_t next_transaction_id);
+
+    size_t get_batch_count();
+};
@@ -22,4 +22,5 @@ public:
 };
 
 int compare_span(const std::span<uint8_t>& a, const std::span<uint8_t>& b);
+uint64_t get_checksum(std::span<const uint8_t> data); // FNV-1a, enough to tell a torn or never written record from a whole one
 
@@ -63,6 +63,22 @@ public:
         return sizeof(filesize_t) * 2;
     }
 
+    // the compact form packs a 24 bit file id and a 40 bit block number into 8 bytes. It can only hold
+    // block aligned offsets in the first 16M files, which is what btree nodes point at
+    static const int compact_block_bits = 40;
+    static const filesize_t compact_max_file_id = (1ull << (64 - compact_block_bits)) - 1;
+    static const filesize_t compact_max_block = (1ull << compact_block_bits) - 1;
+
+    static constexpr filesize_t get_compact_size()
+    {
+        return sizeof(filesize_t);
+    }
+
+    bool is_compactable() const
+    {
+        return file_id <= compact_max_file_id && offset % block_size == 0 && offset / block_size <= compact_max_block;
+    }
+
     // Destructor
     ~far_offset_ptr() = default;
 
@@ -89,4 +105,19 @@ public:
         write_filesize(it, file_id);
         write_filesize(it, offset);
     }
+
+    template<Binary_iterator It>
+    void read_compact(It& it)
+    {
+        auto packed = read_filesize(it);
+        file_id = packed >> compact_block_bits;
+        offset = (packed & compact_max_block) * block_size;
+    }
+
+    // callers must check is_compactable first
+    template<Binary_iterator It>
+    void write_compact(It& it) const
+    {
+        write_filesize(it, (file_id << compact_block_bits) | (offset / block_size));
+    }
 };
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <string>
+#include <utility>
+
 #include "../include/core.hpp"
 
 enum field_type
@@ -40,7 +43,11 @@ struct field_descriptor
     ///     - High 30 bits: Bytes in the mantissa
     ///     - Low 30 bits: Bytes in the exponent
     /// </summary>
-    uint64_t type_descriptor;
+    uint64_t type_descriptor = ft_integer;
+
+    // a length of zero takes the default for the type: 8 byte integers, 255 byte text and binary, and 8 bytes on
+    // either side of a real or a float
+    static const uint64_t default_length = 255;
 
     void set_as_integer(uint64_t width = 0);
     void set_as_bool();
@@ -59,7 +66,10 @@ struct field_descriptor
     std::pair<uint64_t, uint64_t> get_real_lengths() const;
     std::string get_type_name() const;
 
+    // stored as the name, zero padded to max_string_length, then the type descriptor
     static filesize_t get_size();
+    // the bytes the field takes in a row. Text is zero padded, binary starts with a uint32_t length, a date is the
+    // seconds as a uint64_t followed by the fraction as a uint32_t when it has one
     filesize_t get_field_width() const;
     void read_from_span(const std::span<uint8_t>& s);
     void write_to_span(const std::span<uint8_t>& s) const;
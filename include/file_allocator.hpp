@@ -1,15 +1,51 @@
 #pragma once
 
+#include <map>
+
 #include "../include/core.hpp"
 #include "../include/far_offset_ptr.hpp"
 #include "../include/file_cache.hpp"
 
+/*
+* file 0 holds two copies of the superblock, one in each of its first two blocks:
+* uint64_t: sequence number, one more than the copy it replaced
+* uint64_t: transaction id, the last one handed out
+* far_offset_ptr: the root the database is opened from
+* uint64_t: the last block file
+* uint64_t: checksum of the fields above
+* a commit writes the copy that is not current, so a commit torn by a crash leaves the previous one intact. Opening
+* takes the valid copy with the highest sequence number. Until the next commit the superblock is only kept in memory
+*/
 class file_allocator
 {
     file_cache& cache_;
+    std::recursive_mutex mutex_; // a transaction id or block is handed out once even with several threads allocating
+    std::mutex commit_mutex_; // one superblock write at a time, while blocks are still handed out
+
+    filesize_t sequence_ = 0;
+    filesize_t transaction_id_ = 0;
+    far_offset_ptr root_;
+    filesize_t last_file_ = 0;
+
+    // each block file holds the blocks of one transaction. The recent transactions keep the file they allocate from,
+    // so commits that allocate in turn do not start a new file each time
+    std::map<filesize_t, filesize_t> transaction_files_;
+    static const size_t max_transaction_files = 64;
+
+    void read_superblock();
+    bool read_superblock_copy(filesize_t copy_offset, std::vector<uint8_t>& copy);
 public:
     explicit file_allocator(file_cache& cache);
     filesize_t get_current_transaction_id();
     filesize_t create_transaction();
     far_offset_ptr allocate_block(filesize_t transaction_id);
-};
\ No newline at end of file
+
+    // the root slot of the superblock, where the database keeps the one pointer it is opened from
+    far_offset_ptr get_root();
+    void set_root(far_offset_ptr root);
+
+    // make everything written so far durable, then the superblock as it was when the commit began. Blocks can be
+    // allocated while it syncs. Returns the sequence number written
+    filesize_t commit();
+    filesize_t get_sequence();
+};
@@ -2,10 +2,14 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <list>
 #include <fstream>
 #include <filesystem>
 #include <tuple>
+#include <mutex>
+#include <memory>
+#include <vector>
 
 #include "../include/core.hpp"
 #include "../include/file_iterator.hpp"
@@ -30,23 +34,57 @@ public:
     block_cache(int lru_size);
     std::shared_ptr<std::vector<uint8_t>> get_block(filesize_t filename, filesize_t offset);
     bool exists(filesize_t filename, filesize_t offset);
+    void erase_file(filesize_t filename);
 };
 
+/*
+* a cache can stripe its files over several directories, one per device, so that they share the I/O. File 0 stays in
+* the cache path and files 1 on go to the stripe directories in turn. The directories are recorded in the cache path
+* in placement.bin:
+* uint32_t: directory count
+* then for each directory uint16_t: size of the path, then the path
+* and a reopened cache uses the recorded directories
+* each directory has its open files, cached blocks and lock of its own, so reads and writes to the files of different
+* directories go on side by side
+*/
 class file_cache  
 {  
-    std::filesystem::path cache_path; // Use the alias 'fs::path' to resolve incomplete type error  
-    std::map<filesize_t, std::fstream> file_streams; // Map to hold open file streams
-    std::list<filesize_t> lru_file_list;
-
-    block_cache blocks_ = block_cache{ 4096 };
+    class cache_directory
+    {
+    public:
+        std::map<filesize_t, std::fstream> file_streams; // Map to hold open file streams
+        std::list<filesize_t> lru_file_list;
+        block_cache blocks = block_cache{ 4096 };
+        std::recursive_mutex mutex; // file_iterator calls back into the public methods, and partial writes read first
+        std::set<filesize_t> unsynced_files; // written since the last sync
+    };
 
-    void evict_file_if_needed(); // Evict the least recently used file if needed
-    std::fstream& get_stream(filesize_t file_id, std::ios::openmode mode);
-    static std::string get_filename(const std::filesystem::path& cache_path, filesize_t file_id);
+    std::filesystem::path cache_path; // Use the alias 'fs::path' to resolve incomplete type error  
+    std::vector<std::filesystem::path> stripe_paths_; // empty when every file is in cache_path
+    std::vector<std::unique_ptr<cache_directory>> directories_; // the cache path, then the stripe directories
+
+    std::mutex created_mutex_;
+    std::set<std::filesystem::path> unsynced_directories_; // with entries for files or directories created since the last sync
+    std::mutex sync_mutex_; // one sync at a time, so none returns while an earlier one still has files to flush
+
+    void evict_file_if_needed(cache_directory& directory); // Evict the least recently used file if needed
+    void create_directories(const std::filesystem::path& directory);
+    std::fstream& get_stream(cache_directory& directory, filesize_t file_id, std::ios::openmode mode);
+    cache_directory& get_cache_directory(filesize_t file_id);
+    std::filesystem::path get_directory(filesize_t file_id) const;
+    std::string get_filename(filesize_t file_id) const;
+    bool read_placement();
+    void write_placement();
+    void open_directories();
+    static bool sync_file(const std::string& filename);
+    static bool sync_directory(const std::filesystem::path& directory);
+    std::shared_ptr<std::vector<uint8_t>> load_block(cache_directory& directory, filesize_t file_id, filesize_t block_offset_base);
 
 
 public:
-    file_cache(const std::filesystem::path& path) : cache_path(path) {}
+    file_cache(const std::filesystem::path& path);
+    // stripe the files of a new cache over the directories. A cache that was created before is opened as it was
+    file_cache(const std::filesystem::path& path, const std::vector<std::filesystem::path>& stripe_paths);
     ~file_cache() = default;
 
     // Delete copy constructor and copy assignment operator
@@ -60,6 +98,11 @@ public:
     void write_bytes(filesize_t file_id, filesize_t offset, std::span<const uint8_t> data);
     void read_bytes(filesize_t file_id, filesize_t offset, std::span<uint8_t> data);
 
+    void remove_file(filesize_t file_id); // close, forget and delete the file
+    void sync(); // wait until everything written so far is on the disk, syncing each directory in parallel
+
+    const std::vector<std::filesystem::path>& get_stripe_paths() const { return stripe_paths_; }
+
     file_iterator get_iterator(filesize_t file_id, filesize_t offset = 0);
     file_iterator get_iterator(const far_offset_ptr& ptr);
 };
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../include/core.hpp"
+#include "../include/far_offset_ptr.hpp"
+#include "../include/file_allocator.hpp"
+#include "../include/file_cache.hpp"
+
+/*
+* field values too long to keep in a row are written to a chain of blocks, each holding:
+* uint64_t: transaction_id (8 bytes), as in every allocated block
+* far_offset_ptr: the next block, zero in the last one (16 bytes)
+* uint16_t: bytes used (2 bytes)
+* the bytes
+* chains are never modified once written, so a changed value gets a new chain and copy-on-write versions of the rows
+* referring to the old one still read it
+*/
+class overflow_chain
+{
+public:
+    static const size_t header_size = 8 + far_offset_ptr::get_size() + 2;
+    static const size_t capacity = block_size - header_size; // bytes held in each block
+
+    // returns the first block, or a zero pointer if data is empty
+    static far_offset_ptr write(file_cache& cache, file_allocator& allocator, filesize_t transaction_id, std::span<const uint8_t> data);
+};
+
+// reads a chain a block at a time, so a long value never has to be held in memory at once
+class overflow_chain_reader
+{
+    file_cache& cache_;
+    far_offset_ptr current_;
+    filesize_t remaining_;
+    std::vector<uint8_t> block_;
+    size_t block_position_ = 0;
+    size_t block_used_ = 0;
+
+    void load_next();
+public:
+    overflow_chain_reader(file_cache& cache, far_offset_ptr first, filesize_t length);
+
+    filesize_t get_remaining() const { return remaining_; }
+
+    size_t read(std::span<uint8_t> buffer); // fill as much of buffer as possible, returns zero at the end
+};
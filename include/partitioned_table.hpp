@@ -0,0 +1,119 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+#include "../include/btree.hpp"
+#include "../include/file_allocator.hpp"
+#include "../include/file_cache.hpp"
+
+enum class partition_mode : uint32_t
+{
+    range = 1, // each partition holds the keys from its lower bound up to the next partition's
+    hash = 2 // each key goes to the partition its checksum picks, for point reads and writes
+};
+
+/*
+* a table split into independent btrees, so that writes to different partitions do not queue on the same root and
+* latch. Each partition has its own file cache, allocator and root in a directory of its own, and a writer thread
+* that applies the writes queued for it in sorted batches. The layout is kept in a file cache in the table directory:
+* file 0:
+* uint32_t: partition mode
+* uint32_t: partition count
+* uint64_t: the id the next partition will get
+* then for each partition, in key order for range partitions
+* uint64_t: partition id, the partition lives in the directory partition_<id>
+* uint16_t: size of the lower bound, zero for the first partition, then the lower bound
+* each partition commits on its own, so a crash can leave some partitions at their last commit and others at the one
+* before
+*/
+class partitioned_table
+{
+    struct partition
+    {
+        filesize_t id = 0;
+        std::vector<uint8_t> lower_bound;
+
+        std::unique_ptr<file_cache> cache;
+        std::unique_ptr<file_allocator> allocator;
+        std::unique_ptr<btree> tree;
+        filesize_t transaction_id = 0;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> queue; // key and entry, an empty entry for a remove
+        bool applying = false;
+        bool stopping = false;
+        std::exception_ptr error;
+        std::thread writer;
+
+        // a partition is only dropped once its writer has stopped, including when opening or splitting throws
+        ~partition() { stop_writer(); }
+        void stop_writer();
+    };
+
+    std::shared_ptr<btree_row_traits> row_traits_;
+    std::filesystem::path directory_;
+    file_cache layout_cache_;
+    partition_mode mode_ = partition_mode::range;
+    filesize_t next_partition_id_ = 1;
+
+    std::shared_mutex layout_latch_; // writers route under a shared latch, a split changes the layout under a unique one
+    std::vector<std::unique_ptr<partition>> partitions_;
+
+    static const size_t layout_header_size = 16;
+
+    void create_layout(partition_mode mode, const std::vector<std::vector<uint8_t>>& lower_bounds);
+    bool read_layout();
+    void write_layout();
+
+    std::unique_ptr<partition> open_partition(filesize_t id, std::vector<uint8_t> lower_bound);
+    void run_writer(partition& target);
+    void apply(partition& target, std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>& batch);
+    void wait_idle(partition& target, std::unique_lock<std::mutex>& lock);
+    void commit_partition(partition& target);
+    void stop_writers();
+
+    size_t find_partition(std::span<uint8_t> key);
+    void enqueue(std::vector<uint8_t> key, std::vector<uint8_t> entry);
+
+    partitioned_table() = delete;
+    partitioned_table(const partitioned_table&) = delete;
+    void operator=(const partitioned_table&) = delete;
+public:
+    // a table of range partitions split at the keys, which must be in increasing order. A table already in the
+    // directory is opened with the layout it was saved with
+    partitioned_table(std::shared_ptr<btree_row_traits> row_traits, const std::filesystem::path& directory,
+        const std::vector<std::vector<uint8_t>>& split_keys);
+    // a table of hash partitions
+    partitioned_table(std::shared_ptr<btree_row_traits> row_traits, const std::filesystem::path& directory,
+        size_t partition_count);
+    ~partitioned_table(); // the writes queued so far are applied, but not committed
+
+    // both queue the write for the partition's writer and return. Reads see it once flushed
+    void upsert(std::span<uint8_t> entry);
+    void remove(std::span<uint8_t> key);
+
+    // wait for the writes queued so far to be applied, and throw the first error a writer met since the last flush
+    void flush();
+    // apply the writes queued so far and commit every partition
+    void commit();
+
+    bool get(std::span<uint8_t> key, std::span<uint8_t> value); // returns false if the key does not exist
+
+    // visit the entries from the first one greater than or equal to the key, in key order across the partitions,
+    // until visit returns false
+    void scan(std::span<uint8_t> first_key, const std::function<bool(std::span<uint8_t> entry)>& visit);
+
+    // make the key the lower bound of a new range partition, moving the entries from it up to the next bound there.
+    // Writes to the table wait while the entries move. Writes not yet committed move too and stay uncommitted
+    void split_partition(std::span<uint8_t> key);
+
+    partition_mode get_mode() const { return mode_; }
+    size_t get_partition_count();
+};
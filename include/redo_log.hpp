@@ -0,0 +1,89 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "../include/core.hpp"
+#include "../include/file_cache.hpp"
+
+enum class redo_operation : uint8_t
+{
+    upsert = 1, // the data is the entry
+    remove = 2, // the data is the key
+    commit = 3, // the data is the checksum of the transaction's other records
+    abort = 4 // no data, the transaction failed after it was logged
+};
+
+struct redo_record
+{
+    redo_operation operation;
+    filesize_t transaction_id;
+    std::string tree_name;
+    std::vector<uint8_t> data;
+};
+
+/*
+* a log of the entry level changes of committed transactions, so that a small transaction is made durable by one
+* append and sync of the log rather than by syncing every node on the paths it rewrote. The log uses a file cache of
+* its own:
+* file 0: uint64_t: the id of the file appended to, uint64_t: the id of the first file holding records still needed
+* files first .. last: records from offset 0, each
+* uint32_t: record size, this header included (4 bytes), zero after the last record
+* uint8_t: operation
+* uint64_t: transaction id
+* uint16_t: tree name size, then the tree name
+* the data
+* a transaction's records are appended together and end in its commit record, so on replay a transaction whose
+* commit record is missing or does not match its records is one that never finished committing. A transaction that
+* fails to apply once it is logged is followed by an abort record, and is not replayed either
+* appending and syncing are separate steps, so commits that append while a sync is running share the next one
+*/
+class redo_log
+{
+    file_cache& cache_;
+    std::mutex mutex_; // appends and the state
+    filesize_t file_id_ = 1;
+    filesize_t first_file_id_ = 1;
+    filesize_t head_offset_ = 0;
+    filesize_t appended_ = 0; // bytes appended since the log was opened, a position in the log
+
+    std::mutex sync_mutex_; // one sync at a time, the others wait and find their records synced by it
+    filesize_t synced_ = 0; // the position every record before is durable up to
+
+    static const size_t record_header_size = 15;
+
+    void write_state();
+    bool read_record(filesize_t file_id, filesize_t& offset, redo_record& record, std::vector<uint8_t>& bytes);
+    static void write_record(std::vector<uint8_t>& bytes, const redo_record& record);
+    filesize_t append_bytes(std::vector<uint8_t>& bytes);
+
+    redo_log() = delete;
+    redo_log(const redo_log&) = delete;
+    void operator=(const redo_log&) = delete;
+public:
+    explicit redo_log(file_cache& cache);
+
+    // append the changes of a transaction followed by its commit record, without syncing. Returns the position to
+    // sync up to for the transaction to be durable
+    filesize_t append(filesize_t transaction_id, const std::vector<redo_record>& records);
+    void sync(filesize_t position); // returns once the log is durable up to the position
+
+    void commit(filesize_t transaction_id, const std::vector<redo_record>& records); // append and sync
+
+    // record that a logged transaction failed to apply after all, and sync the log
+    void abort(filesize_t transaction_id);
+
+    // pass the changes of every transaction that finished committing to apply, in the order they were logged
+    void replay(const std::function<void(const redo_record& record)>& apply);
+
+    // appends go to a new file from here on. Returns its id, for releasing the files before it
+    filesize_t start_file();
+    // remove the files before this one, once a checkpoint has made their records unnecessary
+    void release_files(filesize_t file_id);
+
+    // start an empty log, once a checkpoint has made the records so far unnecessary
+    void reset();
+
+    filesize_t get_size(); // the size of the file appended to
+};
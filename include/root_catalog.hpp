@@ -0,0 +1,50 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+
+#include "../include/btree.hpp"
+#include "../include/far_offset_ptr.hpp"
+#include "../include/file_allocator.hpp"
+#include "../include/file_cache.hpp"
+
+/*
+* the roots of named trees as of each committed transaction, so a database can be reopened and read as it was at
+* any transaction still in the catalog. The catalog is a btree of its own, whose root is kept in the root slot of
+* block 0. Each entry is:
+* the tree name (64 bytes, zero padded)
+* uint64_t: the transaction id (8 bytes)
+* far_offset_ptr: the root of the tree once the transaction committed (16 bytes)
+* entries sort by name and then transaction, so the root as of a transaction is the entry at or just before it
+*/
+class root_catalog
+{
+    file_allocator& allocator_;
+    btree tree_;
+    std::mutex mutex_; // recording a root writes the catalog and then the root slot as one step
+
+    std::vector<uint8_t> make_key(const std::string& name, filesize_t transaction_id);
+    bool find_root(const std::string& name, filesize_t transaction_id, far_offset_ptr& root);
+
+    static std::shared_ptr<btree_row_traits> create_row_traits();
+
+    root_catalog() = delete;
+    root_catalog(const root_catalog&) = delete;
+    void operator=(const root_catalog&) = delete;
+public:
+    static const size_t max_name_size = 64;
+
+    root_catalog(file_cache& cache, file_allocator& allocator);
+
+    // record a root. It survives a reopen once the allocator commits, which lets several trees commit together
+    void set_root(filesize_t transaction_id, const std::string& name, far_offset_ptr root);
+    // record the roots of several trees as one step, so an allocator commit from another thread has all or none of them
+    void set_roots(filesize_t transaction_id, const std::vector<std::pair<std::string, far_offset_ptr>>& roots);
+    void commit(filesize_t transaction_id, const std::string& name, btree& tree); // commit the tree, record its root and commit the allocator
+
+    far_offset_ptr get_root(const std::string& name); // the latest root, a null pointer for a tree that was never committed
+    far_offset_ptr get_root(const std::string& name, filesize_t transaction_id); // the root as of the transaction
+
+    // forget the roots of the tree that reads as of oldest_read_id or later do not need
+    void release_roots(filesize_t transaction_id, const std::string& name, filesize_t oldest_read_id);
+};
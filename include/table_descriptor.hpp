@@ -1,5 +1,8 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 #include "../include/field_descriptor.hpp"
 
 enum index_type
@@ -7,7 +10,7 @@ enum index_type
     primary_key,
     unique_key,
     foreign_key,
-    index,
+    index_key, // a plain index. Named so it does not clash with index() from the C library
     reference_key
 };
 
@@ -21,13 +24,21 @@ struct index_descriptor
     std::vector<int> remote_schema_field_references;
 };
 
+// a row holds its fields in order, each taking its field width. The primary key is made of the fields it refers to,
+// in the order it refers to them
 struct table_descriptor
 {
+    std::string name;
     std::vector<field_descriptor> fields;
     std::vector<index_descriptor> indexes;
 
     filesize_t get_row_size() const;
+    filesize_t get_field_offset(int field) const; // where the field starts in a row
 
     const index_descriptor& get_primary_key() const;
     filesize_t get_primary_key_size() const;
+
+    // throws unless the fields have names of their own, every index refers to fields of the table and exactly one
+    // index is the primary key
+    void validate() const;
 };
@@ -4,6 +4,7 @@
 #include "../include/span_iterator.hpp"
 #include "../include/binary_iterator.hpp"
 #include "../include/core.hpp"
+#include "../include/overflow_chain.hpp"
 #include <format>
 
 class table_data_traits;
@@ -19,6 +20,7 @@ public:
 
     virtual uint32_t get_size() override;
     virtual std::vector<uint8_t> get_data(const std::span<uint8_t>& entry_span);
+    virtual void copy_data(const std::span<uint8_t>& entry_span, std::span<uint8_t> data) override;
 };
 
 class int32_field : public field_data_traits
@@ -33,6 +35,7 @@ class uint32_field : public field_data_traits
 public:
     uint32_field(uint32_t offset);
     int compare(const std::span<uint8_t>& p1, const std::span<uint8_t>& p2) override;
+    bool is_byte_comparable() override { return true; } // stored big-endian
 };
 
 class span_field : public field_data_traits
@@ -40,6 +43,29 @@ class span_field : public field_data_traits
 public:
     span_field(uint32_t offset, uint32_t size);
     int compare(const std::span<uint8_t>& p1, const std::span<uint8_t>& p2) override;
+    bool is_byte_comparable() override { return true; }
+};
+
+// a text or binary field whose value may be longer than the row can hold. The row keeps:
+// the first inline_size bytes of the value, zero padded
+// uint32_t: the length of the whole value (4 bytes)
+// far_offset_ptr: the overflow chain holding the rest of the value, zero if it all fits inline (16 bytes)
+// comparisons only see the inline bytes, so prefix scans on the field are only as precise as its prefix and the
+// field cannot be part of the key
+class overflow_field : public field_data_traits
+{
+    uint32_t inline_size_;
+public:
+    overflow_field(uint32_t offset, uint32_t inline_size);
+    int compare(const std::span<uint8_t>& p1, const std::span<uint8_t>& p2) override;
+
+    uint32_t get_inline_size() const { return inline_size_; }
+
+    // the field within the whole row
+    void set_value(file_cache& cache, file_allocator& allocator, filesize_t transaction_id, std::span<uint8_t> entry_span, std::span<const uint8_t> value);
+    uint32_t get_length(std::span<uint8_t> entry_span);
+    std::vector<uint8_t> get_value(file_cache& cache, std::span<uint8_t> entry_span);
+    overflow_chain_reader get_overflow_reader(file_cache& cache, std::span<uint8_t> entry_span); // the bytes after the inline ones
 };
 
 class entry_data_traits : public btree_data_traits
@@ -49,6 +75,7 @@ public:
     entry_data_traits(const std::vector<std::shared_ptr<field_data_traits>>& fields);
     virtual int compare(const std::span<uint8_t>& p1, const std::span<uint8_t>& p2);
     virtual std::vector<uint8_t> get_data(const std::span<uint8_t>& entry_span) override;
+    virtual void copy_data(const std::span<uint8_t>& entry_span, std::span<uint8_t> data) override;
     virtual uint32_t get_size() override;
 };
 
@@ -60,6 +87,8 @@ public:
     reference_data_traits(std::shared_ptr<entry_data_traits> entry_traits, const std::vector<int> field_references);
     virtual int compare(const std::span<uint8_t>& p1, const std::span<uint8_t>& p2) final;
     virtual std::vector<uint8_t> get_data(const std::span<uint8_t>& entry_span) final;
+    virtual void copy_data(const std::span<uint8_t>& entry_span, std::span<uint8_t> data) final;
+    virtual bool is_byte_comparable() final;
 
     virtual uint32_t get_size() final;
 };
@@ -77,6 +106,8 @@ public:
     std::shared_ptr<btree_data_traits> get_value_traits() override;
     std::shared_ptr<btree_data_traits> get_entry_traits() override;
 
+    std::shared_ptr<overflow_field> get_overflow_field(int position); // nullptr if the field at position is not one
+
 };
 
 class table_row_traits_builder
@@ -89,6 +120,7 @@ public:
     int add_span_field(int size);
     int add_uint32_field();
     int add_int32_field();
+    int add_overflow_field(int inline_size);
     void add_key_reference(int position);
 
     std::shared_ptr<table_row_traits> create_table_row_traits();
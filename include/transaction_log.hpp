@@ -6,11 +6,6 @@
 #include <filesystem>
 
 #include "../include/core.hpp"
-#include "../include/transaction_log.hpp"
-//#include "../include/offset_ptr.hpp"
-#include "../include/random_access_file.hpp"
-#include "../include/std_random_access_file.hpp"
-
 #include "../include/table_descriptor.hpp"
 
 struct field_adjustment
@@ -94,6 +89,8 @@ public:
     virtual void alter(const alter_table_command& descriptor) = 0;
 
     virtual std::shared_ptr<index_iterator> get_index_iterator(const std::string& index) = 0;
+    // the rows of the table in primary key order, keyed by their primary key fields in key order
+    virtual std::shared_ptr<row_iterator> get_row_iterator() = 0;
 
     virtual void insert_row(const span_t& values) = 0;
     virtual void update_row(const span_t& key, const span_t& values) = 0;
@@ -155,6 +152,10 @@ public:
     virtual void rollback() = 0;
 };
 
+// a database of schemas and tables kept in B-trees under root_path. Transactions are optimistic: each reads as of the
+// last commit before it began and commit throws if a transaction that committed first wrote something it read, having
+// rolled it back. The catalog lives in system tables, one B-tree per table holds its rows. Indexes other than the
+// primary key are kept as descriptions only
 class transaction_log
 {
 public:
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "../include/btree.hpp"
+#include "../include/redo_log.hpp"
+#include "../include/root_catalog.hpp"
+
+class transaction_manager;
+
+// a transaction that reads every table as of the last commit before it began and keeps its writes to itself until
+// it commits. Reads take no latch on the live tables, so transactions run side by side and only meet at commit,
+// which fails if a transaction that committed in the meantime wrote a key this one read
+class optimistic_transaction
+{
+    friend class transaction_manager;
+
+    struct key_range
+    {
+        std::vector<uint8_t> low; // empty from the first key
+        std::vector<uint8_t> high; // empty to the last key
+    };
+
+    struct table_state
+    {
+        std::unique_ptr<btree> snapshot;
+        std::set<std::vector<uint8_t>> read_keys;
+        std::vector<key_range> read_ranges; // the keys scans passed over, both ends included
+        std::map<std::vector<uint8_t>, std::vector<uint8_t>> writes; // key to entry, an empty entry for a remove
+
+        bool has_read(const std::vector<uint8_t>& key);
+    };
+
+    transaction_manager& manager_;
+    filesize_t snapshot_id_;
+    std::map<std::string, table_state> tables_;
+    bool finished_ = false;
+
+    table_state& get_table(const std::string& table);
+    void check_open();
+    std::vector<std::vector<uint8_t>> scan_entries(const std::string& table, std::span<uint8_t> key, size_t limit, bool backward);
+
+    optimistic_transaction() = delete;
+    optimistic_transaction(const optimistic_transaction&) = delete;
+    void operator=(const optimistic_transaction&) = delete;
+public:
+    optimistic_transaction(transaction_manager& manager, filesize_t snapshot_id);
+    ~optimistic_transaction(); // an unfinished transaction is rolled back
+
+    filesize_t get_snapshot_id() const { return snapshot_id_; }
+
+    bool get(const std::string& table, std::span<uint8_t> key, std::span<uint8_t> value); // returns false if the key does not exist
+    void upsert(const std::string& table, std::span<uint8_t> entry);
+    void remove(const std::string& table, std::span<uint8_t> key);
+
+    // up to limit entries in key order, from the first with a key at or after from_key, or from the first entry for an
+    // empty key. The transaction's own writes are included. A key another transaction writes among the keys the scan
+    // passed over is a conflict at commit, as it is for a key read with get
+    std::vector<std::vector<uint8_t>> scan(const std::string& table, std::span<uint8_t> from_key, size_t limit);
+    // the same walking back, from the last entry with a key at or before to_key, or from the last entry
+    std::vector<std::vector<uint8_t>> scan_back(const std::string& table, std::span<uint8_t> to_key, size_t limit);
+
+    bool commit(); // returns false, having rolled back, if the transaction conflicts with one that committed first
+    void rollback();
+};
+
+// runs optimistic transactions over a set of named tables whose roots are kept in a root catalog. Commits are
+// validated one at a time, and commits to different tables apply their writes in parallel
+class transaction_manager
+{
+    friend class optimistic_transaction;
+
+    file_cache& cache_;
+    file_allocator& allocator_;
+    root_catalog& catalog_;
+    redo_log* redo_log_ = nullptr;
+    std::map<std::string, std::unique_ptr<btree>> tables_;
+    std::map<std::string, filesize_t> added_ids_; // the commit that added each table
+    std::mutex tables_mutex_;
+
+    std::mutex commit_mutex_;
+    std::condition_variable commit_order_; // signalled whenever a commit finishes
+    filesize_t last_commit_id_ = 0; // the last published commit, every commit before it is published too
+    std::mutex checkpoint_mutex_;
+
+    // commits are validated and numbered one at a time, then write their tables side by side. A commit writes a table
+    // once the commits numbered before it that write the table have finished, and finishes itself once every commit
+    // numbered before it has. It is published then, or with a redo log once the log is synced past it
+    std::deque<filesize_t> pending_commits_;
+    std::map<std::string, std::deque<filesize_t>> table_writers_; // the pending commits that write each table
+
+    // the keys each commit wrote, by table, for as long as a transaction that began before it is open
+    std::map<filesize_t, std::map<std::string, std::set<std::vector<uint8_t>>>> committed_writes_;
+    std::multiset<filesize_t> open_snapshot_ids_;
+
+    btree& get_tree(const std::string& name);
+    std::unique_ptr<btree> open_snapshot(const std::string& name, filesize_t snapshot_id);
+    static void apply_write(btree& tree, filesize_t commit_id, const std::vector<uint8_t>& key, std::span<uint8_t> entry);
+    void write_checkpoint();
+    bool commit(optimistic_transaction& transaction);
+    void wait_for_table(const std::string& name, filesize_t commit_id);
+    void finish(filesize_t snapshot_id);
+
+    transaction_manager() = delete;
+    transaction_manager(const transaction_manager&) = delete;
+    void operator=(const transaction_manager&) = delete;
+public:
+    transaction_manager(file_cache& cache, file_allocator& allocator, root_catalog& catalog);
+
+    // open a table at its latest root in the catalog, or as a new empty table
+    void add_table(const std::string& name, std::shared_ptr<btree_row_traits> row_traits);
+    btree& get_table(const std::string& name) { return get_tree(name); }
+
+    // with a redo log a commit is made durable by appending its writes to the log, and the tables and the catalog
+    // only reach the disk at the next checkpoint. Commits that finish together share one sync of the log. Set it
+    // before the first commit
+    void set_redo_log(redo_log* log) { redo_log_ = log; }
+
+    // make the tables durable as of the last commit and drop the redo log files that only hold commits before it.
+    // Commits go on while it syncs
+    void checkpoint();
+
+    // apply the transactions in the redo log that committed after the last checkpoint, then checkpoint. Call it once
+    // the tables have been added and before any transaction begins
+    void recover();
+
+    std::unique_ptr<optimistic_transaction> begin_transaction();
+    filesize_t get_last_commit_id();
+};
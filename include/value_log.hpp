@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+
+#include "../include/core.hpp"
+#include "../include/far_offset_ptr.hpp"
+#include "../include/file_cache.hpp"
+
+/*
+* an append only log of values kept outside a btree, so that leaves only hold a key and a pointer and splitting or
+* copying them never moves the values themselves. The log uses a file cache of its own:
+* file 0: uint64_t: tail file id, uint64_t: head file id
+* files tail .. head: records, each
+* uint64_t: checksum of the rest of the record (8 bytes)
+* uint32_t: key size (4 bytes), never zero
+* uint32_t: value size (4 bytes)
+* the key, then the value
+* records are only appended at the head, and space is reclaimed by collecting the tail file: its live records are
+* appended again, and once the new locations are committed the file is released and removed. Records are written
+* through the cache, so sync the log before committing a tree that points into it. A file's records end at the first
+* one that is missing or torn
+*/
+class value_log
+{
+    file_cache& cache_;
+    filesize_t tail_file_id_ = 1;
+    filesize_t next_collect_file_id_ = 1; // files from the tail up to this one are collected but not yet released
+    filesize_t head_file_id_ = 1;
+    filesize_t head_offset_ = 0;
+
+    static const size_t record_header_size = 16;
+
+    void read_state();
+    void write_state();
+    bool read_whole_record(filesize_t file_id, filesize_t offset, std::vector<uint8_t>& key, std::vector<uint8_t>& value);
+
+    value_log() = delete;
+    value_log(const value_log&) = delete;
+    void operator=(const value_log&) = delete;
+public:
+    explicit value_log(file_cache& cache);
+
+    far_offset_ptr append(std::span<const uint8_t> key, std::span<const uint8_t> value);
+    std::vector<uint8_t> read_value(far_offset_ptr location);
+    void read_record(far_offset_ptr location, std::vector<uint8_t>& key, std::vector<uint8_t>& value);
+
+    void sync(); // make the records appended so far durable
+
+    filesize_t get_tail_file_id() const { return tail_file_id_; }
+    filesize_t get_head_file_id() const { return head_file_id_; }
+
+    // collect the oldest file not collected yet. is_live is asked about every record in it, and each live one is
+    // appended again and passed to relocated with its new location. Returns the file id, or 0 if only the head is
+    // left. The file is kept until it is released
+    filesize_t collect_tail(const std::function<bool(std::span<uint8_t> key, far_offset_ptr location)>& is_live,
+        const std::function<void(std::span<uint8_t> key, far_offset_ptr location)>& relocated);
+
+    // remove a collected file, once the relocated locations are committed and no snapshot still points into it.
+    // Files are released in the order they were collected
+    void release_file(filesize_t file_id);
+};
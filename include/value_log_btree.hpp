@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../include/btree.hpp"
+#include "../include/value_log.hpp"
+
+/*
+* a btree whose leaves hold each key with either its value, for values up to the inline size, or the location of
+* the value in a value log. Splits and copies move small entries however large the values are, at the cost of a
+* second read for the logged values. Each entry is:
+* the key
+* uint32_t: the size of an inline value, or logged_value for a value in the log
+* the inline value or the far_offset_ptr, zero padded to the inline size, which nodes store compactly
+*/
+class value_log_btree
+{
+    value_log& log_;
+    uint32_t key_size_;
+    uint32_t inline_size_;
+    std::shared_ptr<btree_row_traits> row_traits_;
+    btree tree_;
+
+    static const uint32_t logged_value = 0xffffffff;
+
+    std::vector<uint8_t> make_entry(std::span<const uint8_t> key, far_offset_ptr location);
+    std::vector<uint8_t> make_inline_entry(std::span<const uint8_t> key, std::span<const uint8_t> value);
+    bool get_stored_value(std::span<uint8_t> key, std::vector<uint8_t>& stored); // the stored size and the inline area
+    bool get_location(std::span<uint8_t> key, far_offset_ptr& location); // returns false for a missing or inline value
+
+    static std::shared_ptr<btree_row_traits> create_row_traits(uint32_t key_size, uint32_t inline_size);
+
+    value_log_btree() = delete;
+    value_log_btree(const value_log_btree&) = delete;
+    void operator=(const value_log_btree&) = delete;
+public:
+    // values up to inline_size bytes stay in the leaves. A tree must be reopened with the inline size it was created with
+    value_log_btree(uint32_t key_size, file_cache& cache, far_offset_ptr offset, file_allocator& allocator, value_log& log,
+        uint32_t inline_size = 256);
+
+    btree& get_tree() { return tree_; } // entries are laid out as above
+    far_offset_ptr get_offset() const { return tree_.get_offset(); }
+
+    void upsert(filesize_t transaction_id, std::span<uint8_t> key, std::span<const uint8_t> value);
+    bool get(std::span<uint8_t> key, std::vector<uint8_t>& value); // returns false if the key does not exist
+    bool remove(filesize_t transaction_id, std::span<uint8_t> key); // returns false if the key does not exist
+
+    // sync the values the transaction logged, then commit the tree that points at them
+    void commit(filesize_t transaction_id);
+
+    // move the values this tree still refers to out of the oldest value log file not collected yet, in the
+    // transaction. Returns the file, or 0 if there was nothing to collect. The committed root and older snapshots
+    // still point into it, so release it from the log once the transaction commits and no reader needs them
+    filesize_t collect_garbage(filesize_t transaction_id);
+};
@@ -2,6 +2,7 @@
 #include "../include/btree.hpp"
 #include "../include/file_allocator.hpp"
 #include "../include/file_cache.hpp"
+#include "../include/root_catalog.hpp"
 #include "../include/span_iterator.hpp"
 #include "../include/table_row_traits.hpp"
 
@@ -88,9 +89,9 @@ void main()
     file_cache cache{ "test_cache" };
     file_allocator allocator{ cache };
 
-    auto transaction_id = allocator.create_transaction();
+    root_catalog catalog{ cache, allocator };
 
-    far_offset_ptr initial{ 0, 0 };
+    auto transaction_id = allocator.create_transaction();
 
     uint32_t key_size = 700;
     uint32_t value_size = 30;
@@ -105,7 +106,7 @@ void main()
     std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
 
 
-    btree tree{traits, cache, initial, allocator };
+    btree tree{traits, cache, catalog.get_root("tree"), allocator };
 
     btree_iterator it;
     for (;;)
@@ -210,6 +211,11 @@ void main()
                     it = tree.remove(transaction_id, it);
                 }
             }
+            else if (command == "cmt" || command == "commit")
+            {
+                catalog.commit(transaction_id, "tree", tree);
+                transaction_id = allocator.create_transaction();
+            }
             else if (command == "xit" || command == "exit")
             {
                 break;
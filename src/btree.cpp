@@ -1,13 +1,40 @@
 
 #include "../include/btree.hpp"
 #include <cassert>
+#include <algorithm>
+
+// the position of the first entry of the nth node when count entries are split evenly between node_count nodes
+static uint32_t get_split_position(uint32_t count, size_t n, size_t node_count)
+{
+    return (uint32_t)(((uint64_t)count * n) / node_count);
+}
+
+// find the node written by write_split_node that holds position, and the position within that node
+void btree::locate_split_position(const std::vector<child_reference>& children, uint32_t position, size_t& node_index, uint32_t& node_position, uint32_t& node_size)
+{
+    uint32_t split_position = 0;
+    for (node_index = 0; node_index < children.size(); node_index++)
+    {
+        node_size = children[node_index].entry_count;
+        if (position < split_position + node_size || node_index + 1 == children.size())
+        {
+            node_position = position - split_position;
+            return;
+        }
+        split_position += node_size;
+    }
+    throw object_db_exception("position is outside the split node");
+}
 
 btree::btree(std::shared_ptr<btree_row_traits> row_traits, file_cache& cache, far_offset_ptr offset, file_allocator& allocator):
     cache_(cache),
     allocator_(allocator),
     offset_(offset),
+    published_offset_(offset),
+    committed_offset_(offset),
     row_traits_(row_traits)
 {
+    byte_comparable_keys_ = row_traits_->get_key_traits()->is_byte_comparable();
 }
 
 std::shared_ptr<btree_row_traits> btree::get_row_traits()
@@ -20,6 +47,115 @@ int btree::compare_keys(std::span<uint8_t> k1, std::span<uint8_t> k2)
     return row_traits_->get_key_traits()->compare(k1, k2);
 }
 
+thread_local btree::write_latch* btree::current_write_ = nullptr;
+
+btree::write_latch::write_latch(btree& tree, bool shared) : tree_(tree), enclosing_(current_write_)
+{
+    if (shared)
+    {
+        shared_lock_ = std::shared_lock(tree.latch_);
+    }
+    else
+    {
+        lock_ = std::unique_lock(tree.latch_);
+    }
+    current_write_ = this;
+}
+
+// the version of a slot moves on before the mark comes off, so a read that missed the mark still sees the change
+btree::write_latch::~write_latch()
+{
+    current_write_ = enclosing_;
+    if (lock_.owns_lock())
+    {
+        std::lock_guard lock(tree_.published_mutex_);
+        tree_.published_offset_ = tree_.offset_;
+    }
+
+    std::lock_guard lock(tree_.marked_mutex_);
+    for (auto offset : marked_)
+    {
+        auto slot = get_version_slot(offset);
+        tree_.node_versions_[slot]++;
+        tree_.marked_nodes_.erase(std::tuple(offset.get_file_id(), offset.get_offset()));
+        tree_.marked_counts_[slot]--;
+    }
+}
+
+// a node stays marked from its first write to the end of the write that made it. Only one write at a time writes a
+// node: the one holding the latch alone, or the one holding the latch of its leaf
+void btree::write_latch::mark(far_offset_ptr offset)
+{
+    std::lock_guard lock(tree_.marked_mutex_);
+    if (tree_.marked_nodes_.insert(std::tuple(offset.get_file_id(), offset.get_offset())).second)
+    {
+        tree_.marked_counts_[get_version_slot(offset)]++;
+        marked_.push_back(offset);
+    }
+}
+
+btree::write_latch* btree::write_latch::find(btree& tree)
+{
+    for (auto latch = current_write_; latch; latch = latch->enclosing_)
+    {
+        if (&latch->tree_ == &tree)
+        {
+            return latch;
+        }
+    }
+    throw object_db_exception("a B-tree node is written outside of a write");
+}
+
+size_t btree::get_version_slot(far_offset_ptr offset)
+{
+    return (size_t)((offset.get_file_id() * 0x9e3779b97f4a7c15ull) ^ (offset.get_offset() / block_size)) % node_version_count;
+}
+
+// reads under the latch note nothing, the branches cannot change then and a leaf is read whole
+uint64_t btree::note_read(node_read_set& reads, far_offset_ptr offset)
+{
+    auto slot = get_version_slot(offset);
+    auto version = node_versions_[slot].load();
+    if (reads.latched)
+    {
+        return version;
+    }
+    if (is_marked(slot, offset))
+    {
+        throw node_changed();
+    }
+    reads.versions.push_back({ offset, slot, version });
+    return version;
+}
+
+// most slots have no marked node, so most reads do not look the node up
+bool btree::is_marked(size_t slot, far_offset_ptr offset) const
+{
+    if (marked_counts_[slot].load() == 0)
+    {
+        return false;
+    }
+    std::lock_guard lock(marked_mutex_);
+    return marked_nodes_.contains(std::tuple(offset.get_file_id(), offset.get_offset()));
+}
+
+void btree::mark_written(far_offset_ptr offset)
+{
+    write_latch::find(*this)->mark(offset);
+}
+
+bool btree::validate(const node_read_set& reads) const
+{
+    for (auto& noted : reads.versions)
+    {
+        if (node_versions_[noted.slot].load() != noted.version || is_marked(noted.slot, noted.offset))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool btree::check_offset()
 {
     if (!offset_)
@@ -29,22 +165,103 @@ bool btree::check_offset()
     return true;
 }
 
+void btree::check_writable(filesize_t transaction_id)
+{
+    if (read_only_)
+    {
+        throw object_db_exception("a snapshot of a B-tree is read only");
+    }
+    if (transaction_id <= committed_transaction_id_)
+    {
+        throw object_db_exception("the transaction is already committed, writes need a newer transaction");
+    }
+}
+
+void btree::commit(filesize_t transaction_id)
+{
+    write_latch latch(*this);
+    check_writable(transaction_id);
+    flush_dirty_nodes();
+    snapshots_[transaction_id] = offset_;
+    committed_transaction_id_ = transaction_id;
+    committed_offset_ = offset_;
+}
+
+void btree::rollback(filesize_t transaction_id)
+{
+    write_latch latch(*this);
+    check_writable(transaction_id);
+
+    // the nodes the transaction wrote are only reachable from its own root, so dropping that root undoes it
+    {
+        std::lock_guard lock(dirty_nodes_mutex_);
+        dirty_nodes_.clear();
+    }
+    branch_cache_.clear();
+    invalidate_rightmost_path();
+    offset_ = committed_offset_;
+}
+
+far_offset_ptr btree::get_snapshot_root(filesize_t transaction_id) const
+{
+    std::shared_lock lock(latch_);
+    auto it = snapshots_.upper_bound(transaction_id);
+    if (it == snapshots_.begin())
+    {
+        throw object_db_exception("no snapshot of the B-tree at or before the transaction");
+    }
+    return std::prev(it)->second;
+}
+
+void btree::release_snapshots(filesize_t transaction_id)
+{
+    std::unique_lock lock(latch_);
+    auto it = snapshots_.upper_bound(transaction_id);
+    if (it != snapshots_.begin())
+    {
+        snapshots_.erase(snapshots_.begin(), std::prev(it)); // the newest one at or before is still read as of the transaction
+    }
+}
+
+std::unique_ptr<btree> btree::open_snapshot(filesize_t transaction_id)
+{
+    auto snapshot = std::make_unique<btree>(row_traits_, cache_, get_snapshot_root(transaction_id), allocator_);
+    snapshot->read_only_ = true;
+    return snapshot;
+}
+
+std::unique_ptr<btree> btree::open_committed()
+{
+    far_offset_ptr root;
+    {
+        std::shared_lock lock(latch_);
+        root = committed_offset_;
+    }
+    auto snapshot = std::make_unique<btree>(row_traits_, cache_, root, allocator_);
+    snapshot->read_only_ = true;
+    return snapshot;
+}
+
 btree_iterator btree::begin()
+{
+    return read_optimistically([this](node_read_set& reads) { return internal_begin(reads); });
+}
+
+btree_iterator btree::internal_begin(node_read_set& reads)
 {
     btree_iterator result;
-    result.btree_offset = offset_;
-    if (!offset_)
+    result.btree_offset = reads.root;
+    if (!reads.root)
     {
         return result;
     }
 
-    btree_node node(*this);
-    auto current_offset = offset_;
+    auto current_offset = reads.root;
 
     for (;;)
     {
-        auto iterator = cache_.get_iterator(current_offset);
-        node.read(iterator);
+        auto node_ptr = read_cached_node(reads, current_offset);
+        auto& node = *node_ptr;
 
         btree_node_info info;
         info.node_offset = current_offset;
@@ -76,22 +293,26 @@ btree_iterator btree::begin()
 }
 
 btree_iterator btree::end()
+{
+    return read_optimistically([this](node_read_set& reads) { return internal_end(reads); });
+}
+
+btree_iterator btree::internal_end(node_read_set& reads)
 {
     btree_iterator result;
-    result.btree_offset = offset_;
-    if (!offset_)
+    result.btree_offset = reads.root;
+    if (!reads.root)
     {
         return result;
     }
 
 
-    far_offset_ptr current_offset = offset_;
+    far_offset_ptr current_offset = reads.root;
 
     for (;;)
     {
-        btree_node node(*this);
-        auto iterator = cache_.get_iterator(current_offset.get_file_id(), current_offset.get_offset());
-        node.read(iterator);
+        auto node_ptr = read_cached_node(reads, current_offset);
+        auto& node = *node_ptr;
         btree_node_info info;
         info.node_offset = current_offset;
         info.btree_position = node.get_entry_count(); // Position after the last entry
@@ -124,21 +345,26 @@ btree_iterator btree::end()
 
 btree_iterator btree::next(btree_iterator it)
 {
-    return internal_next(it);
+    return read_optimistically([this, &it](node_read_set& reads) { return internal_next(reads, it); });
 }
 btree_iterator btree::prev(btree_iterator it)
 {
-    assert(it.btree_offset == offset_); //"Iterator must be from the same B-tree instance.";
-    return internal_prev(it);
+    return read_optimistically([this, &it](node_read_set& reads) {
+        assert(it.btree_offset == reads.root); //"Iterator must be from the same B-tree instance.";
+        return internal_prev(reads, it);
+    });
 }
 
 std::vector<uint8_t> btree::get_entry(btree_iterator it)
 {
-    return internal_get_entry(it);
+    return read_optimistically([this, &it](node_read_set& reads) { return internal_get_entry(reads, it); });
 }
 
 btree_iterator btree::insert(filesize_t transaction_id, btree_iterator it, std::span<uint8_t> entry)
 {
+    write_latch latch(*this);
+    check_writable(transaction_id);
+    invalidate_rightmost_path();
     auto result =  internal_insert(transaction_id, it, entry);
     if (result.path.empty())
     {
@@ -151,6 +377,9 @@ btree_iterator btree::insert(filesize_t transaction_id, btree_iterator it, std::
 }
 btree_iterator btree::update(filesize_t transaction_id, btree_iterator it, std::span<uint8_t> entry)
 {
+    write_latch latch(*this);
+    check_writable(transaction_id);
+    invalidate_rightmost_path();
     auto result = internal_update(transaction_id, it, entry);
     if (result.path.empty())
     {
@@ -162,6 +391,9 @@ btree_iterator btree::update(filesize_t transaction_id, btree_iterator it, std::
 }
 btree_iterator btree::remove(filesize_t transaction_id, btree_iterator it)
 {
+    write_latch latch(*this);
+    check_writable(transaction_id);
+    invalidate_rightmost_path();
     auto result = internal_remove(transaction_id, it);
 
     if (result.path.empty())
@@ -177,146 +409,199 @@ btree_iterator btree::remove(filesize_t transaction_id, btree_iterator it)
     return result;
 }
 
-btree_iterator btree::internal_next(btree_iterator it)
+btree_iterator btree::internal_next(node_read_set& reads, btree_iterator it)
 {
-    if (!offset_)
+    if (!reads.root)
     {
         btree_iterator result{}; // Invalid B-tree offset
-        result.btree_offset = offset_;
+        result.btree_offset = reads.root;
         return result;
     }
     btree_iterator result = it;
-    result.btree_offset = offset_;
+    result.btree_offset = reads.root;
 
     // If iterator is at end, return end iterator
     if (result.is_end()) 
     {
-        return end();
+        return internal_end(reads);
     }
 
-    // find a node with a next
-    auto current_path = it.path;
-    while(!current_path.empty())
+    // staying within the leaf reads nothing
+    auto& leaf_info = result.path.back();
+    if ((leaf_info.btree_position + 1) < leaf_info.btree_size)
     {
-        auto& info = current_path.back();
-        if ((info.btree_position + 1) < info.btree_size)
-        {
-            info.btree_position = info.btree_position + 1;
-            break;
-        }
-        else
-        {
-            current_path.pop_back();
-        }
+        leaf_info.btree_position++;
+        leaf_info.is_found = true;
     }
-
-    if (current_path.empty())
+    else if (!move_to_next_leaf(reads, result.path))
     {
         // If we reach here, there is no next entry (we were at the last entry)
-        return end();
+        return internal_end(reads);
+    }
+    return result;
+}
+btree_iterator btree::internal_prev(node_read_set& reads, btree_iterator it)
+{
+    if (!reads.root)
+    {
+        btree_iterator result{}; // Invalid B-tree offset
+        result.btree_offset = reads.root;
+        return result;
     }
+    btree_iterator result = it;
+    result.btree_offset = reads.root;
 
-    for (;;)
+    if (result.path.empty())
     {
-        auto& info = current_path.back();
-        auto node_iterator = cache_.get_iterator(info.node_offset);
-        btree_node node(*this);
-        node.read(node_iterator);
-        info.is_found = true;
-        info.btree_size = node.get_entry_count();
+        return internal_begin(reads);
+    }
 
-        if (node.is_leaf())
-        {
-            break;
-        }
-        else
-        {
-            far_offset_ptr next_node = node.get_branch_value_at(info.btree_position);
-            btree_node_info new_info;
-            new_info.btree_position = 0;
-            new_info.node_offset = next_node;
-            new_info.is_found = true;
-            current_path.push_back(new_info);
-        }
+    auto& leaf_info = result.path.back();
+    if (leaf_info.btree_position > 0)
+    {
+        leaf_info.btree_position--;
+        leaf_info.is_found = true;
+    }
+    else if (!move_to_prev_leaf(reads, result.path))
+    {
+        //todo: is this an error? basically means there is no earlier record (or is this fine?)
+        return internal_begin(reads);
     }
-    result.path = current_path;
     return result;
 }
-btree_iterator btree::internal_prev( btree_iterator it)
+
+// move a path to the first entry of the following leaf. Only the levels below the branch that moves are read:
+// branches come from the node cache, so normally just the new leaf is read. Returns nullptr at the last leaf
+std::shared_ptr<btree_node> btree::move_to_next_leaf(node_read_set& reads, std::vector<btree_node_info>& path)
 {
-    if (!offset_)
+    auto depth = path.size();
+    path.pop_back();
+    while (!path.empty() && (path.back().btree_position + 1) >= path.back().btree_size)
     {
-        btree_iterator result{}; // Invalid B-tree offset
-        result.btree_offset = offset_;
-        return result;
+        path.pop_back();
     }
-    btree_iterator result = it;
-    result.btree_offset = offset_;
 
-    // find a shared root
-    auto current_path = it.path;
-    while (!current_path.empty())
+    if (path.empty())
     {
-        auto& info = current_path.back();
+        return nullptr;
+    }
 
-        if (info.btree_position == 0)
-        {
-            current_path.pop_back();
-        }
-        else
-        {
-            break;
-        }
+    path.back().btree_position++;
+    auto node = read_cached_node(reads, path.back().node_offset);
+    while (path.size() < depth)
+    {
+        btree_node_info info;
+        info.node_offset = node->get_branch_value_at(path.back().btree_position);
+        info.btree_position = 0;
+        info.is_found = true;
+
+        node = read_cached_node(reads, info.node_offset);
+        info.btree_size = node->get_entry_count();
+        path.push_back(info);
     }
+    return node;
+}
 
-    if (current_path.empty())
+// the mirror of move_to_next_leaf, leaving the path at the last entry of the preceding leaf
+std::shared_ptr<btree_node> btree::move_to_prev_leaf(node_read_set& reads, std::vector<btree_node_info>& path)
+{
+    auto depth = path.size();
+    path.pop_back();
+    while (!path.empty() && path.back().btree_position == 0)
     {
-        //todo: is this an error? basically means there is no earlier record (or is this fine?)
-        return begin();
+        path.pop_back();
     }
-    else
+
+    if (path.empty())
+    {
+        return nullptr;
+    }
+
+    path.back().btree_position--;
+    auto node = read_cached_node(reads, path.back().node_offset);
+    while (path.size() < depth)
     {
-        bool first = true;
-        for (;;)
+        btree_node_info info;
+        info.node_offset = node->get_branch_value_at(path.back().btree_position);
+
+        node = read_cached_node(reads, info.node_offset);
+        info.btree_size = node->get_entry_count();
+        assert(info.btree_size > 0);
+        info.btree_position = info.btree_size - 1;
+        info.is_found = true;
+        path.push_back(info);
+    }
+    return node;
+}
+
+// descend to the leaf that holds the first entry greater than or equal to key, recording the path and returning the leaf
+std::shared_ptr<btree_node> btree::load_leaf_path(node_read_set& reads, std::span<uint8_t> key, std::vector<btree_node_info>& path)
+{
+    path.clear();
+    if (!reads.root)
+    {
+        return nullptr;
+    }
+
+    auto current_offset = reads.root;
+    for (;;)
+    {
+        auto node = read_cached_node(reads, current_offset);
+        auto find_result = node->find_key(key);
+
+        btree_node_info info;
+        info.node_offset = current_offset;
+        info.btree_size = node->get_entry_count();
+        if (node->is_leaf())
         {
-            auto& info = current_path.back();
-            auto it = cache_.get_iterator(info.node_offset);
-            btree_node node(*this);
-            node.read(it);
+            info.btree_position = (uint16_t)find_result.position;
+            info.is_found = find_result.found;
+            path.push_back(info);
+            return node;
+        }
 
-            auto node_size = node.get_entry_count();
-            info.btree_size = node_size;
-            info.is_found = true;
+        info.btree_position = (find_result.found || find_result.position == 0) ? find_result.position : (find_result.position - 1);
+        info.is_found = true;
+        path.push_back(info);
+        current_offset = node->get_branch_value_at(info.btree_position);
+    }
+}
 
-            if (first)
-            {
-                info.btree_position -= 1;
-                first = false;
-            }
-            else
-            {
-                assert(node_size > 0);
-                info.btree_position = node_size - 1;
-            }
+// descend along the first or last child of each level, returning the leaf at the edge of the tree
+std::shared_ptr<btree_node> btree::load_edge_path(node_read_set& reads, bool last, std::vector<btree_node_info>& path)
+{
+    path.clear();
+    if (!reads.root)
+    {
+        return nullptr;
+    }
 
-            if (node.is_leaf())
-            {
-                result.path = current_path;
-                return result;
-            }
-            else
-            {
-                far_offset_ptr new_node_offset = node.get_branch_value_at(info.btree_position);
-                btree_node_info new_node_info;
-                new_node_info.node_offset = new_node_offset;
-                current_path.push_back(new_node_info);
-            }
+    auto current_offset = reads.root;
+    for (;;)
+    {
+        auto node = read_cached_node(reads, current_offset);
+
+        btree_node_info info;
+        info.node_offset = current_offset;
+        info.btree_size = node->get_entry_count();
+        info.btree_position = (last && info.btree_size > 0) ? info.btree_size - 1 : 0;
+        info.is_found = info.btree_size > 0;
+        path.push_back(info);
+
+        if (node->is_leaf())
+        {
+            return node;
+        }
+        if (info.btree_size == 0)
+        {
+            throw object_db_exception("degenerate node found while seeking the edge of the B-tree");
         }
+        current_offset = node->get_branch_value_at(info.btree_position);
     }
 }
 
 
-std::vector<uint8_t> btree::internal_get_entry(btree_iterator it)
+std::vector<uint8_t> btree::internal_get_entry(node_read_set& reads, btree_iterator it)
 {
     if (it.is_end())
     {
@@ -329,8 +614,8 @@ std::vector<uint8_t> btree::internal_get_entry(btree_iterator it)
     if (it.path.back().is_found)
     {
         btree_node node(*this);
-        auto iterator = cache_.get_iterator(it.path.back().node_offset.get_file_id(), it.path.back().node_offset.get_offset());
-        node.read(iterator);
+        note_read(reads, it.path.back().node_offset);
+        read_node(it.path.back().node_offset, node);
         auto entry = node.get_entry(it.path.back().btree_position);
         return std::vector<uint8_t>(entry.begin(), entry.end());
     } else
@@ -368,8 +653,7 @@ btree_iterator btree::internal_insert(filesize_t transaction_id, btree_iterator
         node.insert_leaf_entry(0, entry);
         node.set_transaction_id(transaction_id);
         new_or_current_node_offset = allocator_.allocate_block(transaction_id);
-        auto write_it = cache_.get_iterator(new_or_current_node_offset.get_file_id(), new_or_current_node_offset.get_offset());
-        node.write(write_it);
+        write_node(new_or_current_node_offset, node);
         btree_node_info info;
         info.node_offset = new_or_current_node_offset;
         info.btree_position = 0; // We inserted at the beginning
@@ -391,11 +675,7 @@ btree_iterator btree::internal_insert(filesize_t transaction_id, btree_iterator
         current_path.pop_back();
         int path_position = current_path.size();
         btree_node node(*this);
-        auto iterator = cache_.get_iterator(
-            node_info.node_offset.get_file_id(),
-            node_info.node_offset.get_offset());
-
-        node.read(iterator);
+        read_node(node_info.node_offset, node);
         auto find_result = node_info.get_find_result();
         if (node.is_leaf())
         {
@@ -452,8 +732,7 @@ btree_iterator btree::internal_insert(filesize_t transaction_id, btree_iterator
             insert_needed = false;
         }
 
-        auto write_it = cache_.get_iterator(new_or_current_node_offset.get_file_id(), new_or_current_node_offset.get_offset());
-        node.write(write_it);
+        write_node(new_or_current_node_offset, node);
 
         update_key = node.get_key_at(0);
 
@@ -462,8 +741,7 @@ btree_iterator btree::internal_insert(filesize_t transaction_id, btree_iterator
         {
             auto new_node_offset = allocator_.allocate_block(transaction_id);
             insert_offset = new_node_offset;
-            auto insert_write_it = cache_.get_iterator(new_node_offset.get_file_id(), new_node_offset.get_offset());
-            insert_node.write(insert_write_it);
+            write_node(new_node_offset, insert_node);
 
             insert_key = insert_node.get_key_at(0);
 
@@ -496,17 +774,16 @@ btree_iterator btree::internal_insert(filesize_t transaction_id, btree_iterator
         new_root.init_root();
         new_root.set_transaction_id(transaction_id);
         new_root.set_key_size(get_key_size());
-        new_root.set_value_size(far_offset_ptr::get_size());
+        new_root.set_value_size(far_offset_ptr::get_compact_size());
 
         new_root.insert_branch_entry(0, update_key, new_or_current_node_offset);
         new_root.insert_branch_entry(1, insert_key, insert_offset);
+        lower_first_key(new_root);
 
         auto tmp = result.path;
 
         auto new_root_offset = allocator_.allocate_block(transaction_id);
-        auto new_node_iterator = cache_.get_iterator(new_root_offset.get_file_id(), new_root_offset.get_offset());
-
-        new_root.write(new_node_iterator);
+        write_node(new_root_offset, new_root);
 
         btree_node_info new_node_info
         {
@@ -563,8 +840,7 @@ btree_iterator btree::internal_update(filesize_t transaction_id, btree_iterator
         int path_position = current_path.size();
 
         btree_node node(*this);
-        auto iterator = cache_.get_iterator(offset.get_file_id(), offset.get_offset());
-        node.read(iterator);
+        read_node(offset, node);
         auto find_result = node_info.get_find_result();
 
         if (node.is_leaf())
@@ -598,8 +874,7 @@ btree_iterator btree::internal_update(filesize_t transaction_id, btree_iterator
             new_or_current_node_offset = offset;
         }
 
-        auto write_it = cache_.get_iterator(new_or_current_node_offset.get_file_id(), new_or_current_node_offset.get_offset());
-        node.write(write_it);
+        write_node(new_or_current_node_offset, node);
 
         update_key = node.get_key_at(0);
         new_or_current_node_offset = offset;
@@ -609,6 +884,25 @@ btree_iterator btree::internal_update(filesize_t transaction_id, btree_iterator
     return result;
 }
 
+void btree::set_low_water_fraction(double low_water_fraction)
+{
+    if (low_water_fraction <= 0.0 || low_water_fraction > 0.5)
+    {
+        throw object_db_exception("the low water fraction must be greater than 0 and no more than 0.5");
+    }
+    low_water_fraction_ = low_water_fraction;
+}
+
+uint32_t btree::get_low_water_count(btree_node& node)
+{
+    uint32_t count = (uint32_t)(node.get_capacity() * low_water_fraction_);
+
+    // a branch with a single child is degenerate
+    return std::max<uint32_t>(count, node.is_leaf() ? 1 : 2);
+}
+
+// removes the entry and rebalances lazily: a node is only touched again once it drops below the low water mark,
+// and then it borrows just enough entries from a sibling, merging only when the sibling has none to spare
 btree_iterator btree::internal_remove(filesize_t transaction_id, btree_iterator it)
 {
     if (it.is_end())
@@ -616,223 +910,195 @@ btree_iterator btree::internal_remove(filesize_t transaction_id, btree_iterator
         throw object_db_exception("cannot remove past end of index");
     }
 
-    auto original = it;
-    auto result = it;
-    auto current_path = original.path;
+    if (it.path.empty() || !it.path.back().is_found)
+    {
+        throw object_db_exception("cannot remove a value unless it was found");
+    }
 
-    if (current_path.empty())
+    btree_iterator result = it;
+    std::vector<decoded_path_node> path;
+    for (auto& info : it.path)
     {
-        btree_iterator iterator;
-        return iterator;
+        auto node = std::make_shared<btree_node>(*this);
+        read_node(info.node_offset, *node);
+        path.push_back({ info.node_offset, node, info.btree_position });
     }
 
-    far_offset_ptr offset;
+    path.back().node->remove_key(path.back().position);
 
-    bool remove_needed = true;
-    auto remove_position = current_path.back().btree_position;
+    for (size_t level = path.size(); level > 0; level--)
+    {
+        auto& path_node = path[level - 1];
+        auto& node = *path_node.node;
+        auto& info = result.path[level - 1];
 
-    std::shared_ptr<btree_node> node;
+        if (level == 1)
+        {
+            if (node.get_entry_count() == 0)
+            {
+                return btree_iterator{}; // this btree is now empty
+            }
 
-    bool update_needed = false;
-    uint32_t update_position = 0;
-    std::vector<uint8_t> update_key;
-    far_offset_ptr update_offset;
+            if (!node.is_leaf() && node.get_entry_count() == 1)
+            {
+                // the root has a single child left, which becomes the new root
+                result.path.erase(result.path.begin());
+                return result;
+            }
 
-    while (!current_path.empty() && (remove_needed || update_needed))
-    {
-        auto info_node = current_path.back();
-        if (!info_node.is_found)
-        {
-            throw object_db_exception("cannot remove a value unless it was found");
+            info.node_offset = write_modified_node(transaction_id, path_node.offset, node);
+            info.btree_position = (uint16_t)path_node.position;
+            info.btree_size = node.get_entry_count();
+            info.is_found = info.btree_position < info.btree_size;
+            return result;
         }
-        current_path.pop_back();
-        int path_position = current_path.size();
-        offset = info_node.node_offset;
-        
-        if (!node)
+
+        auto& parent_path_node = path[level - 2];
+        auto& parent = *parent_path_node.node;
+        uint32_t child = parent_path_node.position;
+
+        if (node.get_entry_count() < get_low_water_count(node) && parent.get_entry_count() > 1 &&
+            rebalance_after_remove(transaction_id, path_node, parent_path_node, info))
         {
-            auto it = cache_.get_iterator(info_node.node_offset);
-            node = std::make_shared<btree_node>(*this);
-            node->read(it);
+            continue; // the parent changed
         }
-        auto node_entry_count = node->get_entry_count();
-        auto node_removed_at = remove_position;
-        auto node_removed = remove_needed;
-        if (remove_needed)
+
+        if (node.get_entry_count() == 0)
         {
-            if (node_entry_count > remove_position)
-            {
-                node->remove_key(remove_position);
-                node_entry_count--;
-            }
-            remove_needed = false;
+            throw object_db_exception("degenerate node found while removing");
         }
 
-        if (update_needed)
+        info.node_offset = write_modified_node(transaction_id, path_node.offset, node);
+        info.btree_position = (uint16_t)path_node.position;
+        info.btree_size = node.get_entry_count();
+        info.is_found = info.btree_position < info.btree_size;
+
+        // removing entries never moves a node's left boundary, so its separator stays valid
+        if (info.node_offset == path_node.offset)
         {
-            node->update_branch_entry(update_position, update_key, update_offset);
+            return result; // the node was modified in place, nothing above it changes
         }
-        update_needed = true; // we expect an update at every loop thereafter
+        auto key = parent.get_key_at(child);
+        parent.update_branch_entry(child, key, info.node_offset);
+    }
 
-        std::shared_ptr<btree_node> parent_node;
-        std::shared_ptr<btree_node> other_node;
+    return result;
+}
 
-        far_offset_ptr other_node_offset;
+// borrow entries from a sibling of an underfull node, or merge the two when the sibling has none to spare.
+// Returns false, leaving both nodes as they were, if the result would not fit in a block. That can only happen
+// when entries from the two nodes compress less well together than apart
+bool btree::rebalance_after_remove(filesize_t transaction_id, decoded_path_node& path_node, decoded_path_node& parent_path_node, btree_node_info& info)
+{
+    auto& node = *path_node.node;
+    auto& parent = *parent_path_node.node;
+    uint32_t child = parent_path_node.position;
 
-        update_position = 0;
-        remove_position = 0;
+    bool use_right = (child + 1) < parent.get_entry_count();
+    uint32_t sibling_position = use_right ? child + 1 : child - 1;
+    auto sibling_offset = parent.get_branch_value_at(sibling_position);
 
-        if (path_position != 0 && node_removed)
-        {
-            auto parent_info_node = current_path.back();
-            int node_position_in_parent = parent_info_node.btree_position;
-            update_position = node_position_in_parent;
+    btree_node sibling(*this);
+    read_node(sibling_offset, sibling);
 
-            
-            if (node->should_merge())
+    uint32_t count = node.get_entry_count();
+    uint32_t sibling_count = sibling.get_entry_count();
+    if ((count + sibling_count) >= (2 * get_low_water_count(node)))
+    {
+        // the sibling can spare entries, move just enough to even the two nodes out
+        uint32_t borrow_count = (sibling_count - count) / 2;
+        if (use_right)
+        {
+            node.borrow_from_right(sibling, borrow_count);
+            if (node.should_split())
             {
-                // locate parent node
-                auto parent_it = cache_.get_iterator(parent_info_node.node_offset);
-                parent_node = std::make_shared<btree_node>(*this);
-                parent_node->read(parent_it);
-
-
-                if (parent_node->get_entry_count() > 1)
-                {
-                    auto other_node_position = 1;
-                    if (node_position_in_parent > 0)
-                    {
-                        other_node_position = node_position_in_parent - 1;
-                    }
-
-                    other_node_offset = parent_node->get_branch_value_at(other_node_position);
-
-                    auto other_node_it = cache_.get_iterator(other_node_offset);
-
-                    other_node = std::make_shared<btree_node>(*this);
-                    other_node->read(other_node_it);
-
-                    auto other_node_entry_count = other_node->get_entry_count();
-
-                    int position_in_total = 0;
-
-                    if (other_node_position > node_position_in_parent)
-                    {
-                        position_in_total = node_removed_at;
-                        node->merge(*other_node);
-                    }
-                    else
-                    {
-                        position_in_total = other_node_entry_count + node_removed_at;
-                        other_node->merge(*node);
-
-                        auto tmp_position = node_position_in_parent;
-                        node_position_in_parent = other_node_position;
-                        other_node_position = tmp_position;
-
-                        std::shared_ptr<btree_node> tmp = node;
-                        node = other_node;
-                        other_node = tmp;
-                    }
-
-                    if (node->should_split())
-                    {
-                        node->split(*other_node);
-                        remove_position = 0;
-                        remove_needed = false;
-
-                        if (other_node->get_transaction_id() != transaction_id) // do we need to copy on write?
-                        {
-                            other_node_offset = allocator_.allocate_block(transaction_id);
-                        }
-
-                        auto tmp_other_node_it = cache_.get_iterator(other_node_offset);
-                        other_node->write(tmp_other_node_it);
-
-                        auto key_at_0 = other_node->get_key_at(0);
-                        parent_node->update_branch_entry(other_node_position, key_at_0, other_node_offset);
-                    }
-                    else
-                    {
-                        other_node.reset();
-                        remove_position = (uint16_t)other_node_position;
-                        remove_needed = true;
-                    }
-                }
-
-                if (node->get_entry_count() == 0)
-                {
-                    return btree_iterator{}; // this btree is now empty
-                }
-                update_position = node_position_in_parent;
+                sibling.borrow_from_left(node, borrow_count);
+                return false;
             }
         }
-
-        if (node->get_transaction_id() != transaction_id)
-        {
-            offset = allocator_.allocate_block(transaction_id);
-            update_needed = true;
-        }
-
-        auto node_count_after_merge = node->get_entry_count();
-        if (node_count_after_merge > 0)
-        {
-            update_key = node->get_key_at(0);
-            update_offset = offset;
-        }
-
-        if (node_count_after_merge <= 1 && !node->is_leaf())
+        else
         {
-            auto path = std::vector<btree_node_info>(result.path.begin() + path_position + 1, result.path.end());
-            result.path = path;
-            if (!result.path.empty())
-            {
-                result.btree_offset = result.path.front().node_offset;
-            }
-            else
+            node.borrow_from_left(sibling, borrow_count);
+            if (node.should_split())
             {
-                result.btree_offset = far_offset_ptr(0, 0);
+                sibling.borrow_from_right(node, borrow_count);
+                return false;
             }
-            return result;
+            path_node.position += borrow_count;
         }
 
-        auto write_it = cache_.get_iterator(offset.get_file_id(), offset.get_offset());
+        // only the boundary between the two nodes moved, so the left node keeps its separator
+        sibling_offset = write_modified_node(transaction_id, sibling_offset, sibling);
+        auto sibling_key = use_right ? get_child_key(node, sibling) : parent.get_key_at(sibling_position);
+        parent.update_branch_entry(sibling_position, sibling_key, sibling_offset);
 
-        node->write(write_it);
-        result.path[path_position].node_offset = offset;
-        result.path[path_position].btree_position =
-            node_removed
-            ? node_removed_at
-            : info_node.btree_position; // Keep the same position
-
-        result.path[path_position].btree_size = node->get_entry_count();
-        result.path[path_position].is_found = result.path[path_position].btree_position < result.path[path_position].btree_size;
+        info.node_offset = write_modified_node(transaction_id, path_node.offset, node);
+        info.btree_position = (uint16_t)path_node.position;
+        info.btree_size = node.get_entry_count();
 
-        auto count = node->get_entry_count();
-        if ((count == 0) || (!node->is_leaf() && count == 1)) // we have a new root, above this node (or the tree is now empty)
+        auto key = use_right ? parent.get_key_at(child) : get_child_key(sibling, node);
+        parent.update_branch_entry(child, key, info.node_offset);
+    }
+    else if (use_right)
+    {
+        // merge the right sibling into this node and drop it from the parent
+        auto transaction_id_before = sibling.get_transaction_id();
+        node.merge(sibling);
+        if (node.should_split())
         {
-            std::vector<btree_node_info> result_path(result.path.begin() + path_position + 1, result.path.end());
-            result.path = result_path;
-            break;
+            node.split(sibling, count);
+            sibling.set_transaction_id(transaction_id_before);
+            return false;
         }
 
-        node = parent_node;
-        parent_node.reset();
+        info.node_offset = write_modified_node(transaction_id, path_node.offset, node);
+        info.btree_position = (uint16_t)path_node.position;
+        info.btree_size = node.get_entry_count();
+
+        auto key = parent.get_key_at(child);
+        parent.update_branch_entry(child, key, info.node_offset);
+        parent.remove_key(child + 1);
     }
+    else
+    {
+        // merge this node into the left sibling and drop it from the parent
+        auto transaction_id_before = node.get_transaction_id();
+        sibling.merge(node);
+        if (sibling.should_split())
+        {
+            sibling.split(node, sibling_count);
+            node.set_transaction_id(transaction_id_before);
+            return false;
+        }
 
-    return result;
+        info.node_offset = write_modified_node(transaction_id, sibling_offset, sibling);
+        info.btree_position = (uint16_t)(sibling_count + path_node.position);
+        info.btree_size = sibling.get_entry_count();
+
+        auto sibling_key = parent.get_key_at(sibling_position);
+        parent.update_branch_entry(sibling_position, sibling_key, info.node_offset);
+        parent.remove_key(child);
+        parent_path_node.position = sibling_position;
+    }
+    info.is_found = info.btree_position < info.btree_size;
+    return true;
 }
 
 btree_iterator btree::seek_begin(std::span<uint8_t> key) // seek to the first entry that is greater than or equal to the key
 {
-    if (!offset_)
+    return read_optimistically([this, &key](node_read_set& reads) { return internal_seek_begin(reads, key); });
+}
+
+btree_iterator btree::internal_seek_begin(node_read_set& reads, std::span<uint8_t> key)
+{
+    if (!reads.root)
     {
         return btree_iterator{}; // Invalid B-tree offset
     }
 
     btree_iterator result;
     btree_node node(*this);
-    auto current_offset = offset_;
+    auto current_offset = reads.root;
     for (;;)
     {
         auto iterator = cache_.get_iterator(current_offset.get_file_id(), current_offset.get_offset());
@@ -840,7 +1106,7 @@ btree_iterator btree::seek_begin(std::span<uint8_t> key) // seek to the first en
         {
             if (result.path.empty())
             {
-                result.btree_offset = offset_;
+                result.btree_offset = reads.root;
                 result.path.clear();
                 return result; // Empty B-tree
             }
@@ -849,7 +1115,8 @@ btree_iterator btree::seek_begin(std::span<uint8_t> key) // seek to the first en
                 throw object_db_exception("B-tree node is empty or corrupted.");
             }
         }
-        node.read(iterator);
+        note_read(reads, current_offset);
+        read_node(current_offset, node);
         auto find_result = node.find_key(key);
         btree_node_info info;
         info.node_offset = current_offset;
@@ -881,22 +1148,203 @@ btree_iterator btree::seek_begin(std::span<uint8_t> key) // seek to the first en
             current_offset = node.get_branch_value_at(read_key_position);
         }
     }
-    result.btree_offset = offset_;
+    result.btree_offset = reads.root;
     return result;
 
 }
 
+btree::lookup_node_lease::lookup_node_lease(btree& tree) : tree_(tree)
+{
+    std::lock_guard lock(tree_.lookup_nodes_mutex_);
+    if (tree_.lookup_nodes_.empty())
+    {
+        node_ = std::make_unique<btree_node>(tree_);
+    }
+    else
+    {
+        node_ = std::move(tree_.lookup_nodes_.back());
+        tree_.lookup_nodes_.pop_back();
+    }
+}
+
+btree::lookup_node_lease::~lookup_node_lease()
+{
+    std::lock_guard lock(tree_.lookup_nodes_mutex_);
+    tree_.lookup_nodes_.push_back(std::move(node_));
+}
+
+// get a branch from the node cache, decoding and caching it if needed. Returns nullptr if the node is a leaf,
+// which is left decoded in lookup_node until the next lookup
+std::shared_ptr<btree_node> btree::read_lookup_branch(node_read_set& reads, far_offset_ptr offset, btree_node& lookup_node)
+{
+    auto version = note_read(reads, offset);
+    auto node = branch_cache_.get_node(offset, version);
+    if (node)
+    {
+        return node;
+    }
+
+    read_node(offset, lookup_node);
+    if (lookup_node.is_leaf())
+    {
+        return nullptr;
+    }
+
+    node = std::make_shared<btree_node>(lookup_node);
+    branch_cache_.put_node(offset, node, version);
+    return node;
+}
+
+// descend to the leaf that would hold key without recording a path
+btree_node& btree::read_lookup_leaf(node_read_set& reads, std::span<uint8_t> key, btree_node& lookup_node)
+{
+    auto current_offset = reads.root;
+    for (;;)
+    {
+        auto node = read_lookup_branch(reads, current_offset, lookup_node);
+        if (!node)
+        {
+            return lookup_node;
+        }
+
+        auto find_result = node->find_key(key);
+        auto position = (find_result.found || find_result.position == 0) ? find_result.position : (find_result.position - 1);
+        current_offset = node->get_branch_value_at(position);
+    }
+}
+
+bool btree::get(std::span<uint8_t> key, std::span<uint8_t> value)
+{
+    auto value_traits = row_traits_->get_value_traits();
+    if (value.size() < value_traits->get_size())
+    {
+        throw object_db_exception("the value buffer is smaller than the value");
+    }
+
+    lookup_node_lease lookup_node(*this);
+    return read_optimistically([&](node_read_set& reads) {
+        if (!reads.root)
+        {
+            return false;
+        }
+
+        auto& leaf = read_lookup_leaf(reads, key, lookup_node.get());
+        auto find_result = leaf.find_key(key);
+        if (!find_result.found)
+        {
+            return false;
+        }
+
+        value_traits->copy_data(leaf.get_entry(find_result.position), value);
+        return true;
+    });
+}
+
+size_t btree::multi_get(std::span<std::vector<uint8_t>> sorted_keys, std::span<uint8_t> values, std::vector<bool>& found)
+{
+    auto value_size = (size_t)row_traits_->get_value_traits()->get_size();
+    if (values.size() < sorted_keys.size() * value_size)
+    {
+        throw object_db_exception("the value buffer is smaller than the values");
+    }
+
+    for (size_t n = 1; n < sorted_keys.size(); n++)
+    {
+        if (compare_keys(sorted_keys[n - 1], sorted_keys[n]) > 0)
+        {
+            throw object_db_exception("multi_get requires keys in sorted order");
+        }
+    }
+
+    lookup_node_lease lookup_node(*this);
+    return read_optimistically([&](node_read_set& reads) {
+        found.assign(sorted_keys.size(), false);
+        size_t found_count = 0;
+        if (!reads.root || sorted_keys.empty())
+        {
+            return found_count;
+        }
+
+        internal_multi_get(reads, reads.root, sorted_keys, 0, values, found, found_count, lookup_node.get());
+        return found_count;
+    });
+}
+
+// look up the keys that fall below one node. A branch divides its keys between its children and only descends into
+// children that received some, so nodes shared by several keys are visited once
+void btree::internal_multi_get(node_read_set& reads, far_offset_ptr offset, std::span<std::vector<uint8_t>> keys, size_t first_index, std::span<uint8_t> values, std::vector<bool>& found, size_t& found_count, btree_node& lookup_node)
+{
+    auto branch = read_lookup_branch(reads, offset, lookup_node);
+    if (!branch)
+    {
+        auto value_traits = row_traits_->get_value_traits();
+        auto value_size = (size_t)value_traits->get_size();
+        for (size_t n = 0; n < keys.size(); n++)
+        {
+            auto find_result = lookup_node.find_key(keys[n]);
+            if (find_result.found)
+            {
+                auto index = first_index + n;
+                value_traits->copy_data(lookup_node.get_entry(find_result.position), values.subspan(index * value_size, value_size));
+                found[index] = true;
+                found_count++;
+            }
+        }
+        return;
+    }
+
+    uint32_t count = branch->get_entry_count();
+    size_t n = 0;
+    while (n < keys.size())
+    {
+        auto find_result = branch->find_key(keys[n]);
+        uint32_t child = (find_result.found || find_result.position == 0) ? find_result.position : (find_result.position - 1);
+
+        // the run of keys for this child ends at the first key that belongs to the next child
+        size_t end = keys.size();
+        if (child + 1 < count)
+        {
+            auto next_key = branch->get_key_at(child + 1);
+            end = n + 1;
+            while (end < keys.size() && compare_keys(keys[end], next_key) < 0)
+            {
+                end++;
+            }
+        }
+
+        internal_multi_get(reads, branch->get_branch_value_at(child), keys.subspan(n, end - n), first_index + n, values, found, found_count, lookup_node);
+        n = end;
+    }
+}
+
+bool btree::contains(std::span<uint8_t> key)
+{
+    lookup_node_lease lookup_node(*this);
+    return read_optimistically([&](node_read_set& reads) {
+        if (!reads.root)
+        {
+            return false;
+        }
+        return read_lookup_leaf(reads, key, lookup_node.get()).find_key(key).found;
+    });
+}
+
 btree_iterator btree::seek_end(std::span<uint8_t> key) // seek to the first entry that is greater than the key
 {
-    if (!offset_)
+    return read_optimistically([this, &key](node_read_set& reads) { return internal_seek_end(reads, key); });
+}
+
+btree_iterator btree::internal_seek_end(node_read_set& reads, std::span<uint8_t> key)
+{
+    if (!reads.root)
     {
 
         btree_iterator result{}; // Invalid B-tree offset
-        result.btree_offset = offset_;
+        result.btree_offset = reads.root;
         return result;
     }
 
-    auto it = seek_begin(key);
+    auto it = internal_seek_begin(reads, key);
     if (it.is_end())
     {
         return it; // If the key is not found, return end iterator
@@ -905,33 +1353,1110 @@ btree_iterator btree::seek_end(std::span<uint8_t> key) // seek to the first entr
     if (it.path.back().is_found)
     {
         // Move to the next entry in the B-tree
-        it = next(it);
+        it = internal_next(reads, it);
     }
     else {
         // If the key was not found, we return the iterator at the position where it would be inserted
         // This is already handled by seek_begin, so we just return it
     }
 
-    it.btree_offset = offset_;
+    it.btree_offset = reads.root;
     return it;
 }
 
 btree_iterator btree::upsert(filesize_t transaction_id, std::span<uint8_t> entry) // insert or update an entry in the B-tree
 {
+    bool applied = false;
+    return write_entry(transaction_id, entry, write_mode::upsert, applied);
+}
+
+bool btree::insert_if_absent(filesize_t transaction_id, std::span<uint8_t> entry)
+{
+    bool applied = false;
+    write_entry(transaction_id, entry, write_mode::insert_if_absent, applied);
+    return applied;
+}
+
+bool btree::update_if_present(filesize_t transaction_id, std::span<uint8_t> entry)
+{
+    bool applied = false;
+    write_entry(transaction_id, entry, write_mode::update_if_present, applied);
+    return applied;
+}
+
+btree_iterator btree::write_entry(filesize_t transaction_id, std::span<uint8_t> entry, write_mode mode, bool& applied)
+{
+    btree_iterator result;
+    if (upsert_in_leaf(transaction_id, entry, mode, applied, result))
+    {
+        return result;
+    }
+
+    write_latch latch(*this);
+    check_writable(transaction_id);
+    return internal_upsert(transaction_id, entry, mode, applied);
+}
+
+// the write when it changes one leaf of the open transaction in place and nothing above it, holding the latch shared
+// and the latch of the leaf alone. The branches cannot change under the shared latch, so the path down to the leaf
+// stays as it was read. Returns false, having written nothing, when the write has to copy or split a node or move the
+// key its parent holds for the leaf, which the write then does holding the latch alone
+bool btree::upsert_in_leaf(filesize_t transaction_id, std::span<uint8_t> entry, write_mode mode, bool& applied, btree_iterator& result)
+{
+    if (append_mode_ || read_only_ || entry.size() != get_key_size() + get_value_size())
+    {
+        return false;
+    }
     auto key = derive_key_from_entry(entry);
-    btree_iterator it = seek_begin(key);
-    if (it.is_end() || !it.path.back().is_found)
+
+    std::unique_lock<std::mutex> leaf_lock; // taken off after the latch, so the next write to the leaf finds it unmarked
+    write_latch latch(*this, true);
+    if (transaction_id <= committed_transaction_id_ || !check_offset())
+    {
+        return false;
+    }
+
+    result.btree_offset = offset_;
+    result.path.clear();
+    node_read_set reads;
+    reads.latched = true;
+    std::shared_ptr<btree_node> parent;
+    uint32_t child = 0;
+    auto current_offset = offset_;
+    for (;;)
+    {
+        auto node = read_cached_node(reads, current_offset);
+        if (node->is_leaf())
+        {
+            break;
+        }
+
+        auto find_result = node->find_key(key);
+        child = (find_result.found || find_result.position == 0) ? find_result.position : (find_result.position - 1);
+        result.path.push_back({ .node_offset = current_offset, .btree_position = (uint16_t)child,
+            .btree_size = (uint16_t)node->get_entry_count(), .is_found = true });
+        parent = node;
+        current_offset = node->get_branch_value_at(child);
+    }
+
+    // a key before the first key the parent holds for the leaf would move that key
+    if (parent && child == 0)
+    {
+        auto child_key = parent->get_key_at(0);
+        if (compare_keys(child_key, key) > 0)
+        {
+            return false;
+        }
+    }
+
+    leaf_lock = std::unique_lock(leaf_latches_[get_version_slot(current_offset) % leaf_latch_count]);
+    btree_node leaf(*this);
+    read_node(current_offset, leaf);
+    if (leaf.get_transaction_id() != transaction_id)
+    {
+        return false;
+    }
+
+    auto find_result = leaf.find_key(key);
+    result.path.push_back({ .node_offset = current_offset, .btree_position = (uint16_t)find_result.position,
+        .btree_size = (uint16_t)leaf.get_entry_count(), .is_found = find_result.found });
+    if (find_result.found ? mode == write_mode::insert_if_absent : mode == write_mode::update_if_present)
+    {
+        applied = false;
+        return true;
+    }
+
+    if (find_result.found)
     {
-        // If the key is not found, we need to insert it
-        return insert(transaction_id, it, entry);
+        leaf.update_leaf_entry(find_result.position, entry);
     }
     else
     {
-        // If the key is found, we can update it
-        return update(transaction_id, it, entry);
+        leaf.insert_leaf_entry(find_result.position, entry);
+    }
+    if (leaf.get_entry_count() > leaf.get_capacity() || leaf.should_split())
+    {
+        return false;
+    }
+
+    write_node(current_offset, leaf);
+    result.path.back().btree_size = (uint16_t)leaf.get_entry_count();
+    result.path.back().is_found = true;
+    applied = true;
+    return true;
+}
+
+void btree::set_append_mode(bool append_mode)
+{
+    append_mode_ = append_mode;
+    invalidate_rightmost_path();
+}
+
+void btree::invalidate_rightmost_path()
+{
+    rightmost_path_.clear();
+}
+
+void btree::load_rightmost_path()
+{
+    rightmost_path_.clear();
+
+    auto current_offset = offset_;
+    for (;;)
+    {
+        auto node = std::make_shared<btree_node>(*this);
+        read_node(current_offset, *node);
+        uint32_t count = node->get_entry_count();
+        rightmost_path_.push_back({ current_offset, node, count > 0 ? count - 1 : 0 });
+
+        if (node->is_leaf())
+        {
+            break;
+        }
+        current_offset = node->get_branch_value_at(count - 1);
+    }
+}
+
+btree_iterator btree::get_rightmost_iterator(bool is_found)
+{
+    btree_iterator result;
+    result.btree_offset = offset_;
+    for (auto& path_node : rightmost_path_)
+    {
+        auto count = path_node.node->get_entry_count();
+        path_node.position = count - 1;
+
+        btree_node_info info;
+        info.node_offset = path_node.offset;
+        info.btree_position = (uint16_t)(count - 1);
+        info.btree_size = count;
+        info.is_found = true;
+        result.path.push_back(info);
+    }
+
+    if (!is_found)
+    {
+        // position the leaf after its last entry, where the key would be appended
+        result.path.back().btree_position++;
+        result.path.back().is_found = false;
+    }
+    return result;
+}
+
+// write the rightmost node of a level. When it overflows it keeps most of its entries and a new rightmost node
+// takes the rest, so appended keys leave nearly full nodes behind them instead of half empty ones
+std::vector<btree::child_reference> btree::write_append_node(filesize_t transaction_id, decoded_path_node& path_node)
+{
+    auto& node = *path_node.node;
+    if (node.get_transaction_id() != transaction_id)
+    {
+        path_node.offset = allocator_.allocate_block(transaction_id);
+        node.set_transaction_id(transaction_id);
+    }
+
+    std::vector<child_reference> result;
+    if (!node.should_split())
+    {
+        write_node(path_node.offset, node);
+        result.push_back({ node.get_key_at(0), path_node.offset });
+        return result;
     }
+
+    uint32_t count = node.get_entry_count();
+    uint32_t split_position = (uint32_t)(count * append_split_fraction);
+    split_position = std::min(std::max<uint32_t>(split_position, 1), count - 1);
+
+    auto tail_node = std::make_shared<btree_node>(*this);
+    node.split(*tail_node, split_position);
+    tail_node->set_transaction_id(transaction_id);
+
+    write_node(path_node.offset, node);
+    result.push_back({ node.get_key_at(0), path_node.offset });
+
+    auto tail_offset = allocator_.allocate_block(transaction_id);
+    write_node(tail_offset, *tail_node);
+    result.push_back({ get_child_key(node, *tail_node), tail_offset });
+
+    path_node.node = tail_node;
+    path_node.offset = tail_offset;
+    return result;
 }
 
+// apply a write to the cached rightmost path if the key is at or after the last key in the tree. Returns false
+// if the key belongs further left and the ordinary descent is needed
+bool btree::internal_append(filesize_t transaction_id, std::span<uint8_t> entry, std::span<uint8_t> key, write_mode mode, bool& applied, btree_iterator& result)
+{
+    if (!check_offset())
+    {
+        return false;
+    }
+
+    if (rightmost_path_.empty() || rightmost_path_.front().offset != offset_)
+    {
+        load_rightmost_path();
+    }
+
+    auto& leaf = *rightmost_path_.back().node;
+    uint32_t count = leaf.get_entry_count();
+    if (count == 0)
+    {
+        return false;
+    }
+
+    auto last_key = leaf.get_key_at(count - 1);
+    int cmp = compare_keys(key, last_key);
+    if (cmp < 0)
+    {
+        return false;
+    }
+
+    if (cmp == 0)
+    {
+        if (mode == write_mode::insert_if_absent)
+        {
+            result = get_rightmost_iterator(true);
+            return true;
+        }
+        leaf.update_leaf_entry(count - 1, entry);
+    }
+    else
+    {
+        if (mode == write_mode::update_if_present)
+        {
+            result = get_rightmost_iterator(false);
+            return true;
+        }
+        leaf.insert_leaf_entry(count, entry);
+    }
+    applied = true;
+
+    std::vector<child_reference> children;
+    bool root_written = true;
+    for (size_t level = rightmost_path_.size(); level > 0; level--)
+    {
+        auto& path_node = rightmost_path_[level - 1];
+        auto& node = *path_node.node;
+
+        if (level < rightmost_path_.size())
+        {
+            uint32_t child = node.get_entry_count() - 1;
+            auto child_key = node.get_key_at(child);
+            keep_separator(child_key, children.front());
+            if (children.size() == 1 && children.front().offset == node.get_branch_value_at(child) && children.front().key == child_key)
+            {
+                root_written = false;
+                break; // the child was modified in place, nothing above it changes
+            }
+
+            node.update_branch_entry(child, children.front().key, children.front().offset);
+            for (size_t c = 1; c < children.size(); c++)
+            {
+                node.insert_branch_entry((int)(child + c), children[c].key, children[c].offset);
+            }
+        }
+
+        children = write_append_node(transaction_id, path_node);
+    }
+
+    if (root_written && children.size() > 1)
+    {
+        auto new_root = std::make_shared<btree_node>(*this);
+        new_root->init_root();
+        new_root->set_transaction_id(transaction_id);
+        new_root->set_key_size(get_key_size());
+        new_root->set_value_size(far_offset_ptr::get_compact_size());
+
+        for (size_t n = 0; n < children.size(); n++)
+        {
+            new_root->insert_branch_entry((int)n, children[n].key, children[n].offset);
+        }
+        lower_first_key(*new_root);
+
+        auto new_root_offset = allocator_.allocate_block(transaction_id);
+        write_node(new_root_offset, *new_root);
+        rightmost_path_.insert(rightmost_path_.begin(), { new_root_offset, new_root, (uint32_t)children.size() - 1 });
+    }
+
+    offset_ = rightmost_path_.front().offset;
+    result = get_rightmost_iterator(true);
+    return true;
+}
+
+// a single descent that keeps each node on the path decoded, then modifies and writes back only the nodes that change
+btree_iterator btree::internal_upsert(filesize_t transaction_id, std::span<uint8_t> entry, write_mode mode, bool& applied)
+{
+    applied = false;
+    if (entry.size() != get_key_size() + get_value_size())
+    {
+        throw object_db_exception("entry does not match the B-tree entry size");
+    }
+    auto key = derive_key_from_entry(entry);
+
+    btree_iterator result;
+    result.btree_offset = offset_;
+
+    if (append_mode_ && internal_append(transaction_id, entry, key, mode, applied, result))
+    {
+        return result;
+    }
+    invalidate_rightmost_path();
+
+    if (!check_offset())
+    {
+        if (mode == write_mode::update_if_present)
+        {
+            return result;
+        }
+
+        btree_node leaf(*this);
+        leaf.init_leaf();
+        leaf.set_transaction_id(transaction_id);
+        leaf.set_key_size(get_key_size());
+        leaf.set_value_size(get_value_size());
+        leaf.insert_leaf_entry(0, entry);
+
+        offset_ = allocator_.allocate_block(transaction_id);
+        write_node(offset_, leaf);
+
+        result.btree_offset = offset_;
+        result.path.push_back({ .node_offset = offset_, .btree_position = 0, .btree_size = 1, .is_found = true });
+        applied = true;
+        return result;
+    }
+
+    std::vector<decoded_path_node> path;
+    auto current_offset = offset_;
+    for (;;)
+    {
+        auto node = std::make_shared<btree_node>(*this);
+        read_node(current_offset, *node);
+        auto find_result = node->find_key(key);
+
+        btree_node_info info;
+        info.node_offset = current_offset;
+        info.btree_size = node->get_entry_count();
+
+        if (node->is_leaf())
+        {
+            info.btree_position = (uint16_t)find_result.position;
+            info.is_found = find_result.found;
+            result.path.push_back(info);
+            path.push_back({ current_offset, node, find_result.position });
+            break;
+        }
+
+        uint32_t child = (find_result.found || find_result.position == 0)
+            ? find_result.position
+            : (find_result.position - 1);
+
+        info.btree_position = (uint16_t)child;
+        info.is_found = true;
+        result.path.push_back(info);
+        path.push_back({ current_offset, node, child });
+
+        current_offset = node->get_branch_value_at(child);
+    }
+
+    auto& leaf = *path.back().node;
+    uint32_t position = path.back().position;
+    if (result.path.back().is_found)
+    {
+        if (mode == write_mode::insert_if_absent)
+        {
+            return result;
+        }
+        leaf.update_leaf_entry(position, entry);
+    }
+    else
+    {
+        if (mode == write_mode::update_if_present)
+        {
+            return result;
+        }
+        leaf.insert_leaf_entry(position, entry);
+    }
+    applied = true;
+
+    std::vector<child_reference> children;
+    size_t entry_node_index = 0;
+    bool root_written = true;
+    for (size_t level = path.size(); level > 0; level--)
+    {
+        auto& path_node = path[level - 1];
+        auto& node = *path_node.node;
+
+        if (level < path.size())
+        {
+            auto child = path_node.position;
+            auto child_key = node.get_key_at(child);
+            keep_separator(child_key, children.front());
+            if (children.size() == 1 && children.front().offset == path[level].offset && children.front().key == child_key)
+            {
+                root_written = false;
+                break; // the child was modified in place, nothing above it changes
+            }
+
+            node.update_branch_entry(child, children.front().key, children.front().offset);
+            for (size_t c = 1; c < children.size(); c++)
+            {
+                node.insert_branch_entry((int)(child + c), children[c].key, children[c].offset);
+            }
+            position = child + (uint32_t)entry_node_index;
+        }
+
+        children = write_split_node(transaction_id, path_node.offset, node);
+
+        auto& info = result.path[level - 1];
+        uint32_t node_position = 0;
+        uint32_t node_size = 0;
+        locate_split_position(children, position, entry_node_index, node_position, node_size);
+        info.node_offset = children[entry_node_index].offset;
+        info.btree_position = (uint16_t)node_position;
+        info.btree_size = (uint16_t)node_size;
+        info.is_found = true;
+    }
+
+    // the root split, add branch levels until a single node remains
+    while (root_written && children.size() > 1)
+    {
+        btree_node new_root(*this);
+        new_root.init_root();
+        new_root.set_transaction_id(transaction_id);
+        new_root.set_key_size(get_key_size());
+        new_root.set_value_size(far_offset_ptr::get_compact_size());
+
+        for (size_t n = 0; n < children.size(); n++)
+        {
+            new_root.insert_branch_entry((int)n, children[n].key, children[n].offset);
+        }
+        lower_first_key(new_root);
+
+        position = (uint32_t)entry_node_index;
+        children = write_split_node(transaction_id, far_offset_ptr(), new_root);
+
+        btree_node_info info;
+        uint32_t node_position = 0;
+        uint32_t node_size = 0;
+        locate_split_position(children, position, entry_node_index, node_position, node_size);
+        info.node_offset = children[entry_node_index].offset;
+        info.btree_position = (uint16_t)node_position;
+        info.btree_size = (uint16_t)node_size;
+        info.is_found = true;
+        result.path.insert(result.path.begin(), info);
+    }
+
+    offset_ = result.path.front().node_offset;
+    result.btree_offset = offset_;
+    return result;
+}
+
+
+// write a node, copying it first if it belongs to an older transaction. Returns the offset it was written to
+far_offset_ptr btree::write_modified_node(filesize_t transaction_id, far_offset_ptr offset, btree_node& node)
+{
+    if (!offset || node.get_transaction_id() != transaction_id)
+    {
+        offset = allocator_.allocate_block(transaction_id);
+        node.set_transaction_id(transaction_id);
+    }
+    write_node(offset, node);
+    return offset;
+}
+
+// read a node for traversal. Branches are decoded once and then shared through the node cache, so callers must not modify the result
+std::shared_ptr<btree_node> btree::read_cached_node(node_read_set& reads, far_offset_ptr offset)
+{
+    auto version = note_read(reads, offset);
+    auto node = branch_cache_.get_node(offset, version);
+    if (node)
+    {
+        return node;
+    }
+
+    node = std::make_shared<btree_node>(*this);
+    read_node(offset, *node);
+    if (!node->is_leaf())
+    {
+        branch_cache_.put_node(offset, node, version);
+    }
+    return node;
+}
+
+// the block is read in one go, so a node written at the same time is read either before or after the write
+void btree::read_node(far_offset_ptr offset, btree_node& node)
+{
+    if (buffer_writes_)
+    {
+        std::lock_guard lock(dirty_nodes_mutex_);
+        auto dirty = dirty_nodes_.find(std::tuple(offset.get_file_id(), offset.get_offset()));
+        if (dirty != dirty_nodes_.end())
+        {
+            span_iterator read_it(dirty->second);
+            node.read(read_it);
+            return;
+        }
+    }
+
+    std::vector<uint8_t> block(block_size);
+    cache_.read_bytes(offset.get_file_id(), offset.get_offset(), block);
+    span_iterator read_it(block);
+    node.read(read_it);
+}
+
+void btree::write_node(far_offset_ptr offset, btree_node& node)
+{
+    mark_written(offset);
+    branch_cache_.erase_node(offset);
+    if (buffer_writes_)
+    {
+        std::lock_guard lock(dirty_nodes_mutex_);
+        auto& block = dirty_nodes_[std::tuple(offset.get_file_id(), offset.get_offset())];
+        block.resize(block_size);
+        span_iterator write_it(block);
+        node.write(write_it);
+        return;
+    }
+
+    auto write_it = cache_.get_iterator(offset);
+    node.write(write_it);
+}
+
+// write the nodes buffered for the open transaction, in file order
+void btree::flush_dirty_nodes()
+{
+    std::lock_guard lock(dirty_nodes_mutex_);
+    for (auto& [position, block] : dirty_nodes_)
+    {
+        cache_.write_bytes(std::get<0>(position), std::get<1>(position), block);
+    }
+    dirty_nodes_.clear();
+}
+
+void btree::set_buffer_writes(bool buffer_writes)
+{
+    if (!buffer_writes)
+    {
+        write_latch latch(*this);
+        flush_dirty_nodes();
+    }
+    buffer_writes_ = buffer_writes;
+}
+
+// the key a parent holds for node, which follows left_node. A leaf can be told apart from its neighbour by a
+// shortened key, while a branch's first key already separates it
+std::vector<uint8_t> btree::get_child_key(btree_node& left_node, btree_node& node)
+{
+    if (!node.is_leaf())
+    {
+        return node.get_key_at(0);
+    }
+
+    auto left_key = left_node.get_key_at(left_node.get_entry_count() - 1);
+    auto right_key = node.get_key_at(0);
+    return get_separator(left_key, right_key);
+}
+
+// the shortest prefix of right_key, padded with zeros, that still sorts after left_key. Branches only need a key that
+// falls between the two nodes it separates, and the zeros compress away when the branch is written
+std::vector<uint8_t> btree::get_separator(std::span<uint8_t> left_key, std::span<uint8_t> right_key)
+{
+    std::vector<uint8_t> result(right_key.begin(), right_key.end());
+    if (!byte_comparable_keys_)
+    {
+        return result;
+    }
+
+    auto mismatch = std::mismatch(left_key.begin(), left_key.end(), right_key.begin(), right_key.end());
+    size_t length = std::distance(right_key.begin(), mismatch.second);
+    if (length < result.size())
+    {
+        std::fill(result.begin() + length + 1, result.end(), 0);
+    }
+    return result;
+}
+
+// the first entry of a branch on the left edge of the tree has nothing to its left, so any key that sorts no later than
+// its child's keys will do. Cutting it down to the prefix it shares with the second entry keeps the tree's first key
+// from limiting how well the branches along that edge compress
+void btree::lower_first_key(btree_node& node)
+{
+    if (!byte_comparable_keys_ || node.get_entry_count() < 2)
+    {
+        return;
+    }
+
+    auto first_key = node.get_key_at(0);
+    auto second_key = node.get_key_at(1);
+    auto mismatch = std::mismatch(first_key.begin(), first_key.end(), second_key.begin(), second_key.end());
+    std::fill(mismatch.first, first_key.end(), 0);
+    node.update_branch_entry(0, first_key, node.get_branch_value_at(0));
+}
+
+// a child written back after changes below it keeps the separator its parent already holds while that still sorts
+// no later than the child's first key. Entries only reach a child when they sort at or after its separator
+void btree::keep_separator(std::span<uint8_t> separator, child_reference& first_child)
+{
+    if (compare_keys(separator, first_child.key) <= 0)
+    {
+        first_child.key.assign(separator.begin(), separator.end());
+    }
+}
+
+// write a modified node, copying it if it belongs to an older transaction and splitting it into
+// as many evenly filled nodes as it needs. Returns the first key and offset of each written node
+std::vector<btree::child_reference> btree::write_split_node(filesize_t transaction_id, far_offset_ptr offset, btree_node& node)
+{
+    if (!offset || node.get_transaction_id() != transaction_id)
+    {
+        offset = allocator_.allocate_block(transaction_id);
+        node.set_transaction_id(transaction_id);
+    }
+
+    uint32_t count = node.get_entry_count();
+    uint32_t capacity = node.get_capacity();
+    uint32_t node_count = std::max<uint32_t>((count + capacity - 1) / capacity, 1);
+
+    std::vector<std::shared_ptr<btree_node>> tail_nodes;
+    for (uint32_t n = node_count - 1; n > 0; n--)
+    {
+        auto tail_node = std::make_shared<btree_node>(*this);
+        node.split(*tail_node, get_split_position(count, n, node_count));
+        tail_node->set_transaction_id(transaction_id);
+        tail_nodes.push_back(tail_node);
+    }
+
+    // the capacity is an average, so entries that compress unevenly can still leave a piece too large for its
+    // block. Halve those pieces until each one fits
+    std::vector<btree_node*> pieces{ &node };
+    for (auto it = tail_nodes.rbegin(); it != tail_nodes.rend(); it++)
+    {
+        pieces.push_back(it->get());
+    }
+    for (size_t n = 0; n < pieces.size(); n++)
+    {
+        while (pieces[n]->should_split() && pieces[n]->get_entry_count() > 1)
+        {
+            auto tail_node = std::make_shared<btree_node>(*this);
+            pieces[n]->split(*tail_node);
+            tail_node->set_transaction_id(transaction_id);
+            tail_nodes.push_back(tail_node);
+            pieces.insert(pieces.begin() + n + 1, tail_node.get());
+        }
+    }
+
+    std::vector<child_reference> result;
+    write_node(offset, node);
+    result.push_back({ node.get_key_at(0), offset, node.get_entry_count() });
+
+    for (size_t n = 1; n < pieces.size(); n++)
+    {
+        auto tail_offset = allocator_.allocate_block(transaction_id);
+        write_node(tail_offset, *pieces[n]);
+        result.push_back({ get_child_key(*pieces[n - 1], *pieces[n]), tail_offset, pieces[n]->get_entry_count() });
+    }
+    return result;
+}
+
+void btree::upsert_leaf_entries(btree_node& leaf, std::span<batch_entry> entries)
+{
+    // entries are sorted, so the insert position only ever moves forward
+    uint32_t position = 0;
+    for (auto& batch_entry : entries)
+    {
+        auto count = leaf.get_entry_count();
+        int cmp = -1;
+        while (position < count)
+        {
+            auto key = leaf.get_key_at(position);
+            cmp = compare_keys(key, batch_entry.key);
+            if (cmp >= 0)
+            {
+                break;
+            }
+            position++;
+        }
+
+        if (position < count && cmp == 0)
+        {
+            leaf.update_leaf_entry(position, batch_entry.entry);
+        }
+        else
+        {
+            leaf.insert_leaf_entry(position, batch_entry.entry);
+        }
+        position++;
+    }
+}
+
+std::vector<btree::child_reference> btree::internal_upsert_batch(filesize_t transaction_id, far_offset_ptr offset, std::span<batch_entry> entries)
+{
+    btree_node node(*this);
+    read_node(offset, node);
+
+    if (node.is_leaf())
+    {
+        upsert_leaf_entries(node, entries);
+        return write_split_node(transaction_id, offset, node);
+    }
+
+    // partition the entries between the children, child n receives keys below the key of child n + 1
+    uint32_t count = node.get_entry_count();
+    std::vector<size_t> range_begin(count + 1, entries.size());
+    size_t position = 0;
+    for (uint32_t n = 0; n < count; n++)
+    {
+        range_begin[n] = position;
+        if ((n + 1) < count)
+        {
+            auto next_key = node.get_key_at(n + 1);
+            while (position < entries.size() && compare_keys(entries[position].key, next_key) < 0)
+            {
+                position++;
+            }
+        }
+        else
+        {
+            position = entries.size();
+        }
+    }
+
+    // visit the children right to left so that inserting split children does not move the ones still to visit
+    bool changed = false;
+    for (uint32_t n = count; n > 0; n--)
+    {
+        auto child = n - 1;
+        auto child_entries = entries.subspan(range_begin[child], range_begin[child + 1] - range_begin[child]);
+        if (child_entries.empty())
+        {
+            continue;
+        }
+
+        auto child_offset = node.get_branch_value_at(child);
+        auto child_key = node.get_key_at(child);
+        auto children = internal_upsert_batch(transaction_id, child_offset, child_entries);
+        keep_separator(child_key, children.front());
+
+        if (children.size() == 1 && children.front().offset == child_offset && children.front().key == child_key)
+        {
+            continue; // the child was modified in place, this node does not need to change
+        }
+
+        node.update_branch_entry(child, children.front().key, children.front().offset);
+        for (size_t c = 1; c < children.size(); c++)
+        {
+            node.insert_branch_entry((int)(child + c), children[c].key, children[c].offset);
+        }
+        changed = true;
+    }
+
+    if (!changed)
+    {
+        return { { node.get_key_at(0), offset } };
+    }
+    return write_split_node(transaction_id, offset, node);
+}
+
+void btree::upsert_batch(filesize_t transaction_id, const std::vector<std::vector<uint8_t>>& entries)
+{
+    write_latch latch(*this);
+    check_writable(transaction_id);
+    if (entries.empty())
+    {
+        return;
+    }
+    invalidate_rightmost_path();
+
+    auto entry_size = get_key_size() + get_value_size();
+    std::vector<batch_entry> batch;
+    batch.reserve(entries.size());
+    for (const auto& entry : entries)
+    {
+        if (entry.size() != entry_size)
+        {
+            throw object_db_exception("batch entry does not match the B-tree entry size");
+        }
+        std::vector<uint8_t> copy = entry;
+        batch.push_back({ derive_key_from_entry(copy), copy });
+    }
+
+    // sort by key, when a key is repeated the last entry in the batch wins
+    std::vector<size_t> order(batch.size());
+    for (size_t n = 0; n < order.size(); n++)
+    {
+        order[n] = n;
+    }
+    std::stable_sort(order.begin(), order.end(), [this, &batch](size_t a, size_t b) {
+        return compare_keys(batch[a].key, batch[b].key) < 0;
+    });
+
+    std::vector<batch_entry> unique_batch;
+    unique_batch.reserve(batch.size());
+    for (auto n : order)
+    {
+        if (!unique_batch.empty() && compare_keys(unique_batch.back().key, batch[n].key) == 0)
+        {
+            unique_batch.back() = std::move(batch[n]);
+        }
+        else
+        {
+            unique_batch.push_back(std::move(batch[n]));
+        }
+    }
+
+    std::span<batch_entry> remaining(unique_batch);
+    while (!remaining.empty())
+    {
+        auto chunk_size = std::min(remaining.size(), max_batch_chunk);
+        upsert_batch_chunk(transaction_id, remaining.first(chunk_size));
+        remaining = remaining.subspan(chunk_size);
+    }
+}
+
+void btree::upsert_batch_chunk(filesize_t transaction_id, std::span<batch_entry> entries)
+{
+    std::vector<child_reference> children;
+    if (!check_offset())
+    {
+        btree_node leaf(*this);
+        leaf.init_leaf();
+        leaf.set_transaction_id(transaction_id);
+        leaf.set_key_size(get_key_size());
+        leaf.set_value_size(get_value_size());
+
+        upsert_leaf_entries(leaf, entries);
+        children = write_split_node(transaction_id, far_offset_ptr(), leaf);
+    }
+    else
+    {
+        children = internal_upsert_batch(transaction_id, offset_, entries);
+    }
+
+    // the root split, add branch levels until a single node remains
+    while (children.size() > 1)
+    {
+        btree_node new_root(*this);
+        new_root.init_root();
+        new_root.set_transaction_id(transaction_id);
+        new_root.set_key_size(get_key_size());
+        new_root.set_value_size(far_offset_ptr::get_compact_size());
+
+        for (size_t n = 0; n < children.size(); n++)
+        {
+            new_root.insert_branch_entry((int)n, children[n].key, children[n].offset);
+        }
+        lower_first_key(new_root);
+        children = write_split_node(transaction_id, far_offset_ptr(), new_root);
+    }
+
+    offset_ = children.front().offset;
+}
+
+btree_vector_entry_source::btree_vector_entry_source(const std::vector<std::vector<uint8_t>>& entries) :
+    entries_(entries)
+{
+}
+
+bool btree_vector_entry_source::next(std::vector<uint8_t>& entry)
+{
+    if (position_ >= entries_.size())
+    {
+        return false;
+    }
+    entry = entries_[position_];
+    position_++;
+    return true;
+}
+
+std::shared_ptr<btree_node> btree::create_bulk_load_node(filesize_t transaction_id, size_t level)
+{
+    auto node = std::make_shared<btree_node>(*this);
+    if (level == 0)
+    {
+        node->init_leaf();
+        node->set_key_size(get_key_size());
+        node->set_value_size(get_value_size());
+    }
+    else
+    {
+        node->init_root();
+        node->set_key_size(get_key_size());
+        node->set_value_size(far_offset_ptr::get_compact_size());
+    }
+    node->set_transaction_id(transaction_id);
+    return node;
+}
+
+uint16_t btree::get_bulk_load_count(btree_node& node, double fill_factor)
+{
+    auto capacity = node.get_capacity();
+    auto count = (uint16_t)(capacity * fill_factor);
+
+    // branch nodes with a single child are degenerate, so never pack fewer than two entries
+    count = std::max<uint16_t>(count, 2);
+    return std::min<uint16_t>(count, capacity);
+}
+
+void btree::bulk_load_write(filesize_t transaction_id, std::vector<bulk_load_level>& levels, size_t level, btree_node& node, double fill_factor)
+{
+    if (!node.is_leaf() && !levels[level].has_written)
+    {
+        lower_first_key(node);
+    }
+
+    auto node_offset = allocator_.allocate_block(transaction_id);
+    write_node(node_offset, node);
+
+    // leaves are separated from the one written before them by the shortest key that tells them apart
+    auto key = node.get_key_at(0);
+    if (node.is_leaf())
+    {
+        if (levels[level].has_written)
+        {
+            key = get_separator(levels[level].last_key, key);
+        }
+
+        levels[level].last_key = node.get_key_at(node.get_entry_count() - 1);
+    }
+    levels[level].has_written = true;
+
+    bulk_load_add(transaction_id, levels, level + 1, key, node_offset, fill_factor);
+}
+
+void btree::bulk_load_add(filesize_t transaction_id, std::vector<bulk_load_level>& levels, size_t level, std::span<uint8_t> key, far_offset_ptr offset, double fill_factor)
+{
+    if (levels.size() <= level)
+    {
+        levels.emplace_back();
+    }
+
+    if (!levels[level].current)
+    {
+        levels[level].current = create_bulk_load_node(transaction_id, level);
+    }
+
+    auto add = [&](btree_node& node)
+    {
+        if (level == 0)
+        {
+            node.insert_leaf_entry(node.get_entry_count(), key);
+        }
+        else
+        {
+            node.insert_branch_entry(node.get_entry_count(), key, offset);
+        }
+    };
+
+    // the entry is added before checking, as the capacity of a compressed node depends on what it holds
+    auto current = levels[level].current;
+    add(*current);
+    if (current->get_entry_count() > get_bulk_load_count(*current, fill_factor) || (current->should_split() && current->get_entry_count() > 1))
+    {
+        current->remove_key(current->get_entry_count() - 1);
+
+        // the current node is full, so the held back node can be written (this may add a level above)
+        auto pending = levels[level].pending;
+        if (pending)
+        {
+            bulk_load_write(transaction_id, levels, level, *pending, fill_factor);
+        }
+        levels[level].pending = current;
+        current = create_bulk_load_node(transaction_id, level);
+        levels[level].current = current;
+        add(*current);
+    }
+}
+
+void btree::bulk_load(filesize_t transaction_id, btree_entry_source& source, double fill_factor)
+{
+    write_latch latch(*this);
+    check_writable(transaction_id);
+    if (check_offset())
+    {
+        throw object_db_exception("bulk load requires an empty B-tree");
+    }
+
+    if (fill_factor <= 0.0 || fill_factor > 1.0)
+    {
+        throw object_db_exception("bulk load fill factor must be greater than 0 and no more than 1");
+    }
+
+    invalidate_rightmost_path();
+
+    std::vector<bulk_load_level> levels;
+    std::vector<uint8_t> entry;
+    std::vector<uint8_t> previous_key;
+    bool first = true;
+
+    auto entry_size = get_key_size() + get_value_size();
+    while (source.next(entry))
+    {
+        if (entry.size() != entry_size)
+        {
+            throw object_db_exception("bulk load entry does not match the B-tree entry size");
+        }
+
+        auto key = derive_key_from_entry(entry);
+        if (!first && compare_keys(previous_key, key) >= 0)
+        {
+            throw object_db_exception("bulk load entries must be sorted by key without duplicates");
+        }
+        first = false;
+        previous_key = key;
+
+        // leaf entries are passed as the key, leaves have no child offset
+        bulk_load_add(transaction_id, levels, 0, entry, far_offset_ptr(), fill_factor);
+    }
+
+    // flush the partially filled nodes, bottom up. Each flush may add a new level above
+    for (size_t level = 0; level < levels.size(); level++)
+    {
+        auto pending = levels[level].pending;
+        auto current = levels[level].current;
+        if (current && current->get_entry_count() == 0)
+        {
+            current.reset();
+        }
+
+        bool is_top = (level + 1) == levels.size();
+        if (is_top && !levels[level].has_written && !(pending && current))
+        {
+            // a single node holds the whole level, this is the root
+            auto root = pending ? pending : current;
+            if (!root)
+            {
+                return; // the source was empty
+            }
+
+            offset_ = allocator_.allocate_block(transaction_id);
+            write_node(offset_, *root);
+            return;
+        }
+
+        if (pending && current && current->should_merge())
+        {
+            // the last node of the level is underfull, share the entries evenly with the node before it
+            auto pending_count = pending->get_entry_count();
+            pending->merge(*current);
+            pending->split(*current);
+            if (pending->should_split() || current->should_split())
+            {
+                // the halves compress worse than the originals did, so keep the nodes as they were
+                pending->merge(*current);
+                pending->split(*current, pending_count);
+            }
+            current->set_transaction_id(transaction_id);
+        }
+
+        if (pending)
+        {
+            bulk_load_write(transaction_id, levels, level, *pending, fill_factor);
+        }
+        if (current)
+        {
+            bulk_load_write(transaction_id, levels, level, *current, fill_factor);
+        }
+    }
+}
 
 std::vector<uint8_t> btree::derive_key_from_entry(std::span<uint8_t> entry)
 {
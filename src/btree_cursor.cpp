@@ -0,0 +1,116 @@
+#include "../include/btree_cursor.hpp"
+
+btree_cursor::btree_cursor(btree& tree) : tree_(tree)
+{
+}
+
+// a seek can land after the last entry of a leaf, so step forward until the position holds an entry
+std::shared_ptr<btree_node> btree_cursor::settle(btree::node_read_set& reads, std::shared_ptr<btree_node> leaf, std::vector<btree_node_info>& path)
+{
+    while (leaf && path.back().btree_position >= leaf->get_entry_count())
+    {
+        leaf = tree_.move_to_next_leaf(reads, path);
+    }
+    return leaf;
+}
+
+// the reads work on a copy of the path, as an optimistic read that has to go again starts from the same place
+bool btree_cursor::position(const std::function<std::shared_ptr<btree_node>(btree::node_read_set& reads, std::vector<btree_node_info>& path)>& read)
+{
+    std::vector<btree_node_info> path;
+    leaf_ = tree_.read_optimistically([&](btree::node_read_set& reads) {
+        path = path_;
+        return read(reads, path);
+    });
+    path_ = std::move(path);
+
+    if (!leaf_)
+    {
+        path_.clear();
+        return false;
+    }
+
+    path_.back().is_found = true;
+    return true;
+}
+
+bool btree_cursor::seek_first()
+{
+    return position([this](btree::node_read_set& reads, std::vector<btree_node_info>& path) {
+        return settle(reads, tree_.load_edge_path(reads, false, path), path);
+    });
+}
+
+bool btree_cursor::seek_last()
+{
+    return position([this](btree::node_read_set& reads, std::vector<btree_node_info>& path) {
+        return settle(reads, tree_.load_edge_path(reads, true, path), path);
+    });
+}
+
+bool btree_cursor::seek(std::span<uint8_t> key)
+{
+    return position([this, &key](btree::node_read_set& reads, std::vector<btree_node_info>& path) {
+        return settle(reads, tree_.load_leaf_path(reads, key, path), path);
+    });
+}
+
+bool btree_cursor::next()
+{
+    if (!leaf_)
+    {
+        return false;
+    }
+
+    auto& info = path_.back();
+    if ((info.btree_position + 1) < leaf_->get_entry_count())
+    {
+        info.btree_position++;
+        return true;
+    }
+
+    return position([this](btree::node_read_set& reads, std::vector<btree_node_info>& path) {
+        return settle(reads, tree_.move_to_next_leaf(reads, path), path);
+    });
+}
+
+bool btree_cursor::prev()
+{
+    if (!leaf_)
+    {
+        return false;
+    }
+
+    auto& info = path_.back();
+    if (info.btree_position > 0)
+    {
+        info.btree_position--;
+        return true;
+    }
+
+    return position([this](btree::node_read_set& reads, std::vector<btree_node_info>& path) {
+        return tree_.move_to_prev_leaf(reads, path);
+    });
+}
+
+std::span<uint8_t> btree_cursor::get_entry()
+{
+    if (!leaf_)
+    {
+        throw object_db_exception("cursor is at end, cannot get entry.");
+    }
+    return leaf_->get_entry(path_.back().btree_position);
+}
+
+btree_iterator btree_cursor::get_iterator() const
+{
+    if (!leaf_)
+    {
+        return tree_.end();
+    }
+
+    btree_iterator result;
+    result.btree_offset = tree_.get_offset();
+    result.path = path_;
+    return result;
+}
@@ -8,35 +8,417 @@ bool btree_node::is_leaf() const
     return (data[flags_offset] & is_leaf_bit_mask) != 0;
 }
 
-btree_node::find_result btree_node::find_key(std::span<uint8_t> key)
+bool btree_node::has_key_array() const
+{
+    return (data[flags_offset] & key_array_bit_mask) != 0;
+}
+
+bool btree_node::is_compressible() const
+{
+    if (!is_leaf())
+    {
+        return true;
+    }
+    return (data[flags_offset] & leaf_compression_bit_mask) != 0 && !has_key_array();
+}
+
+// find the prefix shared by every entry and how many bytes of each remain once it and any trailing zeros are removed
+btree_node::compression btree_node::get_compression(const metadata& md)
+{
+    compression result;
+    result.part_size = is_leaf() ? md.key_size + md.value_size : md.key_size;
+    result.tail_size = is_leaf() ? 0 : md.value_size;
+    result.prefix_size = 0;
+    result.stored_size = result.part_size;
+
+    if (!is_compressible() || md.entry_count == 0)
+    {
+        return result;
+    }
+
+    size_t pair_size = md.key_size + md.value_size;
+    const uint8_t* first = data.data() + md.header_size;
+    size_t prefix_size = result.part_size;
+    size_t significant_size = 0;
+    for (size_t n = 0; n < md.entry_count; n++)
+    {
+        const uint8_t* entry = first + n * pair_size;
+        for (size_t i = 0; i < prefix_size; i++)
+        {
+            if (entry[i] != first[i])
+            {
+                prefix_size = i;
+                break;
+            }
+        }
+
+        size_t length = result.part_size;
+        while (length > significant_size && entry[length - 1] == 0)
+        {
+            length--;
+        }
+        significant_size = std::max(significant_size, length);
+    }
+
+    result.prefix_size = prefix_size;
+    result.stored_size = std::max(significant_size, prefix_size) - prefix_size;
+    return result;
+}
+
+size_t btree_node::get_compressed_size(const metadata& md, const compression& c)
+{
+    return md.header_size + compression_header_size + c.prefix_size + md.entry_count * (c.stored_size + c.tail_size);
+}
+
+// the size of the slotted form, where each entry after the shared prefix is stored as a cell of its own
+size_t btree_node::get_slotted_size(const metadata& md, const compression& c)
+{
+    size_t pair_size = md.key_size + md.value_size;
+    size_t size = md.header_size + compression_header_size + c.prefix_size + md.entry_count * slot_size;
+    for (size_t n = 0; n < md.entry_count; n++)
+    {
+        std::span<uint8_t> entry(data.data() + md.header_size + n * pair_size, pair_size);
+        size += get_cell_size(entry.subspan(c.prefix_size));
+    }
+    return size;
+}
+
+// the length of the literal starting at position, and in zero_count the zeros after it that the run skips
+size_t btree_node::next_cell_run(std::span<uint8_t> part, size_t position, size_t& zero_count)
+{
+    size_t end = position;
+    while (end < part.size())
+    {
+        if (part[end] != 0)
+        {
+            end++;
+            continue;
+        }
+
+        size_t zeros_end = end;
+        while (zeros_end < part.size() && part[zeros_end] == 0)
+        {
+            zeros_end++;
+        }
+        if (zeros_end - end >= min_zero_run || zeros_end == part.size())
+        {
+            zero_count = zeros_end - end;
+            return end - position;
+        }
+        end = zeros_end;
+    }
+
+    zero_count = 0;
+    return end - position;
+}
+
+size_t btree_node::get_cell_size(std::span<uint8_t> part)
+{
+    size_t size = 0;
+    size_t position = 0;
+    while (position < part.size())
+    {
+        size_t zero_count = 0;
+        size_t literal_size = next_cell_run(part, position, zero_count);
+        size += 2 * sizeof(uint16_t) + literal_size;
+        position += literal_size + zero_count;
+    }
+    return size;
+}
+
+void btree_node::write_cell(std::span<uint8_t> part, span_iterator& it)
+{
+    size_t position = 0;
+    while (position < part.size())
+    {
+        size_t zero_count = 0;
+        size_t literal_size = next_cell_run(part, position, zero_count);
+        write_uint16(it, (uint16_t)literal_size);
+        write_span(it, part.subspan(position, literal_size));
+        write_uint16(it, (uint16_t)zero_count);
+        position += literal_size + zero_count;
+    }
+}
+
+// expand a cell into part, which must already be zeroed
+void btree_node::read_cell(std::span<uint8_t> cell, std::span<uint8_t> part)
+{
+    span_iterator it(cell);
+    size_t consumed = 0;
+    size_t position = 0;
+    while (position < part.size())
+    {
+        consumed += sizeof(uint16_t);
+        if (consumed > cell.size())
+        {
+            throw object_db_exception("slotted btree node cell is corrupted");
+        }
+        size_t literal_size = read_uint16(it);
+
+        consumed += literal_size + sizeof(uint16_t);
+        if (consumed > cell.size() || position + literal_size > part.size())
+        {
+            throw object_db_exception("slotted btree node cell is corrupted");
+        }
+        read_span(it, part.subspan(position, literal_size));
+        position += literal_size + read_uint16(it);
+    }
+
+    if (position != part.size() || consumed != cell.size())
+    {
+        throw object_db_exception("slotted btree node cell is corrupted");
+    }
+}
+
+// leaves are stored plain or slotted, their entries are never padded out to the widest one
+size_t btree_node::get_stored_size()
 {
     auto md = get_metadata();
-    bool found = false;
-    int n = 0;
-    for (;;)
+    size_t size = md.header_size + md.entry_count * get_entry_stride(md);
+    if (is_compressible() && md.entry_count > 0)
     {
-        if (n >= md.entry_count)
+        auto c = get_compression(md);
+        size = std::min(size, get_slotted_size(md, c));
+        if (!is_leaf())
         {
-            break;
+            size = std::min(size, get_compressed_size(md, c));
         }
+    }
+    return size;
+}
 
-        auto key_at_n = get_key_at(n);
-        int cmp = compare_keys(key, key_at_n);
-        if (cmp < 0)
+// write the node into a block, compressed when that makes it smaller
+void btree_node::encode(std::vector<uint8_t>& block)
+{
+    auto md = get_metadata();
+    size_t size = md.header_size + md.entry_count * get_entry_stride(md);
+    if (is_compressible() && md.entry_count > 0)
+    {
+        auto c = get_compression(md);
+        auto compressed_size = is_leaf() ? size : get_compressed_size(md, c);
+        if (get_slotted_size(md, c) < std::min(size, compressed_size))
         {
-            break;
+            encode_slotted(md, c, block);
+            return;
         }
-        else if (cmp == 0)
+
+        if (compressed_size < size)
         {
-            found = true;
-            break;
+            if (compressed_size > block.size())
+            {
+                throw object_db_exception("btree node is larger than a block and must be split before writing");
+            }
+
+            std::copy(data.begin(), data.begin() + md.header_size, block.begin());
+            block[flags_offset] |= compressed_bit_mask;
+
+            span_iterator header_it({ block.begin() + md.header_size, compression_header_size });
+            write_uint16(header_it, (uint16_t)c.prefix_size);
+            write_uint16(header_it, (uint16_t)c.stored_size);
+
+            size_t pair_size = md.key_size + md.value_size;
+            auto destination = block.begin() + md.header_size + compression_header_size;
+            auto first = data.begin() + md.header_size;
+            destination = std::copy(first, first + c.prefix_size, destination);
+            for (size_t n = 0; n < md.entry_count; n++)
+            {
+                auto entry = first + n * pair_size;
+                destination = std::copy(entry + c.prefix_size, entry + c.prefix_size + c.stored_size, destination);
+                destination = std::copy(entry + c.part_size, entry + c.part_size + c.tail_size, destination);
+            }
+            return;
         }
-        n++;
     }
-    find_result result;
-    result.position = n;
-    result.found = found;
-    return result;
+
+    if (size > block.size())
+    {
+        throw object_db_exception("btree node is larger than a block and must be split before writing");
+    }
+    std::copy(data.begin(), data.end(), block.begin());
+}
+
+void btree_node::encode_slotted(const metadata& md, const compression& c, std::vector<uint8_t>& block)
+{
+    size_t pair_size = md.key_size + md.value_size;
+    size_t slots_offset = md.header_size + compression_header_size + c.prefix_size;
+    size_t cells_offset = slots_offset + md.entry_count * slot_size;
+
+    std::vector<size_t> cell_sizes(md.entry_count);
+    size_t cells_size = 0;
+    for (size_t n = 0; n < md.entry_count; n++)
+    {
+        std::span<uint8_t> entry(data.data() + md.header_size + n * pair_size, pair_size);
+        cell_sizes[n] = get_cell_size(entry.subspan(c.prefix_size));
+        cells_size += cell_sizes[n];
+    }
+
+    if (cells_offset + cells_size > block.size())
+    {
+        throw object_db_exception("btree node is larger than a block and must be split before writing");
+    }
+
+    std::copy(data.begin(), data.begin() + md.header_size, block.begin());
+    block[flags_offset] |= compressed_bit_mask | slotted_bit_mask;
+
+    span_iterator header_it({ block.begin() + md.header_size, compression_header_size });
+    write_uint16(header_it, (uint16_t)c.prefix_size);
+    write_uint16(header_it, (uint16_t)cells_size);
+
+    auto first = data.begin() + md.header_size;
+    std::copy(first, first + c.prefix_size, block.begin() + md.header_size + compression_header_size);
+
+    span_iterator slot_it({ block.begin() + slots_offset, md.entry_count * slot_size });
+    span_iterator cell_it({ block.begin() + cells_offset, cells_size });
+    size_t cell_end = 0;
+    for (size_t n = 0; n < md.entry_count; n++)
+    {
+        std::span<uint8_t> entry(data.data() + md.header_size + n * pair_size, pair_size);
+        write_cell(entry.subspan(c.prefix_size), cell_it);
+        cell_end += cell_sizes[n];
+        write_uint16(slot_it, (uint16_t)cell_end);
+    }
+}
+
+size_t btree_node::get_compressed_length(std::span<uint8_t> compression_header)
+{
+    span_iterator header_it(compression_header);
+    size_t prefix_size = read_uint16(header_it);
+    size_t stored_size = read_uint16(header_it);
+
+    auto md = get_metadata();
+    if ((data[flags_offset] & slotted_bit_mask) != 0)
+    {
+        return prefix_size + md.entry_count * slot_size + stored_size;
+    }
+    size_t tail_size = is_leaf() ? 0 : md.value_size;
+    return prefix_size + md.entry_count * (stored_size + tail_size);
+}
+
+// expand a compressed block, already read into the header, back to the in memory layout
+void btree_node::decode(std::span<uint8_t> compression_header, std::span<uint8_t> stored)
+{
+    span_iterator header_it(compression_header);
+    size_t prefix_size = read_uint16(header_it);
+    size_t stored_size = read_uint16(header_it);
+
+    bool slotted = (data[flags_offset] & slotted_bit_mask) != 0;
+    data[flags_offset] &= ~(compressed_bit_mask | slotted_bit_mask);
+    auto md = get_metadata();
+    if (slotted)
+    {
+        decode_slotted(md, prefix_size, stored);
+        return;
+    }
+
+    size_t part_size = is_leaf() ? md.key_size + md.value_size : md.key_size;
+    size_t tail_size = is_leaf() ? 0 : md.value_size;
+    if (prefix_size + stored_size > part_size)
+    {
+        throw object_db_exception("compressed btree node is corrupted");
+    }
+
+    data.resize(md.header_size);
+    data.resize(calculate_buffer_size(), 0);
+
+    size_t pair_size = md.key_size + md.value_size;
+    auto source = stored.begin();
+    auto prefix = source;
+    source += prefix_size;
+    for (size_t n = 0; n < md.entry_count; n++)
+    {
+        auto entry = data.begin() + md.header_size + n * pair_size;
+        std::copy(prefix, prefix + prefix_size, entry);
+        std::copy(source, source + stored_size, entry + prefix_size);
+        source += stored_size;
+        std::copy(source, source + tail_size, entry + part_size);
+        source += tail_size;
+    }
+}
+
+void btree_node::decode_slotted(const metadata& md, size_t prefix_size, std::span<uint8_t> stored)
+{
+    size_t pair_size = md.key_size + md.value_size;
+    size_t cells_offset = prefix_size + md.entry_count * slot_size;
+    if (prefix_size > pair_size || cells_offset > stored.size())
+    {
+        throw object_db_exception("slotted btree node is corrupted");
+    }
+
+    data.resize(md.header_size);
+    data.resize(calculate_buffer_size(), 0);
+
+    auto cells = stored.subspan(cells_offset);
+    span_iterator slot_it(stored.subspan(prefix_size, md.entry_count * slot_size));
+    size_t cell_start = 0;
+    for (size_t n = 0; n < md.entry_count; n++)
+    {
+        size_t cell_end = read_uint16(slot_it);
+        if (cell_end < cell_start || cell_end > cells.size())
+        {
+            throw object_db_exception("slotted btree node is corrupted");
+        }
+
+        std::span<uint8_t> entry(data.data() + md.header_size + n * pair_size, pair_size);
+        std::copy(stored.begin(), stored.begin() + prefix_size, entry.begin());
+        read_cell(cells.subspan(cell_start, cell_end - cell_start), entry.subspan(prefix_size));
+        cell_start = cell_end;
+    }
+}
+
+// the bytes each entry occupies, including its copy in the key array
+size_t btree_node::get_entry_stride(const metadata& md)
+{
+    return md.key_array_size + md.key_size + md.value_size;
+}
+
+size_t btree_node::get_entries_offset(const metadata& md)
+{
+    return md.header_size + md.entry_count * md.key_array_size;
+}
+
+std::span<uint8_t> btree_node::get_array_key(const metadata& md, size_t n)
+{
+    return std::span<uint8_t>(data.data() + md.header_size + n * md.key_array_size, md.key_array_size);
+}
+
+void btree_node::set_array_key(const metadata& md, size_t n, std::span<uint8_t> entry)
+{
+    btree_.get_row_traits()->get_key_traits()->copy_data(entry, get_array_key(md, n));
+}
+
+// binary search for the first entry whose key is greater than or equal to key
+btree_node::find_result btree_node::find_key(std::span<uint8_t> key)
+{
+    auto md = get_metadata();
+    uint32_t low = 0;
+    uint32_t high = (uint32_t)md.entry_count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        int cmp;
+        if (md.key_array_size > 0)
+        {
+            cmp = compare_keys(key, get_array_key(md, middle));
+        }
+        else
+        {
+            auto key_at_middle = get_key_at(middle);
+            cmp = compare_keys(key, key_at_middle);
+        }
+        if (cmp == 0)
+        {
+            return find_result{ .position = middle, .found = true };
+        }
+        else if (cmp < 0)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    return find_result{ .position = low, .found = false };
 }
 
 int btree_node::compare_keys(std::span<uint8_t> key_a, std::span<uint8_t> key_b)
@@ -98,7 +480,28 @@ void btree_node::set_entry_count(uint16_t value_count)
     span_iterator value_count_iter(value_count_span);
     write_uint16(value_count_iter, value_count);
 
-    data.resize(md.header_size + (value_count * (md.key_size + md.value_size)));
+    auto new_size = md.header_size + (value_count * get_entry_stride(md));
+    if (md.key_array_size == 0 || value_count == md.entry_count)
+    {
+        data.resize(new_size);
+        return;
+    }
+
+    // the entries follow the key array, so they move whenever the key array changes length
+    size_t pair_size = md.key_size + md.value_size;
+    size_t old_offset = get_entries_offset(md);
+    size_t new_offset = md.header_size + value_count * md.key_array_size;
+    size_t kept_size = std::min<size_t>(md.entry_count, value_count) * pair_size;
+    if (new_offset > old_offset)
+    {
+        data.resize(new_size);
+        std::memmove(data.data() + new_offset, data.data() + old_offset, kept_size);
+    }
+    else
+    {
+        std::memmove(data.data() + new_offset, data.data() + old_offset, kept_size);
+        data.resize(new_size);
+    }
 }
 
 uint32_t btree_node::get_value_size()
@@ -118,24 +521,30 @@ void btree_node::set_value_size(uint32_t value_size)
 filesize_t btree_node::calculate_buffer_size()
 {
     auto md = get_metadata();
-    return md.entry_count * (md.key_size + md.value_size) + md.header_size;
+    return md.entry_count * get_entry_stride(md) + md.header_size;
 }
 
 filesize_t btree_node::calculate_entry_count_from_buffer_size()
 {
-    filesize_t key_size = get_key_size();
-    filesize_t value_size = get_value_size();
+    auto md = get_metadata();
 
     if (data.size() < get_header_size())
         throw object_db_exception("could not calculate buffer size");
 
     auto data_size = data.size() - get_header_size();
 
-    return data_size / (key_size + value_size);
+    return data_size / get_entry_stride(md);
 }
 
 std::vector<uint8_t> btree_node::get_key_at(int n)
 {
+    auto md = get_metadata();
+    if (md.key_array_size > 0)
+    {
+        auto key_span = get_array_key(md, n);
+        return std::vector<uint8_t>(key_span.begin(), key_span.end());
+    }
+
     auto entry_span = get_entry(n);
 
     if (is_leaf())
@@ -180,21 +589,90 @@ far_offset_ptr btree_node::get_branch_value_at(int n)
     auto span = std::span<uint8_t>(entry_span.begin() + key_size, value_size);
     span_iterator it{ span };
     far_offset_ptr result;
-    result.read(it);
+    if (value_size == far_offset_ptr::get_compact_size())
+    {
+        result.read_compact(it);
+    }
+    else
+    {
+        result.read(it);
+    }
     return result;
 }
 
+// a branch entry in this node's pointer format, widening the node first if the offset has no compact form
+std::vector<uint8_t> btree_node::make_branch_entry(std::span<uint8_t> key, far_offset_ptr offset)
+{
+    if (get_value_size() == far_offset_ptr::get_compact_size() && !offset.is_compactable())
+    {
+        widen_branch_values();
+    }
+
+    std::vector<uint8_t> new_entry(get_key_size() + get_value_size());
+    std::copy(key.begin(), key.end(), new_entry.begin());
+
+    span_iterator value_it({ new_entry.begin() + get_key_size(), new_entry.end() });
+    if (get_value_size() == far_offset_ptr::get_compact_size())
+    {
+        offset.write_compact(value_it);
+    }
+    else
+    {
+        offset.write(value_it);
+    }
+    return new_entry;
+}
+
+// rewrite every entry of a compact branch with full size pointers
+void btree_node::widen_branch_values()
+{
+    auto md = get_metadata();
+    std::vector<uint8_t> widened(data.begin(), data.begin() + md.header_size);
+    widened.reserve(md.header_size + md.entry_count * (md.key_size + far_offset_ptr::get_size()));
+
+    std::vector<uint8_t> value(far_offset_ptr::get_size());
+    for (size_t n = 0; n < md.entry_count; n++)
+    {
+        auto entry = get_entry((int)n);
+        widened.insert(widened.end(), entry.begin(), entry.begin() + md.key_size);
+
+        span_iterator value_it{ value };
+        get_branch_value_at((int)n).write(value_it);
+        widened.insert(widened.end(), value.begin(), value.end());
+    }
+
+    data = std::move(widened);
+    set_value_size(far_offset_ptr::get_size());
+}
+
+// entries are copied between nodes as they are stored, so two branches must agree on their pointer format first
+void btree_node::match_branch_values(btree_node& other_node)
+{
+    if (is_leaf() || get_value_size() == other_node.get_value_size())
+    {
+        return;
+    }
+
+    if (get_value_size() == far_offset_ptr::get_compact_size())
+    {
+        widen_branch_values();
+    }
+    else
+    {
+        other_node.widen_branch_values();
+    }
+}
+
 std::span<uint8_t> btree_node::get_entry(int n)
 {
-    filesize_t key_size = get_key_size();
-    filesize_t value_size = get_value_size();
+    auto md = get_metadata();
+    filesize_t key_size = md.key_size;
+    filesize_t value_size = md.value_size;
 
-    // Calculate the offset to the nth key-value pair
-    // Layout: [0] is_leaf (1 byte), [1-3] key_size (3 bytes), [4-7] value_size (4 bytes)
-    size_t header_size = get_header_size();
+    // Calculate the offset to the nth key-value pair, after the key array if there is one
     size_t pair_size = static_cast<size_t>(key_size + value_size);
 
-    size_t offset = header_size + n * pair_size;
+    size_t offset = get_entries_offset(md) + n * pair_size;
 
     if (offset + key_size > data.size())
         throw std::out_of_range("Key index out of range");
@@ -205,12 +683,37 @@ std::span<uint8_t> btree_node::get_entry(int n)
 
 bool btree_node::should_split()
 {
-    return data.size() > block_size;
+    // a node that fits uncompressed fits, so the compressed sizes are only worked out for full ones
+    auto md = get_metadata();
+    if (md.header_size + md.entry_count * get_entry_stride(md) <= block_size)
+    {
+        return false;
+    }
+    return get_stored_size() > block_size;
 }
 
 uint16_t btree_node::get_capacity(const metadata& md)
 {
-    return (block_size - md.header_size) / (md.key_size + md.value_size);
+    size_t capacity = (block_size - md.header_size) / get_entry_stride(md);
+    if (is_compressible() && md.entry_count > 0)
+    {
+        // judged by the entries already in the node, so a nearly empty node may claim more than it can hold
+        auto c = get_compression(md);
+        size_t compressed_entry_size = c.stored_size + c.tail_size;
+        size_t overhead = md.header_size + compression_header_size + c.prefix_size;
+        if (!is_leaf() && compressed_entry_size > 0 && overhead < block_size)
+        {
+            capacity = std::max(capacity, (block_size - overhead) / compressed_entry_size);
+        }
+
+        // and with cells, by their average size
+        size_t slotted_entry_size = (get_slotted_size(md, c) - overhead + md.entry_count - 1) / md.entry_count;
+        if (overhead < block_size)
+        {
+            capacity = std::max(capacity, (block_size - overhead) / slotted_entry_size);
+        }
+    }
+    return (uint16_t)std::min<size_t>(capacity, UINT16_MAX);
 }
 
 uint16_t btree_node::get_capacity()
@@ -227,6 +730,8 @@ bool btree_node::should_merge()
 
 void btree_node::merge(btree_node& other_node)
 {
+    match_branch_values(other_node);
+
     auto other_entry_count = other_node.get_entry_count();
 
     for (uint32_t a = 0; a < other_entry_count; a++)
@@ -241,9 +746,7 @@ void btree_node::merge(btree_node& other_node)
 bool btree_node::is_full()
 {
     auto md = get_metadata();
-    filesize_t key_size = md.key_size;
-    filesize_t value_size = md.value_size;
-    if ((data.size() + key_size + value_size) >= block_size)
+    if ((data.size() + get_entry_stride(md)) >= block_size)
     {
         return true;
     }
@@ -263,6 +766,7 @@ btree_node::metadata btree_node::get_metadata()
     result.key_size = key_size;
     result.value_size = value_size;
     result.entry_count = count;
+    result.key_array_size = has_key_array() ? key_size : 0;
 
     return result;
 }
@@ -271,15 +775,28 @@ void btree_node::internal_insert_entry(int position, std::span<uint8_t> entry)
 {
     auto md = get_metadata();
     size_t pair_size = static_cast<size_t>(md.key_size + md.value_size);
-    size_t offset = md.header_size + position * pair_size;
-    set_entry_count(md.entry_count + 1);
+    int old_count = md.entry_count;
+    set_entry_count(old_count + 1);
+    md.entry_count = old_count + 1;
+
+    if (md.key_array_size > 0)
+    {
+        std::memmove(
+            data.data() + md.header_size + (position + 1) * md.key_array_size,
+            data.data() + md.header_size + position * md.key_array_size,
+            (old_count - position) * md.key_array_size
+        );
+        set_array_key(md, position, entry);
+    }
+
+    size_t offset = get_entries_offset(md) + position * pair_size;
     // Move existing data at and after the insert position back by one pair_size
-    if (position < md.entry_count)
+    if (position < old_count)
     {
         std::memmove(
             data.data() + offset + pair_size,
             data.data() + offset,
-            (md.entry_count - position) * pair_size
+            (old_count - position) * pair_size
         );
     }
     std::span<uint8_t> destination(data.begin() + offset, pair_size);
@@ -288,11 +805,7 @@ void btree_node::internal_insert_entry(int position, std::span<uint8_t> entry)
 
 void btree_node::insert_branch_entry(int position, std::span<uint8_t> key, far_offset_ptr offset)
 {
-    std::vector<uint8_t> new_entry(key.size() + far_offset_ptr::get_size());
-    std::copy(key.begin(), key.end(), new_entry.begin());
-
-    span_iterator value_it({ new_entry.begin() + key.size(), new_entry.size() - key.size() });
-    offset.write(value_it);
+    auto new_entry = make_branch_entry(key, offset);
     internal_insert_entry(position, new_entry);
 }
 
@@ -305,7 +818,12 @@ void btree_node::internal_update_entry(int position, std::span<uint8_t> entry)
 {
     auto md = get_metadata();
     size_t pair_size = static_cast<size_t>(md.key_size + md.value_size);
-    size_t offset = md.header_size + position * pair_size;
+    size_t offset = get_entries_offset(md) + position * pair_size;
+
+    if (md.key_array_size > 0)
+    {
+        set_array_key(md, position, entry);
+    }
 
     std::span<uint8_t> destination(data.begin() + offset, pair_size);
     std::copy(entry.begin(), entry.end(), destination.begin());
@@ -313,16 +831,7 @@ void btree_node::internal_update_entry(int position, std::span<uint8_t> entry)
 
 void btree_node::update_branch_entry(int position, std::span<uint8_t> key, far_offset_ptr reference)
 {
-    std::vector<uint8_t> new_node_entry(get_key_size() + far_offset_ptr::get_size());
-    std::copy(key.begin(), key.end(), new_node_entry.begin());
-    std::span<uint8_t> new_value_span{
-        new_node_entry.begin() + get_key_size(),
-        new_node_entry.end()
-    };
-
-    auto new_entry_span_it = span_iterator{ new_value_span };
-    reference.write(new_entry_span_it);
-
+    auto new_node_entry = make_branch_entry(key, reference);
     internal_update_entry(position, new_node_entry);
 }
 
@@ -332,26 +841,86 @@ void btree_node::update_leaf_entry(int position, std::span<uint8_t> entry)
 }
 
 void btree_node::remove_key(int position)
+{
+    remove_keys(position, 1);
+}
+
+void btree_node::remove_keys(int position, int count)
 {
     auto md = get_metadata();
+    if (position < 0 || count < 0 || (size_t)(position + count) > md.entry_count)
+    {
+        throw object_db_exception("cannot remove entries past the end of a node");
+    }
+
+    if (md.key_array_size > 0 && (size_t)(position + count) < md.entry_count)
+    {
+        std::memmove(
+            data.data() + md.header_size + position * md.key_array_size,
+            data.data() + md.header_size + (position + count) * md.key_array_size,
+            (md.entry_count - position - count) * md.key_array_size
+        );
+    }
+
     size_t pair_size = static_cast<size_t>(md.key_size + md.value_size);
-    size_t offset = md.header_size + position * pair_size;
-    if (position < (md.entry_count - 1))
+    size_t offset = get_entries_offset(md) + position * pair_size;
+    if ((size_t)(position + count) < md.entry_count)
     {
         std::memmove(
             data.data() + offset,
-            data.data() + offset + pair_size,
-            (md.entry_count - position - 1) * pair_size
+            data.data() + offset + count * pair_size,
+            (md.entry_count - position - count) * pair_size
         );
     }
 
-    set_entry_count(md.entry_count - 1);
+    set_entry_count((uint16_t)(md.entry_count - count));
+}
+
+void btree_node::borrow_from_left(btree_node& left_node, uint32_t count)
+{
+    match_branch_values(left_node);
+
+    auto left_count = left_node.get_entry_count();
+    if (count > left_count)
+    {
+        throw object_db_exception("cannot borrow more entries than the left node holds");
+    }
+
+    for (uint32_t n = 0; n < count; n++)
+    {
+        internal_insert_entry(n, left_node.get_entry(left_count - count + n));
+    }
+    left_node.remove_keys(left_count - count, count);
+}
+
+void btree_node::borrow_from_right(btree_node& right_node, uint32_t count)
+{
+    match_branch_values(right_node);
+
+    if (count > right_node.get_entry_count())
+    {
+        throw object_db_exception("cannot borrow more entries than the right node holds");
+    }
+
+    for (uint32_t n = 0; n < count; n++)
+    {
+        internal_insert_entry(get_entry_count(), right_node.get_entry(n));
+    }
+    right_node.remove_keys(0, count);
 }
 
 void btree_node::init_leaf()
 {
-    data.resize(data_offset + get_header_size());
-    data[flags_offset] |= is_leaf_bit_mask; // Set the leaf bit
+    data.assign(get_header_size(), 0);
+    data[flags_offset] = is_leaf_bit_mask; // Set the leaf bit
+    if (btree_.get_leaf_key_array())
+    {
+        data[flags_offset] |= key_array_bit_mask;
+    }
+    else if (btree_.get_leaf_compression())
+    {
+        data[flags_offset] |= leaf_compression_bit_mask;
+    }
     set_key_size(0);
     set_value_size(0);
     set_entry_count(0);
@@ -360,7 +929,7 @@ void btree_node::init_leaf()
 
 void btree_node::init_root()
 {
-    data.resize(data_offset + get_header_size());
+    data.assign(get_header_size(), 0);
     set_key_size(0);
     set_value_size(0);
     set_entry_count(0);
@@ -370,10 +939,19 @@ void btree_node::init_root()
 void btree_node::split(btree_node& overflow_node)
 {
     // determine the median
+    auto count = get_entry_count();
+    split(overflow_node, (uint32_t)(count / 2));
+}
+
+void btree_node::split(btree_node& overflow_node, uint32_t half_way)
+{
     auto md = get_metadata();
     auto count = md.entry_count;
-    auto half_way = (uint32_t) (count / 2);
-    overflow_node.data.resize(overflow_node.get_header_size());
+    if (half_way > count)
+    {
+        throw object_db_exception("cannot split a node past its last entry");
+    }
+    overflow_node.data.assign(overflow_node.get_header_size(), 0);
     overflow_node.data[flags_offset] = data[flags_offset];
     overflow_node.set_key_size(md.key_size);
     overflow_node.set_value_size(md.value_size);
@@ -0,0 +1,70 @@
+#include "../include/btree_node_cache.hpp"
+
+btree_node_cache::btree_node_cache(size_t lru_size) : lru_max_(lru_size)
+{
+}
+
+std::shared_ptr<btree_node> btree_node_cache::get_node(far_offset_ptr offset, uint64_t version)
+{
+    std::lock_guard lock(mutex_);
+    auto tup = std::tuple(offset.get_file_id(), offset.get_offset());
+    auto it = nodes_.find(tup);
+    if (it == nodes_.end() || it->second.version != version)
+    {
+        return nullptr;
+    }
+
+    auto& entry = it->second;
+    lru_node_list_.erase(entry.lru_iterator);
+
+    lru_node_list_.push_back(tup);
+    entry.lru_iterator = std::prev(lru_node_list_.end());
+    return entry.node;
+}
+
+void btree_node_cache::put_node(far_offset_ptr offset, std::shared_ptr<btree_node> node, uint64_t version)
+{
+    std::lock_guard lock(mutex_);
+    erase_entry(offset);
+
+    auto tup = std::tuple(offset.get_file_id(), offset.get_offset());
+    btree_node_cache_entry entry{ };
+    entry.node = node;
+    entry.version = version;
+
+    lru_node_list_.push_back(tup);
+    entry.lru_iterator = std::prev(lru_node_list_.end());
+    nodes_.try_emplace(tup, entry);
+
+    // pop from cache
+    while (lru_node_list_.size() > lru_max_)
+    {
+        auto front_tup = lru_node_list_.front();
+        lru_node_list_.pop_front();
+
+        nodes_.erase(front_tup);
+    }
+}
+
+void btree_node_cache::erase_node(far_offset_ptr offset)
+{
+    std::lock_guard lock(mutex_);
+    erase_entry(offset);
+}
+
+void btree_node_cache::erase_entry(far_offset_ptr offset)
+{
+    auto it = nodes_.find(std::tuple(offset.get_file_id(), offset.get_offset()));
+    if (it != nodes_.end())
+    {
+        lru_node_list_.erase(it->second.lru_iterator);
+        nodes_.erase(it);
+    }
+}
+
+void btree_node_cache::clear()
+{
+    std::lock_guard lock(mutex_);
+    nodes_.clear();
+    lru_node_list_.clear();
+}
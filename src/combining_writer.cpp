@@ -0,0 +1,183 @@
+#include <algorithm>
+
+#include "../include/combining_writer.hpp"
+
+combining_writer::combining_writer(btree& tree, filesize_t transaction_id) :
+    tree_(tree),
+    transaction_id_(transaction_id)
+{
+}
+
+// a wrong sized write is refused before it joins a batch, where it would fail the writes of the other threads
+void combining_writer::upsert(std::span<uint8_t> entry)
+{
+    auto row_traits = tree_.get_row_traits();
+    if (entry.size() != row_traits->get_key_traits()->get_size() + row_traits->get_value_traits()->get_size())
+    {
+        throw object_db_exception("entry does not match the B-tree entry size");
+    }
+
+    pending_write upserted;
+    upserted.key = tree_.get_row_traits()->get_key_traits()->get_data(entry);
+    upserted.entry.assign(entry.begin(), entry.end());
+    write(upserted);
+}
+
+void combining_writer::remove(std::span<uint8_t> key)
+{
+    if (key.size() != tree_.get_row_traits()->get_key_traits()->get_size())
+    {
+        throw object_db_exception("key does not match the B-tree key size");
+    }
+
+    pending_write removed;
+    removed.key.assign(key.begin(), key.end());
+    write(removed);
+}
+
+void combining_writer::write(pending_write& write)
+{
+    std::unique_lock lock(mutex_);
+    queue_.push_back(&write);
+    while (!write.done)
+    {
+        if (combining_)
+        {
+            applied_.wait(lock);
+            continue;
+        }
+
+        combining_ = true;
+        combine(lock);
+        combining_ = false;
+        applied_.notify_all();
+    }
+
+    if (write.error)
+    {
+        std::rethrow_exception(write.error);
+    }
+}
+
+// called with the lock held, which is released while a batch is applied so that other threads can publish more.
+// The combiner's own write is in its first batch, so after a few batches it hands what is left to a waiting thread
+// rather than staying the combiner for as long as writes keep coming
+void combining_writer::combine(std::unique_lock<std::mutex>& lock)
+{
+    for (size_t round = 0; round < max_combine_rounds && !queue_.empty(); round++)
+    {
+        std::vector<pending_write*> batch;
+        batch.swap(queue_);
+
+        lock.unlock();
+        try
+        {
+            apply(batch);
+        }
+        catch (...)
+        {
+            auto error = std::current_exception();
+            for (auto write : batch)
+            {
+                write->error = write->error ? write->error : error;
+            }
+        }
+        lock.lock();
+
+        for (auto write : batch)
+        {
+            write->done = true;
+        }
+        batch_count_++;
+        applied_.notify_all();
+    }
+}
+
+// each write gets the error of its own key, so one failing write does not fail the others in its batch
+void combining_writer::apply(std::vector<pending_write*>& batch)
+{
+    // the writes are in the order they were published, so when a key repeats the last write wins
+    std::stable_sort(batch.begin(), batch.end(), [this](pending_write* a, pending_write* b) {
+        return tree_.compare_keys(a->key, b->key) < 0;
+    });
+
+    std::vector<std::vector<uint8_t>> upserts;
+    std::vector<pending_write*> upserted;
+    std::vector<pending_write*> removed;
+    for (size_t n = 0; n < batch.size(); n++)
+    {
+        if (n + 1 < batch.size() && tree_.compare_keys(batch[n]->key, batch[n + 1]->key) == 0)
+        {
+            continue;
+        }
+
+        if (batch[n]->entry.empty())
+        {
+            removed.push_back(batch[n]);
+        }
+        else
+        {
+            upserts.push_back(batch[n]->entry);
+            upserted.push_back(batch[n]);
+        }
+    }
+
+    try
+    {
+        tree_.upsert_batch(transaction_id_, upserts);
+    }
+    catch (...)
+    {
+        // part of the batch may be in, and writing an entry again leaves it the same, so each goes in on its own
+        for (auto write : upserted)
+        {
+            try
+            {
+                tree_.upsert(transaction_id_, write->entry);
+            }
+            catch (...)
+            {
+                write->error = std::current_exception();
+            }
+        }
+    }
+
+    for (auto write : removed)
+    {
+        try
+        {
+            auto it = tree_.seek_begin(write->key);
+            if (!it.path.empty() && it.path.back().is_found)
+            {
+                tree_.remove(transaction_id_, it);
+            }
+        }
+        catch (...)
+        {
+            write->error = std::current_exception();
+        }
+    }
+
+    // a write that was overtaken by a later one for its key shares the outcome of that one
+    for (size_t n = batch.size(); n > 1; n--)
+    {
+        if (tree_.compare_keys(batch[n - 2]->key, batch[n - 1]->key) == 0)
+        {
+            batch[n - 2]->error = batch[n - 1]->error;
+        }
+    }
+}
+
+void combining_writer::commit(filesize_t next_transaction_id)
+{
+    std::unique_lock lock(mutex_);
+    applied_.wait(lock, [this]() { return !combining_ && queue_.empty(); });
+    tree_.commit(transaction_id_);
+    transaction_id_ = next_transaction_id;
+}
+
+size_t combining_writer::get_batch_count()
+{
+    std::lock_guard lock(mutex_);
+    return batch_count_;
+}
@@ -36,4 +36,15 @@ int compare_span(const std::span<uint8_t>& a, const std::span<uint8_t>& b)
             itb++;
         }
     }
-}
\ No newline at end of file
+}
+
+uint64_t get_checksum(std::span<const uint8_t> data)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (auto byte : data)
+    {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
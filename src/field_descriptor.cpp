@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <format>
+
+#include "../include/field_descriptor.hpp"
+#include "../include/binary_iterator.hpp"
+#include "../include/span_iterator.hpp"
+
+static const uint64_t type_mask = 0xf;
+static const int length_shift = 4;
+static const uint64_t max_length = (1ull << (64 - length_shift)) - 1;
+static const int pair_length_bits = 30;
+static const uint64_t max_pair_length = (1ull << pair_length_bits) - 1;
+static const uint64_t max_integer_width = 8;
+static const uint64_t max_fraction_digits = 9; // nanoseconds, the most a uint32_t fraction holds
+
+static uint64_t or_default(uint64_t length, uint64_t default_length)
+{
+    return length == 0 ? default_length : length;
+}
+
+static uint64_t pack(field_type type, uint64_t length)
+{
+    if (length > max_length)
+    {
+        throw object_db_exception("field length does not fit the type descriptor");
+    }
+    return (uint64_t)type | (length << length_shift);
+}
+
+// the high length goes above the low one, in 30 bits each
+static uint64_t pack_pair(field_type type, uint64_t high, uint64_t low)
+{
+    if (high > max_pair_length || low > max_pair_length)
+    {
+        throw object_db_exception("field length does not fit the type descriptor");
+    }
+    return pack(type, (high << pair_length_bits) | low);
+}
+
+void field_descriptor::set_as_integer(uint64_t width)
+{
+    if (width > max_integer_width)
+    {
+        throw object_db_exception("integer fields are at most 8 bytes wide");
+    }
+    type_descriptor = pack(ft_integer, width);
+}
+
+void field_descriptor::set_as_bool()
+{
+    type_descriptor = pack(ft_bool, 0);
+}
+
+void field_descriptor::set_as_text(uint64_t max_length)
+{
+    type_descriptor = pack(ft_text, max_length);
+}
+
+void field_descriptor::set_as_binary(uint64_t max_length)
+{
+    type_descriptor = pack(ft_binary, max_length);
+}
+
+void field_descriptor::set_as_real(uint64_t integer_length_bytes, uint64_t fraction_length_bytes)
+{
+    type_descriptor = pack_pair(ft_real, integer_length_bytes, fraction_length_bytes);
+}
+
+void field_descriptor::set_as_float(uint64_t mantissa_length_bytes, uint64_t exponent_length_bytes)
+{
+    type_descriptor = pack_pair(ft_float, mantissa_length_bytes, exponent_length_bytes);
+}
+
+void field_descriptor::set_as_date(uint64_t fraction_digits)
+{
+    if (fraction_digits > max_fraction_digits)
+    {
+        throw object_db_exception("dates hold at most 9 digits of a second");
+    }
+    type_descriptor = pack(ft_date, fraction_digits);
+}
+
+uint64_t field_descriptor::get_type() const
+{
+    return type_descriptor & type_mask;
+}
+
+uint64_t field_descriptor::get_length() const
+{
+    return type_descriptor >> length_shift;
+}
+
+uint64_t field_descriptor::get_integer_width() const
+{
+    if (get_type() != ft_integer)
+    {
+        throw object_db_exception("the field is not an integer");
+    }
+    return or_default(get_length(), max_integer_width);
+}
+
+uint64_t field_descriptor::get_text_max_length() const
+{
+    if (get_type() != ft_text)
+    {
+        throw object_db_exception("the field is not text");
+    }
+    return or_default(get_length(), default_length);
+}
+
+uint64_t field_descriptor::get_binary_max_length() const
+{
+    if (get_type() != ft_binary)
+    {
+        throw object_db_exception("the field is not binary");
+    }
+    return or_default(get_length(), default_length);
+}
+
+uint64_t field_descriptor::get_date_fraction_digits() const
+{
+    if (get_type() != ft_date)
+    {
+        throw object_db_exception("the field is not a date");
+    }
+    return get_length();
+}
+
+// the integer and fraction bytes of a real, or the mantissa and exponent bytes of a float
+std::pair<uint64_t, uint64_t> field_descriptor::get_real_lengths() const
+{
+    if (get_type() != ft_real && get_type() != ft_float)
+    {
+        throw object_db_exception("the field is not a real or a float");
+    }
+    auto length = get_length();
+    return { or_default(length >> pair_length_bits, 8), or_default(length & max_pair_length, 8) };
+}
+
+std::string field_descriptor::get_type_name() const
+{
+    switch (get_type())
+    {
+    case ft_integer: return "integer";
+    case ft_bool: return "bool";
+    case ft_text: return "text";
+    case ft_binary: return "binary";
+    case ft_date: return "date";
+    case ft_real: return "real";
+    case ft_float: return "float";
+    }
+    throw object_db_exception(std::format("unknown field type: {}", get_type()));
+}
+
+filesize_t field_descriptor::get_size()
+{
+    return max_string_length + sizeof(uint64_t);
+}
+
+filesize_t field_descriptor::get_field_width() const
+{
+    switch (get_type())
+    {
+    case ft_integer: return get_integer_width();
+    case ft_bool: return 1;
+    case ft_text: return get_text_max_length();
+    case ft_binary: return sizeof(uint32_t) + get_binary_max_length();
+    case ft_date: return sizeof(uint64_t) + (get_length() > 0 ? sizeof(uint32_t) : 0);
+    case ft_real:
+    case ft_float:
+    {
+        auto [high, low] = get_real_lengths();
+        return high + low;
+    }
+    }
+    throw object_db_exception(std::format("unknown field type: {}", get_type()));
+}
+
+void field_descriptor::read_from_span(const std::span<uint8_t>& s)
+{
+    if (s.size() < get_size())
+    {
+        throw object_db_exception("span is smaller than a field descriptor");
+    }
+
+    auto name_end = std::find(s.begin(), s.begin() + max_string_length, 0);
+    name.assign(s.begin(), name_end);
+    span_iterator it(s, max_string_length);
+    type_descriptor = read_uint64(it);
+}
+
+void field_descriptor::write_to_span(const std::span<uint8_t>& s) const
+{
+    if (s.size() < get_size())
+    {
+        throw object_db_exception("span is smaller than a field descriptor");
+    }
+    if (name.size() > max_string_length)
+    {
+        throw object_db_exception("field name is too long");
+    }
+
+    std::fill(s.begin(), s.begin() + max_string_length, 0);
+    std::copy(name.begin(), name.end(), s.begin());
+    span_iterator it(s, max_string_length);
+    write_uint64(it, type_descriptor);
+}
+
+static field_descriptor create_field(const std::string& name)
+{
+    field_descriptor field;
+    field.name = name;
+    return field;
+}
+
+field_descriptor create_boolean_field(const std::string& name)
+{
+    auto field = create_field(name);
+    field.set_as_bool();
+    return field;
+}
+
+field_descriptor create_integer_field(const std::string& name, uint64_t width)
+{
+    auto field = create_field(name);
+    field.set_as_integer(width);
+    return field;
+}
+
+field_descriptor create_text_field(const std::string& name, uint64_t max_length)
+{
+    auto field = create_field(name);
+    field.set_as_text(max_length);
+    return field;
+}
+
+field_descriptor create_binary_field(const std::string& name, uint64_t max_length)
+{
+    auto field = create_field(name);
+    field.set_as_binary(max_length);
+    return field;
+}
+
+field_descriptor create_date_field(const std::string& name, uint64_t fraction_digits)
+{
+    auto field = create_field(name);
+    field.set_as_date(fraction_digits);
+    return field;
+}
+
+field_descriptor create_real_field(const std::string& name, uint64_t integer_digits, uint64_t fraction_digits)
+{
+    auto field = create_field(name);
+    field.set_as_real(integer_digits, fraction_digits);
+    return field;
+}
+
+field_descriptor create_float_field(const std::string& name, uint64_t mantissa_digits, uint64_t exponent_digits)
+{
+    auto field = create_field(name);
+    field.set_as_float(mantissa_digits, exponent_digits);
+    return field;
+}
@@ -2,98 +2,140 @@
 #include "../include/span_iterator.hpp"
 #include "../include/far_offset_ptr.hpp"
 
-static const uint64_t transaction_id_offset = 0;
-static const uint64_t transaction_root_offset = transaction_id_offset + sizeof(uint64_t);
-static const uint64_t last_transaction_file = transaction_root_offset + sizeof(far_offset_ptr);
+static const filesize_t superblock_size = 4 * sizeof(uint64_t) + far_offset_ptr::get_size();
+static const filesize_t checksum_offset = superblock_size - sizeof(uint64_t);
 
 file_allocator::file_allocator(file_cache& cache) : cache_(cache)
 {
+    read_superblock();
 }
 
-filesize_t file_allocator::get_current_transaction_id()
+bool file_allocator::read_superblock_copy(filesize_t copy_offset, std::vector<uint8_t>& copy)
 {
-    filesize_t transaction_id = 0;
-    std::vector<uint8_t> node(block_size, 0);
-    auto root_file_iterator = cache_.get_iterator(0, transaction_id_offset);
+    copy.resize(block_size);
+    cache_.read_bytes(0, copy_offset, copy);
 
-    if (cache_.get_file_size(0) >= block_size) // does the block exist on file?
-    {
-        // load the current value
-        auto current_iterator = root_file_iterator;
-        read_span(current_iterator, node);
-        span_iterator root_block_iterator(node);
-        transaction_id = read_filesize(root_block_iterator);
-    }
-    else // we need to initialise the block with a default state
-    {
-        // write to the block in memory
-        span_iterator root_block_iterator(node);
-        write_uint64(root_block_iterator, transaction_id);
+    span_iterator checksum_it({ copy.begin() + checksum_offset, sizeof(uint64_t) });
+    auto checksum = read_uint64(checksum_it);
+    return checksum == get_checksum({ copy.begin(), checksum_offset });
+}
 
-        // write the block to the file
-        write_span(root_file_iterator, node);
-        return transaction_id;
+void file_allocator::read_superblock()
+{
+    std::vector<uint8_t> first;
+    std::vector<uint8_t> second;
+    auto first_valid = read_superblock_copy(0, first);
+    auto second_valid = read_superblock_copy(block_size, second);
+    if (!first_valid && !second_valid)
+    {
+        return; // a new database
     }
 
-    return transaction_id;
+    auto read_sequence = [](std::vector<uint8_t>& copy)
+    {
+        span_iterator it(copy);
+        return read_filesize(it);
+    };
+    auto& current = !second_valid || (first_valid && read_sequence(first) > read_sequence(second)) ? first : second;
+
+    span_iterator it(current);
+    sequence_ = read_filesize(it);
+    transaction_id_ = read_filesize(it);
+    root_.read(it);
+    last_file_ = read_filesize(it);
 }
 
-filesize_t file_allocator::create_transaction()
+filesize_t file_allocator::commit()
 {
-    auto transaction_id = get_current_transaction_id();
+    std::lock_guard commit_lock(commit_mutex_);
 
-    std::vector<uint8_t> node(block_size, 0);
+    // the superblock is taken first, so everything it points at was written before the sync below begins
+    filesize_t sequence = 0;
+    std::vector<uint8_t> copy(block_size, 0);
+    {
+        std::lock_guard lock(mutex_);
+        sequence = sequence_ + 1;
+        span_iterator it(copy);
+        write_filesize(it, sequence);
+        write_filesize(it, transaction_id_);
+        root_.write(it);
+        write_filesize(it, last_file_);
+        write_uint64(it, get_checksum({ copy.begin(), checksum_offset }));
+    }
 
-    auto root_file_iterator = cache_.get_iterator(0, transaction_id_offset);
-    read_span(root_file_iterator, node);
+    // the blocks the superblock points at reach the disk before it does
+    cache_.sync();
 
-    auto span_it = span_iterator(node);
-    transaction_id++;
-    write_uint64(span_it, transaction_id);
+    // odd sequence numbers go to the first copy, even ones to the second, so the current copy is never overwritten
+    cache_.write_bytes(0, (sequence % 2) == 1 ? 0 : block_size, copy);
+    cache_.sync();
 
-    root_file_iterator = cache_.get_iterator(0, transaction_id_offset);
-    write_span(root_file_iterator, node);
+    std::lock_guard lock(mutex_);
+    sequence_ = sequence;
+    return sequence;
+}
 
-    return transaction_id;
+filesize_t file_allocator::get_sequence()
+{
+    std::lock_guard lock(mutex_);
+    return sequence_;
 }
 
-far_offset_ptr file_allocator::allocate_block(filesize_t transaction_id)
+filesize_t file_allocator::get_current_transaction_id()
 {
-    auto transaction_file_iterator = cache_.get_iterator(0, last_transaction_file);
-    if (!transaction_file_iterator.has_next())
-    {
-        throw object_db_exception("could not read block ptr");
-    }
+    std::lock_guard lock(mutex_);
+    return transaction_id_;
+}
 
-    auto tmp_last_file_iterator = transaction_file_iterator;
-    auto last_file = read_uint64(tmp_last_file_iterator);
+filesize_t file_allocator::create_transaction()
+{
+    std::lock_guard lock(mutex_);
+    return ++transaction_id_;
+}
 
-    auto last_file_transaction_id_iterator = cache_.get_iterator(last_file, 0);
-    auto last_file_transaction_id = read_filesize(last_file_transaction_id_iterator);
+far_offset_ptr file_allocator::allocate_block(filesize_t transaction_id)
+{
+    std::lock_guard lock(mutex_);
 
-    uint64_t size = 0;
-    if (last_file == 0 || last_file_transaction_id != transaction_id)
+    filesize_t file_id = 0;
+    filesize_t size = 0;
+    auto file = transaction_files_.find(transaction_id);
+    if (file != transaction_files_.end())
     {
-        last_file = last_file + 1;
-        write_uint64(transaction_file_iterator, last_file);
+        file_id = file->second;
+        size = cache_.get_file_size(file_id);
     }
-    else
+
+    if (file_id == 0 || size >= block_file_size)
     {
-        size = cache_.get_file_size(last_file);
-        if (size >= block_file_size)
+        file_id = ++last_file_;
+        size = 0;
+        transaction_files_[transaction_id] = file_id;
+
+        // the oldest other transaction is forgotten, and only starts a new file if it allocates again
+        if (transaction_files_.size() > max_transaction_files)
         {
-            last_file = last_file + 1;
-            write_uint64(transaction_file_iterator, last_file);
-            size = 0;
+            auto oldest = transaction_files_.begin();
+            transaction_files_.erase(oldest->first != transaction_id ? oldest : std::next(oldest));
         }
     }
 
-    auto it = cache_.get_iterator(last_file, size);
     std::vector<uint8_t> block(block_size, 0);
     auto span_it = span_iterator(block);
-
     write_filesize(span_it, transaction_id);
-    write_span(it, block);
+    cache_.write_bytes(file_id, size, block);
+
+    return far_offset_ptr(file_id, size);
+}
+
+far_offset_ptr file_allocator::get_root()
+{
+    std::lock_guard lock(mutex_);
+    return root_;
+}
 
-    return far_offset_ptr(last_file, size);
-}
\ No newline at end of file
+void file_allocator::set_root(far_offset_ptr root)
+{
+    std::lock_guard lock(mutex_);
+    root_ = root;
+}
@@ -7,6 +7,21 @@
 #include "../include/far_offset_ptr.hpp"
 
 #include <list>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <thread>
+
+#include "../include/binary_iterator.hpp"
+#include "../include/span_iterator.hpp"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 block_cache::block_cache(int lru_size) :lru_max_(lru_size)
 {
@@ -56,9 +71,21 @@ bool block_cache::exists(filesize_t filename, filesize_t offset)
     return blocks_.find(std::tuple(filename, offset)) != blocks_.end();
 }
 
+void block_cache::erase_file(filesize_t filename)
+{
+    auto it = blocks_.lower_bound(std::tuple(filename, (filesize_t)0));
+    while (it != blocks_.end() && std::get<0>(it->first) == filename)
+    {
+        lru_block_list_.erase(it->second.lru_iterator);
+        it = blocks_.erase(it);
+    }
+}
+
 // Helper function to close and erase the least recently used file
-void file_cache::evict_file_if_needed()
+void file_cache::evict_file_if_needed(cache_directory& directory)
 {
+    auto& file_streams = directory.file_streams;
+    auto& lru_file_list = directory.lru_file_list;
     if (file_streams.size() > 4) {
         // Remove any file_ids from lru_file_list that are not in file_streams
         for (auto it = lru_file_list.begin(); it != lru_file_list.end();) {
@@ -77,23 +104,159 @@ void file_cache::evict_file_if_needed()
     }
 }
 
-std::fstream& file_cache::get_stream(filesize_t file_id, std::ios::openmode mode)
+file_cache::file_cache(const std::filesystem::path& path) : cache_path(path)
+{
+    read_placement();
+    open_directories();
+}
+
+file_cache::file_cache(const std::filesystem::path& path, const std::vector<std::filesystem::path>& stripe_paths) : cache_path(path)
+{
+    if (read_placement() || stripe_paths.empty())
+    {
+        open_directories();
+        return;
+    }
+
+    // the files a cache already has would no longer be found where the stripes put them
+    if (std::filesystem::exists(get_filename(1)))
+    {
+        throw object_db_exception("only a new cache can be striped");
+    }
+    stripe_paths_ = stripe_paths;
+    open_directories();
+    write_placement();
+}
+
+void file_cache::open_directories()
 {
+    for (size_t n = 0; n <= stripe_paths_.size(); n++)
+    {
+        directories_.push_back(std::make_unique<cache_directory>());
+    }
+}
+
+// returns false if the cache is not striped
+bool file_cache::read_placement()
+{
+    std::ifstream file(cache_path / "placement.bin", std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // a damaged placement runs off the end of the bytes, and the iterator throws
+    std::vector<uint8_t> placement((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    span_iterator it(placement);
+    auto count = read_uint32(it);
+    for (uint32_t n = 0; n < count; n++)
+    {
+        std::string path(read_uint16(it), 0);
+        for (auto& c : path)
+        {
+            c = (char)it.read();
+        }
+        stripe_paths_.emplace_back(path);
+    }
+    return !stripe_paths_.empty();
+}
+
+void file_cache::write_placement()
+{
+    std::vector<uint8_t> placement(sizeof(uint32_t));
+    span_iterator count_it(placement);
+    write_uint32(count_it, (uint32_t)stripe_paths_.size());
+    for (auto& stripe_path : stripe_paths_)
+    {
+        auto path = stripe_path.string();
+        if (path.size() > std::numeric_limits<uint16_t>::max())
+        {
+            throw object_db_exception("stripe path is too long");
+        }
+        auto offset = placement.size();
+        placement.resize(offset + sizeof(uint16_t));
+        span_iterator size_it({ placement.begin() + offset, sizeof(uint16_t) });
+        write_uint16(size_it, (uint16_t)path.size());
+        placement.insert(placement.end(), path.begin(), path.end());
+    }
+
+    create_directories(cache_path);
+    {
+        std::lock_guard lock(created_mutex_);
+        unsynced_directories_.insert(cache_path);
+    }
+    auto filename = (cache_path / "placement.bin").string();
+    {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        file.write((const char*)placement.data(), placement.size());
+        if (!file.good())
+        {
+            throw object_db_exception("could not write the placement of the cache files");
+        }
+    }
+    if (!sync_file(filename))
+    {
+        throw object_db_exception("could not sync file to disk");
+    }
+    sync();
+}
+
+std::filesystem::path file_cache::get_directory(filesize_t file_id) const
+{
+    if (stripe_paths_.empty() || file_id == 0)
+    {
+        return cache_path;
+    }
+    return stripe_paths_[(file_id - 1) % stripe_paths_.size()];
+}
+
+file_cache::cache_directory& file_cache::get_cache_directory(filesize_t file_id)
+{
+    if (stripe_paths_.empty() || file_id == 0)
+    {
+        return *directories_[0];
+    }
+    return *directories_[1 + (file_id - 1) % stripe_paths_.size()];
+}
+
+// each directory created, and the one they were created in, gain an entry that the next sync makes durable
+void file_cache::create_directories(const std::filesystem::path& directory)
+{
+    std::lock_guard lock(created_mutex_);
+    auto existing = directory;
+    while (!existing.empty() && !std::filesystem::exists(existing))
+    {
+        unsynced_directories_.insert(existing);
+        existing = existing.parent_path();
+    }
+    if (existing != directory)
+    {
+        unsynced_directories_.insert(existing.empty() ? std::filesystem::path(".") : existing);
+        std::filesystem::create_directories(directory);
+    }
+}
+
+std::fstream& file_cache::get_stream(cache_directory& cache_directory, filesize_t file_id, std::ios::openmode mode)
+{
+    auto& file_streams = cache_directory.file_streams;
+    auto& lru_file_list = cache_directory.lru_file_list;
     auto it = file_streams.find(file_id);
     if (it == file_streams.end()) {
         // Open new file stream
-        std::string filename = get_filename(cache_path, file_id);
-        if (!std::filesystem::exists(cache_path))
-        {
-            std::filesystem::create_directories(cache_path);
-        }
+        std::string filename = get_filename(file_id);
+        auto directory = get_directory(file_id);
+        create_directories(directory);
         std::fstream fs(filename, mode);
         if (!fs.is_open())
         {
             if (mode & std::ios::out)
             {
-                // Try to create the file if it doesn't exist
+                // Try to create the file if it doesn't exist. Its directory entry is only durable once the directory is synced
                 fs.open(filename, std::ios::binary | std::ios::trunc | std::ios::out);
+                {
+                    std::lock_guard lock(created_mutex_);
+                    unsynced_directories_.insert(directory);
+                }
                 fs.close();
                 fs.open(filename, std::ios::binary | std::ios::in | std::ios::out);
             }
@@ -107,7 +270,7 @@ std::fstream& file_cache::get_stream(filesize_t file_id, std::ios::openmode mode
 
         file_streams[file_id] = std::move(fs);
         lru_file_list.push_back(file_id);
-        evict_file_if_needed();
+        evict_file_if_needed(cache_directory);
         return file_streams[file_id];
     } else {
         // Move to back (most recently used)
@@ -119,9 +282,11 @@ std::fstream& file_cache::get_stream(filesize_t file_id, std::ios::openmode mode
 
 filesize_t file_cache::get_file_size(filesize_t file_id)
 {
-    std::fstream& file = get_stream(file_id, std::ios::binary | std::ios::in);
+    auto& directory = get_cache_directory(file_id);
+    std::lock_guard lock(directory.mutex);
+    std::fstream& file = get_stream(directory, file_id, std::ios::binary | std::ios::in);
     if (!file.is_open()) {
-        file_streams.erase(file_id);
+        directory.file_streams.erase(file_id);
         return 0;
     }
     file.seekg(0, std::ios::end);
@@ -132,20 +297,23 @@ filesize_t file_cache::get_file_size(filesize_t file_id)
 
 void file_cache::write(filesize_t file_id, filesize_t offset, uint8_t data)
 {
+    auto& directory = get_cache_directory(file_id);
+    std::lock_guard lock(directory.mutex);
     auto block_offset_remainder = offset % 4096;
     auto block_offset_base = offset - block_offset_remainder;
 
-    std::fstream& file = get_stream(file_id, std::ios::binary | std::ios::in | std::ios::out);
+    std::fstream& file = get_stream(directory, file_id, std::ios::binary | std::ios::in | std::ios::out);
     if (!file.is_open()) {
-        file_streams.erase(file_id);
+        directory.file_streams.erase(file_id);
         throw object_db_exception("could not open file for writing");
     }
     file.seekp(offset);
     file.put(data);
+    directory.unsynced_files.insert(file_id);
 
-    if (blocks_.exists(file_id, block_offset_base))
+    if (directory.blocks.exists(file_id, block_offset_base))
     {
-        auto block = blocks_.get_block(file_id, block_offset_base);
+        auto block = directory.blocks.get_block(file_id, block_offset_base);
         if (block)
         {
             block->at(block_offset_remainder) = data;
@@ -155,83 +323,252 @@ void file_cache::write(filesize_t file_id, filesize_t offset, uint8_t data)
     file.flush();
 }
 
-uint8_t file_cache::read(filesize_t file_id, filesize_t offset)
+// get a block from the cache, loading it from the file if needed. The block is left empty if it cannot be read
+std::shared_ptr<std::vector<uint8_t>> file_cache::load_block(cache_directory& directory, filesize_t file_id, filesize_t block_offset_base)
 {
-    auto block_offset_remainder = offset % 4096;
-    auto block_offset_base = offset - block_offset_remainder;
-
-    auto block = blocks_.get_block(file_id, block_offset_base);
-    if (block)
+    auto block = directory.blocks.get_block(file_id, block_offset_base);
+    if (!block)
     {
-        if (block->size() == 0)
-        {
-            std::fstream& file = get_stream(file_id, std::ios::binary | std::ios::in);
-            if (!file.is_open()) {
-                file_streams.erase(file_id);
-                return 0;
-            }
-            file.seekg(offset);
+        throw object_db_exception("Block cache failure");
+    }
 
-            block->resize(4096);
-            file.read((char*)&(block->at(0)), 4096);
-            if (file.fail())
-            {
-                block->resize(0);
-                return 0;
-            }
+    if (block->size() == 0)
+    {
+        std::fstream& file = get_stream(directory, file_id, std::ios::binary | std::ios::in);
+        if (!file.is_open()) {
+            directory.file_streams.erase(file_id);
+            return block;
         }
+        file.seekg(block_offset_base);
 
-        return block->at(block_offset_remainder);
+        block->resize(4096);
+        file.read((char*)&(block->at(0)), 4096);
+        if (file.fail())
+        {
+            file.clear();
+            block->resize(0);
+        }
     }
-    else
+    return block;
+}
+
+uint8_t file_cache::read(filesize_t file_id, filesize_t offset)
+{
+    auto& directory = get_cache_directory(file_id);
+    std::lock_guard lock(directory.mutex);
+    auto block_offset_remainder = offset % 4096;
+    auto block_offset_base = offset - block_offset_remainder;
+
+    auto block = load_block(directory, file_id, block_offset_base);
+    if (block->size() == 0)
     {
-        throw object_db_exception("Block cache failure");
+        return 0;
     }
+    return block->at(block_offset_remainder);
 }
 
 void file_cache::write_bytes(filesize_t file_id, filesize_t offset, std::span<const uint8_t> data)
 {
+    auto& directory = get_cache_directory(file_id);
+    std::lock_guard lock(directory.mutex);
     auto block_offset_remainder = offset % 4096;
     auto block_offset_base = offset - block_offset_remainder;
 
     if (block_offset_remainder == 0 && data.size() == 4096)
     {
-        auto block = blocks_.get_block(file_id, block_offset_base);
-        std::fstream& file = get_stream(file_id, std::ios::binary | std::ios::in | std::ios::out);
-        file.seekg(offset);
+        auto block = directory.blocks.get_block(file_id, block_offset_base);
+        std::fstream& file = get_stream(directory, file_id, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(offset);
 
         block->resize(4096);
-        file.write((char*)&(block->at(0)), 4096);
         for (int a = 0; a < 4096; a++)
         {
             block->at(a) = data[a];
         }
+        file.write((char*)&(block->at(0)), 4096);
+        file.flush();
+        directory.unsynced_files.insert(file_id);
     }
     else
     {
-        auto current_offset = offset;
-        for (auto d : data)
+        // a block at a time, so a partial block is read once and written back whole
+        std::vector<uint8_t> block(4096);
+        size_t position = 0;
+        while (position < data.size())
         {
-            write(file_id, current_offset, d);
-            current_offset++;
+            auto current_offset = offset + position;
+            auto current_remainder = current_offset % 4096;
+            auto count = std::min<size_t>(4096 - current_remainder, data.size() - position);
+
+            read_bytes(file_id, current_offset - current_remainder, block);
+            std::copy(data.begin() + position, data.begin() + position + count, block.begin() + current_remainder);
+            write_bytes(file_id, current_offset - current_remainder, block);
+            position += count;
         }
     }
 }
 
-//todo: see if we can improve the performance here
+// copies a block at a time, so reading a whole node looks up its block once rather than once per byte
 void file_cache::read_bytes(filesize_t file_id, filesize_t offset, std::span<uint8_t> data)
 {
-    auto current_offset = offset;
-    for (auto& d : data)
+    auto& directory = get_cache_directory(file_id);
+    std::lock_guard lock(directory.mutex);
+    size_t position = 0;
+    while (position < data.size())
+    {
+        auto current_offset = offset + position;
+        auto block_offset_remainder = current_offset % 4096;
+        auto block_offset_base = current_offset - block_offset_remainder;
+        auto count = std::min<size_t>(4096 - block_offset_remainder, data.size() - position);
+
+        auto block = load_block(directory, file_id, block_offset_base);
+        if (block->size() == 0)
+        {
+            std::fill(data.begin() + position, data.begin() + position + count, 0);
+        }
+        else
+        {
+            std::copy(block->begin() + block_offset_remainder, block->begin() + block_offset_remainder + count, data.begin() + position);
+        }
+        position += count;
+    }
+}
+
+void file_cache::remove_file(filesize_t file_id)
+{
+    auto& directory = get_cache_directory(file_id);
+    std::lock_guard lock(directory.mutex);
+    auto it = directory.file_streams.find(file_id);
+    if (it != directory.file_streams.end())
+    {
+        it->second.close();
+        directory.file_streams.erase(it);
+    }
+    directory.lru_file_list.remove(file_id);
+    directory.blocks.erase_file(file_id);
+    directory.unsynced_files.erase(file_id);
+
+    std::filesystem::remove(get_filename(file_id));
+}
+
+bool file_cache::sync_file(const std::string& filename)
+{
+#ifdef _WIN32
+    int fd = _open(filename.c_str(), _O_RDWR | _O_BINARY);
+    if (fd < 0)
+    {
+        return errno == ENOENT; // removed since it was written
+    }
+    auto failed = _commit(fd) != 0;
+    _close(fd);
+#else
+    int fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        return errno == ENOENT; // removed since it was written
+    }
+    auto failed = ::fsync(fd) != 0;
+    ::close(fd);
+#endif
+    return !failed;
+}
+
+// the streams are flushed after every write, so what is left is to have the system write its buffers for each file.
+// a descriptor of its own does that, the file may have been evicted from the open streams by now. The files of each
+// directory are synced by a thread of their own, so striped devices flush side by side, and no directory is locked
+// while its files are flushed
+// a new file is only found after a power loss if the directory holding it was synced as well, and syncing a
+// directory needs a descriptor of its own too. Windows keeps directory entries durable itself
+bool file_cache::sync_directory(const std::filesystem::path& directory)
+{
+#ifdef _WIN32
+    return true;
+#else
+    int fd = ::open(directory.string().c_str(), O_RDONLY | O_DIRECTORY);
+    auto failed = fd < 0 || ::fsync(fd) != 0;
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    return !failed;
+#endif
+}
+
+void file_cache::sync()
+{
+    std::lock_guard sync_lock(sync_mutex_);
+
+    // entries created from here on are left for the next sync
+    std::set<std::filesystem::path> directories;
+    {
+        std::lock_guard lock(created_mutex_);
+        directories.swap(unsynced_directories_);
+    }
+
+    std::atomic<bool> failed = false;
+    auto sync_files = [this, &failed, &directories](size_t index)
+    {
+        // files written from here on are left for the next sync, and writes go on while these are flushed
+        auto& cache_directory = *directories_[index];
+        std::set<filesize_t> files;
+        {
+            std::lock_guard lock(cache_directory.mutex);
+            files.swap(cache_directory.unsynced_files);
+        }
+
+        auto directory_failed = false;
+        for (auto file_id : files)
+        {
+            if (!sync_file(get_filename(file_id)))
+            {
+                directory_failed = true;
+            }
+        }
+        auto& path = index == 0 ? cache_path : stripe_paths_[index - 1];
+        if (directories.contains(path) && !sync_directory(path))
+        {
+            directory_failed = true;
+        }
+        if (directory_failed)
+        {
+            std::lock_guard lock(cache_directory.mutex);
+            cache_directory.unsynced_files.insert(files.begin(), files.end());
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t index = 1; index < directories_.size(); index++)
+    {
+        threads.emplace_back(sync_files, index);
+    }
+    sync_files(0);
+
+    // the directories the cache directories were created in
+    for (auto& directory : directories)
+    {
+        if (directory != cache_path && std::find(stripe_paths_.begin(), stripe_paths_.end(), directory) == stripe_paths_.end() &&
+            !sync_directory(directory))
+        {
+            failed = true;
+        }
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (failed)
     {
-        d = read(file_id, current_offset);
-        current_offset++;
+        std::lock_guard lock(created_mutex_);
+        unsynced_directories_.insert(directories.begin(), directories.end());
+        throw object_db_exception("could not sync file to disk");
     }
 }
 
-std::string file_cache::get_filename(const std::filesystem::path& cache_path, filesize_t file_id)
+std::string file_cache::get_filename(filesize_t file_id) const
 {
-    return (cache_path / ("file_" + std::to_string(file_id) + ".bin")).string();
+    return (get_directory(file_id) / ("file_" + std::to_string(file_id) + ".bin")).string();
 }
 
 file_iterator file_cache::get_iterator(const far_offset_ptr& ptr)
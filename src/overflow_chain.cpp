@@ -0,0 +1,82 @@
+#include "../include/overflow_chain.hpp"
+#include <algorithm>
+
+#include "../include/span_iterator.hpp"
+
+// the chain is written back to front, so each block can hold the location of the one after it
+far_offset_ptr overflow_chain::write(file_cache& cache, file_allocator& allocator, filesize_t transaction_id, std::span<const uint8_t> data)
+{
+    size_t block_count = (data.size() + capacity - 1) / capacity;
+    std::vector<far_offset_ptr> offsets;
+    for (size_t n = 0; n < block_count; n++)
+    {
+        offsets.push_back(allocator.allocate_block(transaction_id));
+    }
+
+    std::vector<uint8_t> block(block_size);
+    far_offset_ptr next;
+    for (size_t n = block_count; n > 0; n--)
+    {
+        auto start = (n - 1) * capacity;
+        auto used = std::min(capacity, data.size() - start);
+
+        std::fill(block.begin(), block.end(), 0);
+        span_iterator header_it({ block.begin(), header_size });
+        write_filesize(header_it, transaction_id);
+        next.write(header_it);
+        write_uint16(header_it, (uint16_t)used);
+        std::copy(data.begin() + start, data.begin() + start + used, block.begin() + header_size);
+
+        cache.write_bytes(offsets[n - 1].get_file_id(), offsets[n - 1].get_offset(), block);
+        next = offsets[n - 1];
+    }
+    return next;
+}
+
+overflow_chain_reader::overflow_chain_reader(file_cache& cache, far_offset_ptr first, filesize_t length) :
+    cache_(cache),
+    current_(first),
+    remaining_(length),
+    block_(block_size)
+{
+}
+
+void overflow_chain_reader::load_next()
+{
+    if (!current_)
+    {
+        throw object_db_exception("overflow chain ends before its value");
+    }
+
+    cache_.read_bytes(current_.get_file_id(), current_.get_offset(), block_);
+
+    span_iterator header_it(block_);
+    read_filesize(header_it); // transaction id
+    current_.read(header_it);
+    block_used_ = read_uint16(header_it);
+    block_position_ = 0;
+    if (block_used_ == 0 || block_used_ > overflow_chain::capacity)
+    {
+        throw object_db_exception("overflow chain block is corrupted");
+    }
+}
+
+size_t overflow_chain_reader::read(std::span<uint8_t> buffer)
+{
+    size_t count = 0;
+    while (count < buffer.size() && remaining_ > 0)
+    {
+        if (block_position_ == block_used_)
+        {
+            load_next();
+        }
+
+        auto size = std::min({ buffer.size() - count, block_used_ - block_position_, (size_t)remaining_ });
+        auto source = block_.begin() + overflow_chain::header_size + block_position_;
+        std::copy(source, source + size, buffer.begin() + count);
+        block_position_ += size;
+        remaining_ -= size;
+        count += size;
+    }
+    return count;
+}
@@ -0,0 +1,531 @@
+#include <algorithm>
+
+#include "../include/partitioned_table.hpp"
+#include "../include/binary_iterator.hpp"
+#include "../include/btree_cursor.hpp"
+#include "../include/span_iterator.hpp"
+
+partitioned_table::partitioned_table(std::shared_ptr<btree_row_traits> row_traits, const std::filesystem::path& directory,
+    const std::vector<std::vector<uint8_t>>& split_keys) :
+    row_traits_(row_traits),
+    directory_(directory),
+    layout_cache_(directory)
+{
+    if (!read_layout())
+    {
+        std::vector<std::vector<uint8_t>> lower_bounds{ {} };
+        lower_bounds.insert(lower_bounds.end(), split_keys.begin(), split_keys.end());
+        create_layout(partition_mode::range, lower_bounds);
+    }
+}
+
+partitioned_table::partitioned_table(std::shared_ptr<btree_row_traits> row_traits, const std::filesystem::path& directory,
+    size_t partition_count) :
+    row_traits_(row_traits),
+    directory_(directory),
+    layout_cache_(directory)
+{
+    if (!read_layout())
+    {
+        if (partition_count == 0)
+        {
+            throw object_db_exception("a hash partitioned table needs at least one partition");
+        }
+        create_layout(partition_mode::hash, std::vector<std::vector<uint8_t>>(partition_count));
+    }
+}
+
+partitioned_table::~partitioned_table()
+{
+    stop_writers();
+}
+
+void partitioned_table::create_layout(partition_mode mode, const std::vector<std::vector<uint8_t>>& lower_bounds)
+{
+    mode_ = mode;
+    for (auto& lower_bound : lower_bounds)
+    {
+        partitions_.push_back(open_partition(next_partition_id_++, lower_bound));
+        auto& created = *partitions_.back();
+        if (mode_ == partition_mode::range && partitions_.size() > 1 && (created.lower_bound.empty() || (partitions_.size() > 2
+            && created.tree->compare_keys(partitions_[partitions_.size() - 2]->lower_bound, created.lower_bound) >= 0)))
+        {
+            throw object_db_exception("split keys must be in increasing order and not empty");
+        }
+    }
+    write_layout();
+}
+
+// returns false if there is no table in the directory yet
+bool partitioned_table::read_layout()
+{
+    std::vector<uint8_t> header(layout_header_size);
+    layout_cache_.read_bytes(0, 0, header);
+    span_iterator header_it(header);
+    auto mode = read_uint32(header_it);
+    auto partition_count = read_uint32(header_it);
+    auto next_partition_id = read_uint64(header_it);
+    if (next_partition_id == 0)
+    {
+        return false;
+    }
+
+    mode_ = (partition_mode)mode;
+    next_partition_id_ = next_partition_id;
+    filesize_t offset = layout_header_size;
+    for (uint32_t n = 0; n < partition_count; n++)
+    {
+        std::vector<uint8_t> partition_header(sizeof(uint64_t) + sizeof(uint16_t));
+        layout_cache_.read_bytes(0, offset, partition_header);
+        span_iterator partition_it(partition_header);
+        auto id = read_uint64(partition_it);
+        std::vector<uint8_t> lower_bound(read_uint16(partition_it));
+        layout_cache_.read_bytes(0, offset + partition_header.size(), lower_bound);
+        offset += partition_header.size() + lower_bound.size();
+
+        partitions_.push_back(open_partition(id, lower_bound));
+    }
+    return true;
+}
+
+void partitioned_table::write_layout()
+{
+    std::vector<uint8_t> layout(layout_header_size);
+    span_iterator header_it(layout);
+    write_uint32(header_it, (uint32_t)mode_);
+    write_uint32(header_it, (uint32_t)partitions_.size());
+    write_uint64(header_it, next_partition_id_);
+    for (auto& existing : partitions_)
+    {
+        auto offset = layout.size();
+        layout.resize(offset + sizeof(uint64_t) + sizeof(uint16_t) + existing->lower_bound.size());
+        span_iterator partition_it({ layout.begin() + offset, sizeof(uint64_t) + sizeof(uint16_t) });
+        write_uint64(partition_it, existing->id);
+        write_uint16(partition_it, (uint16_t)existing->lower_bound.size());
+        std::copy(existing->lower_bound.begin(), existing->lower_bound.end(), layout.begin() + offset + sizeof(uint64_t) + sizeof(uint16_t));
+    }
+    layout_cache_.write_bytes(0, 0, layout);
+    layout_cache_.sync();
+}
+
+std::unique_ptr<partitioned_table::partition> partitioned_table::open_partition(filesize_t id, std::vector<uint8_t> lower_bound)
+{
+    if (lower_bound.size() > std::numeric_limits<uint16_t>::max())
+    {
+        throw object_db_exception("partition bound is too long");
+    }
+
+    auto opened = std::make_unique<partition>();
+    opened->id = id;
+    opened->lower_bound = std::move(lower_bound);
+    opened->cache = std::make_unique<file_cache>(directory_ / ("partition_" + std::to_string(id)));
+    opened->allocator = std::make_unique<file_allocator>(*opened->cache);
+    opened->tree = std::make_unique<btree>(row_traits_, *opened->cache, opened->allocator->get_root(), *opened->allocator);
+    opened->transaction_id = opened->allocator->create_transaction();
+    opened->writer = std::thread([this, target = opened.get()]() { run_writer(*target); });
+    return opened;
+}
+
+void partitioned_table::run_writer(partition& target)
+{
+    std::unique_lock lock(target.mutex);
+    while (true)
+    {
+        target.changed.wait(lock, [&target]() { return target.stopping || !target.queue.empty(); });
+        if (target.queue.empty())
+        {
+            return; // stopping, with nothing left to apply
+        }
+
+        std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> batch;
+        batch.swap(target.queue);
+        target.applying = true;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try
+        {
+            apply(target, batch);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        target.applying = false;
+        if (error && !target.error)
+        {
+            target.error = error;
+        }
+        target.changed.notify_all();
+    }
+}
+
+void partitioned_table::apply(partition& target, std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>& batch)
+{
+    // the writes are in the order they were queued, so when a key repeats the last write wins
+    auto& tree = *target.tree;
+    std::vector<size_t> order(batch.size());
+    for (size_t n = 0; n < order.size(); n++)
+    {
+        order[n] = n;
+    }
+    std::stable_sort(order.begin(), order.end(), [&tree, &batch](size_t a, size_t b) {
+        return tree.compare_keys(batch[a].first, batch[b].first) < 0;
+    });
+
+    std::vector<std::vector<uint8_t>> upserts;
+    std::vector<std::vector<uint8_t>*> removes;
+    for (size_t n = 0; n < order.size(); n++)
+    {
+        auto& write = batch[order[n]];
+        if (n + 1 < order.size() && tree.compare_keys(write.first, batch[order[n + 1]].first) == 0)
+        {
+            continue;
+        }
+
+        if (write.second.empty())
+        {
+            removes.push_back(&write.first);
+        }
+        else
+        {
+            upserts.push_back(std::move(write.second));
+        }
+    }
+
+    tree.upsert_batch(target.transaction_id, upserts);
+    for (auto key : removes)
+    {
+        auto it = tree.seek_begin(*key);
+        if (!it.path.empty() && it.path.back().is_found)
+        {
+            tree.remove(target.transaction_id, it);
+        }
+    }
+}
+
+void partitioned_table::wait_idle(partition& target, std::unique_lock<std::mutex>& lock)
+{
+    target.changed.wait(lock, [&target]() { return target.queue.empty() && !target.applying; });
+}
+
+// called with the partition idle and its mutex held
+void partitioned_table::commit_partition(partition& target)
+{
+    target.tree->commit(target.transaction_id);
+    target.allocator->set_root(target.tree->get_offset());
+    target.allocator->commit();
+    target.transaction_id = target.allocator->create_transaction();
+}
+
+void partitioned_table::stop_writers()
+{
+    for (auto& existing : partitions_)
+    {
+        existing->stop_writer();
+    }
+}
+
+// applies what is queued and returns once the writer has finished
+void partitioned_table::partition::stop_writer()
+{
+    if (!writer.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    writer.join();
+}
+
+// called with the layout latched
+size_t partitioned_table::find_partition(std::span<uint8_t> key)
+{
+    if (mode_ == partition_mode::hash)
+    {
+        return get_checksum(key) % partitions_.size();
+    }
+
+    // the last partition whose lower bound is at or before the key. The first one's empty bound is before every key
+    auto& tree = *partitions_.front()->tree;
+    auto it = std::upper_bound(partitions_.begin() + 1, partitions_.end(), key, [&tree](std::span<uint8_t> key, auto& existing) {
+        return tree.compare_keys(key, existing->lower_bound) < 0;
+    });
+    return it - partitions_.begin() - 1;
+}
+
+void partitioned_table::enqueue(std::vector<uint8_t> key, std::vector<uint8_t> entry)
+{
+    std::shared_lock layout_lock(layout_latch_);
+    auto& target = *partitions_[find_partition(key)];
+    {
+        std::lock_guard lock(target.mutex);
+        target.queue.emplace_back(std::move(key), std::move(entry));
+    }
+    target.changed.notify_all();
+}
+
+void partitioned_table::upsert(std::span<uint8_t> entry)
+{
+    if (entry.size() != row_traits_->get_key_traits()->get_size() + row_traits_->get_value_traits()->get_size())
+    {
+        throw object_db_exception("entry does not match the table entry size");
+    }
+    enqueue(row_traits_->get_key_traits()->get_data(entry), std::vector<uint8_t>(entry.begin(), entry.end()));
+}
+
+void partitioned_table::remove(std::span<uint8_t> key)
+{
+    enqueue(std::vector<uint8_t>(key.begin(), key.end()), {});
+}
+
+void partitioned_table::flush()
+{
+    std::shared_lock layout_lock(layout_latch_);
+    std::exception_ptr error;
+    for (auto& existing : partitions_)
+    {
+        std::unique_lock lock(existing->mutex);
+        wait_idle(*existing, lock);
+        if (existing->error && !error)
+        {
+            error = existing->error;
+        }
+        existing->error = nullptr;
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void partitioned_table::commit()
+{
+    flush();
+
+    std::shared_lock layout_lock(layout_latch_);
+    for (auto& existing : partitions_)
+    {
+        std::unique_lock lock(existing->mutex);
+        wait_idle(*existing, lock);
+        commit_partition(*existing);
+    }
+}
+
+bool partitioned_table::get(std::span<uint8_t> key, std::span<uint8_t> value)
+{
+    std::shared_lock layout_lock(layout_latch_);
+    return partitions_[find_partition(key)]->tree->get(key, value);
+}
+
+void partitioned_table::scan(std::span<uint8_t> first_key, const std::function<bool(std::span<uint8_t> entry)>& visit)
+{
+    std::shared_lock layout_lock(layout_latch_);
+
+    // a cursor per partition, and each step visits the one at the lowest key. Range partitions ahead of the first
+    // key have nothing to visit, and each range partition stops at the next one's lower bound
+    struct partition_cursor
+    {
+        std::unique_ptr<btree_cursor> cursor;
+        std::vector<uint8_t> key;
+        std::vector<uint8_t> upper_bound; // empty for no bound
+    };
+
+    std::vector<uint8_t> entry;
+    auto settle = [&](partition_cursor& current, btree& tree)
+    {
+        if (current.cursor->is_end())
+        {
+            return;
+        }
+        auto cursor_entry = current.cursor->get_entry();
+        entry.assign(cursor_entry.begin(), cursor_entry.end());
+        current.key = row_traits_->get_key_traits()->get_data(entry);
+        if (!current.upper_bound.empty() && tree.compare_keys(current.key, current.upper_bound) >= 0)
+        {
+            current.cursor.reset();
+        }
+    };
+
+    size_t first = mode_ == partition_mode::range ? find_partition(first_key) : 0;
+    std::vector<partition_cursor> cursors;
+    std::vector<btree*> trees;
+    for (size_t n = first; n < partitions_.size(); n++)
+    {
+        partition_cursor current;
+        current.cursor = std::make_unique<btree_cursor>(*partitions_[n]->tree);
+        if (mode_ == partition_mode::range && n + 1 < partitions_.size())
+        {
+            current.upper_bound = partitions_[n + 1]->lower_bound;
+        }
+        current.cursor->seek(first_key);
+        settle(current, *partitions_[n]->tree);
+        cursors.push_back(std::move(current));
+        trees.push_back(partitions_[n]->tree.get());
+    }
+
+    auto& tree = *partitions_.front()->tree;
+    while (true)
+    {
+        partition_cursor* lowest = nullptr;
+        size_t lowest_index = 0;
+        for (size_t n = 0; n < cursors.size(); n++)
+        {
+            auto& current = cursors[n];
+            if (!current.cursor || current.cursor->is_end())
+            {
+                continue;
+            }
+            if (lowest == nullptr || tree.compare_keys(current.key, lowest->key) < 0)
+            {
+                lowest = &current;
+                lowest_index = n;
+            }
+        }
+        if (lowest == nullptr)
+        {
+            return;
+        }
+
+        if (!visit(lowest->cursor->get_entry()))
+        {
+            return;
+        }
+        lowest->cursor->next();
+        settle(*lowest, *trees[lowest_index]);
+    }
+}
+
+void partitioned_table::split_partition(std::span<uint8_t> key)
+{
+    if (mode_ != partition_mode::range)
+    {
+        throw object_db_exception("only range partitions can be split");
+    }
+    if (key.empty())
+    {
+        throw object_db_exception("a partition bound cannot be empty");
+    }
+
+    std::unique_lock layout_lock(layout_latch_); // no writes are queued until the layout is back
+    auto index = find_partition(key);
+    auto& existing = *partitions_[index];
+    std::unique_lock lock(existing.mutex);
+    wait_idle(existing, lock);
+    if (index > 0 && existing.tree->compare_keys(existing.lower_bound, key) == 0)
+    {
+        throw object_db_exception("the key is already a partition bound");
+    }
+
+    std::vector<uint8_t> upper_bound;
+    if (index + 1 < partitions_.size())
+    {
+        upper_bound = partitions_[index + 1]->lower_bound;
+    }
+
+    // the entries from the key up to the next bound. Ones beyond it were left behind by an earlier split and are no
+    // longer read
+    auto read_range = [&](btree& tree)
+    {
+        std::vector<std::vector<uint8_t>> entries;
+        btree_cursor cursor(tree);
+        for (bool more = cursor.seek(key); more; more = cursor.next())
+        {
+            auto entry = cursor.get_entry();
+            auto entry_key = row_traits_->get_key_traits()->get_data(entry);
+            if (!upper_bound.empty() && tree.compare_keys(entry_key, upper_bound) >= 0)
+            {
+                break;
+            }
+            entries.emplace_back(entry.begin(), entry.end());
+        }
+        return entries;
+    };
+    auto moved = read_range(*existing.tree);
+    auto committed = read_range(*existing.tree->open_committed());
+
+    // the id is saved before the partition is created, so a crash cannot leave a directory that a later split reuses
+    auto created_id = next_partition_id_++;
+    write_layout();
+
+    // the new partition commits only the entries that were committed, and takes the writes made since then into its
+    // open transaction, so a split commits none of the caller's writes. It is committed before the layout points at
+    // it, so a crash at any point leaves each committed key readable from the partition the saved layout routes it to
+    auto created = open_partition(created_id, std::vector<uint8_t>(key.begin(), key.end()));
+    {
+        std::unique_lock created_lock(created->mutex);
+        btree_vector_entry_source source(committed); // the new tree is empty and the cursor gave the entries in key order
+        created->tree->bulk_load(created->transaction_id, source);
+        commit_partition(*created);
+
+        std::vector<std::vector<uint8_t>> upserts;
+        std::vector<std::vector<uint8_t>> removes;
+        size_t c = 0;
+        for (auto& entry : moved)
+        {
+            auto moved_key = row_traits_->get_key_traits()->get_data(entry);
+            for (; c < committed.size(); c++)
+            {
+                auto committed_key = row_traits_->get_key_traits()->get_data(committed[c]);
+                auto order = created->tree->compare_keys(committed_key, moved_key);
+                if (order > 0)
+                {
+                    break;
+                }
+                if (order < 0)
+                {
+                    removes.push_back(committed_key);
+                }
+                else if (committed[c] == entry)
+                {
+                    break; // unchanged since the commit
+                }
+            }
+            if (c < committed.size() && committed[c] == entry)
+            {
+                c++;
+                continue;
+            }
+            upserts.push_back(entry);
+        }
+        for (; c < committed.size(); c++)
+        {
+            removes.push_back(row_traits_->get_key_traits()->get_data(committed[c]));
+        }
+
+        created->tree->upsert_batch(created->transaction_id, upserts);
+        for (auto& removed_key : removes)
+        {
+            auto it = created->tree->seek_begin(removed_key);
+            if (!it.path.empty() && it.path.back().is_found)
+            {
+                created->tree->remove(created->transaction_id, it);
+            }
+        }
+    }
+    partitions_.insert(partitions_.begin() + index + 1, std::move(created));
+    write_layout();
+
+    // the old partition no longer reads the moved range, so its copies go with its next commit
+    for (auto& entry : moved)
+    {
+        auto moved_key = row_traits_->get_key_traits()->get_data(entry);
+        auto it = existing.tree->seek_begin(moved_key);
+        if (!it.path.empty() && it.path.back().is_found)
+        {
+            existing.tree->remove(existing.transaction_id, it);
+        }
+    }
+}
+
+size_t partitioned_table::get_partition_count()
+{
+    std::shared_lock layout_lock(layout_latch_);
+    return partitions_.size();
+}
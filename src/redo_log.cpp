@@ -0,0 +1,249 @@
+#include <map>
+#include <set>
+
+#include "../include/redo_log.hpp"
+#include "../include/binary_iterator.hpp"
+#include "../include/span_iterator.hpp"
+
+redo_log::redo_log(file_cache& cache) : cache_(cache)
+{
+    std::vector<uint8_t> state(2 * sizeof(filesize_t));
+    cache_.read_bytes(0, 0, state);
+    span_iterator it(state);
+    auto file_id = read_filesize(it);
+    auto first_file_id = read_filesize(it);
+    if (file_id == 0)
+    {
+        write_state(); // a new log
+        cache_.sync();
+    }
+    else
+    {
+        file_id_ = file_id;
+        first_file_id_ = first_file_id == 0 ? file_id : first_file_id;
+    }
+
+    // records are appended after the last whole one, so a torn tail is overwritten by the next commit
+    redo_record record;
+    std::vector<uint8_t> bytes;
+    while (read_record(file_id_, head_offset_, record, bytes))
+    {
+    }
+}
+
+// the state is durable with the next sync, before any record appended after it is reported durable
+void redo_log::write_state()
+{
+    std::vector<uint8_t> state(2 * sizeof(filesize_t));
+    span_iterator it(state);
+    write_filesize(it, file_id_);
+    write_filesize(it, first_file_id_);
+    cache_.write_bytes(0, 0, state);
+}
+
+void redo_log::write_record(std::vector<uint8_t>& bytes, const redo_record& record)
+{
+    if (record.tree_name.size() > std::numeric_limits<uint16_t>::max())
+    {
+        throw object_db_exception("tree name is too long for the redo log");
+    }
+
+    auto record_offset = bytes.size();
+    auto record_size = record_header_size + record.tree_name.size() + record.data.size();
+    bytes.resize(record_offset + record_size);
+
+    span_iterator it({ bytes.begin() + record_offset, record_size });
+    write_uint32(it, (uint32_t)record_size);
+    it.write((uint8_t)record.operation);
+    write_uint64(it, record.transaction_id);
+    write_uint16(it, (uint16_t)record.tree_name.size());
+    std::copy(record.tree_name.begin(), record.tree_name.end(), bytes.begin() + record_offset + record_header_size);
+    std::copy(record.data.begin(), record.data.end(), bytes.begin() + record_offset + record_header_size + record.tree_name.size());
+}
+
+// read the record at offset and move past it. bytes receives the whole record. Returns false at the end of the file
+bool redo_log::read_record(filesize_t file_id, filesize_t& offset, redo_record& record, std::vector<uint8_t>& bytes)
+{
+    std::vector<uint8_t> header(record_header_size);
+    cache_.read_bytes(file_id, offset, header);
+
+    span_iterator it(header);
+    auto record_size = read_uint32(it);
+    if (record_size < record_header_size)
+    {
+        return false;
+    }
+    record.operation = (redo_operation)it.read();
+    record.transaction_id = read_uint64(it);
+    auto name_size = read_uint16(it);
+    if (name_size > record_size - record_header_size)
+    {
+        return false;
+    }
+
+    bytes.resize(record_size);
+    cache_.read_bytes(file_id, offset, bytes);
+    record.tree_name.assign(bytes.begin() + record_header_size, bytes.begin() + record_header_size + name_size);
+    record.data.assign(bytes.begin() + record_header_size + name_size, bytes.end());
+    offset += record_size;
+    return true;
+}
+
+// append whole records and return the position after them
+filesize_t redo_log::append_bytes(std::vector<uint8_t>& bytes)
+{
+    auto size = bytes.size();
+    bytes.resize(size + sizeof(uint32_t)); // a zero size marks the end of the log
+
+    std::lock_guard lock(mutex_);
+    cache_.write_bytes(file_id_, head_offset_, bytes);
+    head_offset_ += size;
+    appended_ += size;
+    return appended_;
+}
+
+filesize_t redo_log::append(filesize_t transaction_id, const std::vector<redo_record>& records)
+{
+    std::vector<uint8_t> bytes;
+    for (auto& record : records)
+    {
+        if (record.transaction_id != transaction_id || record.operation == redo_operation::commit ||
+            record.operation == redo_operation::abort)
+        {
+            throw object_db_exception("redo records must be changes of the committing transaction");
+        }
+        write_record(bytes, record);
+    }
+
+    redo_record commit_record{ redo_operation::commit, transaction_id, {}, std::vector<uint8_t>(sizeof(uint64_t)) };
+    span_iterator checksum_it(commit_record.data);
+    write_uint64(checksum_it, get_checksum(bytes));
+    write_record(bytes, commit_record);
+    return append_bytes(bytes);
+}
+
+// a sync covers everything appended before it began. A caller that waited for the one running either finds its
+// records synced by it, or syncs them together with everything the others appended in the meantime
+void redo_log::sync(filesize_t position)
+{
+    std::lock_guard sync_lock(sync_mutex_);
+    if (synced_ >= position)
+    {
+        return;
+    }
+
+    filesize_t appended = 0;
+    {
+        std::lock_guard lock(mutex_);
+        appended = appended_;
+    }
+    cache_.sync();
+    synced_ = appended;
+}
+
+void redo_log::commit(filesize_t transaction_id, const std::vector<redo_record>& records)
+{
+    sync(append(transaction_id, records));
+}
+
+void redo_log::abort(filesize_t transaction_id)
+{
+    std::vector<uint8_t> bytes;
+    write_record(bytes, redo_record{ redo_operation::abort, transaction_id, {}, {} });
+    sync(append_bytes(bytes));
+}
+
+void redo_log::replay(const std::function<void(const redo_record& record)>& apply)
+{
+    std::lock_guard lock(mutex_);
+
+    // an abort record follows the commit record it cancels, so find them all first
+    std::set<filesize_t> aborted;
+    redo_record record;
+    std::vector<uint8_t> bytes;
+    for (auto file_id = first_file_id_; file_id <= file_id_; file_id++)
+    {
+        filesize_t offset = 0;
+        while (read_record(file_id, offset, record, bytes))
+        {
+            if (record.operation == redo_operation::abort)
+            {
+                aborted.insert(record.transaction_id);
+            }
+        }
+    }
+
+    // the changes are held back until their commit record shows the transaction was logged whole. A transaction's
+    // records are appended together, so they are all in one file
+    std::map<filesize_t, std::vector<redo_record>> pending;
+    std::map<filesize_t, std::vector<uint8_t>> pending_bytes;
+
+    for (auto file_id = first_file_id_; file_id <= file_id_; file_id++)
+    {
+        filesize_t offset = 0;
+        while (read_record(file_id, offset, record, bytes))
+        {
+            if (record.operation == redo_operation::abort)
+            {
+                continue;
+            }
+            if (record.operation != redo_operation::commit)
+            {
+                auto& transaction_bytes = pending_bytes[record.transaction_id];
+                transaction_bytes.insert(transaction_bytes.end(), bytes.begin(), bytes.end());
+                pending[record.transaction_id].push_back(record);
+                continue;
+            }
+
+            span_iterator checksum_it(record.data);
+            if (!aborted.contains(record.transaction_id) && record.data.size() == sizeof(uint64_t) &&
+                read_uint64(checksum_it) == get_checksum(pending_bytes[record.transaction_id]))
+            {
+                for (auto& change : pending[record.transaction_id])
+                {
+                    apply(change);
+                }
+            }
+            pending.erase(record.transaction_id);
+            pending_bytes.erase(record.transaction_id);
+        }
+    }
+}
+
+filesize_t redo_log::start_file()
+{
+    std::lock_guard lock(mutex_);
+    file_id_++;
+    head_offset_ = 0;
+    write_state();
+    return file_id_;
+}
+
+void redo_log::release_files(filesize_t file_id)
+{
+    filesize_t first_file_id = 0;
+    {
+        std::lock_guard lock(mutex_);
+        first_file_id = first_file_id_;
+        first_file_id_ = std::max(first_file_id_, file_id);
+        write_state();
+    }
+
+    // the state no longer points at the files by the time they go
+    cache_.sync();
+    for (; first_file_id < file_id; first_file_id++)
+    {
+        cache_.remove_file(first_file_id);
+    }
+}
+
+void redo_log::reset()
+{
+    release_files(start_file());
+}
+
+filesize_t redo_log::get_size()
+{
+    std::lock_guard lock(mutex_);
+    return head_offset_;
+}
@@ -0,0 +1,156 @@
+#include <limits>
+
+#include "../include/root_catalog.hpp"
+#include "../include/btree_cursor.hpp"
+#include "../include/span_iterator.hpp"
+#include "../include/table_row_traits.hpp"
+
+static const size_t transaction_id_size = sizeof(filesize_t);
+
+root_catalog::root_catalog(file_cache& cache, file_allocator& allocator) :
+    allocator_(allocator),
+    tree_(create_row_traits(), cache, allocator.get_root(), allocator)
+{
+}
+
+std::shared_ptr<btree_row_traits> root_catalog::create_row_traits()
+{
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int name_id = row_traits_builder->add_span_field(max_name_size);
+    int transaction_id = row_traits_builder->add_span_field(transaction_id_size); // big-endian, so it sorts as bytes
+    row_traits_builder->add_span_field((uint32_t)far_offset_ptr::get_size());
+    row_traits_builder->add_key_reference(name_id);
+    row_traits_builder->add_key_reference(transaction_id);
+
+    return row_traits_builder->create_table_row_traits();
+}
+
+std::vector<uint8_t> root_catalog::make_key(const std::string& name, filesize_t transaction_id)
+{
+    if (name.empty() || name.size() > max_name_size)
+    {
+        throw object_db_exception("tree names in the root catalog must be 1 to 64 bytes");
+    }
+
+    std::vector<uint8_t> key(max_name_size + transaction_id_size, 0);
+    std::copy(name.begin(), name.end(), key.begin());
+
+    span_iterator transaction_it({ key.begin() + max_name_size, transaction_id_size });
+    write_uint64(transaction_it, transaction_id);
+    return key;
+}
+
+// the entry for the transaction, or else the one before it as long as it is still for the same tree
+bool root_catalog::find_root(const std::string& name, filesize_t transaction_id, far_offset_ptr& root)
+{
+    auto key = make_key(name, transaction_id);
+
+    btree_cursor cursor(tree_);
+    bool found = cursor.seek(key);
+    if (!found || !std::equal(key.begin(), key.end(), cursor.get_entry().begin()))
+    {
+        found = found ? cursor.prev() : cursor.seek_last();
+    }
+    if (!found)
+    {
+        return false;
+    }
+
+    auto entry = cursor.get_entry();
+    if (!std::equal(key.begin(), key.begin() + max_name_size, entry.begin()))
+    {
+        return false;
+    }
+
+    span_iterator root_it({ entry.begin() + key.size(), far_offset_ptr::get_size() });
+    root.read(root_it);
+    return true;
+}
+
+void root_catalog::set_root(filesize_t transaction_id, const std::string& name, far_offset_ptr root)
+{
+    set_roots(transaction_id, { { name, root } });
+}
+
+void root_catalog::set_roots(filesize_t transaction_id, const std::vector<std::pair<std::string, far_offset_ptr>>& roots)
+{
+    std::lock_guard lock(mutex_);
+
+    for (auto& [name, root] : roots)
+    {
+        auto entry = make_key(name, transaction_id);
+        entry.resize(entry.size() + far_offset_ptr::get_size());
+        span_iterator root_it({ entry.begin() + max_name_size + transaction_id_size, far_offset_ptr::get_size() });
+        root.write(root_it);
+
+        tree_.upsert(transaction_id, entry);
+    }
+    allocator_.set_root(tree_.get_offset());
+}
+
+void root_catalog::commit(filesize_t transaction_id, const std::string& name, btree& tree)
+{
+    tree.commit(transaction_id);
+    set_root(transaction_id, name, tree.get_offset());
+    allocator_.commit();
+}
+
+far_offset_ptr root_catalog::get_root(const std::string& name)
+{
+    std::lock_guard lock(mutex_);
+
+    far_offset_ptr root;
+    find_root(name, std::numeric_limits<filesize_t>::max(), root);
+    return root;
+}
+
+far_offset_ptr root_catalog::get_root(const std::string& name, filesize_t transaction_id)
+{
+    std::lock_guard lock(mutex_);
+
+    far_offset_ptr root;
+    if (!find_root(name, transaction_id, root))
+    {
+        throw object_db_exception("no root for the tree at or before the transaction");
+    }
+    return root;
+}
+
+void root_catalog::release_roots(filesize_t transaction_id, const std::string& name, filesize_t oldest_read_id)
+{
+    std::lock_guard lock(mutex_);
+
+    // everything before the root that reads as of oldest_read_id start from
+    auto first_key = make_key(name, 0);
+    auto kept_key = make_key(name, oldest_read_id);
+    std::vector<std::vector<uint8_t>> released;
+    {
+        btree_cursor cursor(tree_);
+        for (bool found = cursor.seek(first_key); found; found = cursor.next())
+        {
+            auto entry = cursor.get_entry();
+            if (!std::equal(first_key.begin(), first_key.begin() + max_name_size, entry.begin()))
+            {
+                break;
+            }
+            std::span<uint8_t> key(entry.begin(), first_key.size());
+            if (compare_span(key, kept_key) > 0)
+            {
+                break;
+            }
+            released.emplace_back(key.begin(), key.end());
+        }
+    }
+
+    if (!released.empty())
+    {
+        released.pop_back(); // the newest at or before oldest_read_id stays
+    }
+    for (auto& key : released)
+    {
+        auto it = tree_.seek_begin(key);
+        tree_.remove(transaction_id, it);
+    }
+    allocator_.set_root(tree_.get_offset());
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <set>
+
+#include "../include/table_descriptor.hpp"
+
+filesize_t table_descriptor::get_row_size() const
+{
+    filesize_t size = 0;
+    for (auto& field : fields)
+    {
+        size += field.get_field_width();
+    }
+    return size;
+}
+
+filesize_t table_descriptor::get_field_offset(int field) const
+{
+    if (field < 0 || field >= fields.size())
+    {
+        throw object_db_exception("the index refers to a field the table does not have");
+    }
+
+    filesize_t offset = 0;
+    for (int n = 0; n < field; n++)
+    {
+        offset += fields[n].get_field_width();
+    }
+    return offset;
+}
+
+const index_descriptor& table_descriptor::get_primary_key() const
+{
+    auto it = std::find_if(indexes.begin(), indexes.end(), [](const index_descriptor& index) { return index.type == primary_key; });
+    if (it == indexes.end())
+    {
+        throw object_db_exception("the table has no primary key");
+    }
+    return *it;
+}
+
+filesize_t table_descriptor::get_primary_key_size() const
+{
+    filesize_t size = 0;
+    for (auto field : get_primary_key().local_field_references)
+    {
+        size += fields.at(field).get_field_width();
+    }
+    return size;
+}
+
+void table_descriptor::validate() const
+{
+    if (fields.empty())
+    {
+        throw object_db_exception("a table needs at least one field");
+    }
+
+    std::set<std::string> field_names;
+    for (auto& field : fields)
+    {
+        if (field.name.empty() || field.name.size() > field_descriptor::max_string_length || !field_names.insert(field.name).second)
+        {
+            throw object_db_exception("every field needs a name of its own, of at most 64 bytes");
+        }
+        field.get_field_width(); // throws for an unknown type
+    }
+
+    std::set<std::string> index_names;
+    size_t primary_keys = 0;
+    for (auto& index : indexes)
+    {
+        if (index.name.empty() || index.name.size() > field_descriptor::max_string_length || !index_names.insert(index.name).second)
+        {
+            throw object_db_exception("every index needs a name of its own, of at most 64 bytes");
+        }
+        if (index.local_field_references.empty())
+        {
+            throw object_db_exception("an index needs at least one field");
+        }
+        std::set<int> referenced;
+        for (auto field : index.local_field_references)
+        {
+            if (field < 0 || field >= fields.size() || !referenced.insert(field).second)
+            {
+                throw object_db_exception("an index refers to a field the table does not have, or to one twice");
+            }
+        }
+        primary_keys += index.type == primary_key ? 1 : 0;
+    }
+    if (primary_keys != 1)
+    {
+        throw object_db_exception("a table needs exactly one primary key");
+    }
+}
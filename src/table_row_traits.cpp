@@ -42,6 +42,15 @@ std::shared_ptr<btree_data_traits> table_row_traits::get_entry_traits()
     return entry_traits_;
 }
 
+std::shared_ptr<overflow_field> table_row_traits::get_overflow_field(int position)
+{
+    if (position < 0 || position >= entry_traits_->fields_.size())
+    {
+        throw object_db_exception(std::format("invalid field reference: {}", position));
+    }
+    return std::dynamic_pointer_cast<overflow_field>(entry_traits_->fields_[position]);
+}
+
 field_data_traits::field_data_traits(uint32_t offset, uint32_t size) :
     offset_(offset),
     size_(size)
@@ -63,6 +72,11 @@ std::vector<uint8_t> field_data_traits::get_data(const std::span<uint8_t>& entry
     return std::vector<uint8_t>(entry_span.begin() + offset_, entry_span.begin() + offset_ + size_);
 }
 
+void field_data_traits::copy_data(const std::span<uint8_t>& entry_span, std::span<uint8_t> data)
+{
+    std::copy_n(entry_span.begin() + offset_, size_, data.begin());
+}
+
 
 int32_field::int32_field(uint32_t offset) : field_data_traits(offset, 4)
 {
@@ -75,7 +89,7 @@ int int32_field::compare(const std::span<uint8_t>& p1, const std::span<uint8_t>&
     auto n1 = read_int32(it1);
     auto n2 = read_int32(it2);
 
-    return n1 < n2;
+    return (n1 < n2) ? -1 : ((n1 > n2) ? 1 : 0);
 }
 
 uint32_field::uint32_field(uint32_t offset) : field_data_traits(offset, 4)
@@ -89,7 +103,7 @@ int uint32_field::compare(const std::span<uint8_t>& p1, const std::span<uint8_t>
     auto n1 = read_uint32(it1);
     auto n2 = read_uint32(it2);
 
-    return n1 < n2;
+    return (n1 < n2) ? -1 : ((n1 > n2) ? 1 : 0);
 }
 
 span_field::span_field(uint32_t offset, uint32_t size) : field_data_traits(offset, size)
@@ -101,6 +115,65 @@ int span_field::compare(const std::span<uint8_t>& p1, const std::span<uint8_t>&
     return compare_span(p1, p2);
 }
 
+overflow_field::overflow_field(uint32_t offset, uint32_t inline_size) :
+    field_data_traits(offset, inline_size + sizeof(uint32_t) + (uint32_t)far_offset_ptr::get_size()),
+    inline_size_(inline_size)
+{
+}
+
+int overflow_field::compare(const std::span<uint8_t>& p1, const std::span<uint8_t>& p2)
+{
+    return compare_span(p1.subspan(0, inline_size_), p2.subspan(0, inline_size_));
+}
+
+void overflow_field::set_value(file_cache& cache, file_allocator& allocator, filesize_t transaction_id, std::span<uint8_t> entry_span, std::span<const uint8_t> value)
+{
+    auto field = entry_span.subspan(get_offset(), get_size());
+    auto inline_length = std::min<size_t>(value.size(), inline_size_);
+    std::fill(field.begin(), field.end(), 0);
+    std::copy(value.begin(), value.begin() + inline_length, field.begin());
+
+    far_offset_ptr overflow;
+    if (value.size() > inline_size_)
+    {
+        overflow = overflow_chain::write(cache, allocator, transaction_id, value.subspan(inline_size_));
+    }
+
+    span_iterator it(field.subspan(inline_size_));
+    write_uint32(it, (uint32_t)value.size());
+    overflow.write(it);
+}
+
+uint32_t overflow_field::get_length(std::span<uint8_t> entry_span)
+{
+    span_iterator it(entry_span.subspan(get_offset() + inline_size_, sizeof(uint32_t)));
+    return read_uint32(it);
+}
+
+overflow_chain_reader overflow_field::get_overflow_reader(file_cache& cache, std::span<uint8_t> entry_span)
+{
+    span_iterator it(entry_span.subspan(get_offset() + inline_size_, get_size() - inline_size_));
+    auto length = read_uint32(it);
+    far_offset_ptr overflow;
+    overflow.read(it);
+
+    return overflow_chain_reader(cache, overflow, length > inline_size_ ? length - inline_size_ : 0);
+}
+
+std::vector<uint8_t> overflow_field::get_value(file_cache& cache, std::span<uint8_t> entry_span)
+{
+    std::vector<uint8_t> result(get_length(entry_span));
+    auto inline_length = std::min<size_t>(result.size(), inline_size_);
+    std::copy_n(entry_span.begin() + get_offset(), inline_length, result.begin());
+
+    auto reader = get_overflow_reader(cache, entry_span);
+    if (reader.read(std::span<uint8_t>(result).subspan(inline_length)) != result.size() - inline_length)
+    {
+        throw object_db_exception("overflow chain is shorter than its value");
+    }
+    return result;
+}
+
 entry_data_traits::entry_data_traits(const std::vector<std::shared_ptr<field_data_traits>>& fields) :
     fields_(fields)
 {
@@ -135,6 +208,17 @@ std::vector<uint8_t> entry_data_traits::get_data(const std::span<uint8_t>& entry
     return result;
 }
 
+void entry_data_traits::copy_data(const std::span<uint8_t>& entry_span, std::span<uint8_t> data)
+{
+    size_t position = 0;
+    for (auto& field : fields_)
+    {
+        auto size = (size_t)field->get_size();
+        std::copy_n(entry_span.begin() + field->get_offset(), size, data.begin() + position);
+        position += size;
+    }
+}
+
 uint32_t entry_data_traits::get_size()
 {
     uint32_t result = 0;
@@ -185,6 +269,27 @@ std::vector<uint8_t> reference_data_traits::get_data(const std::span<uint8_t>& e
     return result;
 }
 
+void reference_data_traits::copy_data(const std::span<uint8_t>& entry_span, std::span<uint8_t> data)
+{
+    size_t position = 0;
+    for (auto field_reference : field_references_)
+    {
+        auto& field = entry_traits_->fields_[field_reference];
+
+        auto size = (size_t)field->get_size();
+        std::copy_n(entry_span.begin() + field->get_offset(), size, data.begin() + position);
+        position += size;
+    }
+}
+
+bool reference_data_traits::is_byte_comparable()
+{
+    return std::all_of(field_references_.begin(), field_references_.end(), [this](int field_reference)
+        {
+            return entry_traits_->fields_[field_reference]->is_byte_comparable();
+        });
+}
+
 uint32_t reference_data_traits::get_size()
 {
     uint32_t result = 0;
@@ -233,12 +338,25 @@ int table_row_traits_builder::add_int32_field()
     return (int)result;
 }
 
+int table_row_traits_builder::add_overflow_field(int inline_size)
+{
+    auto result = field_traits_.size();
+    auto offset = get_current_offset();
+    field_traits_.push_back(std::make_shared<overflow_field>(offset, inline_size));
+    return (int)result;
+}
+
 void table_row_traits_builder::add_key_reference(int position)
 {
     if (position < 0 || position >= field_traits_.size())
     {
         throw object_db_exception("key reference does not refer to a known field position");
     }
+    // its comparison sees only the inline bytes, so two long values sharing a prefix would be the same key
+    if (std::dynamic_pointer_cast<overflow_field>(field_traits_[position]))
+    {
+        throw object_db_exception("an overflow field cannot be part of the key");
+    }
     field_references_.push_back(position);
 }
 
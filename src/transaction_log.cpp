@@ -0,0 +1,1235 @@
+#include <algorithm>
+#include <format>
+#include <functional>
+#include <optional>
+#include <set>
+
+#include "../include/transaction_log.hpp"
+#include "../include/binary_iterator.hpp"
+#include "../include/file_allocator.hpp"
+#include "../include/file_cache.hpp"
+#include "../include/root_catalog.hpp"
+#include "../include/span_iterator.hpp"
+#include "../include/table_row_traits.hpp"
+#include "../include/transaction_manager.hpp"
+
+/*
+* the catalog is kept in system tables, each entry a key followed by a value:
+* $schemas: the schema name (64 bytes, zero padded), then a reserved uint64_t
+* $tables: the schema name and the table name (64 bytes each), then the table id (uint64_t)
+* $fields: the table id (uint64_t) and the field number (uint32_t), then the field descriptor
+* $indexes: the table id (uint64_t) and the index number (uint32_t), then the index type (uint32_t), its name
+*   (64 bytes), its fields, the remote schema and table (int32_t each) and the remote fields. Fields are a count
+*   (uint32_t) followed by 16 int32_t references
+* the rows of each table are in a table of their own, named after the table id. A row is stored as its primary key
+* fields in key order, followed by its other fields in field order
+*/
+
+static const std::string schemas_table = "$schemas";
+static const std::string tables_table = "$tables";
+static const std::string fields_table = "$fields";
+static const std::string indexes_table = "$indexes";
+
+static const size_t name_size = field_descriptor::max_string_length;
+static const size_t number_key_size = sizeof(uint64_t) + sizeof(uint32_t);
+static const size_t max_references = 16;
+static const size_t references_size = sizeof(uint32_t) + max_references * sizeof(int32_t);
+static const size_t index_size = sizeof(uint32_t) + name_size + references_size + 2 * sizeof(int32_t) + references_size;
+static const size_t scan_chunk = 64; // entries read at a time when walking a range
+
+static void check_name(const std::string& name)
+{
+    if (name.empty() || name.size() > name_size || name.find('\0') != std::string::npos)
+    {
+        throw object_db_exception("names are 1 to 64 bytes long and hold no zero bytes");
+    }
+}
+
+static std::vector<uint8_t> make_name(const std::string& name)
+{
+    check_name(name);
+    std::vector<uint8_t> result(name_size, 0);
+    std::copy(name.begin(), name.end(), result.begin());
+    return result;
+}
+
+static std::string read_name(std::span<uint8_t> data)
+{
+    auto end = std::find(data.begin(), data.begin() + name_size, 0);
+    return std::string(data.begin(), end);
+}
+
+static std::vector<uint8_t> make_number_key(filesize_t table_id, uint32_t number)
+{
+    std::vector<uint8_t> key(number_key_size);
+    span_iterator it(key);
+    write_uint64(it, table_id);
+    write_uint32(it, number);
+    return key;
+}
+
+static std::vector<uint8_t> make_id_prefix(filesize_t table_id)
+{
+    std::vector<uint8_t> prefix(sizeof(uint64_t));
+    span_iterator it(prefix);
+    write_uint64(it, table_id);
+    return prefix;
+}
+
+static std::string get_rows_table(filesize_t table_id)
+{
+    return "rows_" + std::to_string(table_id);
+}
+
+static std::shared_ptr<btree_row_traits> create_system_traits(int key_size, int value_size)
+{
+    table_row_traits_builder builder;
+    builder.add_key_reference(builder.add_span_field(key_size));
+    builder.add_span_field(value_size);
+    return builder.create_table_row_traits();
+}
+
+static void write_references(span_iterator& it, const std::vector<int>& references)
+{
+    if (references.size() > max_references)
+    {
+        throw object_db_exception("an index refers to at most 16 fields");
+    }
+    write_uint32(it, (uint32_t)references.size());
+    for (size_t n = 0; n < max_references; n++)
+    {
+        write_int32(it, n < references.size() ? references[n] : 0);
+    }
+}
+
+static std::vector<int> read_references(span_iterator& it)
+{
+    auto count = std::min<size_t>(read_uint32(it), max_references);
+    std::vector<int> references;
+    for (size_t n = 0; n < max_references; n++)
+    {
+        auto reference = read_int32(it);
+        if (n < count)
+        {
+            references.push_back(reference);
+        }
+    }
+    return references;
+}
+
+static std::vector<uint8_t> write_index(const index_descriptor& index)
+{
+    std::vector<uint8_t> data(index_size, 0);
+    span_iterator it(data);
+    write_uint32(it, (uint32_t)index.type);
+    auto name = make_name(index.name);
+    write_span(it, name);
+    write_references(it, index.local_field_references);
+    write_int32(it, index.remote_schema);
+    write_int32(it, index.remote_table_name);
+    write_references(it, index.remote_schema_field_references);
+    return data;
+}
+
+static index_descriptor read_index(std::span<uint8_t> data)
+{
+    index_descriptor index;
+    span_iterator it(data);
+    index.type = (index_type)read_uint32(it);
+    index.name = read_name(data.subspan(sizeof(uint32_t)));
+    span_iterator references_it(data, sizeof(uint32_t) + name_size);
+    index.local_field_references = read_references(references_it);
+    index.remote_schema = read_int32(references_it);
+    index.remote_table_name = read_int32(references_it);
+    index.remote_schema_field_references = read_references(references_it);
+    return index;
+}
+
+static std::vector<index_descriptor>::iterator find_index(table_descriptor& descriptor, const std::string& name)
+{
+    auto it = std::find_if(descriptor.indexes.begin(), descriptor.indexes.end(),
+        [&](const index_descriptor& index) { return index.name == name; });
+    if (it == descriptor.indexes.end())
+    {
+        throw object_db_exception("no index with this name");
+    }
+    return it;
+}
+
+// where the fields of a row go in the entry that stores it
+class row_layout
+{
+    struct field_copy
+    {
+        size_t row_offset;
+        size_t entry_offset;
+        size_t size;
+    };
+
+    std::vector<field_copy> fields_; // in entry order
+    size_t key_fields_ = 0;
+    size_t key_size_ = 0;
+    size_t row_size_ = 0;
+public:
+    explicit row_layout(const table_descriptor& descriptor);
+
+    size_t get_key_size() const { return key_size_; }
+    size_t get_row_size() const { return row_size_; }
+
+    std::shared_ptr<btree_row_traits> create_row_traits() const;
+    std::vector<uint8_t> to_entry(std::span<uint8_t> row) const;
+    std::vector<uint8_t> to_row(std::span<uint8_t> entry) const;
+    std::vector<uint8_t> get_key(std::span<uint8_t> row) const;
+};
+
+row_layout::row_layout(const table_descriptor& descriptor)
+{
+    auto& key_references = descriptor.get_primary_key().local_field_references;
+    size_t entry_offset = 0;
+    auto add_field = [&](int field)
+    {
+        auto size = (size_t)descriptor.fields[field].get_field_width();
+        fields_.push_back({ (size_t)descriptor.get_field_offset(field), entry_offset, size });
+        entry_offset += size;
+    };
+
+    for (auto field : key_references)
+    {
+        add_field(field);
+    }
+    key_fields_ = fields_.size();
+    key_size_ = entry_offset;
+    for (int field = 0; field < descriptor.fields.size(); field++)
+    {
+        if (std::find(key_references.begin(), key_references.end(), field) == key_references.end())
+        {
+            add_field(field);
+        }
+    }
+    row_size_ = entry_offset;
+}
+
+std::shared_ptr<btree_row_traits> row_layout::create_row_traits() const
+{
+    table_row_traits_builder builder;
+    for (size_t n = 0; n < fields_.size(); n++)
+    {
+        auto field = builder.add_span_field((int)fields_[n].size);
+        if (n < key_fields_)
+        {
+            builder.add_key_reference(field);
+        }
+    }
+    return builder.create_table_row_traits();
+}
+
+std::vector<uint8_t> row_layout::to_entry(std::span<uint8_t> row) const
+{
+    if (row.size() != row_size_)
+    {
+        throw object_db_exception(std::format("a row of this table is {} bytes", row_size_));
+    }
+    std::vector<uint8_t> entry(row_size_);
+    for (auto& field : fields_)
+    {
+        std::copy_n(row.begin() + field.row_offset, field.size, entry.begin() + field.entry_offset);
+    }
+    return entry;
+}
+
+std::vector<uint8_t> row_layout::to_row(std::span<uint8_t> entry) const
+{
+    std::vector<uint8_t> row(row_size_);
+    for (auto& field : fields_)
+    {
+        std::copy_n(entry.begin() + field.entry_offset, field.size, row.begin() + field.row_offset);
+    }
+    return row;
+}
+
+std::vector<uint8_t> row_layout::get_key(std::span<uint8_t> row) const
+{
+    auto entry = to_entry(row);
+    entry.resize(key_size_);
+    return entry;
+}
+
+class btree_transaction_log : public transaction_log, public std::enable_shared_from_this<btree_transaction_log>
+{
+    file_cache cache_;
+    file_allocator allocator_;
+    root_catalog catalog_;
+    transaction_manager manager_;
+public:
+    explicit btree_transaction_log(const std::filesystem::path& root_path);
+    void add_tables(); // add the rows table of every table in the catalog
+
+    std::shared_ptr<transaction> begin_transaction() override;
+
+    transaction_manager& get_manager() { return manager_; }
+    filesize_t create_table_id() { return allocator_.create_transaction(); } // unique, as transaction ids are never reused
+};
+
+// the optimistic transaction behind a transaction and its iterators, with the catalog operations on top of it
+class catalog_transaction
+{
+    std::shared_ptr<btree_transaction_log> log_;
+    std::unique_ptr<optimistic_transaction> transaction_;
+    std::map<filesize_t, std::shared_ptr<row_layout>> layouts_;
+
+    bool exists(const std::string& table, std::vector<uint8_t> key);
+    void for_each_entry(const std::string& table, const std::vector<uint8_t>& prefix, size_t key_size,
+        const std::function<void(std::vector<uint8_t>& entry)>& action);
+    std::vector<uint8_t> make_table_key(const std::string& schema, const std::string& table);
+    void remove_descriptor(filesize_t table_id);
+    void store_descriptor(filesize_t table_id, const table_descriptor& descriptor);
+public:
+    explicit catalog_transaction(std::shared_ptr<btree_transaction_log> log);
+
+    optimistic_transaction& get() { return *transaction_; }
+    void commit();
+    void rollback();
+
+    // the rest of the first key after from among the keys starting with prefix, or the last one before from walking
+    // back. No from starts at either end, inclusive takes from itself too
+    std::optional<std::vector<uint8_t>> find_key(const std::string& table, const std::vector<uint8_t>& prefix,
+        const std::optional<std::vector<uint8_t>>& from, size_t key_size, bool backward, bool inclusive);
+    std::optional<std::string> find_name(const std::string& table, const std::vector<uint8_t>& prefix,
+        const std::optional<std::string>& from, bool backward, bool inclusive);
+
+    void create_schema(const std::string& schema);
+    void drop_schema(const std::string& schema);
+    std::optional<std::string> find_schema(const std::optional<std::string>& from, bool backward, bool inclusive);
+
+    void create_table(const std::string& schema, const table_descriptor& descriptor);
+    void drop_table(const std::string& schema, const std::string& table);
+    void alter_table(const std::string& schema, const std::string& table, const alter_table_command& command);
+    std::optional<std::string> find_table(const std::string& schema, const std::optional<std::string>& from, bool backward, bool inclusive);
+    filesize_t get_table_id(const std::string& schema, const std::string& table);
+    std::vector<filesize_t> get_table_ids();
+    table_descriptor load_descriptor(const std::string& schema, const std::string& table);
+    table_descriptor load_descriptor(filesize_t table_id);
+
+    void alter_index(const std::string& schema, const std::string& table, const std::string& index, const index_descriptor& descriptor);
+    void drop_index(const std::string& schema, const std::string& table, const std::string& index);
+
+    const row_layout& get_layout(filesize_t table_id);
+    bool get_row(filesize_t table_id, std::span<uint8_t> key, std::vector<uint8_t>& row);
+    void insert_row(filesize_t table_id, std::span<uint8_t> row);
+    void update_row(filesize_t table_id, std::span<uint8_t> key, std::span<uint8_t> row);
+    void delete_row(filesize_t table_id, std::span<uint8_t> key);
+};
+
+catalog_transaction::catalog_transaction(std::shared_ptr<btree_transaction_log> log)
+    : log_(log), transaction_(log->get_manager().begin_transaction())
+{
+}
+
+void catalog_transaction::commit()
+{
+    if (!transaction_->commit())
+    {
+        throw object_db_exception("the transaction conflicts with one that committed first and was rolled back");
+    }
+}
+
+void catalog_transaction::rollback()
+{
+    transaction_->rollback();
+}
+
+bool catalog_transaction::exists(const std::string& table, std::vector<uint8_t> key)
+{
+    std::vector<uint8_t> value(sizeof(uint64_t) + index_size); // enough for the value of any system table
+    return transaction_->get(table, key, value);
+}
+
+void catalog_transaction::for_each_entry(const std::string& table, const std::vector<uint8_t>& prefix, size_t key_size,
+    const std::function<void(std::vector<uint8_t>& entry)>& action)
+{
+    auto bound = prefix;
+    bound.resize(key_size, 0);
+    bool skip_bound = false;
+    while (true)
+    {
+        auto entries = transaction_->scan(table, bound, scan_chunk);
+        for (auto& entry : entries)
+        {
+            if (skip_bound && std::equal(bound.begin(), bound.end(), entry.begin()))
+            {
+                continue;
+            }
+            if (!std::equal(prefix.begin(), prefix.end(), entry.begin()))
+            {
+                return;
+            }
+            action(entry);
+        }
+        if (entries.size() < scan_chunk)
+        {
+            return;
+        }
+
+        // the next chunk starts at the last entry of this one
+        bound.assign(entries.back().begin(), entries.back().begin() + key_size);
+        skip_bound = true;
+    }
+}
+
+std::optional<std::vector<uint8_t>> catalog_transaction::find_key(const std::string& table, const std::vector<uint8_t>& prefix,
+    const std::optional<std::vector<uint8_t>>& from, size_t key_size, bool backward, bool inclusive)
+{
+    std::vector<uint8_t> bound;
+    if (from)
+    {
+        bound = prefix;
+        bound.insert(bound.end(), from->begin(), from->end());
+        bound.resize(key_size, 0);
+    }
+    else if (!prefix.empty())
+    {
+        bound = prefix;
+        bound.resize(key_size, backward ? 0xff : 0);
+    }
+
+    // keys are unique, so the second entry is the one wanted when the first is from itself
+    auto entries = backward ? transaction_->scan_back(table, bound, 2) : transaction_->scan(table, bound, 2);
+    for (auto& entry : entries)
+    {
+        std::vector<uint8_t> key(entry.begin(), entry.begin() + key_size);
+        if (!inclusive && from && key == bound)
+        {
+            continue;
+        }
+        if (!std::equal(prefix.begin(), prefix.end(), key.begin()))
+        {
+            return std::nullopt;
+        }
+        return std::vector<uint8_t>(key.begin() + prefix.size(), key.end());
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string> catalog_transaction::find_name(const std::string& table, const std::vector<uint8_t>& prefix,
+    const std::optional<std::string>& from, bool backward, bool inclusive)
+{
+    std::optional<std::vector<uint8_t>> from_key;
+    if (from)
+    {
+        from_key = std::vector<uint8_t>(from->begin(), from->end());
+        from_key->resize(name_size, 0);
+    }
+    auto key = find_key(table, prefix, from_key, prefix.size() + name_size, backward, inclusive);
+    if (!key)
+    {
+        return std::nullopt;
+    }
+    return read_name(*key);
+}
+
+void catalog_transaction::create_schema(const std::string& schema)
+{
+    auto key = make_name(schema);
+    if (exists(schemas_table, key))
+    {
+        throw object_db_exception("a schema with this name already exists");
+    }
+    key.resize(name_size + sizeof(uint64_t), 0);
+    transaction_->upsert(schemas_table, key);
+}
+
+void catalog_transaction::drop_schema(const std::string& schema)
+{
+    auto key = make_name(schema);
+    if (!exists(schemas_table, key))
+    {
+        throw object_db_exception("no schema with this name");
+    }
+
+    std::vector<std::string> tables;
+    for_each_entry(tables_table, key, 2 * name_size, [&](std::vector<uint8_t>& entry)
+        {
+            tables.push_back(read_name({ entry.begin() + name_size, name_size }));
+        });
+    for (auto& table : tables)
+    {
+        drop_table(schema, table);
+    }
+    transaction_->remove(schemas_table, key);
+}
+
+std::optional<std::string> catalog_transaction::find_schema(const std::optional<std::string>& from, bool backward, bool inclusive)
+{
+    return find_name(schemas_table, {}, from, backward, inclusive);
+}
+
+std::vector<uint8_t> catalog_transaction::make_table_key(const std::string& schema, const std::string& table)
+{
+    auto key = make_name(schema);
+    auto table_name = make_name(table);
+    key.insert(key.end(), table_name.begin(), table_name.end());
+    return key;
+}
+
+void catalog_transaction::create_table(const std::string& schema, const table_descriptor& descriptor)
+{
+    descriptor.validate();
+    auto key = make_table_key(schema, descriptor.name);
+    if (!exists(schemas_table, make_name(schema)))
+    {
+        throw object_db_exception("no schema with this name");
+    }
+    if (exists(tables_table, key))
+    {
+        throw object_db_exception("a table with this name already exists");
+    }
+
+    // the rows table is added right away, empty. Should the transaction not commit it is left unused
+    auto table_id = log_->create_table_id();
+    auto layout = std::make_shared<row_layout>(descriptor);
+    log_->get_manager().add_table(get_rows_table(table_id), layout->create_row_traits());
+    layouts_[table_id] = layout;
+
+    key.resize(2 * name_size + sizeof(uint64_t));
+    span_iterator it(key, 2 * name_size);
+    write_uint64(it, table_id);
+    transaction_->upsert(tables_table, key);
+    store_descriptor(table_id, descriptor);
+}
+
+void catalog_transaction::drop_table(const std::string& schema, const std::string& table)
+{
+    auto table_id = get_table_id(schema, table);
+    auto rows_table = get_rows_table(table_id);
+    auto key_size = get_layout(table_id).get_key_size();
+    for_each_entry(rows_table, {}, key_size, [&](std::vector<uint8_t>& entry)
+        {
+            transaction_->remove(rows_table, { entry.begin(), key_size });
+        });
+
+    remove_descriptor(table_id);
+    auto key = make_table_key(schema, table);
+    transaction_->remove(tables_table, key);
+}
+
+void catalog_transaction::alter_table(const std::string& schema, const std::string& table, const alter_table_command& command)
+{
+    auto table_id = get_table_id(schema, table);
+    auto descriptor = load_descriptor(table_id);
+    auto& key_references = descriptor.get_primary_key().local_field_references;
+
+    for (auto& adjustment : command.field_adjustments)
+    {
+        auto field = std::find_if(descriptor.fields.begin(), descriptor.fields.end(),
+            [&](const field_descriptor& field) { return field.name == adjustment.old_name; });
+        if (field == descriptor.fields.end())
+        {
+            throw object_db_exception("no field with this name");
+        }
+
+        // the rows are left as they are, so a field keeps its width
+        field_descriptor adjusted = *field;
+        adjusted.type_descriptor = adjustment.new_type;
+        if (adjusted.get_field_width() != field->get_field_width())
+        {
+            throw object_db_exception("a field can only change to a type of the same width");
+        }
+        if (!adjustment.new_name.empty())
+        {
+            adjusted.name = adjustment.new_name;
+        }
+        *field = adjusted;
+    }
+
+    for (auto& adjustment : command.index_adjustments)
+    {
+        auto index = find_index(descriptor, adjustment.old_name);
+        if (!adjustment.new_local_field_references.empty())
+        {
+            if (index->type == primary_key && adjustment.new_local_field_references != key_references)
+            {
+                throw object_db_exception("the primary key of a table cannot change");
+            }
+            index->local_field_references = adjustment.new_local_field_references;
+        }
+        if (!adjustment.new_name.empty())
+        {
+            index->name = adjustment.new_name;
+        }
+    }
+
+    descriptor.name = command.new_name.empty() ? table : command.new_name;
+    descriptor.validate();
+    if (descriptor.name != table)
+    {
+        auto key = make_table_key(schema, descriptor.name);
+        if (exists(tables_table, key))
+        {
+            throw object_db_exception("a table with this name already exists");
+        }
+        auto old_key = make_table_key(schema, table);
+        transaction_->remove(tables_table, old_key);
+        key.resize(2 * name_size + sizeof(uint64_t));
+        span_iterator it(key, 2 * name_size);
+        write_uint64(it, table_id);
+        transaction_->upsert(tables_table, key);
+    }
+    store_descriptor(table_id, descriptor);
+}
+
+std::optional<std::string> catalog_transaction::find_table(const std::string& schema, const std::optional<std::string>& from,
+    bool backward, bool inclusive)
+{
+    return find_name(tables_table, make_name(schema), from, backward, inclusive);
+}
+
+filesize_t catalog_transaction::get_table_id(const std::string& schema, const std::string& table)
+{
+    std::vector<uint8_t> value(sizeof(uint64_t));
+    auto key = make_table_key(schema, table);
+    if (!transaction_->get(tables_table, key, value))
+    {
+        throw object_db_exception("no table with this name");
+    }
+    span_iterator it(value);
+    return read_uint64(it);
+}
+
+std::vector<filesize_t> catalog_transaction::get_table_ids()
+{
+    std::vector<filesize_t> table_ids;
+    for_each_entry(tables_table, {}, 2 * name_size, [&](std::vector<uint8_t>& entry)
+        {
+            span_iterator it(entry, 2 * name_size);
+            table_ids.push_back(read_uint64(it));
+        });
+    return table_ids;
+}
+
+table_descriptor catalog_transaction::load_descriptor(const std::string& schema, const std::string& table)
+{
+    auto descriptor = load_descriptor(get_table_id(schema, table));
+    descriptor.name = table;
+    return descriptor;
+}
+
+table_descriptor catalog_transaction::load_descriptor(filesize_t table_id)
+{
+    table_descriptor descriptor;
+    auto prefix = make_id_prefix(table_id);
+    for_each_entry(fields_table, prefix, number_key_size, [&](std::vector<uint8_t>& entry)
+        {
+            field_descriptor field;
+            field.read_from_span({ entry.begin() + number_key_size, entry.end() });
+            descriptor.fields.push_back(field);
+        });
+    for_each_entry(indexes_table, prefix, number_key_size, [&](std::vector<uint8_t>& entry)
+        {
+            descriptor.indexes.push_back(read_index({ entry.begin() + number_key_size, entry.end() }));
+        });
+    return descriptor;
+}
+
+void catalog_transaction::remove_descriptor(filesize_t table_id)
+{
+    auto prefix = make_id_prefix(table_id);
+    for (auto& table : { fields_table, indexes_table })
+    {
+        for_each_entry(table, prefix, number_key_size, [&](std::vector<uint8_t>& entry)
+            {
+                transaction_->remove(table, { entry.begin(), number_key_size });
+            });
+    }
+}
+
+// the descriptor replaces the one stored, which may have had more fields or indexes
+void catalog_transaction::store_descriptor(filesize_t table_id, const table_descriptor& descriptor)
+{
+    remove_descriptor(table_id);
+    for (uint32_t n = 0; n < descriptor.fields.size(); n++)
+    {
+        auto entry = make_number_key(table_id, n);
+        entry.resize(number_key_size + field_descriptor::get_size());
+        descriptor.fields[n].write_to_span({ entry.begin() + number_key_size, entry.end() });
+        transaction_->upsert(fields_table, entry);
+    }
+    for (uint32_t n = 0; n < descriptor.indexes.size(); n++)
+    {
+        auto entry = make_number_key(table_id, n);
+        auto index = write_index(descriptor.indexes[n]);
+        entry.insert(entry.end(), index.begin(), index.end());
+        transaction_->upsert(indexes_table, entry);
+    }
+}
+
+void catalog_transaction::alter_index(const std::string& schema, const std::string& table, const std::string& index,
+    const index_descriptor& descriptor)
+{
+    auto table_id = get_table_id(schema, table);
+    auto table_descriptor = load_descriptor(table_id);
+    auto altered = find_index(table_descriptor, index);
+    if ((altered->type == primary_key || descriptor.type == primary_key) &&
+        (altered->type != descriptor.type || altered->local_field_references != descriptor.local_field_references))
+    {
+        throw object_db_exception("the primary key of a table cannot change");
+    }
+
+    *altered = descriptor;
+    table_descriptor.validate();
+    store_descriptor(table_id, table_descriptor);
+}
+
+void catalog_transaction::drop_index(const std::string& schema, const std::string& table, const std::string& index)
+{
+    auto table_id = get_table_id(schema, table);
+    auto descriptor = load_descriptor(table_id);
+    auto dropped = find_index(descriptor, index);
+    if (dropped->type == primary_key)
+    {
+        throw object_db_exception("the primary key of a table cannot be dropped");
+    }
+
+    descriptor.indexes.erase(dropped);
+    store_descriptor(table_id, descriptor);
+}
+
+const row_layout& catalog_transaction::get_layout(filesize_t table_id)
+{
+    auto& layout = layouts_[table_id];
+    if (!layout)
+    {
+        // fields only change to types of the same width and the primary key never changes, so neither does the layout
+        layout = std::make_shared<row_layout>(load_descriptor(table_id));
+    }
+    return *layout;
+}
+
+bool catalog_transaction::get_row(filesize_t table_id, std::span<uint8_t> key, std::vector<uint8_t>& row)
+{
+    auto& layout = get_layout(table_id);
+    if (key.size() != layout.get_key_size())
+    {
+        throw object_db_exception(std::format("a primary key of this table is {} bytes", layout.get_key_size()));
+    }
+
+    std::vector<uint8_t> entry(layout.get_row_size());
+    std::copy(key.begin(), key.end(), entry.begin());
+    if (!transaction_->get(get_rows_table(table_id), key, { entry.begin() + key.size(), entry.end() }))
+    {
+        return false;
+    }
+    row = layout.to_row(entry);
+    return true;
+}
+
+void catalog_transaction::insert_row(filesize_t table_id, std::span<uint8_t> row)
+{
+    auto& layout = get_layout(table_id);
+    auto entry = layout.to_entry(row);
+    std::vector<uint8_t> existing;
+    if (get_row(table_id, { entry.begin(), layout.get_key_size() }, existing))
+    {
+        throw object_db_exception("a row with this primary key already exists");
+    }
+    transaction_->upsert(get_rows_table(table_id), entry);
+}
+
+void catalog_transaction::update_row(filesize_t table_id, std::span<uint8_t> key, std::span<uint8_t> row)
+{
+    auto& layout = get_layout(table_id);
+    std::vector<uint8_t> existing;
+    if (!get_row(table_id, key, existing))
+    {
+        throw object_db_exception("no row with this primary key");
+    }
+
+    auto entry = layout.to_entry(row);
+    if (!std::equal(key.begin(), key.end(), entry.begin()))
+    {
+        // the row moves to its new key
+        if (get_row(table_id, { entry.begin(), layout.get_key_size() }, existing))
+        {
+            throw object_db_exception("a row with this primary key already exists");
+        }
+        transaction_->remove(get_rows_table(table_id), key);
+    }
+    transaction_->upsert(get_rows_table(table_id), entry);
+}
+
+void catalog_transaction::delete_row(filesize_t table_id, std::span<uint8_t> key)
+{
+    std::vector<uint8_t> existing;
+    if (!get_row(table_id, key, existing))
+    {
+        throw object_db_exception("no row with this primary key");
+    }
+    transaction_->remove(get_rows_table(table_id), key);
+}
+
+// a position among sorted keys: before the first, on one of them or past the last
+class key_position
+{
+public:
+    using find_function = std::function<std::optional<std::string>(const std::optional<std::string>& from, bool backward, bool inclusive)>;
+private:
+    find_function find_;
+    std::string key_;
+    bool on_ = false;
+    bool at_end_ = false;
+    bool found_ = false;
+
+    void move(const std::optional<std::string>& key, bool backward)
+    {
+        on_ = key.has_value();
+        at_end_ = !on_ && !backward;
+        found_ = on_;
+        if (on_)
+        {
+            key_ = *key;
+        }
+    }
+public:
+    explicit key_position(find_function find) : find_(find) {}
+
+    // found is true once a seek lands on the key it was given, or a step lands on any key
+    void seek_forward(const std::string& seek_to)
+    {
+        move(find_(seek_to, false, true), false);
+        found_ = on_ && key_ == seek_to;
+    }
+    void seek_backward(const std::string& seek_to)
+    {
+        move(find_(seek_to, true, true), true);
+        found_ = on_ && key_ == seek_to;
+    }
+    void step_forward()
+    {
+        if (!at_end_)
+        {
+            move(find_(on_ ? std::optional(key_) : std::nullopt, false, false), false);
+        }
+    }
+    void seek_last() { move(find_(std::nullopt, true, false), true); }
+    void step_back()
+    {
+        if (on_ || at_end_)
+        {
+            move(find_(on_ ? std::optional(key_) : std::nullopt, true, false), true);
+        }
+    }
+
+    bool found() const { return found_; }
+    bool at_end() const { return at_end_; }
+    bool at_start() const { return !on_ && !at_end_; }
+
+    const std::string& get() const
+    {
+        if (!on_)
+        {
+            throw object_db_exception("the iterator is not on an entry");
+        }
+        return key_;
+    }
+    void set(const std::string& key)
+    {
+        key_ = key;
+        on_ = true;
+        at_end_ = false;
+        found_ = true;
+    }
+    void forget() { found_ = false; } // the key is gone, steps still move on from it
+};
+
+static std::optional<std::string> find_in(const std::set<std::string>& keys, const std::optional<std::string>& from,
+    bool backward, bool inclusive)
+{
+    if (!backward)
+    {
+        auto it = !from ? keys.begin() : inclusive ? keys.lower_bound(*from) : keys.upper_bound(*from);
+        return it == keys.end() ? std::nullopt : std::optional(*it);
+    }
+    auto it = !from ? keys.end() : inclusive ? keys.upper_bound(*from) : keys.lower_bound(*from);
+    return it == keys.begin() ? std::nullopt : std::optional(*std::prev(it));
+}
+
+class btree_row_iterator : public row_iterator
+{
+    std::shared_ptr<catalog_transaction> transaction_;
+    filesize_t table_id_;
+    key_position position_;
+
+    blob_t get_current_key() const { return blob_t(position_.get().begin(), position_.get().end()); }
+    std::string pad_key(const std::string& key);
+public:
+    btree_row_iterator(std::shared_ptr<catalog_transaction> transaction, filesize_t table_id);
+
+    blob_t get_key() override { return get_current_key(); }
+    blob_t get_value() override;
+
+    void insert_entry(const span_t& key, const span_t& value) override;
+    void update_entry(const span_t& value) override;
+    void delete_entry() override;
+
+    void seek_forward(const std::string& seek_to) override { position_.seek_forward(pad_key(seek_to)); }
+    void seek_backward(const std::string& seek_to) override { position_.seek_backward(pad_key(seek_to)); }
+
+    bool found() override { return position_.found(); }
+    bool at_end() override { return position_.at_end(); }
+    bool at_start() override { return position_.at_start(); }
+
+    void step_forward() override { position_.step_forward(); }
+    void step_back() override { position_.step_back(); }
+};
+
+btree_row_iterator::btree_row_iterator(std::shared_ptr<catalog_transaction> transaction, filesize_t table_id)
+    : transaction_(transaction), table_id_(table_id),
+    position_([this](const std::optional<std::string>& from, bool backward, bool inclusive) -> std::optional<std::string>
+        {
+            auto& layout = transaction_->get_layout(table_id_);
+            std::optional<std::vector<uint8_t>> from_key;
+            if (from)
+            {
+                from_key = std::vector<uint8_t>(from->begin(), from->end());
+            }
+            auto key = transaction_->find_key(get_rows_table(table_id_), {}, from_key, layout.get_key_size(), backward, inclusive);
+            return key ? std::optional(std::string(key->begin(), key->end())) : std::nullopt;
+        })
+{
+}
+
+// a key to seek to is cut or zero padded to the size of the primary key
+std::string btree_row_iterator::pad_key(const std::string& key)
+{
+    auto padded = key;
+    padded.resize(transaction_->get_layout(table_id_).get_key_size(), 0);
+    return padded;
+}
+
+blob_t btree_row_iterator::get_value()
+{
+    auto key = get_current_key();
+    blob_t row;
+    if (!transaction_->get_row(table_id_, key, row))
+    {
+        throw object_db_exception("no row with this primary key");
+    }
+    return row;
+}
+
+void btree_row_iterator::insert_entry(const span_t& key, const span_t& value)
+{
+    auto row_key = transaction_->get_layout(table_id_).get_key(value);
+    if (!std::equal(key.begin(), key.end(), row_key.begin(), row_key.end()))
+    {
+        throw object_db_exception("the key is not the primary key of the row");
+    }
+    transaction_->insert_row(table_id_, value);
+    position_.set(std::string(row_key.begin(), row_key.end()));
+}
+
+void btree_row_iterator::update_entry(const span_t& value)
+{
+    auto key = get_current_key();
+    transaction_->update_row(table_id_, key, value);
+    auto row_key = transaction_->get_layout(table_id_).get_key(value);
+    position_.set(std::string(row_key.begin(), row_key.end()));
+}
+
+void btree_row_iterator::delete_entry()
+{
+    auto key = get_current_key();
+    transaction_->delete_row(table_id_, key);
+    position_.forget();
+}
+
+class btree_index_iterator : public index_iterator
+{
+    std::shared_ptr<catalog_transaction> transaction_;
+    std::string schema_;
+    std::string table_;
+    key_position position_;
+    index_descriptor descriptor_;
+public:
+    btree_index_iterator(std::shared_ptr<catalog_transaction> transaction, const std::string& schema, const std::string& table);
+
+    const index_descriptor& get_descriptor() override;
+    void alter(const index_descriptor& descriptor) override;
+
+    void seek_forward(const std::string& seek_to) override { position_.seek_forward(seek_to); }
+    void seek_backward(const std::string& seek_to) override { position_.seek_backward(seek_to); }
+
+    bool found() override { return position_.found(); }
+    bool at_end() override { return position_.at_end(); }
+    bool at_start() override { return position_.at_start(); }
+
+    void step_forward() override { position_.step_forward(); }
+    void step_back() override { position_.step_back(); }
+
+    void drop() override;
+};
+
+// indexes are few, so they are walked in name order from the descriptor
+btree_index_iterator::btree_index_iterator(std::shared_ptr<catalog_transaction> transaction, const std::string& schema,
+    const std::string& table)
+    : transaction_(transaction), schema_(schema), table_(table),
+    position_([this](const std::optional<std::string>& from, bool backward, bool inclusive)
+        {
+            std::set<std::string> names;
+            for (auto& index : transaction_->load_descriptor(schema_, table_).indexes)
+            {
+                names.insert(index.name);
+            }
+            return find_in(names, from, backward, inclusive);
+        })
+{
+}
+
+const index_descriptor& btree_index_iterator::get_descriptor()
+{
+    auto descriptor = transaction_->load_descriptor(schema_, table_);
+    descriptor_ = *find_index(descriptor, position_.get());
+    return descriptor_;
+}
+
+void btree_index_iterator::alter(const index_descriptor& descriptor)
+{
+    transaction_->alter_index(schema_, table_, position_.get(), descriptor);
+    position_.set(descriptor.name);
+}
+
+void btree_index_iterator::drop()
+{
+    transaction_->drop_index(schema_, table_, position_.get());
+    position_.forget();
+}
+
+class btree_table_iterator : public table_iterator
+{
+    std::shared_ptr<catalog_transaction> transaction_;
+    std::string schema_;
+    key_position position_;
+    table_descriptor descriptor_;
+
+    filesize_t get_table_id() { return transaction_->get_table_id(schema_, position_.get()); }
+public:
+    btree_table_iterator(std::shared_ptr<catalog_transaction> transaction, const std::string& schema);
+
+    const std::string get_table_name() override { return position_.get(); }
+
+    void create(const table_descriptor& descriptor) override;
+    const table_descriptor& get_descriptor() override;
+    void alter(const alter_table_command& descriptor) override;
+
+    std::shared_ptr<index_iterator> get_index_iterator(const std::string& index) override;
+    std::shared_ptr<row_iterator> get_row_iterator() override;
+
+    void insert_row(const span_t& values) override { transaction_->insert_row(get_table_id(), values); }
+    void update_row(const span_t& key, const span_t& values) override { transaction_->update_row(get_table_id(), key, values); }
+    void delete_row(const span_t& key) override { transaction_->delete_row(get_table_id(), key); }
+
+    void seek_forward(const std::string& seek_to) override { position_.seek_forward(seek_to); }
+    void seek_backward(const std::string& seek_to) override { position_.seek_backward(seek_to); }
+
+    bool found() override { return position_.found(); }
+    bool at_end() override { return position_.at_end(); }
+    bool at_start() override { return position_.at_start(); }
+
+    void step_forward() override { position_.step_forward(); }
+    void step_back() override { position_.step_back(); }
+
+    void drop() override;
+
+    void set(const std::string& table) { position_.set(table); }
+};
+
+btree_table_iterator::btree_table_iterator(std::shared_ptr<catalog_transaction> transaction, const std::string& schema)
+    : transaction_(transaction), schema_(schema),
+    position_([this](const std::optional<std::string>& from, bool backward, bool inclusive)
+        {
+            return transaction_->find_table(schema_, from, backward, inclusive);
+        })
+{
+}
+
+void btree_table_iterator::create(const table_descriptor& descriptor)
+{
+    transaction_->create_table(schema_, descriptor);
+    position_.set(descriptor.name);
+}
+
+const table_descriptor& btree_table_iterator::get_descriptor()
+{
+    descriptor_ = transaction_->load_descriptor(schema_, position_.get());
+    return descriptor_;
+}
+
+void btree_table_iterator::alter(const alter_table_command& descriptor)
+{
+    transaction_->alter_table(schema_, position_.get(), descriptor);
+    if (!descriptor.new_name.empty())
+    {
+        position_.set(descriptor.new_name);
+    }
+}
+
+std::shared_ptr<index_iterator> btree_table_iterator::get_index_iterator(const std::string& index)
+{
+    auto iterator = std::make_shared<btree_index_iterator>(transaction_, schema_, position_.get());
+    iterator->seek_forward(index);
+    return iterator;
+}
+
+std::shared_ptr<row_iterator> btree_table_iterator::get_row_iterator()
+{
+    return std::make_shared<btree_row_iterator>(transaction_, get_table_id());
+}
+
+void btree_table_iterator::drop()
+{
+    transaction_->drop_table(schema_, position_.get());
+    position_.forget();
+}
+
+class btree_schema_iterator : public schema_iterator
+{
+    std::shared_ptr<catalog_transaction> transaction_;
+    key_position position_;
+public:
+    explicit btree_schema_iterator(std::shared_ptr<catalog_transaction> transaction);
+
+    const std::string& get_schema_name() override { return position_.get(); }
+
+    void create_schema(const std::string& schema_name) override;
+
+    std::shared_ptr<table_iterator> create_table(const table_descriptor& descriptor) override;
+    std::shared_ptr<table_iterator> get_table_iterator(const std::string& table_name) override;
+
+    void seek_forward(const std::string& seek_to) override { position_.seek_forward(seek_to); }
+    void seek_backward(const std::string& seek_to) override { position_.seek_backward(seek_to); }
+
+    bool found() override { return position_.found(); }
+    bool at_end() override { return position_.at_end(); }
+    bool at_start() override { return position_.at_start(); }
+
+    void step_forward() override { position_.step_forward(); }
+    void step_back() override { position_.step_back(); }
+    void seek_last() { position_.seek_last(); }
+
+    void drop() override;
+};
+
+btree_schema_iterator::btree_schema_iterator(std::shared_ptr<catalog_transaction> transaction)
+    : transaction_(transaction),
+    position_([this](const std::optional<std::string>& from, bool backward, bool inclusive)
+        {
+            return transaction_->find_schema(from, backward, inclusive);
+        })
+{
+}
+
+void btree_schema_iterator::create_schema(const std::string& schema_name)
+{
+    transaction_->create_schema(schema_name);
+    position_.set(schema_name);
+}
+
+std::shared_ptr<table_iterator> btree_schema_iterator::create_table(const table_descriptor& descriptor)
+{
+    auto iterator = std::make_shared<btree_table_iterator>(transaction_, get_schema_name());
+    iterator->create(descriptor);
+    return iterator;
+}
+
+std::shared_ptr<table_iterator> btree_schema_iterator::get_table_iterator(const std::string& table_name)
+{
+    auto iterator = std::make_shared<btree_table_iterator>(transaction_, get_schema_name());
+    iterator->seek_forward(table_name);
+    return iterator;
+}
+
+void btree_schema_iterator::drop()
+{
+    transaction_->drop_schema(get_schema_name());
+    position_.forget();
+}
+
+class btree_transaction : public transaction
+{
+    std::shared_ptr<catalog_transaction> transaction_;
+public:
+    explicit btree_transaction(std::shared_ptr<btree_transaction_log> log)
+        : transaction_(std::make_shared<catalog_transaction>(log))
+    {
+    }
+
+    std::shared_ptr<schema_iterator> create_schema(const std::string& schema_name) override
+    {
+        auto iterator = std::make_shared<btree_schema_iterator>(transaction_);
+        iterator->create_schema(schema_name);
+        return iterator;
+    }
+
+    std::shared_ptr<table_iterator> create_table(const std::string& schema_name, const table_descriptor& table) override
+    {
+        auto iterator = std::make_shared<btree_table_iterator>(transaction_, schema_name);
+        iterator->create(table);
+        return iterator;
+    }
+
+    std::shared_ptr<schema_iterator> get_schema_iterator_start() override
+    {
+        auto iterator = std::make_shared<btree_schema_iterator>(transaction_);
+        iterator->step_forward();
+        return iterator;
+    }
+
+    std::shared_ptr<schema_iterator> get_schema_iterator_end() override
+    {
+        auto iterator = std::make_shared<btree_schema_iterator>(transaction_);
+        iterator->seek_last();
+        return iterator;
+    }
+
+    void commit() override { transaction_->commit(); }
+    void rollback() override { transaction_->rollback(); }
+};
+
+btree_transaction_log::btree_transaction_log(const std::filesystem::path& root_path)
+    : cache_(root_path), allocator_(cache_), catalog_(cache_, allocator_), manager_(cache_, allocator_, catalog_)
+{
+    manager_.add_table(schemas_table, create_system_traits(name_size, sizeof(uint64_t)));
+    manager_.add_table(tables_table, create_system_traits(2 * name_size, sizeof(uint64_t)));
+    manager_.add_table(fields_table, create_system_traits(number_key_size, (int)field_descriptor::get_size()));
+    manager_.add_table(indexes_table, create_system_traits(number_key_size, index_size));
+}
+
+// the rows tables are added before any transaction begins, as one that began earlier would see them empty
+void btree_transaction_log::add_tables()
+{
+    std::vector<std::pair<filesize_t, std::shared_ptr<btree_row_traits>>> tables;
+    {
+        catalog_transaction transaction(shared_from_this());
+        for (auto table_id : transaction.get_table_ids())
+        {
+            tables.emplace_back(table_id, row_layout(transaction.load_descriptor(table_id)).create_row_traits());
+        }
+        transaction.rollback();
+    }
+
+    for (auto& [table_id, row_traits] : tables)
+    {
+        manager_.add_table(get_rows_table(table_id), row_traits);
+    }
+}
+
+std::shared_ptr<transaction> btree_transaction_log::begin_transaction()
+{
+    return std::make_shared<btree_transaction>(shared_from_this());
+}
+
+std::shared_ptr<transaction_log> transaction_log::open(const std::filesystem::path& root_path)
+{
+    auto log = std::make_shared<btree_transaction_log>(root_path);
+    log->add_tables();
+    return log;
+}
@@ -0,0 +1,567 @@
+#include <algorithm>
+
+#include "../include/transaction_manager.hpp"
+#include "../include/btree_cursor.hpp"
+
+optimistic_transaction::optimistic_transaction(transaction_manager& manager, filesize_t snapshot_id) :
+    manager_(manager),
+    snapshot_id_(snapshot_id)
+{
+}
+
+optimistic_transaction::~optimistic_transaction()
+{
+    if (!finished_)
+    {
+        rollback();
+    }
+}
+
+void optimistic_transaction::check_open()
+{
+    if (finished_)
+    {
+        throw object_db_exception("the transaction has already committed or rolled back");
+    }
+}
+
+optimistic_transaction::table_state& optimistic_transaction::get_table(const std::string& table)
+{
+    check_open();
+    auto it = tables_.find(table);
+    if (it != tables_.end())
+    {
+        return it->second;
+    }
+
+    auto& state = tables_[table];
+    state.snapshot = manager_.open_snapshot(table, snapshot_id_);
+    return state;
+}
+
+bool optimistic_transaction::table_state::has_read(const std::vector<uint8_t>& key)
+{
+    if (read_keys.contains(key))
+    {
+        return true;
+    }
+
+    auto key_traits = snapshot->get_row_traits()->get_key_traits();
+    std::vector<uint8_t> compared = key;
+    return std::any_of(read_ranges.begin(), read_ranges.end(), [&](key_range& range)
+        {
+            return (range.low.empty() || key_traits->compare(range.low, compared) <= 0) &&
+                (range.high.empty() || key_traits->compare(compared, range.high) <= 0);
+        });
+}
+
+bool optimistic_transaction::get(const std::string& table, std::span<uint8_t> key, std::span<uint8_t> value)
+{
+    auto& state = get_table(table);
+    std::vector<uint8_t> key_data(key.begin(), key.end());
+    state.read_keys.insert(key_data);
+
+    auto written = state.writes.find(key_data);
+    if (written == state.writes.end())
+    {
+        return state.snapshot->get(key, value);
+    }
+    if (written->second.empty())
+    {
+        return false; // removed by this transaction
+    }
+
+    auto value_traits = state.snapshot->get_row_traits()->get_value_traits();
+    if (value.size() < value_traits->get_size())
+    {
+        throw object_db_exception("value buffer is smaller than the value size of the B-tree");
+    }
+    value_traits->copy_data(written->second, value);
+    return true;
+}
+
+void optimistic_transaction::upsert(const std::string& table, std::span<uint8_t> entry)
+{
+    auto& state = get_table(table);
+    auto key = state.snapshot->get_row_traits()->get_key_traits()->get_data(entry);
+    state.writes[key] = std::vector<uint8_t>(entry.begin(), entry.end());
+}
+
+void optimistic_transaction::remove(const std::string& table, std::span<uint8_t> key)
+{
+    auto& state = get_table(table);
+    state.writes[std::vector<uint8_t>(key.begin(), key.end())].clear();
+}
+
+std::vector<std::vector<uint8_t>> optimistic_transaction::scan(const std::string& table, std::span<uint8_t> from_key, size_t limit)
+{
+    return scan_entries(table, from_key, limit, false);
+}
+
+std::vector<std::vector<uint8_t>> optimistic_transaction::scan_back(const std::string& table, std::span<uint8_t> to_key, size_t limit)
+{
+    return scan_entries(table, to_key, limit, true);
+}
+
+// the snapshot and the transaction's writes are walked side by side, a write replacing the snapshot entry with its key
+std::vector<std::vector<uint8_t>> optimistic_transaction::scan_entries(const std::string& table, std::span<uint8_t> key, size_t limit,
+    bool backward)
+{
+    auto& state = get_table(table);
+    auto key_traits = state.snapshot->get_row_traits()->get_key_traits();
+    std::vector<uint8_t> bound(key.begin(), key.end());
+
+    // compares in the direction of the scan
+    auto compare = [&](std::span<uint8_t> k1, std::span<uint8_t> k2)
+    {
+        auto result = key_traits->compare(k1, k2);
+        return backward ? -result : result;
+    };
+
+    std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>*>> writes;
+    for (auto& [write_key, entry] : state.writes)
+    {
+        std::vector<uint8_t> compared = write_key;
+        if (bound.empty() || compare(compared, bound) >= 0)
+        {
+            writes.emplace_back(write_key, &entry);
+        }
+    }
+    std::sort(writes.begin(), writes.end(), [&](auto& w1, auto& w2) { return compare(w1.first, w2.first) < 0; });
+
+    btree_cursor cursor(*state.snapshot);
+    bool valid = false;
+    if (bound.empty())
+    {
+        valid = backward ? cursor.seek_last() : cursor.seek_first();
+    }
+    else
+    {
+        valid = cursor.seek(bound);
+        if (backward)
+        {
+            // seek finds the first key at or after the bound, walking back starts from the last one at or before it
+            if (!valid)
+            {
+                valid = cursor.seek_last();
+            }
+            else if (key_traits->compare(cursor.get_entry(), bound) > 0)
+            {
+                valid = cursor.prev();
+            }
+        }
+    }
+
+    std::vector<std::vector<uint8_t>> result;
+    size_t next_write = 0;
+    while (result.size() < limit)
+    {
+        std::vector<uint8_t> snapshot_key;
+        if (valid)
+        {
+            snapshot_key = key_traits->get_data(cursor.get_entry());
+        }
+
+        if (next_write < writes.size() && (!valid || compare(writes[next_write].first, snapshot_key) <= 0))
+        {
+            if (valid && compare(writes[next_write].first, snapshot_key) == 0)
+            {
+                valid = backward ? cursor.prev() : cursor.next();
+            }
+            auto& entry = *writes[next_write].second;
+            if (!entry.empty())
+            {
+                result.push_back(entry);
+            }
+            next_write++;
+            continue;
+        }
+        if (!valid)
+        {
+            break;
+        }
+
+        auto entry = cursor.get_entry();
+        result.emplace_back(entry.begin(), entry.end());
+        valid = backward ? cursor.prev() : cursor.next();
+    }
+
+    // a scan that stopped at the limit only passed over the keys up to its last entry
+    std::vector<uint8_t> last_key;
+    if (result.size() == limit && limit > 0)
+    {
+        last_key = key_traits->get_data(result.back());
+    }
+    state.read_ranges.push_back(backward ? key_range{ last_key, bound } : key_range{ bound, last_key });
+    return result;
+}
+
+bool optimistic_transaction::commit()
+{
+    check_open();
+    auto committed = manager_.commit(*this);
+    finished_ = true;
+    tables_.clear();
+    manager_.finish(snapshot_id_);
+    return committed;
+}
+
+void optimistic_transaction::rollback()
+{
+    check_open();
+    finished_ = true;
+    tables_.clear();
+    manager_.finish(snapshot_id_);
+}
+
+transaction_manager::transaction_manager(file_cache& cache, file_allocator& allocator, root_catalog& catalog) :
+    cache_(cache),
+    allocator_(allocator),
+    catalog_(catalog)
+{
+}
+
+void transaction_manager::add_table(const std::string& name, std::shared_ptr<btree_row_traits> row_traits)
+{
+    std::unique_lock lock(commit_mutex_);
+    commit_order_.wait(lock, [this]() { return pending_commits_.empty(); }); // its commit id must not overtake them
+    std::lock_guard tables_lock(tables_mutex_);
+    if (tables_.contains(name))
+    {
+        throw object_db_exception("the table has already been added");
+    }
+
+    // the table is committed as it is, so that transactions beginning from now on have a snapshot of it
+    auto tree = std::make_unique<btree>(row_traits, cache_, catalog_.get_root(name), allocator_);
+    auto commit_id = allocator_.create_transaction();
+    catalog_.commit(commit_id, name, *tree);
+    tables_[name] = std::move(tree);
+    added_ids_[name] = commit_id;
+    last_commit_id_ = commit_id;
+}
+
+btree& transaction_manager::get_tree(const std::string& name)
+{
+    std::lock_guard lock(tables_mutex_);
+    auto it = tables_.find(name);
+    if (it == tables_.end())
+    {
+        throw object_db_exception("no table with this name");
+    }
+    return *it->second;
+}
+
+// a table added after the snapshot was empty as of it
+std::unique_ptr<btree> transaction_manager::open_snapshot(const std::string& name, filesize_t snapshot_id)
+{
+    auto& tree = get_tree(name);
+    {
+        std::lock_guard lock(tables_mutex_);
+        if (added_ids_[name] <= snapshot_id)
+        {
+            return tree.open_snapshot(snapshot_id);
+        }
+    }
+    return std::make_unique<btree>(tree.get_row_traits(), cache_, far_offset_ptr{ 0, 0 }, allocator_);
+}
+
+std::unique_ptr<optimistic_transaction> transaction_manager::begin_transaction()
+{
+    std::lock_guard lock(commit_mutex_);
+    open_snapshot_ids_.insert(last_commit_id_);
+    return std::make_unique<optimistic_transaction>(*this, last_commit_id_);
+}
+
+filesize_t transaction_manager::get_last_commit_id()
+{
+    std::lock_guard lock(commit_mutex_);
+    return last_commit_id_;
+}
+
+// an empty entry removes the key
+void transaction_manager::apply_write(btree& tree, filesize_t commit_id, const std::vector<uint8_t>& key, std::span<uint8_t> entry)
+{
+    if (!entry.empty())
+    {
+        tree.upsert(commit_id, entry);
+        return;
+    }
+
+    std::vector<uint8_t> removed_key = key;
+    auto it = tree.seek_begin(removed_key);
+    if (!it.path.empty() && it.path.back().is_found)
+    {
+        tree.remove(commit_id, it);
+    }
+}
+
+bool transaction_manager::commit(optimistic_transaction& transaction)
+{
+    std::map<std::string, std::set<std::vector<uint8_t>>> written;
+    for (auto& [name, state] : transaction.tables_)
+    {
+        for (auto& [key, entry] : state.writes)
+        {
+            written[name].insert(key);
+        }
+    }
+
+    filesize_t commit_id = 0;
+    {
+        std::lock_guard lock(commit_mutex_);
+
+        // backward validation: nothing committed since the snapshot may have written a key the transaction read.
+        // Commits still applying their writes are recorded as well, they are ordered before this one
+        for (auto it = committed_writes_.upper_bound(transaction.snapshot_id_); it != committed_writes_.end(); ++it)
+        {
+            for (auto& [name, written_keys] : it->second)
+            {
+                auto state = transaction.tables_.find(name);
+                if (state == transaction.tables_.end())
+                {
+                    continue;
+                }
+                for (auto& key : written_keys)
+                {
+                    if (state->second.has_read(key))
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+        if (written.empty())
+        {
+            return true; // read only
+        }
+
+        commit_id = allocator_.create_transaction();
+        pending_commits_.push_back(commit_id);
+        for (auto& [name, keys] : written)
+        {
+            table_writers_[name].push_back(commit_id);
+        }
+        committed_writes_[commit_id] = written;
+    }
+
+    // nothing is committed or recorded until every write has applied, a write that throws rolls back every table
+    // the transaction touched
+    std::vector<std::pair<std::string, btree*>> touched;
+    std::exception_ptr error;
+    try
+    {
+        for (auto& [name, state] : transaction.tables_)
+        {
+            if (state.writes.empty())
+            {
+                continue;
+            }
+
+            wait_for_table(name, commit_id);
+            auto& tree = get_tree(name);
+            touched.emplace_back(name, &tree);
+            for (auto& [key, entry] : state.writes)
+            {
+                apply_write(tree, commit_id, key, entry);
+            }
+        }
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    std::unique_lock lock(commit_mutex_);
+    commit_order_.wait(lock, [this, commit_id]() { return pending_commits_.front() == commit_id; });
+
+    // with a redo log the records are appended here, in commit order, and synced once the lock is released. Commits
+    // that append while one syncs share the next sync
+    size_t committed_trees = 0;
+    filesize_t log_position = 0;
+    if (!error)
+    {
+        try
+        {
+            if (redo_log_ != nullptr)
+            {
+                std::vector<redo_record> records;
+                for (auto& [name, state] : transaction.tables_)
+                {
+                    for (auto& [key, entry] : state.writes)
+                    {
+                        records.push_back(entry.empty() ? redo_record{ redo_operation::remove, commit_id, name, key }
+                            : redo_record{ redo_operation::upsert, commit_id, name, entry });
+                    }
+                }
+                log_position = redo_log_->append(commit_id, records);
+            }
+
+            std::vector<std::pair<std::string, far_offset_ptr>> roots;
+            for (auto& [name, tree] : touched)
+            {
+                tree->commit(commit_id);
+                committed_trees++;
+                roots.emplace_back(name, tree->get_offset());
+            }
+            catalog_.set_roots(commit_id, roots);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+    }
+
+    if (error)
+    {
+        for (size_t n = committed_trees; n < touched.size(); n++)
+        {
+            touched[n].second->rollback(commit_id);
+        }
+        committed_writes_.erase(commit_id);
+
+        // a transaction reported as failed must not come back on recovery. If the abort record cannot be written
+        // either, the first error is still the one reported
+        if (log_position != 0)
+        {
+            try
+            {
+                redo_log_->abort(commit_id);
+            }
+            catch (...)
+            {
+            }
+        }
+    }
+    else if (redo_log_ == nullptr)
+    {
+        last_commit_id_ = commit_id;
+    }
+
+    pending_commits_.pop_front();
+    for (auto& [name, keys] : written)
+    {
+        auto& writers = table_writers_[name];
+        writers.erase(std::find(writers.begin(), writers.end(), commit_id));
+        if (writers.empty())
+        {
+            table_writers_.erase(name);
+        }
+    }
+    commit_order_.notify_all();
+    lock.unlock();
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    if (redo_log_ != nullptr)
+    {
+        // the commit is published once it is durable. The log is synced in order, so every commit logged before it
+        // is durable too, and publishing it publishes them
+        redo_log_->sync(log_position);
+        lock.lock();
+        last_commit_id_ = std::max(last_commit_id_, commit_id);
+        return true;
+    }
+
+    // one superblock write for all the tables. It holds every commit published by the time it is written, so
+    // commits that finish together share it
+    allocator_.commit();
+    return true;
+}
+
+void transaction_manager::wait_for_table(const std::string& name, filesize_t commit_id)
+{
+    std::unique_lock lock(commit_mutex_);
+    commit_order_.wait(lock, [this, &name, commit_id]() { return table_writers_[name].front() == commit_id; });
+}
+
+// once no open transaction began before a commit, its keys are no longer needed for validation, and the tables
+// only need to keep the snapshots from the oldest open transaction on
+void transaction_manager::finish(filesize_t snapshot_id)
+{
+    std::lock_guard lock(commit_mutex_);
+    open_snapshot_ids_.erase(open_snapshot_ids_.find(snapshot_id));
+
+    auto oldest = open_snapshot_ids_.empty() ? last_commit_id_ : *open_snapshot_ids_.begin();
+    committed_writes_.erase(committed_writes_.begin(), committed_writes_.upper_bound(oldest));
+
+    std::lock_guard tables_lock(tables_mutex_);
+    for (auto& [name, tree] : tables_)
+    {
+        tree->release_snapshots(oldest);
+    }
+}
+
+void transaction_manager::write_checkpoint()
+{
+    // the superblock has to be on disk before the log is emptied, the log is all that holds the commits since the last
+    allocator_.commit();
+    if (redo_log_ != nullptr)
+    {
+        redo_log_->reset();
+    }
+}
+
+void transaction_manager::checkpoint()
+{
+    std::lock_guard checkpoint_lock(checkpoint_mutex_);
+    if (redo_log_ == nullptr)
+    {
+        allocator_.commit();
+        return;
+    }
+
+    // commits logged before the switch have recorded their roots already, so the superblock written next holds them
+    // and their log files can go once it is durable. Commits carry on into the new file meanwhile
+    filesize_t log_file_id = 0;
+    {
+        std::lock_guard lock(commit_mutex_);
+        log_file_id = redo_log_->start_file();
+    }
+    allocator_.commit();
+    redo_log_->release_files(log_file_id);
+}
+
+void transaction_manager::recover()
+{
+    if (redo_log_ == nullptr)
+    {
+        throw object_db_exception("recovery needs a redo log");
+    }
+
+    std::unique_lock lock(commit_mutex_);
+    commit_order_.wait(lock, [this]() { return pending_commits_.empty(); });
+
+    // the log may hold writes the tables already have, from before a crash during a checkpoint, but applying an
+    // upsert or a remove again leaves the same rows
+    auto commit_id = allocator_.create_transaction();
+    std::set<std::string> changed;
+    redo_log_->replay([&](const redo_record& record)
+        {
+            auto& tree = get_tree(record.tree_name);
+            if (record.operation == redo_operation::remove)
+            {
+                apply_write(tree, commit_id, record.data, {});
+            }
+            else
+            {
+                auto entry = record.data;
+                apply_write(tree, commit_id, tree.get_row_traits()->get_key_traits()->get_data(entry), entry);
+            }
+            changed.insert(record.tree_name);
+        });
+
+    for (auto& name : changed)
+    {
+        auto& tree = get_tree(name);
+        tree.commit(commit_id);
+        catalog_.set_root(commit_id, name, tree.get_offset());
+    }
+    if (!changed.empty())
+    {
+        last_commit_id_ = commit_id;
+    }
+    write_checkpoint();
+}
@@ -0,0 +1,163 @@
+#include "../include/value_log.hpp"
+#include "../include/span_iterator.hpp"
+
+value_log::value_log(file_cache& cache) : cache_(cache)
+{
+    read_state();
+
+    // the head offset is not stored, so find it by walking the records of the head file. Appends carry on at the
+    // first torn record, which no committed tree can point at
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> value;
+    while (read_whole_record(head_file_id_, head_offset_, key, value))
+    {
+        head_offset_ += record_header_size + key.size() + value.size();
+    }
+}
+
+void value_log::read_state()
+{
+    std::vector<uint8_t> state(2 * sizeof(filesize_t));
+    cache_.read_bytes(0, 0, state);
+
+    span_iterator it(state);
+    auto tail_file_id = read_filesize(it);
+    auto head_file_id = read_filesize(it);
+    if (tail_file_id == 0)
+    {
+        write_state(); // a new log
+        return;
+    }
+
+    tail_file_id_ = tail_file_id;
+    next_collect_file_id_ = tail_file_id;
+    head_file_id_ = head_file_id;
+}
+
+void value_log::write_state()
+{
+    std::vector<uint8_t> state(2 * sizeof(filesize_t));
+    span_iterator it(state);
+    write_filesize(it, tail_file_id_);
+    write_filesize(it, head_file_id_);
+    cache_.write_bytes(0, 0, state);
+}
+
+// returns false at the end of the records in a file, or at a record that was never written whole
+bool value_log::read_whole_record(filesize_t file_id, filesize_t offset, std::vector<uint8_t>& key, std::vector<uint8_t>& value)
+{
+    std::vector<uint8_t> header(record_header_size);
+    cache_.read_bytes(file_id, offset, header);
+
+    span_iterator it(header);
+    auto checksum = read_uint64(it);
+    auto key_size = read_uint32(it);
+    auto value_size = read_uint32(it);
+    filesize_t record_size = record_header_size + (filesize_t)key_size + value_size;
+    if (key_size == 0 || (offset > 0 && offset + record_size > block_file_size))
+    {
+        return false; // only a record at the start of a file may be larger than a file
+    }
+
+    std::vector<uint8_t> record(record_size - sizeof(uint64_t));
+    cache_.read_bytes(file_id, offset + sizeof(uint64_t), record);
+    if (get_checksum(record) != checksum)
+    {
+        return false;
+    }
+
+    auto key_begin = record.begin() + record_header_size - sizeof(uint64_t);
+    key.assign(key_begin, key_begin + key_size);
+    value.assign(key_begin + key_size, record.end());
+    return true;
+}
+
+far_offset_ptr value_log::append(std::span<const uint8_t> key, std::span<const uint8_t> value)
+{
+    if (key.empty())
+    {
+        throw object_db_exception("value log records need a key");
+    }
+
+    std::vector<uint8_t> record(record_header_size + key.size() + value.size());
+    span_iterator it({ record.begin() + sizeof(uint64_t), record.end() });
+    write_uint32(it, (uint32_t)key.size());
+    write_uint32(it, (uint32_t)value.size());
+    std::copy(key.begin(), key.end(), record.begin() + record_header_size);
+    std::copy(value.begin(), value.end(), record.begin() + record_header_size + key.size());
+
+    span_iterator checksum_it(record);
+    write_uint64(checksum_it, get_checksum({ record.begin() + sizeof(uint64_t), record.end() }));
+
+    if (head_offset_ > 0 && head_offset_ + record.size() > block_file_size)
+    {
+        head_file_id_++;
+        head_offset_ = 0;
+        write_state();
+    }
+
+    far_offset_ptr location(head_file_id_, head_offset_);
+    cache_.write_bytes(head_file_id_, head_offset_, record);
+    head_offset_ += record.size();
+    return location;
+}
+
+void value_log::read_record(far_offset_ptr location, std::vector<uint8_t>& key, std::vector<uint8_t>& value)
+{
+    if (!read_whole_record(location.get_file_id(), location.get_offset(), key, value))
+    {
+        throw object_db_exception("no value log record at this location");
+    }
+}
+
+void value_log::sync()
+{
+    cache_.sync();
+}
+
+std::vector<uint8_t> value_log::read_value(far_offset_ptr location)
+{
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> value;
+    read_record(location, key, value);
+    return value;
+}
+
+filesize_t value_log::collect_tail(const std::function<bool(std::span<uint8_t> key, far_offset_ptr location)>& is_live,
+    const std::function<void(std::span<uint8_t> key, far_offset_ptr location)>& relocated)
+{
+    if (next_collect_file_id_ == head_file_id_)
+    {
+        return 0;
+    }
+
+    auto file_id = next_collect_file_id_;
+    filesize_t offset = 0;
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> value;
+    while (read_whole_record(file_id, offset, key, value))
+    {
+        far_offset_ptr location(file_id, offset);
+        if (is_live(key, location))
+        {
+            relocated(key, append(key, value));
+        }
+        offset += record_header_size + key.size() + value.size();
+    }
+
+    next_collect_file_id_++;
+    return file_id;
+}
+
+void value_log::release_file(filesize_t file_id)
+{
+    if (file_id != tail_file_id_ || file_id == next_collect_file_id_)
+    {
+        throw object_db_exception("value log files are released in the order they were collected");
+    }
+
+    // the state moves on before the file goes, so a failure in between only leaves an unreferenced file behind
+    tail_file_id_++;
+    write_state();
+    cache_.remove_file(file_id);
+}
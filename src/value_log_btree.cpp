@@ -0,0 +1,144 @@
+#include "../include/value_log_btree.hpp"
+#include "../include/table_row_traits.hpp"
+
+value_log_btree::value_log_btree(uint32_t key_size, file_cache& cache, far_offset_ptr offset, file_allocator& allocator, value_log& log,
+    uint32_t inline_size) :
+    log_(log),
+    key_size_(key_size),
+    inline_size_(std::max(inline_size, (uint32_t)far_offset_ptr::get_size())),
+    row_traits_(create_row_traits(key_size, inline_size_)),
+    tree_(row_traits_, cache, offset, allocator)
+{
+}
+
+std::shared_ptr<btree_row_traits> value_log_btree::create_row_traits(uint32_t key_size, uint32_t inline_size)
+{
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    row_traits_builder->add_span_field(sizeof(uint32_t) + inline_size);
+    row_traits_builder->add_key_reference(key_id);
+
+    return row_traits_builder->create_table_row_traits();
+}
+
+std::vector<uint8_t> value_log_btree::make_entry(std::span<const uint8_t> key, far_offset_ptr location)
+{
+    if (key.size() != key_size_)
+    {
+        throw object_db_exception("key does not match the key size of the tree");
+    }
+
+    std::vector<uint8_t> entry(key_size_ + sizeof(uint32_t) + inline_size_);
+    std::copy(key.begin(), key.end(), entry.begin());
+
+    span_iterator location_it({ entry.begin() + key_size_, entry.end() });
+    write_uint32(location_it, logged_value);
+    location.write(location_it);
+    return entry;
+}
+
+std::vector<uint8_t> value_log_btree::make_inline_entry(std::span<const uint8_t> key, std::span<const uint8_t> value)
+{
+    if (key.size() != key_size_)
+    {
+        throw object_db_exception("key does not match the key size of the tree");
+    }
+
+    std::vector<uint8_t> entry(key_size_ + sizeof(uint32_t) + inline_size_);
+    std::copy(key.begin(), key.end(), entry.begin());
+
+    span_iterator size_it({ entry.begin() + key_size_, sizeof(uint32_t) });
+    write_uint32(size_it, (uint32_t)value.size());
+    std::copy(value.begin(), value.end(), entry.begin() + key_size_ + sizeof(uint32_t));
+    return entry;
+}
+
+bool value_log_btree::get_stored_value(std::span<uint8_t> key, std::vector<uint8_t>& stored)
+{
+    stored.resize(sizeof(uint32_t) + inline_size_);
+    return tree_.get(key, stored);
+}
+
+bool value_log_btree::get_location(std::span<uint8_t> key, far_offset_ptr& location)
+{
+    std::vector<uint8_t> stored;
+    if (!get_stored_value(key, stored))
+    {
+        return false;
+    }
+
+    span_iterator location_it(stored);
+    if (read_uint32(location_it) != logged_value)
+    {
+        return false;
+    }
+    location.read(location_it);
+    return true;
+}
+
+// a logged value is in the log before the tree refers to it
+void value_log_btree::upsert(filesize_t transaction_id, std::span<uint8_t> key, std::span<const uint8_t> value)
+{
+    auto entry = value.size() <= inline_size_ ? make_inline_entry(key, value) : make_entry(key, log_.append(key, value));
+    tree_.upsert(transaction_id, entry);
+}
+
+bool value_log_btree::get(std::span<uint8_t> key, std::vector<uint8_t>& value)
+{
+    std::vector<uint8_t> stored;
+    if (!get_stored_value(key, stored))
+    {
+        return false;
+    }
+
+    span_iterator stored_it(stored);
+    auto stored_size = read_uint32(stored_it);
+    if (stored_size != logged_value)
+    {
+        value.assign(stored.begin() + sizeof(uint32_t), stored.begin() + sizeof(uint32_t) + stored_size);
+        return true;
+    }
+
+    far_offset_ptr location;
+    location.read(stored_it);
+    value = log_.read_value(location);
+    return true;
+}
+
+// the value stays in the log until its file is collected
+bool value_log_btree::remove(filesize_t transaction_id, std::span<uint8_t> key)
+{
+    auto it = tree_.seek_begin(key);
+    if (it.path.empty() || !it.path.back().is_found)
+    {
+        return false;
+    }
+
+    tree_.remove(transaction_id, it);
+    return true;
+}
+
+void value_log_btree::commit(filesize_t transaction_id)
+{
+    log_.sync();
+    tree_.commit(transaction_id);
+}
+
+// a record is live while the tree still points at it, anything else was overwritten, removed or replaced by an inline value
+filesize_t value_log_btree::collect_garbage(filesize_t transaction_id)
+{
+    auto is_live = [&](std::span<uint8_t> key, far_offset_ptr location)
+    {
+        far_offset_ptr current;
+        return get_location(key, current) && current == location;
+    };
+
+    auto relocated = [&](std::span<uint8_t> key, far_offset_ptr location)
+    {
+        auto entry = make_entry(key, location);
+        tree_.upsert(transaction_id, entry);
+    };
+
+    return log_.collect_tail(is_live, relocated);
+}
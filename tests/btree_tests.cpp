@@ -1,11 +1,24 @@
 
 #include "pch.h"
 #include <filesystem>
+#include <map>
+#include <set>
+#include <thread>
+#include <atomic>
 #include "../include/btree.hpp"
+#include "../include/btree_cursor.hpp"
+#include "../include/combining_writer.hpp"
+#include "../include/overflow_chain.hpp"
 #include "../include/file_allocator.hpp"
 #include "../include/file_cache.hpp"
+#include "../include/partitioned_table.hpp"
+#include "../include/redo_log.hpp"
+#include "../include/root_catalog.hpp"
 #include "../include/span_iterator.hpp"
 #include "../include/table_row_traits.hpp"
+#include "../include/transaction_log.hpp"
+#include "../include/transaction_manager.hpp"
+#include "../include/value_log_btree.hpp"
 
 class btree_test_fixture: public ::testing::Test
 {
@@ -150,3 +163,2808 @@ TEST_F(btree_test_fixture, test_delete)
         }
     }
 }
+
+TEST_F(btree_test_fixture, test_bulk_load)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    uint32_t entry_count = 2000;
+    std::vector<std::vector<uint8_t>> entries;
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+
+        write_uint32(key_span, i);
+        write_uint32(value_span, i % 10);
+        entries.push_back(entry);
+    }
+
+    btree_vector_entry_source source{ entries };
+    tree.bulk_load(transaction_id, source, 0.9);
+
+    uint32_t count = 0;
+    for (auto it = tree.begin(); !it.is_end(); it = tree.next(it))
+    {
+        auto entry = tree.get_entry(it);
+        EXPECT_TRUE(entry == entries[count]);
+        count++;
+    }
+    EXPECT_EQ(count, entry_count);
+
+    std::vector<uint8_t> key(key_size);
+    for (uint32_t i = 0; i < entry_count; i += 7)
+    {
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, i);
+
+        auto it = tree.seek_begin(key);
+        EXPECT_TRUE(it.path.back().is_found);
+    }
+
+    // the bulk loaded tree must still accept ordinary writes
+    std::vector<uint8_t> entry(key_size + value_size, 0xff);
+    tree.upsert(transaction_id, entry);
+
+    std::vector<uint8_t> last_key(entry.begin(), entry.begin() + key_size);
+    EXPECT_TRUE(tree.get_entry(tree.seek_begin(last_key)) == entry);
+}
+
+TEST_F(btree_test_fixture, test_upsert_batch)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    std::map<uint32_t, uint32_t> expected;
+    uint32_t seed = 12345;
+    for (uint32_t batch_number = 0; batch_number < 10; batch_number++)
+    {
+        std::vector<std::vector<uint8_t>> batch;
+        for (uint32_t i = 0; i < 300; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint32_t key_value = (seed >> 8) % 2000;
+
+            std::vector<uint8_t> entry(key_size + value_size, 0);
+            span_iterator key_span{ {entry.begin(), key_size} };
+            span_iterator value_span{ {entry.begin() + key_size, value_size} };
+
+            write_uint32(key_span, key_value);
+            write_uint32(value_span, batch_number * 1000 + i);
+            batch.push_back(entry);
+            expected[key_value] = batch_number * 1000 + i;
+        }
+        tree.upsert_batch(transaction_id, batch);
+
+        // later batches copy on write
+        if (batch_number == 5)
+        {
+            transaction_id = allocator.create_transaction();
+        }
+    }
+
+    auto expected_it = expected.begin();
+    for (auto it = tree.begin(); !it.is_end(); it = tree.next(it))
+    {
+        ASSERT_TRUE(expected_it != expected.end());
+
+        auto entry = tree.get_entry(it);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        EXPECT_EQ(read_uint32(key_span), expected_it->first);
+        EXPECT_EQ(read_uint32(value_span), expected_it->second);
+        expected_it++;
+    }
+    EXPECT_TRUE(expected_it == expected.end());
+}
+
+TEST_F(btree_test_fixture, test_large_upsert_batch)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 8;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    btree tree(row_traits_builder->create_table_row_traits(), cache, far_offset_ptr{ 0, 0 }, allocator);
+
+    // more entries than a node entry count can hold, all landing in the one leaf of an empty tree
+    uint32_t entry_count = 70000;
+    std::vector<std::vector<uint8_t>> entries;
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, i);
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(value_span, i * 3);
+        entries.push_back(entry);
+    }
+    tree.upsert_batch(transaction_id, entries);
+
+    uint32_t expected = 0;
+    for (auto it = tree.begin(); !it.is_end(); it = tree.next(it))
+    {
+        auto entry = tree.get_entry(it);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        ASSERT_EQ(read_uint32(key_span), expected);
+        ASSERT_EQ(read_uint32(value_span), expected * 3);
+        expected++;
+    }
+    EXPECT_EQ(expected, entry_count);
+}
+
+TEST_F(btree_test_fixture, test_single_pass_upsert)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    auto make_entry = [&](uint32_t key_value, uint32_t value) {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(key_span, key_value);
+        write_uint32(value_span, value);
+        return entry;
+    };
+
+    uint32_t entry_count = 1000;
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        uint32_t key_value = (i * 7919) % entry_count; // visit every key once, out of order
+        auto entry = make_entry(key_value, 0);
+
+        EXPECT_FALSE(tree.update_if_present(transaction_id, entry));
+        EXPECT_TRUE(tree.insert_if_absent(transaction_id, entry));
+        EXPECT_FALSE(tree.insert_if_absent(transaction_id, entry));
+
+        if (i == entry_count / 2)
+        {
+            transaction_id = allocator.create_transaction();
+        }
+    }
+
+    transaction_id = allocator.create_transaction();
+    for (uint32_t i = 0; i < entry_count; i += 3)
+    {
+        auto entry = make_entry(i, i);
+        auto it = tree.upsert(transaction_id, entry);
+        EXPECT_TRUE(tree.get_entry(it) == entry);
+    }
+
+    uint32_t count = 0;
+    for (auto it = tree.begin(); !it.is_end(); it = tree.next(it))
+    {
+        auto expected = make_entry(count, (count % 3 == 0) ? count : 0);
+        EXPECT_TRUE(tree.get_entry(it) == expected);
+        count++;
+    }
+    EXPECT_EQ(count, entry_count);
+}
+
+TEST_F(btree_test_fixture, test_append_mode)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+    tree.set_append_mode(true);
+
+    auto make_entry = [&](uint32_t key_value, uint32_t value) {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(key_span, key_value);
+        write_uint32(value_span, value);
+        return entry;
+    };
+
+    uint32_t entry_count = 3000;
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        auto entry = make_entry(i * 2, i);
+        auto it = tree.upsert(transaction_id, entry);
+        EXPECT_TRUE(tree.get_entry(it) == entry);
+
+        if (i == entry_count / 2)
+        {
+            transaction_id = allocator.create_transaction();
+
+            // a key behind the right edge takes the ordinary path
+            auto behind_entry = make_entry(1, 1);
+            tree.upsert(transaction_id, behind_entry);
+        }
+    }
+
+    uint32_t count = 0;
+    uint32_t leaf_count = 0;
+    far_offset_ptr leaf_offset;
+    for (auto it = tree.begin(); !it.is_end(); it = tree.next(it))
+    {
+        if (!(it.path.back().node_offset == leaf_offset))
+        {
+            leaf_offset = it.path.back().node_offset;
+            leaf_count++;
+        }
+        count++;
+    }
+    EXPECT_EQ(count, entry_count + 1);
+
+    // median splits would leave about 19 entries per leaf, right edge splits leave more than 30
+    EXPECT_LT(leaf_count, entry_count / 30);
+}
+
+TEST_F(btree_test_fixture, test_remove_redistribute)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+    tree.set_low_water_fraction(0.3);
+
+    uint32_t entry_count = 2000;
+    std::vector<std::vector<uint8_t>> entries;
+    std::set<uint32_t> expected;
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, i);
+        entries.push_back(entry);
+        expected.insert(i);
+    }
+
+    btree_vector_entry_source source{ entries };
+    tree.bulk_load(transaction_id, source);
+
+    std::vector<uint8_t> key(key_size);
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        uint32_t key_value = (i * 7919) % entry_count;
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, key_value);
+
+        auto it = tree.seek_begin(key);
+        ASSERT_TRUE(it.path.back().is_found);
+        it = tree.remove(transaction_id, it);
+        expected.erase(key_value);
+
+        // the returned iterator is positioned at the entry after the one removed
+        auto next_expected = expected.upper_bound(key_value);
+        if (next_expected != expected.end() && it.path.back().is_found)
+        {
+            auto entry = tree.get_entry(it);
+            span_iterator entry_span{ {entry.begin(), key_size} };
+            EXPECT_EQ(read_uint32(entry_span), *next_expected);
+        }
+
+        if (i % 500 == 0)
+        {
+            transaction_id = allocator.create_transaction();
+
+            auto expected_it = expected.begin();
+            for (auto tree_it = tree.begin(); !tree_it.is_end(); tree_it = tree.next(tree_it))
+            {
+                ASSERT_TRUE(expected_it != expected.end());
+                auto entry = tree.get_entry(tree_it);
+                span_iterator entry_span{ {entry.begin(), key_size} };
+                EXPECT_EQ(read_uint32(entry_span), *expected_it);
+                expected_it++;
+            }
+            EXPECT_TRUE(expected_it == expected.end());
+        }
+    }
+    EXPECT_TRUE(tree.begin() == tree.end());
+}
+
+TEST_F(btree_test_fixture, test_leaf_traversal)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    uint32_t entry_count = 3000;
+    std::vector<std::vector<uint8_t>> entries;
+    std::set<uint32_t> expected;
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, i * 2);
+        entries.push_back(entry);
+        expected.insert(i * 2);
+    }
+
+    btree_vector_entry_source source{ entries };
+    tree.bulk_load(transaction_id, source, 0.7);
+
+    auto check_scans = [&]()
+    {
+        auto expected_it = expected.begin();
+        for (auto tree_it = tree.begin(); !tree_it.is_end(); tree_it = tree.next(tree_it))
+        {
+            ASSERT_TRUE(expected_it != expected.end());
+            auto entry = tree.get_entry(tree_it);
+            span_iterator entry_span{ {entry.begin(), key_size} };
+            ASSERT_EQ(read_uint32(entry_span), *expected_it);
+            expected_it++;
+        }
+        EXPECT_TRUE(expected_it == expected.end());
+
+        auto reverse_it = expected.rbegin();
+        auto tree_it = tree.end();
+        for (size_t n = 0; n < expected.size(); n++)
+        {
+            tree_it = tree.prev(tree_it);
+            auto entry = tree.get_entry(tree_it);
+            span_iterator entry_span{ {entry.begin(), key_size} };
+            ASSERT_EQ(read_uint32(entry_span), *reverse_it);
+            reverse_it++;
+        }
+    };
+
+    check_scans();
+
+    // writes in the same transaction modify branches in place, so the cached copies must not be used afterwards
+    for (uint32_t i = 0; i < entry_count; i += 3)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, i * 2 + 1);
+        tree.upsert(transaction_id, entry);
+        expected.insert(i * 2 + 1);
+    }
+    check_scans();
+
+    transaction_id = allocator.create_transaction();
+    for (uint32_t i = 0; i < entry_count; i += 5)
+    {
+        std::vector<uint8_t> key(key_size);
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, i * 2);
+        auto it = tree.seek_begin(key);
+        ASSERT_TRUE(it.path.back().is_found);
+        tree.remove(transaction_id, it);
+        expected.erase(i * 2);
+    }
+    check_scans();
+}
+
+TEST_F(btree_test_fixture, test_cursor)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    btree_cursor empty_cursor(tree);
+    EXPECT_FALSE(empty_cursor.seek_first());
+    EXPECT_TRUE(empty_cursor.is_end());
+
+    uint32_t entry_count = 3000;
+    std::vector<std::vector<uint8_t>> entries;
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, i * 2);
+        entries.push_back(entry);
+    }
+
+    btree_vector_entry_source source{ entries };
+    tree.bulk_load(transaction_id, source);
+
+    btree_cursor cursor(tree);
+    uint32_t count = 0;
+    for (bool valid = cursor.seek_first(); valid; valid = cursor.next())
+    {
+        span_iterator entry_span{ cursor.get_entry() };
+        ASSERT_EQ(read_uint32(entry_span), count * 2);
+        count++;
+    }
+    EXPECT_EQ(count, entry_count);
+    EXPECT_TRUE(cursor.is_end());
+    EXPECT_FALSE(cursor.next());
+
+    for (bool valid = cursor.seek_last(); valid; valid = cursor.prev())
+    {
+        count--;
+        span_iterator entry_span{ cursor.get_entry() };
+        ASSERT_EQ(read_uint32(entry_span), count * 2);
+    }
+    EXPECT_EQ(count, 0);
+
+    std::vector<uint8_t> key(key_size);
+    for (uint32_t i = 0; i < entry_count * 2; i += 37)
+    {
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, i);
+
+        // odd keys are missing, so the cursor lands on the following even key
+        ASSERT_TRUE(cursor.seek(key));
+        span_iterator entry_span{ cursor.get_entry() };
+        uint32_t expected_key = (i + 1) & ~1u;
+        ASSERT_EQ(read_uint32(entry_span), expected_key);
+
+        auto entry = tree.get_entry(cursor.get_iterator());
+        span_iterator iterator_span{ {entry.begin(), key_size} };
+        EXPECT_EQ(read_uint32(iterator_span), expected_key);
+    }
+
+    span_iterator key_span{ {key.begin(), key_size} };
+    write_uint32(key_span, entry_count * 2);
+    EXPECT_FALSE(cursor.seek(key));
+    EXPECT_TRUE(cursor.is_end());
+}
+
+TEST_F(btree_test_fixture, test_get)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    std::vector<uint8_t> key(key_size);
+    std::vector<uint8_t> value(value_size);
+    EXPECT_FALSE(tree.contains(key));
+    EXPECT_FALSE(tree.get(key, value));
+
+    uint32_t entry_count = 3000;
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, i * 2);
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(value_span, i * 7);
+        tree.upsert(transaction_id, entry);
+    }
+
+    for (uint32_t i = 0; i < entry_count * 2; ++i)
+    {
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, i);
+
+        bool expected = (i % 2) == 0;
+        ASSERT_EQ(tree.contains(key), expected);
+        ASSERT_EQ(tree.get(key, value), expected);
+        if (expected)
+        {
+            span_iterator value_span{ value };
+            EXPECT_EQ(read_uint32(value_span), (i / 2) * 7);
+        }
+    }
+
+    std::vector<uint8_t> small_value(value_size - 1);
+    EXPECT_THROW(tree.get(key, small_value), object_db_exception);
+}
+
+TEST_F(btree_test_fixture, test_multi_get)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    uint32_t entry_count = 5000;
+    std::vector<std::vector<uint8_t>> entries;
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, i * 2);
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(value_span, i * 7);
+        entries.push_back(entry);
+    }
+
+    btree_vector_entry_source source{ entries };
+    tree.bulk_load(transaction_id, source);
+
+    // a mix of present and missing keys, including runs inside one leaf and keys past either end
+    std::vector<std::vector<uint8_t>> keys;
+    for (uint32_t k = 0; k < entry_count * 2 + 10; k += (k % 5) + 1)
+    {
+        std::vector<uint8_t> key(key_size);
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, k);
+        keys.push_back(key);
+    }
+
+    std::vector<uint8_t> values(keys.size() * value_size);
+    std::vector<bool> found;
+    auto found_count = tree.multi_get(keys, values, found);
+
+    size_t expected_count = 0;
+    std::vector<uint8_t> value(value_size);
+    for (size_t n = 0; n < keys.size(); n++)
+    {
+        bool expected = tree.get(keys[n], value);
+        ASSERT_EQ(found[n], expected);
+        if (expected)
+        {
+            expected_count++;
+            EXPECT_TRUE(std::equal(value.begin(), value.end(), values.begin() + n * value_size));
+        }
+    }
+    EXPECT_EQ(found_count, expected_count);
+
+    std::swap(keys.front(), keys.back());
+    EXPECT_THROW(tree.multi_get(keys, values, found), object_db_exception);
+}
+
+TEST_F(btree_test_fixture, test_leaf_key_array)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 500;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+    tree.set_leaf_key_array(true);
+
+    std::map<uint32_t, uint32_t> expected;
+    auto make_entry = [&](uint32_t key_value, uint32_t value)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, key_value);
+        span_iterator value_span{ {entry.begin() + key_size + value_size - 4, 4} };
+        write_uint32(value_span, value);
+        return entry;
+    };
+
+    auto check = [&](btree& check_tree)
+    {
+        btree_cursor cursor(check_tree);
+        auto expected_it = expected.begin();
+        for (bool valid = cursor.seek_first(); valid; valid = cursor.next())
+        {
+            ASSERT_TRUE(expected_it != expected.end());
+            auto entry = cursor.get_entry();
+            span_iterator key_span{ {entry.begin(), key_size} };
+            ASSERT_EQ(read_uint32(key_span), expected_it->first);
+            span_iterator value_span{ {entry.begin() + key_size + value_size - 4, 4} };
+            ASSERT_EQ(read_uint32(value_span), expected_it->second);
+            expected_it++;
+        }
+        EXPECT_TRUE(expected_it == expected.end());
+
+        std::vector<uint8_t> value(value_size);
+        for (auto& [key_value, expected_value] : expected)
+        {
+            std::vector<uint8_t> key(key_size);
+            span_iterator key_span{ {key.begin(), key_size} };
+            write_uint32(key_span, key_value);
+            ASSERT_TRUE(check_tree.get(key, value));
+            span_iterator value_span{ {value.begin() + value_size - 4, 4} };
+            ASSERT_EQ(read_uint32(value_span), expected_value);
+        }
+    };
+
+    for (uint32_t i = 0; i < 1500; i++)
+    {
+        uint32_t key_value = (i * 7919) % 2000;
+        auto entry = make_entry(key_value, i);
+        tree.upsert(transaction_id, entry);
+        expected[key_value] = i;
+    }
+    check(tree);
+
+    transaction_id = allocator.create_transaction();
+    for (uint32_t key_value = 0; key_value < 2000; key_value += 3)
+    {
+        std::vector<uint8_t> key(key_size);
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, key_value);
+        auto it = tree.seek_begin(key);
+        if (it.path.back().is_found)
+        {
+            tree.remove(transaction_id, it);
+            expected.erase(key_value);
+        }
+    }
+    check(tree);
+
+    // the layout is recorded in each node, so a tree opened without the setting reads and extends it unchanged
+    btree reopened(traits, cache, tree.get_offset(), allocator);
+    for (uint32_t key_value = 2000; key_value < 2500; key_value++)
+    {
+        auto entry = make_entry(key_value, key_value);
+        reopened.upsert(transaction_id, entry);
+        expected[key_value] = key_value;
+    }
+    check(reopened);
+}
+
+TEST_F(btree_test_fixture, test_key_compression)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    // wide keys sharing a long prefix, so that separators truncate and nodes compress well
+    uint32_t key_size = 200;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+
+    std::map<uint32_t, uint32_t> expected;
+    auto make_key = [&](uint32_t key_value)
+    {
+        std::vector<uint8_t> key(key_size, 'k');
+        span_iterator key_span{ {key.begin() + 100, 4} };
+        write_uint32(key_span, key_value);
+        return key;
+    };
+    auto make_entry = [&](uint32_t key_value, uint32_t value)
+    {
+        auto entry = make_key(key_value);
+        entry.resize(key_size + value_size, 0);
+        span_iterator value_span{ {entry.begin() + key_size, 4} };
+        write_uint32(value_span, value);
+        return entry;
+    };
+
+    auto check = [&](btree& check_tree)
+    {
+        btree_cursor cursor(check_tree);
+        auto expected_it = expected.begin();
+        for (bool valid = cursor.seek_first(); valid; valid = cursor.next())
+        {
+            ASSERT_TRUE(expected_it != expected.end());
+            auto entry = cursor.get_entry();
+            std::vector<uint8_t> expected_entry = make_entry(expected_it->first, expected_it->second);
+            ASSERT_TRUE(std::equal(entry.begin(), entry.end(), expected_entry.begin(), expected_entry.end()));
+            expected_it++;
+        }
+        EXPECT_TRUE(expected_it == expected.end());
+
+        std::vector<uint8_t> value(value_size);
+        for (auto& [key_value, expected_value] : expected)
+        {
+            auto key = make_key(key_value);
+            ASSERT_TRUE(check_tree.get(key, value));
+            span_iterator value_span{ {value.begin(), 4} };
+            ASSERT_EQ(read_uint32(value_span), expected_value);
+        }
+
+        auto missing = make_key(50000);
+        EXPECT_FALSE(check_tree.contains(missing));
+    };
+
+    btree tree(traits, cache, initial, allocator);
+    tree.set_leaf_compression(true);
+
+    for (uint32_t i = 0; i < 6000; i++)
+    {
+        uint32_t key_value = (i * 7919) % 9000;
+        auto entry = make_entry(key_value, i);
+        tree.upsert(transaction_id, entry);
+        expected[key_value] = i;
+    }
+    check(tree);
+
+    // compressed branches and leaves hold more entries, so the same rows in a plain tree need more levels
+    btree plain(traits, cache, initial, allocator);
+    plain.set_leaf_compression(false);
+    for (auto& [key_value, value] : expected)
+    {
+        auto entry = make_entry(key_value, value);
+        plain.upsert(transaction_id, entry);
+    }
+    EXPECT_LT(tree.begin().path.size(), plain.begin().path.size());
+
+    transaction_id = allocator.create_transaction();
+    for (uint32_t key_value = 0; key_value < 9000; key_value += 3)
+    {
+        auto key = make_key(key_value);
+        auto it = tree.seek_begin(key);
+        if (it.path.back().is_found)
+        {
+            tree.remove(transaction_id, it);
+            expected.erase(key_value);
+        }
+    }
+    check(tree);
+
+    // bulk loaded trees truncate separators the same way
+    std::vector<std::vector<uint8_t>> entries;
+    for (auto& [key_value, value] : expected)
+    {
+        entries.push_back(make_entry(key_value, value));
+    }
+
+    btree loaded(traits, cache, initial, allocator);
+    loaded.set_leaf_compression(true);
+    btree_vector_entry_source source{ entries };
+    loaded.bulk_load(transaction_id, source, 1.0);
+    check(loaded);
+
+    // compression is recorded per node, so a tree opened with the setting off still reads and extends it
+    btree reopened(traits, cache, loaded.get_offset(), allocator);
+    reopened.set_leaf_compression(false);
+    for (uint32_t key_value = 9000; key_value < 9500; key_value++)
+    {
+        auto entry = make_entry(key_value, key_value);
+        reopened.upsert(transaction_id, entry);
+        expected[key_value] = key_value;
+    }
+    check(reopened);
+}
+
+TEST_F(btree_test_fixture, test_compact_branch_pointers)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 8;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    btree_node node(tree);
+    node.init_root();
+    node.set_key_size(key_size);
+    node.set_value_size(far_offset_ptr::get_compact_size());
+
+    std::vector<far_offset_ptr> expected;
+    std::vector<uint8_t> key(key_size);
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, i);
+        far_offset_ptr offset{ far_offset_ptr::compact_max_file_id - i, (far_offset_ptr::compact_max_block - i) * block_size };
+        node.insert_branch_entry(i, key, offset);
+        expected.push_back(offset);
+    }
+    EXPECT_EQ(node.get_value_size(), far_offset_ptr::get_compact_size());
+
+    // a pointer that has no compact form widens the whole node
+    far_offset_ptr wide{ far_offset_ptr::compact_max_file_id + 1, block_size };
+    auto wide_key = node.get_key_at(3);
+    node.update_branch_entry(3, wide_key, wide);
+    expected[3] = wide;
+    EXPECT_EQ(node.get_value_size(), far_offset_ptr::get_size());
+
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        EXPECT_TRUE(node.get_branch_value_at(i) == expected[i]);
+        span_iterator key_span{ {key.begin(), key_size} };
+        write_uint32(key_span, i);
+        EXPECT_TRUE(node.get_key_at(i) == key);
+    }
+
+    // compact and wide branches agree on a format before entries move between them
+    btree_node compact(tree);
+    compact.init_root();
+    compact.set_key_size(key_size);
+    compact.set_value_size(far_offset_ptr::get_compact_size());
+    compact.borrow_from_left(node, 4);
+    expected.erase(expected.begin(), expected.begin() + 6);
+
+    EXPECT_EQ(compact.get_value_size(), far_offset_ptr::get_size());
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        EXPECT_TRUE(compact.get_branch_value_at(i) == expected[i]);
+    }
+}
+
+TEST_F(btree_test_fixture, test_slotted_leaves)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    // text columns declared far wider than the values they usually hold
+    uint32_t key_size = 100;
+    uint32_t value_size = 700;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+
+    std::map<uint32_t, uint32_t> expected;
+    auto make_key = [&](uint32_t key_value)
+    {
+        std::vector<uint8_t> key(key_size, 0);
+        auto number = std::to_string(key_value);
+        auto text = "row-" + std::string(5 - number.size(), '0') + number;
+        std::copy(text.begin(), text.end(), key.begin());
+        return key;
+    };
+    auto make_entry = [&](uint32_t key_value, uint32_t value)
+    {
+        auto entry = make_key(key_value);
+        entry.resize(key_size + value_size, 0);
+        span_iterator value_span{ {entry.begin() + key_size, 4} };
+        write_uint32(value_span, value);
+
+        // mostly short values, with the odd one using the whole column
+        size_t length = value % 97 == 0 ? value_size - 4 : value % 120;
+        std::fill(entry.begin() + key_size + 4, entry.begin() + key_size + 4 + length, 'v');
+        return entry;
+    };
+
+    auto check = [&](btree& check_tree)
+    {
+        btree_cursor cursor(check_tree);
+        auto expected_it = expected.begin();
+        for (bool valid = cursor.seek_first(); valid; valid = cursor.next())
+        {
+            ASSERT_TRUE(expected_it != expected.end());
+            auto entry = cursor.get_entry();
+            auto expected_entry = make_entry(expected_it->first, expected_it->second);
+            ASSERT_TRUE(std::equal(entry.begin(), entry.end(), expected_entry.begin(), expected_entry.end()));
+            expected_it++;
+        }
+        EXPECT_TRUE(expected_it == expected.end());
+
+        std::vector<uint8_t> value(value_size);
+        for (auto& [key_value, expected_value] : expected)
+        {
+            auto key = make_key(key_value);
+            ASSERT_TRUE(check_tree.get(key, value));
+            span_iterator value_span{ {value.begin(), 4} };
+            ASSERT_EQ(read_uint32(value_span), expected_value);
+        }
+    };
+
+    // leaves are slotted unless turned off
+    btree tree(traits, cache, initial, allocator);
+    EXPECT_TRUE(tree.get_leaf_compression());
+
+    for (uint32_t i = 0; i < 3000; i++)
+    {
+        uint32_t key_value = (i * 7919) % 5000;
+        auto entry = make_entry(key_value, i);
+        tree.upsert(transaction_id, entry);
+        expected[key_value] = i;
+    }
+    check(tree);
+
+    // each row takes about the space of its contents, so the tree is shallower than one storing every column in full
+    btree plain(traits, cache, initial, allocator);
+    plain.set_leaf_compression(false);
+    for (auto& [key_value, value] : expected)
+    {
+        auto entry = make_entry(key_value, value);
+        plain.upsert(transaction_id, entry);
+    }
+    EXPECT_LT(tree.begin().path.size(), plain.begin().path.size());
+
+    transaction_id = allocator.create_transaction();
+    for (uint32_t i = 0; i < 3000; i += 2)
+    {
+        uint32_t key_value = (i * 7919) % 5000;
+        auto key = make_key(key_value);
+        auto it = tree.seek_begin(key);
+        ASSERT_TRUE(it.path.back().is_found);
+        tree.remove(transaction_id, it);
+        expected.erase(key_value);
+    }
+    check(tree);
+
+    // rewriting rows with values of a different length moves cells between nodes of every size
+    for (auto& [key_value, value] : expected)
+    {
+        value += 50;
+        auto entry = make_entry(key_value, value);
+        tree.upsert(transaction_id, entry);
+    }
+    check(tree);
+
+    // a batch of short rows followed by full width ones splits its leaf into pieces of very different counts
+    std::vector<std::vector<uint8_t>> batch;
+    for (uint32_t key_value = 5000; key_value < 5600; key_value++)
+    {
+        uint32_t value = key_value < 5300 ? 1 : 97 * key_value;
+        batch.push_back(make_entry(key_value, value));
+        expected[key_value] = value;
+    }
+    tree.upsert_batch(transaction_id, batch);
+    check(tree);
+}
+
+TEST_F(btree_test_fixture, test_value_log)
+{
+    file_cache cache{ "test_cache" };
+    file_cache log_cache{ "test_cache/values" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    uint32_t key_size = 8;
+
+    std::map<uint32_t, std::vector<uint8_t>> expected;
+    auto make_key = [&](uint32_t key_value)
+    {
+        std::vector<uint8_t> key(key_size);
+        span_iterator key_span{ key };
+        write_uint32(key_span, key_value);
+        return key;
+    };
+    auto make_value = [&](uint32_t key_value, uint32_t version)
+    {
+        // values of a few kilobytes, each a different length
+        std::vector<uint8_t> value(2000 + (key_value * 37 + version * 101) % 6000);
+        for (size_t n = 0; n < value.size(); n++)
+        {
+            value[n] = (uint8_t)(key_value + version + n);
+        }
+        return value;
+    };
+
+    auto check = [&](value_log_btree& check_tree)
+    {
+        std::vector<uint8_t> value;
+        for (auto& [key_value, expected_value] : expected)
+        {
+            auto key = make_key(key_value);
+            ASSERT_TRUE(check_tree.get(key, value));
+            ASSERT_TRUE(value == expected_value);
+        }
+
+        auto missing = make_key(100000);
+        EXPECT_FALSE(check_tree.get(missing, value));
+    };
+
+    far_offset_ptr offset;
+    {
+        value_log log{ log_cache };
+        value_log_btree tree(key_size, cache, far_offset_ptr{ 0, 0 }, allocator, log);
+
+        // enough versions of each value to fill several log files
+        for (uint32_t version = 0; version < 4; version++)
+        {
+            for (uint32_t key_value = 0; key_value < 2000; key_value++)
+            {
+                auto key = make_key(key_value);
+                auto value = make_value(key_value, version);
+                tree.upsert(transaction_id, key, value);
+                expected[key_value] = value;
+            }
+        }
+        check(tree);
+
+        for (uint32_t key_value = 0; key_value < 2000; key_value += 5)
+        {
+            auto key = make_key(key_value);
+            EXPECT_TRUE(tree.remove(transaction_id, key));
+            expected.erase(key_value);
+        }
+        auto removed = make_key(0);
+        EXPECT_FALSE(tree.remove(transaction_id, removed));
+        check(tree);
+
+        // collecting moves the live values out of the old files, which are deleted once the moves are committed
+        EXPECT_GT(log.get_head_file_id(), log.get_tail_file_id());
+        size_t collected = 0;
+        filesize_t collected_file_id = 0;
+        while ((collected_file_id = tree.collect_garbage(transaction_id)) != 0)
+        {
+            collected++;
+            check(tree);
+
+            auto filename = "test_cache/values/file_" + std::to_string(collected_file_id) + ".bin";
+            EXPECT_TRUE(std::filesystem::exists(filename));
+            {
+                value_log uncommitted{ log_cache };
+                EXPECT_EQ(uncommitted.get_tail_file_id(), collected_file_id); // a crash now collects it again
+            }
+
+            tree.commit(transaction_id);
+            transaction_id = allocator.create_transaction();
+            log.release_file(collected_file_id);
+            EXPECT_FALSE(std::filesystem::exists(filename));
+        }
+        EXPECT_GT(collected, 0);
+        EXPECT_EQ(log.get_head_file_id(), log.get_tail_file_id());
+        EXPECT_FALSE(std::filesystem::exists("test_cache/values/file_1.bin"));
+
+        offset = tree.get_offset();
+    }
+
+    // a reopened log carries on after its last record
+    value_log log{ log_cache };
+    value_log_btree reopened(key_size, cache, offset, allocator, log);
+    check(reopened);
+
+    for (uint32_t key_value = 2000; key_value < 2100; key_value++)
+    {
+        auto key = make_key(key_value);
+        auto value = make_value(key_value, 0);
+        reopened.upsert(transaction_id, key, value);
+        expected[key_value] = value;
+    }
+    check(reopened);
+
+    // small values stay in the leaves, including ones that replace a logged value
+    for (uint32_t key_value = 1990; key_value < 2010; key_value++)
+    {
+        auto key = make_key(key_value);
+        std::vector<uint8_t> value(key_value % 200, (uint8_t)key_value);
+        reopened.upsert(transaction_id, key, value);
+        expected[key_value] = value;
+
+        auto it = reopened.get_tree().seek_begin(key);
+        auto entry = reopened.get_tree().get_entry(it);
+        span_iterator size_span{ {entry.begin() + key_size, 4} };
+        EXPECT_EQ(read_uint32(size_span), value.size());
+    }
+    check(reopened);
+    reopened.commit(transaction_id);
+
+    // a record torn by a crash ends the log, and the next append takes its place
+    auto key = make_key(5000);
+    auto value = make_value(5000, 0);
+    auto torn = log.append(key, value);
+    log.sync();
+    {
+        file_cache torn_cache{ "test_cache/values" };
+        torn_cache.write(torn.get_file_id(), torn.get_offset() + 100, torn_cache.read(torn.get_file_id(), torn.get_offset() + 100) + 1);
+        torn_cache.sync();
+
+        value_log torn_log{ torn_cache };
+        std::vector<uint8_t> torn_key;
+        std::vector<uint8_t> torn_value;
+        EXPECT_THROW(torn_log.read_record(torn, torn_key, torn_value), object_db_exception);
+        EXPECT_TRUE(torn_log.append(key, value) == torn);
+    }
+}
+
+TEST_F(btree_test_fixture, test_overflow_field)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t inline_size = 32;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_uint32_field();
+    int blob_id = row_traits_builder->add_overflow_field(inline_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    auto traits = row_traits_builder->create_table_row_traits();
+    auto blob_field = traits->get_overflow_field(blob_id);
+    ASSERT_TRUE(blob_field);
+    EXPECT_FALSE(traits->get_overflow_field(key_id));
+
+    // long values sharing their inline bytes would compare equal, so the field cannot be a key
+    EXPECT_THROW(row_traits_builder->add_key_reference(blob_id), object_db_exception);
+
+    btree tree(traits, cache, initial, allocator);
+    uint32_t entry_size = traits->get_entry_traits()->get_size();
+
+    // mostly short values with the odd large blob, which only costs the row its fixed size field
+    auto make_blob = [&](uint32_t key_value, uint32_t version)
+    {
+        size_t length = key_value % 50 == 0 ? 20000 + key_value * 3 : (key_value + version) % 40;
+        std::vector<uint8_t> blob(length);
+        for (size_t n = 0; n < length; n++)
+        {
+            blob[n] = (uint8_t)(key_value * 7 + version + n / 3);
+        }
+        return blob;
+    };
+
+    std::map<uint32_t, std::vector<uint8_t>> expected;
+    auto write_row = [&](uint32_t key_value, uint32_t version)
+    {
+        std::vector<uint8_t> entry(entry_size, 0);
+        span_iterator key_span{ entry };
+        write_uint32(key_span, key_value);
+        auto blob = make_blob(key_value, version);
+        blob_field->set_value(cache, allocator, transaction_id, entry, blob);
+        tree.upsert(transaction_id, entry);
+        expected[key_value] = blob;
+    };
+
+    auto check = [&]()
+    {
+        btree_cursor cursor(tree);
+        auto expected_it = expected.begin();
+        for (bool valid = cursor.seek_first(); valid; valid = cursor.next())
+        {
+            ASSERT_TRUE(expected_it != expected.end());
+            auto entry = cursor.get_entry();
+            ASSERT_EQ(blob_field->get_length(entry), expected_it->second.size());
+            ASSERT_TRUE(blob_field->get_value(cache, entry) == expected_it->second);
+
+            // the inline bytes are the start of the value
+            auto inline_length = std::min<size_t>(inline_size, expected_it->second.size());
+            ASSERT_TRUE(std::equal(expected_it->second.begin(), expected_it->second.begin() + inline_length, entry.begin() + blob_field->get_offset()));
+            expected_it++;
+        }
+        EXPECT_TRUE(expected_it == expected.end());
+    };
+
+    for (uint32_t key_value = 0; key_value < 500; key_value++)
+    {
+        write_row(key_value, 0);
+    }
+    check();
+
+    // the rest of a value can be streamed in pieces of any size
+    std::vector<uint8_t> key(4);
+    span_iterator key_span{ key };
+    write_uint32(key_span, 100);
+    auto entry = tree.get_entry(tree.seek_begin(key));
+    auto reader = blob_field->get_overflow_reader(cache, entry);
+    EXPECT_EQ(reader.get_remaining(), expected[100].size() - inline_size);
+
+    std::vector<uint8_t> streamed(expected[100].begin(), expected[100].begin() + inline_size);
+    std::vector<uint8_t> buffer(1000);
+    for (size_t count = reader.read(buffer); count > 0; count = reader.read(buffer))
+    {
+        streamed.insert(streamed.end(), buffer.begin(), buffer.begin() + count);
+    }
+    EXPECT_TRUE(streamed == expected[100]);
+
+    // a changed value gets a new chain, the row read before the change still sees the old one
+    transaction_id = allocator.create_transaction();
+    for (uint32_t key_value = 0; key_value < 500; key_value += 25)
+    {
+        write_row(key_value, 1);
+    }
+    check();
+    EXPECT_TRUE(blob_field->get_value(cache, entry) == streamed);
+}
+
+TEST_F(btree_test_fixture, test_concurrent_access)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    // two writers fill the even and odd keys while readers look them up, every key found must carry its own value.
+    // the readers take no latch, so they also check that the keys written before they started are never missed
+    uint32_t entry_count = 4000;
+    uint32_t initial_count = 200;
+    std::atomic<size_t> mismatches = 0;
+    std::atomic<size_t> missing = 0;
+    std::atomic<size_t> found_count = 0;
+
+    auto writer = [&](uint32_t first, uint32_t last)
+    {
+        for (uint32_t i = first; i < last; i += 2)
+        {
+            std::vector<uint8_t> entry(key_size + value_size, 0);
+            span_iterator key_span{ {entry.begin(), key_size} };
+            write_uint32(key_span, i);
+            span_iterator value_span{ {entry.begin() + key_size, value_size} };
+            write_uint32(value_span, i * 7);
+            tree.upsert(transaction_id, entry);
+        }
+    };
+
+    auto reader = [&](uint32_t seed)
+    {
+        std::vector<uint8_t> key(key_size);
+        std::vector<uint8_t> value(value_size);
+        uint32_t i = seed;
+        for (uint32_t n = 0; n < entry_count * 4; n++)
+        {
+            i = (i * 1103515245 + 12345) % entry_count;
+            span_iterator key_span{ key };
+            write_uint32(key_span, i);
+            if (tree.get(key, value))
+            {
+                span_iterator value_span{ value };
+                if (read_uint32(value_span) != i * 7)
+                {
+                    mismatches++;
+                }
+                found_count++;
+            }
+            else if (i < initial_count)
+            {
+                missing++;
+            }
+        }
+    };
+
+    auto scanner = [&]()
+    {
+        for (uint32_t n = 0; n < 20; n++)
+        {
+            btree_cursor cursor(tree);
+            uint32_t scanned = 0;
+            int64_t last_key = -1;
+            for (bool found = cursor.seek_first(); found; found = cursor.next())
+            {
+                auto entry = cursor.get_entry();
+                span_iterator key_span{ {entry.begin(), key_size} };
+                auto key = read_uint32(key_span);
+                span_iterator value_span{ {entry.begin() + key_size, value_size} };
+                if ((int64_t)key <= last_key || read_uint32(value_span) != key * 7)
+                {
+                    mismatches++;
+                }
+                last_key = key;
+                scanned++;
+            }
+            if (scanned < initial_count)
+            {
+                missing++;
+            }
+        }
+    };
+
+    // a few rows are there before the threads start, so the readers are sure to find some
+    writer(0, initial_count);
+    writer(1, initial_count);
+
+    std::vector<std::thread> readers;
+    for (uint32_t n = 0; n < 6; n++)
+    {
+        readers.emplace_back(reader, n + 1);
+    }
+    readers.emplace_back(scanner);
+    readers.emplace_back(scanner);
+    std::thread even_writer(writer, initial_count, entry_count);
+    std::thread odd_writer(writer, initial_count + 1, entry_count);
+    even_writer.join();
+    odd_writer.join();
+    for (auto& thread : readers)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(mismatches, 0);
+    EXPECT_EQ(missing, 0);
+    EXPECT_GT(found_count, 0);
+
+    // everything the writers added is there, in order
+    btree_cursor cursor(tree);
+    uint32_t expected = 0;
+    for (bool found = cursor.seek_first(); found; found = cursor.next())
+    {
+        auto entry = cursor.get_entry();
+        span_iterator key_span{ {entry.begin(), key_size} };
+        ASSERT_EQ(read_uint32(key_span), expected);
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        ASSERT_EQ(read_uint32(value_span), expected * 7);
+        expected++;
+    }
+    EXPECT_EQ(expected, entry_count);
+
+    // updates change their leaves in place and hold only those, so writers to different ranges go on together
+    auto updater = [&](uint32_t first, uint32_t last)
+    {
+        for (uint32_t i = first; i < last; i++)
+        {
+            std::vector<uint8_t> entry(key_size + value_size, 0);
+            span_iterator key_span{ {entry.begin(), key_size} };
+            write_uint32(key_span, i);
+            span_iterator value_span{ {entry.begin() + key_size, value_size} };
+            write_uint32(value_span, i * 11);
+            if (!tree.update_if_present(transaction_id, entry))
+            {
+                missing++;
+            }
+        }
+    };
+
+    std::vector<std::thread> updaters;
+    uint32_t updater_count = 4;
+    for (uint32_t n = 0; n < updater_count; n++)
+    {
+        updaters.emplace_back(updater, entry_count * n / updater_count, entry_count * (n + 1) / updater_count);
+    }
+    for (auto& thread : updaters)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(missing, 0);
+
+    std::vector<uint8_t> key(key_size);
+    std::vector<uint8_t> value(value_size);
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        span_iterator key_span{ key };
+        write_uint32(key_span, i);
+        ASSERT_TRUE(tree.get(key, value));
+        span_iterator value_span{ value };
+        ASSERT_EQ(read_uint32(value_span), i * 11);
+    }
+}
+
+TEST_F(btree_test_fixture, test_snapshots)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+
+    uint32_t entry_count = 3000;
+    auto write_rows = [&](filesize_t transaction_id, uint32_t version, uint32_t step)
+    {
+        for (uint32_t i = 0; i < entry_count; i += step)
+        {
+            std::vector<uint8_t> entry(key_size + value_size, 0);
+            span_iterator key_span{ {entry.begin(), key_size} };
+            write_uint32(key_span, i);
+            span_iterator value_span{ {entry.begin() + key_size, value_size} };
+            write_uint32(value_span, i * 7 + version);
+            tree.upsert(transaction_id, entry);
+        }
+    };
+
+    // version n rewrites every steps[n]th row, and a tree as of version n holds the latest of them for each row
+    std::vector<uint32_t> steps = { 1, 3, 5 };
+    auto check = [&](btree& check_tree, uint32_t version)
+    {
+        std::vector<uint8_t> key(key_size);
+        std::vector<uint8_t> value(value_size);
+        for (uint32_t i = 0; i < entry_count; i++)
+        {
+            span_iterator key_span{ key };
+            write_uint32(key_span, i);
+            ASSERT_TRUE(check_tree.get(key, value));
+            uint32_t row_version = version;
+            while ((i % steps[row_version]) != 0)
+            {
+                row_version--;
+            }
+            span_iterator value_span{ value };
+            EXPECT_EQ(read_uint32(value_span), i * 7 + row_version);
+        }
+    };
+
+    auto first_transaction = allocator.create_transaction();
+    write_rows(first_transaction, 0, steps[0]);
+    tree.commit(first_transaction);
+    EXPECT_THROW(write_rows(first_transaction, 1, 1), object_db_exception);
+
+    auto second_transaction = allocator.create_transaction();
+    write_rows(second_transaction, 1, steps[1]);
+    tree.commit(second_transaction);
+
+    auto third_transaction = allocator.create_transaction();
+    write_rows(third_transaction, 2, steps[2]);
+
+    auto first_snapshot = tree.open_snapshot(first_transaction);
+    auto second_snapshot = tree.open_snapshot(second_transaction);
+    EXPECT_TRUE(first_snapshot->is_read_only());
+    check(*first_snapshot, 0);
+    check(*second_snapshot, 1);
+    check(tree, 2);
+
+    // a snapshot is not written to, and the open transaction has none yet
+    std::vector<uint8_t> entry(key_size + value_size, 0);
+    EXPECT_THROW(first_snapshot->upsert(third_transaction, entry), object_db_exception);
+    EXPECT_EQ(tree.get_snapshot_root(third_transaction), tree.get_snapshot_root(second_transaction));
+    EXPECT_THROW(tree.get_snapshot_root(first_transaction - 1), object_db_exception);
+
+    // a scan of a snapshot sees the rows as they were while the writer keeps going
+    btree_cursor cursor(*first_snapshot);
+    uint32_t expected = 0;
+    for (bool found = cursor.seek_first(); found; found = cursor.next())
+    {
+        if (expected % 100 == 0)
+        {
+            write_rows(third_transaction, 2, 7);
+        }
+        auto scanned = cursor.get_entry();
+        span_iterator value_span{ {scanned.begin() + key_size, value_size} };
+        ASSERT_EQ(read_uint32(value_span), expected * 7);
+        expected++;
+    }
+    EXPECT_EQ(expected, entry_count);
+
+    tree.release_snapshots(second_transaction);
+    EXPECT_THROW(tree.get_snapshot_root(first_transaction), object_db_exception);
+    check(*tree.open_snapshot(second_transaction), 1);
+}
+
+TEST_F(btree_test_fixture, test_root_catalog)
+{
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+
+    auto write_rows = [&](btree& tree, filesize_t transaction_id, uint32_t first, uint32_t count, uint32_t version)
+    {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            std::vector<uint8_t> entry(key_size + value_size, 0);
+            span_iterator key_span{ {entry.begin(), key_size} };
+            write_uint32(key_span, i);
+            span_iterator value_span{ {entry.begin() + key_size, value_size} };
+            write_uint32(value_span, i * 7 + version);
+            tree.upsert(transaction_id, entry);
+        }
+    };
+
+    // the row count, checking each row holds the version
+    auto check = [&](btree& tree, uint32_t version)
+    {
+        uint32_t count = 0;
+        btree_cursor cursor(tree);
+        for (bool found = cursor.seek_first(); found; found = cursor.next())
+        {
+            auto entry = cursor.get_entry();
+            span_iterator key_span{ {entry.begin(), key_size} };
+            auto i = read_uint32(key_span);
+            span_iterator value_span{ {entry.begin() + key_size, value_size} };
+            EXPECT_EQ(read_uint32(value_span), i * 7 + version);
+            count++;
+        }
+        return count;
+    };
+
+    filesize_t first_transaction = 0;
+    filesize_t second_transaction = 0;
+    {
+        file_cache cache{ "test_cache" };
+        file_allocator allocator{ cache };
+        root_catalog catalog{ cache, allocator };
+        EXPECT_FALSE(catalog.get_root("orders"));
+
+        btree orders(traits, cache, catalog.get_root("orders"), allocator);
+        btree customers(traits, cache, catalog.get_root("customers"), allocator);
+
+        first_transaction = allocator.create_transaction();
+        write_rows(orders, first_transaction, 0, 2000, 0);
+        write_rows(customers, first_transaction, 0, 500, 0);
+        catalog.commit(first_transaction, "orders", orders);
+        catalog.commit(first_transaction, "customers", customers);
+
+        second_transaction = allocator.create_transaction();
+        write_rows(orders, second_transaction, 0, 3000, 1);
+        catalog.commit(second_transaction, "orders", orders);
+
+        // written but never committed, so a reopen does not see it
+        auto third_transaction = allocator.create_transaction();
+        write_rows(orders, third_transaction, 0, 4000, 2);
+    }
+
+    // reopening finds the trees from block 0 alone
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+    root_catalog catalog{ cache, allocator };
+
+    btree orders(traits, cache, catalog.get_root("orders"), allocator);
+    btree customers(traits, cache, catalog.get_root("customers"), allocator);
+    EXPECT_EQ(check(orders, 1), 3000);
+    EXPECT_EQ(check(customers, 0), 500);
+
+    btree first_orders(traits, cache, catalog.get_root("orders", first_transaction), allocator);
+    EXPECT_EQ(check(first_orders, 0), 2000);
+    EXPECT_EQ(catalog.get_root("customers", second_transaction), customers.get_offset());
+    EXPECT_THROW(catalog.get_root("orders", first_transaction - 1), object_db_exception);
+    EXPECT_FALSE(catalog.get_root("order"));
+    EXPECT_THROW(catalog.get_root(std::string(root_catalog::max_name_size + 1, 'x')), object_db_exception);
+
+    auto release_transaction = allocator.create_transaction();
+    catalog.release_roots(release_transaction, "orders", second_transaction);
+    EXPECT_THROW(catalog.get_root("orders", first_transaction), object_db_exception);
+    EXPECT_EQ(catalog.get_root("orders", second_transaction), orders.get_offset());
+    EXPECT_EQ(catalog.get_root("customers", first_transaction), customers.get_offset());
+}
+
+TEST_F(btree_test_fixture, test_buffered_writes)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    far_offset_ptr initial{ 0, 0 };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    std::shared_ptr<btree_row_traits> traits = row_traits_builder->create_table_row_traits();
+    btree tree(traits, cache, initial, allocator);
+    tree.set_buffer_writes(true);
+
+    uint32_t entry_count = 3000;
+    auto write_rows = [&](filesize_t transaction_id, uint32_t version)
+    {
+        for (uint32_t i = 0; i < entry_count; i++)
+        {
+            std::vector<uint8_t> entry(key_size + value_size, 0);
+            span_iterator key_span{ {entry.begin(), key_size} };
+            write_uint32(key_span, i);
+            span_iterator value_span{ {entry.begin() + key_size, value_size} };
+            write_uint32(value_span, i * 7 + version);
+            tree.upsert(transaction_id, entry);
+        }
+    };
+
+    auto check = [&](btree& check_tree, uint32_t version)
+    {
+        std::vector<uint8_t> key(key_size);
+        std::vector<uint8_t> value(value_size);
+        for (uint32_t i = 0; i < entry_count; i++)
+        {
+            span_iterator key_span{ key };
+            write_uint32(key_span, i);
+            ASSERT_TRUE(check_tree.get(key, value));
+            span_iterator value_span{ value };
+            ASSERT_EQ(read_uint32(value_span), i * 7 + version);
+        }
+    };
+
+    // the tree reads its own buffered nodes, while on file the root is still the empty block it was allocated as
+    auto first_transaction = allocator.create_transaction();
+    write_rows(first_transaction, 0);
+    check(tree, 0);
+    {
+        btree_node root(tree);
+        auto root_it = cache.get_iterator(tree.get_offset());
+        root.read(root_it);
+        EXPECT_EQ(root.get_entry_count(), 0);
+    }
+    tree.commit(first_transaction);
+    {
+        btree flushed(traits, cache, tree.get_offset(), allocator);
+        check(flushed, 0);
+    }
+
+    // a rollback returns to the committed rows
+    auto second_transaction = allocator.create_transaction();
+    write_rows(second_transaction, 1);
+    check(tree, 1);
+    tree.rollback(second_transaction);
+    check(tree, 0);
+
+    write_rows(second_transaction, 2);
+    tree.commit(second_transaction);
+    check(tree, 2);
+    check(*tree.open_snapshot(first_transaction), 0);
+
+    // rolling back works the same way without buffering
+    tree.set_buffer_writes(false);
+    auto third_transaction = allocator.create_transaction();
+    write_rows(third_transaction, 3);
+    tree.rollback(third_transaction);
+    check(tree, 2);
+}
+
+TEST_F(btree_test_fixture, test_optimistic_transactions)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+    root_catalog catalog{ cache, allocator };
+    transaction_manager manager{ cache, allocator, catalog };
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    manager.add_table("counters", row_traits_builder->create_table_row_traits());
+
+    auto make_key = [&](uint32_t key_value)
+    {
+        std::vector<uint8_t> key(key_size);
+        span_iterator key_span{ key };
+        write_uint32(key_span, key_value);
+        return key;
+    };
+    auto make_entry = [&](uint32_t key_value, uint32_t count)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, key_value);
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(value_span, count);
+        return entry;
+    };
+    // the count, or -1 if the key does not exist
+    auto read_count = [&](optimistic_transaction& transaction, uint32_t key_value)
+    {
+        auto key = make_key(key_value);
+        std::vector<uint8_t> value(value_size);
+        if (!transaction.get("counters", key, value))
+        {
+            return (int64_t)-1;
+        }
+        span_iterator value_span{ value };
+        return (int64_t)read_uint32(value_span);
+    };
+
+    uint32_t counter_count = 10;
+    {
+        auto setup = manager.begin_transaction();
+        for (uint32_t n = 0; n < counter_count; n++)
+        {
+            auto entry = make_entry(n, 0);
+            setup->upsert("counters", entry);
+        }
+        EXPECT_EQ(read_count(*setup, 3), 0); // its own write
+        EXPECT_TRUE(setup->commit());
+    }
+
+    // a transaction sees the database as it was when it began, and fails if what it read changed before it commits
+    auto first = manager.begin_transaction();
+    auto second = manager.begin_transaction();
+    auto first_entry = make_entry(1, 5);
+    first->upsert("counters", first_entry);
+    EXPECT_EQ(read_count(*second, 1), 0);
+    EXPECT_TRUE(first->commit());
+    EXPECT_EQ(read_count(*second, 1), 0);
+    auto second_entry = make_entry(2, 5);
+    second->upsert("counters", second_entry);
+    EXPECT_FALSE(second->commit());
+    EXPECT_THROW(second->commit(), object_db_exception);
+
+    // one that did not read the changed key commits
+    auto third = manager.begin_transaction();
+    auto fourth = manager.begin_transaction();
+    EXPECT_EQ(read_count(*third, 1), 5);
+    auto removed_key = make_key(2);
+    third->remove("counters", removed_key);
+    EXPECT_EQ(read_count(*third, 2), -1);
+    EXPECT_EQ(read_count(*fourth, 3), 0);
+    auto fourth_entry = make_entry(3, 7);
+    fourth->upsert("counters", fourth_entry);
+    EXPECT_TRUE(third->commit());
+    EXPECT_TRUE(fourth->commit());
+
+    // a commit whose write fails leaves every table as it was, and the next commit carries none of it
+    manager.add_table("others", row_traits_builder->create_table_row_traits());
+    {
+        auto failing = manager.begin_transaction();
+        auto counter_entry = make_entry(4, 9);
+        failing->upsert("counters", counter_entry);
+        std::vector<uint8_t> short_entry(key_size);
+        failing->upsert("others", short_entry);
+        EXPECT_THROW(failing->commit(), object_db_exception);
+    }
+    {
+        auto after = manager.begin_transaction();
+        auto after_entry = make_entry(5, 0);
+        after->upsert("counters", after_entry);
+        EXPECT_TRUE(after->commit());
+        auto check = manager.begin_transaction();
+        EXPECT_EQ(read_count(*check, 4), 0);
+    }
+
+    // threads incrementing shared counters retry on conflict, and no increment is lost. Each commit also writes a row
+    // of its own to a second table, so commits of several tables are applied side by side
+    uint32_t thread_count = 4;
+    uint32_t increments = 200;
+    std::atomic<size_t> conflicts = 0;
+    auto increment = [&](uint32_t seed)
+    {
+        for (uint32_t n = 0; n < increments; n++)
+        {
+            auto key_value = (seed + n * 7) % counter_count;
+            for (;;)
+            {
+                auto transaction = manager.begin_transaction();
+                auto count = read_count(*transaction, key_value);
+                if (count < 0)
+                {
+                    count = 0;
+                }
+                auto entry = make_entry(key_value, (uint32_t)count + 1);
+                transaction->upsert("counters", entry);
+                auto row = make_entry(1000 + seed * increments + n, seed);
+                transaction->upsert("others", row);
+                if (transaction->commit())
+                {
+                    break;
+                }
+                conflicts++;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t n = 0; n < thread_count; n++)
+    {
+        threads.emplace_back(increment, n);
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto check = manager.begin_transaction();
+    int64_t total = 0;
+    for (uint32_t n = 0; n < counter_count; n++)
+    {
+        total += std::max<int64_t>(read_count(*check, n), 0);
+    }
+    EXPECT_EQ(total, 5 + 7 + thread_count * increments);
+    for (uint32_t n = 0; n < thread_count * increments; n++)
+    {
+        auto key = make_key(1000 + n);
+        std::vector<uint8_t> value(value_size);
+        ASSERT_TRUE(check->get("others", key, value));
+    }
+    check->rollback();
+}
+
+TEST_F(btree_test_fixture, test_transaction_log)
+{
+    table_descriptor orders;
+    orders.name = "orders";
+    orders.fields.push_back(create_integer_field("id", 4));
+    orders.fields.push_back(create_text_field("customer", 16));
+    orders.fields.push_back(create_integer_field("amount"));
+    orders.indexes.push_back({ primary_key, "pk_orders", { 0 } });
+    orders.indexes.push_back({ index_key, "by_customer", { 1 } });
+    EXPECT_EQ(orders.get_row_size(), 4 + 16 + 8);
+
+    table_descriptor customers;
+    customers.name = "customers";
+    customers.fields.push_back(create_text_field("name", 16));
+    customers.indexes.push_back({ primary_key, "pk_customers", { 0 } });
+
+    auto make_key = [](uint32_t id)
+    {
+        std::vector<uint8_t> key(4);
+        span_iterator it{ key };
+        write_uint32(it, id);
+        return key;
+    };
+    auto make_row = [](uint32_t id, const std::string& customer, uint64_t amount)
+    {
+        std::vector<uint8_t> row(4 + 16 + 8, 0);
+        span_iterator id_it{ row };
+        write_uint32(id_it, id);
+        std::copy(customer.begin(), customer.end(), row.begin() + 4);
+        span_iterator amount_it{ row, 4 + 16 };
+        write_uint64(amount_it, amount);
+        return row;
+    };
+    auto read_id = [](std::vector<uint8_t> key)
+    {
+        span_iterator it{ key };
+        return read_uint32(it);
+    };
+
+    {
+        auto log = transaction_log::open("test_cache");
+        auto create = log->begin_transaction();
+        auto schema = create->create_schema("sales");
+        EXPECT_EQ(schema->get_schema_name(), "sales");
+        auto table = schema->create_table(orders);
+        create->create_table("sales", customers);
+        for (uint32_t id = 3; id > 0; id--)
+        {
+            auto row = make_row(id * 10, "customer", id * 100);
+            table->insert_row(row);
+        }
+        auto duplicate = make_row(20, "again", 1);
+        EXPECT_THROW(table->insert_row(duplicate), object_db_exception);
+        EXPECT_THROW(create->create_table("sales", customers), object_db_exception);
+        create->commit();
+
+        auto read = log->begin_transaction();
+        auto schemas = read->get_schema_iterator_start();
+        ASSERT_FALSE(schemas->at_end());
+        EXPECT_EQ(schemas->get_schema_name(), "sales");
+        schemas->step_forward();
+        EXPECT_TRUE(schemas->at_end());
+        EXPECT_EQ(read->get_schema_iterator_end()->get_schema_name(), "sales");
+
+        // tables walk in name order
+        auto tables = read->get_schema_iterator_start()->get_table_iterator("c");
+        EXPECT_FALSE(tables->found());
+        EXPECT_EQ(tables->get_table_name(), "customers");
+        tables->step_forward();
+        EXPECT_EQ(tables->get_table_name(), "orders");
+        auto& descriptor = tables->get_descriptor();
+        ASSERT_EQ(descriptor.fields.size(), 3);
+        EXPECT_EQ(descriptor.fields[1].name, "customer");
+        EXPECT_EQ(descriptor.fields[1].get_text_max_length(), 16);
+        EXPECT_EQ(descriptor.fields[2].get_integer_width(), 8);
+        EXPECT_EQ(descriptor.get_primary_key().name, "pk_orders");
+        tables->step_forward();
+        EXPECT_TRUE(tables->at_end());
+        tables->step_back();
+        EXPECT_EQ(tables->get_table_name(), "orders");
+
+        auto indexes = tables->get_index_iterator("by_customer");
+        EXPECT_TRUE(indexes->found());
+        EXPECT_EQ(indexes->get_descriptor().local_field_references, std::vector<int>{ 1 });
+        indexes->step_forward();
+        EXPECT_EQ(indexes->get_descriptor().name, "pk_orders");
+
+        // rows walk in key order and read back as they were written
+        auto rows = tables->get_row_iterator();
+        std::vector<uint32_t> ids;
+        for (rows->step_forward(); !rows->at_end(); rows->step_forward())
+        {
+            ids.push_back(read_id(rows->get_key()));
+        }
+        EXPECT_EQ(ids, (std::vector<uint32_t>{ 10, 20, 30 }));
+        auto key = make_key(20);
+        rows->seek_forward(std::string(key.begin(), key.end()));
+        EXPECT_TRUE(rows->found());
+        EXPECT_EQ(rows->get_value(), make_row(20, "customer", 200));
+        key = make_key(25);
+        rows->seek_backward(std::string(key.begin(), key.end()));
+        EXPECT_FALSE(rows->found());
+        EXPECT_EQ(read_id(rows->get_key()), 20);
+        read->rollback();
+
+        // a transaction that walked the rows conflicts with one that inserted among them first
+        auto first = log->begin_transaction();
+        auto second = log->begin_transaction();
+        auto first_rows = first->get_schema_iterator_start()->get_table_iterator("orders")->get_row_iterator();
+        for (first_rows->step_forward(); !first_rows->at_end(); first_rows->step_forward())
+        {
+        }
+        auto inserted = make_row(15, "second", 1);
+        second->get_schema_iterator_start()->get_table_iterator("orders")->insert_row(inserted);
+        second->commit();
+        std::vector<uint8_t> customer(16, 'a');
+        first->get_schema_iterator_start()->get_table_iterator("customers")->insert_row(customer);
+        EXPECT_THROW(first->commit(), object_db_exception);
+
+        auto change = log->begin_transaction();
+        auto changed = change->get_schema_iterator_start()->get_table_iterator("orders");
+        auto key_15 = make_key(15);
+        auto moved = make_row(16, "moved", 2);
+        changed->update_row(key_15, moved);
+        auto key_30 = make_key(30);
+        changed->delete_row(key_30);
+        EXPECT_THROW(changed->delete_row(key_30), object_db_exception);
+        EXPECT_THROW(changed->alter({ "", { { "amount", "", create_integer_field("", 4).type_descriptor } }, {} }), object_db_exception);
+        EXPECT_THROW(changed->alter({ "", {}, { { "pk_orders", "", { 1 } } } }), object_db_exception);
+        changed->alter({ "purchases", { { "customer", "buyer", create_text_field("", 16).type_descriptor } }, {} });
+        EXPECT_EQ(changed->get_table_name(), "purchases");
+        change->commit();
+    }
+
+    // the catalog and the rows are read back from the files
+    auto log = transaction_log::open("test_cache");
+    auto reopened = log->begin_transaction();
+    auto tables = reopened->get_schema_iterator_start()->get_table_iterator("purchases");
+    ASSERT_TRUE(tables->found());
+    EXPECT_EQ(tables->get_descriptor().fields[1].name, "buyer");
+    auto rows = tables->get_row_iterator();
+    std::vector<uint32_t> ids;
+    for (rows->step_forward(); !rows->at_end(); rows->step_forward())
+    {
+        ids.push_back(read_id(rows->get_key()));
+    }
+    EXPECT_EQ(ids, (std::vector<uint32_t>{ 10, 16, 20 }));
+    EXPECT_FALSE(reopened->get_schema_iterator_start()->get_table_iterator("orders")->found());
+
+    // dropping the schema drops its tables
+    reopened->get_schema_iterator_start()->drop();
+    EXPECT_TRUE(reopened->get_schema_iterator_start()->at_end());
+    reopened->commit();
+
+    auto dropped = log->begin_transaction();
+    EXPECT_TRUE(dropped->get_schema_iterator_start()->at_end());
+    EXPECT_THROW(dropped->create_table("sales", customers), object_db_exception);
+    dropped->rollback();
+}
+
+TEST_F(btree_test_fixture, test_superblock)
+{
+    {
+        file_cache cache{ "test_cache" };
+        file_allocator allocator{ cache };
+        EXPECT_EQ(allocator.get_sequence(), 0);
+
+        allocator.create_transaction();
+        allocator.set_root(far_offset_ptr{ 1, block_size });
+        EXPECT_EQ(allocator.commit(), 1);
+
+        allocator.create_transaction();
+        allocator.set_root(far_offset_ptr{ 2, block_size * 2 });
+        EXPECT_EQ(allocator.commit(), 2);
+
+        // not committed, so lost on reopen
+        allocator.create_transaction();
+        allocator.set_root(far_offset_ptr{ 3, 0 });
+    }
+
+    {
+        file_cache cache{ "test_cache" };
+        file_allocator allocator{ cache };
+        EXPECT_EQ(allocator.get_sequence(), 2);
+        EXPECT_EQ(allocator.get_current_transaction_id(), 2);
+        EXPECT_EQ(allocator.get_root(), (far_offset_ptr{ 2, block_size * 2 }));
+    }
+
+    // a torn write of the newest copy, the second block, leaves the one before it
+    {
+        std::fstream file("test_cache/file_0.bin", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(block_size + 12);
+        file.put(0x55);
+    }
+    {
+        file_cache cache{ "test_cache" };
+        file_allocator allocator{ cache };
+        EXPECT_EQ(allocator.get_sequence(), 1);
+        EXPECT_EQ(allocator.get_current_transaction_id(), 1);
+        EXPECT_EQ(allocator.get_root(), (far_offset_ptr{ 1, block_size }));
+
+        // the next commit replaces the damaged copy rather than the good one
+        allocator.create_transaction();
+        EXPECT_EQ(allocator.commit(), 2);
+    }
+    {
+        file_cache cache{ "test_cache" };
+        file_allocator allocator{ cache };
+        EXPECT_EQ(allocator.get_sequence(), 2);
+        EXPECT_EQ(allocator.get_root(), (far_offset_ptr{ 1, block_size }));
+
+        // transactions allocating in turn each keep to a file of their own
+        auto first_id = allocator.create_transaction();
+        auto second_id = allocator.create_transaction();
+        auto first = allocator.allocate_block(first_id);
+        auto second = allocator.allocate_block(second_id);
+        EXPECT_NE(first.get_file_id(), second.get_file_id());
+        for (filesize_t n = 1; n < 10; n++)
+        {
+            EXPECT_EQ(allocator.allocate_block(first_id), (far_offset_ptr{ first.get_file_id(), n * block_size }));
+            EXPECT_EQ(allocator.allocate_block(second_id), (far_offset_ptr{ second.get_file_id(), n * block_size }));
+        }
+    }
+}
+
+TEST_F(btree_test_fixture, test_redo_log)
+{
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto create_row_traits = [&]()
+    {
+        auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+        int key_id = row_traits_builder->add_span_field(key_size);
+        row_traits_builder->add_span_field(value_size);
+        row_traits_builder->add_key_reference(key_id);
+        return row_traits_builder->create_table_row_traits();
+    };
+    auto make_key = [&](uint32_t key_value)
+    {
+        std::vector<uint8_t> key(key_size);
+        span_iterator key_span{ key };
+        write_uint32(key_span, key_value);
+        return key;
+    };
+    auto upsert = [&](optimistic_transaction& transaction, uint32_t key_value, uint32_t count)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, key_value);
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(value_span, count);
+        transaction.upsert("counters", entry);
+    };
+    // the count, or -1 if the key does not exist
+    auto read_count = [&](transaction_manager& manager, uint32_t key_value)
+    {
+        auto transaction = manager.begin_transaction();
+        auto key = make_key(key_value);
+        std::vector<uint8_t> value(value_size);
+        if (!transaction->get("counters", key, value))
+        {
+            return (int64_t)-1;
+        }
+        span_iterator value_span{ value };
+        return (int64_t)read_uint32(value_span);
+    };
+
+    filesize_t torn_offset = 0;
+    {
+        file_cache cache{ "test_cache" };
+        file_cache log_cache{ "test_cache/redo" };
+        file_allocator allocator{ cache };
+        root_catalog catalog{ cache, allocator };
+        redo_log log{ log_cache };
+        transaction_manager manager{ cache, allocator, catalog };
+        manager.set_redo_log(&log);
+        manager.add_table("counters", create_row_traits());
+
+        auto first = manager.begin_transaction();
+        for (uint32_t n = 0; n < 10; n++)
+        {
+            upsert(*first, n, 1);
+        }
+        EXPECT_TRUE(first->commit());
+        EXPECT_GT(log.get_size(), 0);
+
+        manager.checkpoint();
+        EXPECT_EQ(log.get_size(), 0);
+
+        // only in the log from here on
+        auto second = manager.begin_transaction();
+        for (uint32_t n = 0; n < 5; n++)
+        {
+            upsert(*second, n, 2);
+        }
+        auto removed = make_key(9);
+        second->remove("counters", removed);
+        EXPECT_TRUE(second->commit());
+
+        torn_offset = log.get_size();
+        auto third = manager.begin_transaction();
+        upsert(*third, 20, 3);
+        EXPECT_TRUE(third->commit());
+
+        EXPECT_EQ(read_count(manager, 0), 2);
+        EXPECT_EQ(read_count(manager, 9), -1);
+        EXPECT_EQ(read_count(manager, 20), 3);
+
+        // a transaction that failed after it was logged is cancelled by an abort record
+        auto failed_id = allocator.create_transaction();
+        std::vector<uint8_t> failed_entry(key_size + value_size, 0);
+        span_iterator failed_key_span{ {failed_entry.begin(), key_size} };
+        write_uint32(failed_key_span, 30);
+        log.commit(failed_id, { redo_record{ redo_operation::upsert, failed_id, "counters", failed_entry } });
+        log.abort(failed_id);
+    }
+
+    // damage the value of the third transaction's upsert, as a write torn by a crash would
+    {
+        std::fstream file("test_cache/redo/file_2.bin", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(torn_offset + 15 + 8 + key_size);
+        file.put(0x55);
+    }
+
+    for (int reopen = 0; reopen < 2; reopen++)
+    {
+        file_cache cache{ "test_cache" };
+        file_cache log_cache{ "test_cache/redo" };
+        file_allocator allocator{ cache };
+        root_catalog catalog{ cache, allocator };
+        redo_log log{ log_cache };
+        transaction_manager manager{ cache, allocator, catalog };
+        manager.set_redo_log(&log);
+        manager.add_table("counters", create_row_traits());
+
+        if (reopen == 0)
+        {
+            // the tables are as of the checkpoint until the log is applied
+            EXPECT_EQ(read_count(manager, 0), 1);
+            EXPECT_EQ(read_count(manager, 9), 1);
+            EXPECT_GT(log.get_size(), 0);
+        }
+
+        manager.recover();
+        EXPECT_EQ(log.get_size(), 0);
+        for (uint32_t n = 0; n < 9; n++)
+        {
+            EXPECT_EQ(read_count(manager, n), n < 5 ? 2 : 1);
+        }
+        EXPECT_EQ(read_count(manager, 9), -1);
+        EXPECT_EQ(read_count(manager, 20), -1); // its commit record no longer matches
+        EXPECT_EQ(read_count(manager, 30), -1);
+    }
+
+    // threads commit side by side while checkpoints run, and every commit survives a reopen. Each checkpoint drops
+    // the log files before it
+    uint32_t thread_count = 4;
+    uint32_t commits = 50;
+    {
+        file_cache cache{ "test_cache" };
+        file_cache log_cache{ "test_cache/redo" };
+        file_allocator allocator{ cache };
+        root_catalog catalog{ cache, allocator };
+        redo_log log{ log_cache };
+        transaction_manager manager{ cache, allocator, catalog };
+        manager.set_redo_log(&log);
+        manager.add_table("counters", create_row_traits());
+
+        auto commit_rows = [&](uint32_t seed)
+        {
+            for (uint32_t n = 0; n < commits; n++)
+            {
+                auto transaction = manager.begin_transaction();
+                upsert(*transaction, 100 + seed * commits + n, seed);
+                EXPECT_TRUE(transaction->commit());
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (uint32_t n = 0; n < thread_count; n++)
+        {
+            threads.emplace_back(commit_rows, n);
+        }
+        for (int checkpoints = 0; checkpoints < 5; checkpoints++)
+        {
+            manager.checkpoint();
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        size_t log_files = 0;
+        for (auto& entry : std::filesystem::directory_iterator("test_cache/redo"))
+        {
+            log_files += entry.path().filename().string().starts_with("file_") ? 1 : 0;
+        }
+        EXPECT_LE(log_files, 2); // the state and the file appended to
+    }
+    {
+        file_cache cache{ "test_cache" };
+        file_cache log_cache{ "test_cache/redo" };
+        file_allocator allocator{ cache };
+        root_catalog catalog{ cache, allocator };
+        redo_log log{ log_cache };
+        transaction_manager manager{ cache, allocator, catalog };
+        manager.set_redo_log(&log);
+        manager.add_table("counters", create_row_traits());
+        manager.recover();
+
+        for (uint32_t seed = 0; seed < thread_count; seed++)
+        {
+            for (uint32_t n = 0; n < commits; n++)
+            {
+                EXPECT_EQ(read_count(manager, 100 + seed * commits + n), seed);
+            }
+        }
+    }
+}
+
+TEST_F(btree_test_fixture, test_combining_writer)
+{
+    file_cache cache{ "test_cache" };
+    file_allocator allocator{ cache };
+
+    auto transaction_id = allocator.create_transaction();
+
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+
+    int key_id = row_traits_builder->add_span_field(key_size);
+    int value_id = row_traits_builder->add_span_field(value_size);
+
+    row_traits_builder->add_key_reference(key_id);
+
+    btree tree(row_traits_builder->create_table_row_traits(), cache, far_offset_ptr{ 0, 0 }, allocator);
+    combining_writer writer(tree, transaction_id);
+
+    auto make_entry = [&](uint32_t key_value, uint32_t version)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, key_value);
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(value_span, key_value * 7 + version);
+        return entry;
+    };
+
+    // each thread writes its own keys twice and removes every tenth, while the others do the same
+    uint32_t thread_count = 4;
+    uint32_t keys_per_thread = 1000;
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([&, t]()
+            {
+                for (uint32_t version = 0; version < 2; version++)
+                {
+                    for (uint32_t n = 0; n < keys_per_thread; n++)
+                    {
+                        auto entry = make_entry(n * thread_count + t, version);
+                        writer.upsert(entry);
+                    }
+                }
+                for (uint32_t n = 0; n < keys_per_thread; n += 10)
+                {
+                    auto key = make_entry(n * thread_count + t, 0);
+                    key.resize(key_size);
+                    writer.remove(key);
+                }
+            });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_GT(writer.get_batch_count(), 0);
+
+    // a wrong sized write is refused up front rather than failing a batch shared with other threads
+    std::vector<uint8_t> short_entry(key_size + value_size - 1, 0);
+    EXPECT_THROW(writer.upsert(short_entry), object_db_exception);
+    std::vector<uint8_t> short_key(key_size - 1, 0);
+    EXPECT_THROW(writer.remove(short_key), object_db_exception);
+
+    std::vector<uint8_t> value(value_size);
+    for (uint32_t key_value = 0; key_value < thread_count * keys_per_thread; key_value++)
+    {
+        auto key = make_entry(key_value, 0);
+        key.resize(key_size);
+        bool found = tree.get(key, value);
+        ASSERT_EQ(found, (key_value / thread_count) % 10 != 0);
+        if (found)
+        {
+            span_iterator value_span{ value };
+            ASSERT_EQ(read_uint32(value_span), key_value * 7 + 1);
+        }
+    }
+
+    // writes after a commit go to the next transaction and leave the snapshot as it was
+    writer.commit(allocator.create_transaction());
+    auto entry = make_entry(5, 5);
+    writer.upsert(entry);
+    auto snapshot = tree.open_snapshot(transaction_id);
+    auto key = make_entry(5, 0);
+    key.resize(key_size);
+    ASSERT_TRUE(snapshot->get(key, value));
+    span_iterator value_span{ value };
+    EXPECT_EQ(read_uint32(value_span), 36);
+}
+
+TEST_F(btree_test_fixture, test_partitioned_table)
+{
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto create_row_traits = [&]()
+    {
+        auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+        int key_id = row_traits_builder->add_span_field(key_size);
+        row_traits_builder->add_span_field(value_size);
+        row_traits_builder->add_key_reference(key_id);
+        return row_traits_builder->create_table_row_traits();
+    };
+    auto make_key = [&](uint32_t key_value)
+    {
+        std::vector<uint8_t> key(key_size);
+        span_iterator key_span{ key };
+        write_uint32(key_span, key_value);
+        return key;
+    };
+    auto make_entry = [&](uint32_t key_value)
+    {
+        std::vector<uint8_t> entry(key_size + value_size, 0);
+        span_iterator key_span{ {entry.begin(), key_size} };
+        write_uint32(key_span, key_value);
+        span_iterator value_span{ {entry.begin() + key_size, value_size} };
+        write_uint32(value_span, key_value * 7);
+        return entry;
+    };
+
+    // every key from first_key up, less the removed ones, in order and with its own value
+    uint32_t entry_count = 4000;
+    auto check = [&](partitioned_table& table, uint32_t first_key)
+    {
+        auto key = make_key(first_key);
+        uint32_t expected = first_key;
+        bool in_order = true;
+        table.scan(key, [&](std::span<uint8_t> entry)
+            {
+                while (expected % 100 == 0)
+                {
+                    expected++;
+                }
+                span_iterator key_span{ {entry.begin(), key_size} };
+                span_iterator value_span{ {entry.begin() + key_size, value_size} };
+                auto key_value = read_uint32(key_span);
+                in_order = in_order && key_value == expected && read_uint32(value_span) == key_value * 7;
+                expected++;
+                return in_order;
+            });
+        EXPECT_TRUE(in_order);
+        EXPECT_EQ(expected, entry_count);
+
+        std::vector<uint8_t> value(value_size);
+        for (uint32_t key_value : { 0u, 1u, 999u, 1000u, 2500u, 3999u })
+        {
+            auto get_key = make_key(key_value);
+            EXPECT_EQ(table.get(get_key, value), key_value % 100 != 0);
+        }
+    };
+
+    // four threads write interleaved keys, so each partition's writer gets writes from all of them
+    auto fill = [&](partitioned_table& table)
+    {
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < 4; t++)
+        {
+            threads.emplace_back([&, t]()
+                {
+                    for (uint32_t key_value = t; key_value < entry_count; key_value += 4)
+                    {
+                        auto entry = make_entry(key_value);
+                        table.upsert(entry);
+                    }
+                });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        for (uint32_t key_value = 0; key_value < entry_count; key_value += 100)
+        {
+            auto key = make_key(key_value);
+            table.remove(key);
+        }
+        table.flush();
+    };
+
+    {
+        partitioned_table table(create_row_traits(), "test_cache/range", { make_key(1000), make_key(2000), make_key(3000) });
+        EXPECT_EQ(table.get_partition_count(), 4);
+        fill(table);
+        check(table, 0);
+        check(table, 2500);
+
+        // split while the other threads keep writing the same rows again
+        std::thread rewriter([&]()
+            {
+                for (uint32_t key_value = 1; key_value < entry_count; key_value += 100)
+                {
+                    auto entry = make_entry(key_value);
+                    table.upsert(entry);
+                }
+            });
+        auto first_split = make_key(500);
+        auto second_split = make_key(2750);
+        table.split_partition(first_split);
+        table.split_partition(second_split);
+        rewriter.join();
+        table.flush();
+        EXPECT_EQ(table.get_partition_count(), 6);
+        EXPECT_THROW(table.split_partition(first_split), object_db_exception);
+        check(table, 0);
+        check(table, 600);
+        table.commit();
+    }
+    {
+        partitioned_table table(create_row_traits(), "test_cache/range", std::vector<std::vector<uint8_t>>{});
+        EXPECT_EQ(table.get_mode(), partition_mode::range);
+        EXPECT_EQ(table.get_partition_count(), 6);
+        check(table, 0);
+    }
+
+    {
+        partitioned_table table(create_row_traits(), "test_cache/hash", 4);
+        fill(table);
+        check(table, 0);
+        check(table, 1234);
+        auto split = make_key(500);
+        EXPECT_THROW(table.split_partition(split), object_db_exception);
+    }
+
+    // the partitions opened before a bad split key are stopped rather than left running
+    std::vector<std::vector<uint8_t>> unordered{ make_key(2000), make_key(1000) };
+    EXPECT_THROW(partitioned_table(create_row_traits(), "test_cache/unordered", unordered), object_db_exception);
+
+    // a split commits none of the writes made since the last commit, in either partition
+    {
+        partitioned_table table(create_row_traits(), "test_cache/uncommitted", std::vector<std::vector<uint8_t>>{});
+        for (uint32_t key_value = 0; key_value < 100; key_value++)
+        {
+            auto entry = make_entry(key_value);
+            table.upsert(entry);
+        }
+        table.commit();
+
+        auto changed = make_entry(70);
+        std::fill(changed.begin() + key_size, changed.end(), 9);
+        table.upsert(changed);
+        auto added = make_entry(150);
+        table.upsert(added);
+        auto removed = make_key(80);
+        table.remove(removed);
+        auto early = make_entry(10);
+        std::fill(early.begin() + key_size, early.end(), 9);
+        table.upsert(early);
+        table.flush();
+
+        auto split = make_key(50);
+        table.split_partition(split);
+        std::vector<uint8_t> value(value_size);
+        auto key = make_key(70);
+        ASSERT_TRUE(table.get(key, value));
+        EXPECT_EQ(value[0], 9);
+        key = make_key(150);
+        EXPECT_TRUE(table.get(key, value));
+        EXPECT_FALSE(table.get(removed, value));
+    }
+    {
+        partitioned_table table(create_row_traits(), "test_cache/uncommitted", std::vector<std::vector<uint8_t>>{});
+        EXPECT_EQ(table.get_partition_count(), 2);
+        std::vector<uint8_t> value(value_size);
+        for (uint32_t key_value = 0; key_value < 100; key_value++)
+        {
+            auto key = make_key(key_value);
+            ASSERT_TRUE(table.get(key, value));
+            EXPECT_NE(value[0], 9);
+        }
+        auto key = make_key(150);
+        EXPECT_FALSE(table.get(key, value));
+    }
+
+    // a split moving more rows than one batch can take into a leaf
+    {
+        partitioned_table table(create_row_traits(), "test_cache/large", std::vector<std::vector<uint8_t>>{});
+        uint32_t large_count = 70000;
+        for (uint32_t key_value = 0; key_value < large_count; key_value++)
+        {
+            auto entry = make_entry(key_value);
+            table.upsert(entry);
+        }
+        table.flush();
+        auto split = make_key(1);
+        table.split_partition(split);
+        EXPECT_EQ(table.get_partition_count(), 2);
+
+        uint32_t visited = 0;
+        auto first = make_key(0);
+        table.scan(first, [&](std::span<uint8_t> entry)
+            {
+                span_iterator key_span{ {entry.begin(), key_size} };
+                visited += read_uint32(key_span) == visited ? 1 : 0;
+                return true;
+            });
+        EXPECT_EQ(visited, large_count);
+    }
+}
+
+TEST_F(btree_test_fixture, test_striped_cache)
+{
+    uint32_t key_size = 8;
+    uint32_t value_size = 100;
+
+    auto row_traits_builder = std::make_shared<table_row_traits_builder>();
+    int key_id = row_traits_builder->add_span_field(key_size);
+    row_traits_builder->add_span_field(value_size);
+    row_traits_builder->add_key_reference(key_id);
+    auto row_traits = row_traits_builder->create_table_row_traits();
+
+    std::vector<std::filesystem::path> stripe_paths{ "test_cache/stripe_0", "test_cache/stripe_1", "test_cache/stripe_2" };
+    uint32_t transaction_count = 6;
+    uint32_t entries_per_transaction = 100;
+    {
+        file_cache cache{ "test_cache/data", stripe_paths };
+        file_allocator allocator{ cache };
+        btree tree(row_traits, cache, far_offset_ptr{ 0, 0 }, allocator);
+
+        // each transaction starts a block file of its own, so the files go to each stripe in turn
+        for (uint32_t t = 0; t < transaction_count; t++)
+        {
+            auto transaction_id = allocator.create_transaction();
+            for (uint32_t n = 0; n < entries_per_transaction; n++)
+            {
+                std::vector<uint8_t> entry(key_size + value_size, 0);
+                span_iterator key_span{ {entry.begin(), key_size} };
+                write_uint32(key_span, t * entries_per_transaction + n);
+                span_iterator value_span{ {entry.begin() + key_size, value_size} };
+                write_uint32(value_span, n * 3);
+                tree.upsert(transaction_id, entry);
+            }
+            tree.commit(transaction_id);
+            allocator.set_root(tree.get_offset());
+            allocator.commit();
+        }
+    }
+
+    EXPECT_TRUE(std::filesystem::exists("test_cache/data/file_0.bin"));
+    EXPECT_FALSE(std::filesystem::exists("test_cache/data/file_1.bin"));
+    for (filesize_t file_id = 1; file_id <= transaction_count; file_id++)
+    {
+        auto filename = stripe_paths[(file_id - 1) % stripe_paths.size()] / ("file_" + std::to_string(file_id) + ".bin");
+        EXPECT_TRUE(std::filesystem::exists(filename));
+    }
+
+    // reopened from the recorded placement alone
+    {
+        file_cache cache{ "test_cache/data" };
+        EXPECT_EQ(cache.get_stripe_paths(), stripe_paths);
+        file_allocator allocator{ cache };
+        btree tree(row_traits, cache, allocator.get_root(), allocator);
+
+        std::vector<uint8_t> key(key_size);
+        std::vector<uint8_t> value(value_size);
+        for (uint32_t key_value = 0; key_value < transaction_count * entries_per_transaction; key_value++)
+        {
+            span_iterator key_span{ key };
+            write_uint32(key_span, key_value);
+            ASSERT_TRUE(tree.get(key, value));
+            span_iterator value_span{ value };
+            ASSERT_EQ(read_uint32(value_span), (key_value % entries_per_transaction) * 3);
+        }
+    }
+
+    // the files of each stripe are read and written by threads of their own while another syncs
+    {
+        file_cache cache{ "test_cache/parallel", stripe_paths };
+        uint32_t block_count = 200;
+        std::atomic<bool> writing = true;
+        std::thread syncer([&]()
+        {
+            while (writing)
+            {
+                cache.sync();
+            }
+        });
+        std::vector<std::thread> threads;
+        for (filesize_t file_id = 1; file_id <= stripe_paths.size(); file_id++)
+        {
+            threads.emplace_back([&cache, file_id, block_count]()
+            {
+                for (uint32_t n = 0; n < block_count; n++)
+                {
+                    std::vector<uint8_t> block(block_size, (uint8_t)(file_id + n));
+                    cache.write_bytes(file_id, n * block_size, block);
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+        writing = false;
+        syncer.join();
+        cache.sync();
+
+        std::vector<uint8_t> block(block_size);
+        for (filesize_t file_id = 1; file_id <= stripe_paths.size(); file_id++)
+        {
+            EXPECT_EQ(cache.get_file_size(file_id), block_count * block_size);
+            for (uint32_t n = 0; n < block_count; n++)
+            {
+                cache.read_bytes(file_id, n * block_size, block);
+                ASSERT_EQ(block[0], (uint8_t)(file_id + n));
+                ASSERT_EQ(block[block_size - 1], (uint8_t)(file_id + n));
+            }
+        }
+    }
+
+    // a cache with files of its own cannot be striped after the fact
+    {
+        file_cache cache{ "test_cache/unstriped" };
+        std::vector<uint8_t> block(block_size, 1);
+        cache.write_bytes(1, 0, block);
+    }
+    EXPECT_THROW((file_cache{ "test_cache/unstriped", stripe_paths }), object_db_exception);
+}